@@ -1,6 +1,6 @@
 Summary:	low-level IO library which stores data in huge blob files appending records one after another
 Name:		eblob
-Version:	0.22.4
+Version:	0.23.0
 Release:	1%{?dist}.1
 
 License:	GPLv2+
@@ -108,6 +108,11 @@ rm -rf %{buildroot}
 %{_libdir}/lib*.so
 
 %changelog
+* Mon Oct 19 2026 Evgeniy Polyakov <zbr@ioremap.net> - 0.23.0
+- ABI: eblob_config got new tunables
+- ABI: eblob_iterate_control got user flags and time filters
+- ABI: eblob_ram_control keeps flags and disk size of the record
+
 * Fri Aug 15 2014 Evgeniy Polyakov <zbr@ioremap.net> - 0.22.4
 - stat: added malloc() return value check
 - stat: fixed null-byte json string generation
@@ -1,65 +1,478 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include <fstream>
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <stdexcept>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include <eblob/eblob.hpp>
 #include "common.hpp"
 
-int main(int argc, char *argv[])
+static void ei_usage(char *p)
 {
-	struct eblob_key key;
-	int check_key_len = 0;
+	std::cerr << "Usage: " << p << " [OPTION]... PATH... [id]\n\n"
+		"  Analyzes eblob indexes. PATH is either index file or directory,\n"
+		"  in which case all *.index files in it are processed.\n\n"
+		"Options\n"
+		"  -k id               - print index entries whose key starts with given hex id\n"
+		"  -t threads          - number of threads (default: number of CPUs)\n"
+		"  -j                  - print report as JSON\n"
+		"  -b                  - include per-base statistics into report\n"
+		"  -h                  - this help\n"
+		"\n";
+	exit(-1);
+}
+
+/* Power of two buckets: bucket N holds values in [2^(N-1), 2^N) */
+#define EI_HIST_BUCKETS		64
 
-	if (argc < 2) {
-		std::cerr << "Usage: " << argv[0] << " eblob.index <id>" << std::endl;
-		return(-1);
-	} else if (argc > 2) {
-		memset(&key, 0, sizeof(struct eblob_key));
-		dnet_parse_numeric_id(argv[2], key.id);
-		check_key_len = strlen(argv[2]) / 2;
+struct ei_hist {
+	uint64_t			count[EI_HIST_BUCKETS];
+
+	ei_hist() {
+		memset(count, 0, sizeof(count));
 	}
 
-	struct eblob_disk_control dc;
-	long long total = 0, removed = 0;
+	void add(uint64_t value) {
+		count[value ? 64 - __builtin_clzll(value) : 0]++;
+	}
 
-	try {
-		std::ifstream ind(argv[1], std::ios_base::in | std::ios_base::binary);
+	void merge(const ei_hist &h) {
+		for (int i = 0; i < EI_HIST_BUCKETS; ++i)
+			count[i] += h.count[i];
+	}
+};
 
-		while (!ind.eof()) {
-			ind.read((char *)&dc, sizeof(dc));
+/*
+ * HyperLogLog estimator of number of distinct keys, registers of per-base
+ * estimators are merged to get cross-base cardinality.
+ */
+#define EI_HLL_BITS		14
+#define EI_HLL_SIZE		(1 << EI_HLL_BITS)
 
-			eblob_convert_disk_control(&dc);
+struct ei_hll {
+	std::vector<uint8_t>		reg;
 
-			if (ind.gcount() == 0)
-				break;
+	ei_hll() : reg(EI_HLL_SIZE) {}
 
-			if (ind.gcount() != sizeof(dc))
-				throw std::runtime_error("Index read failed");
+	/* Keys are not necessarily hashes, so mix them */
+	static uint64_t hash(const struct eblob_key &key) {
+		uint64_t h = 0xcbf29ce484222325ULL, w;
 
-			total++;
-			if (dc.flags & BLOB_DISK_CTL_REMOVE)
-				removed++;
+		for (size_t i = 0; i < sizeof(key.id); i += sizeof(w)) {
+			memcpy(&w, key.id + i, sizeof(w));
+			h ^= w;
+			h *= 0x9e3779b97f4a7c15ULL;
+			h ^= h >> 29;
+		}
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
 
-			if (check_key_len) {
-				if (memcmp(dc.key.id, key.id, check_key_len) == 0) {
-					long long position = ind.tellg();
+	void add(const struct eblob_key &key) {
+		uint64_t h = hash(key);
+		uint32_t idx = h >> (64 - EI_HLL_BITS);
+		uint64_t rest = h << EI_HLL_BITS;
+		uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - EI_HLL_BITS + 1;
 
-					position -= sizeof(struct eblob_disk_control);
+		if (rank > reg[idx])
+			reg[idx] = rank;
+	}
 
-					std::cout << ioremap::eblob::eblob_dump_control(&dc, position, 1, 0) << std::endl;
-				}
-			}
+	void merge(const ei_hll &h) {
+		for (size_t i = 0; i < reg.size(); ++i)
+			reg[i] = std::max(reg[i], h.reg[i]);
+	}
+
+	double estimate() const {
+		const double m = EI_HLL_SIZE;
+		double sum = 0, alpha = 0.7213 / (1 + 1.079 / m);
+		size_t zeroes = 0;
+
+		for (size_t i = 0; i < reg.size(); ++i) {
+			sum += ldexp(1.0, -reg[i]);
+			if (reg[i] == 0)
+				zeroes++;
+		}
+
+		double e = alpha * m * m / sum;
+		/* Small range correction */
+		if (e <= 2.5 * m && zeroes != 0)
+			e = m * log(m / zeroes);
+		return e;
+	}
+
+	/* Standard error of estimate relative to it */
+	static double error() {
+		return 1.04 / sqrt((double)EI_HLL_SIZE);
+	}
+};
+
+struct ei_base {
+	std::string			path;
+	std::string			error;
+	uint64_t			total, removed;
+	uint64_t			data_bytes, disk_bytes, removed_bytes;
+	struct eblob_key		min_key, max_key;
+	ei_hist				data_size, disk_size;
+	ei_hll				keys;
+
+	ei_base(const std::string &p) : path(p), total(0), removed(0),
+			data_bytes(0), disk_bytes(0), removed_bytes(0) {
+		memset(&min_key, 0xff, sizeof(min_key));
+		memset(&max_key, 0, sizeof(max_key));
+	}
+};
+
+struct ei_ctl {
+	std::vector<ei_base *>		bases;
+	size_t				next;
+
+	struct eblob_key		key;
+	int				check_key_len;
+	boost::mutex			print_lock;
+
+	ei_ctl() : next(0), check_key_len(0) {}
+	~ei_ctl() {
+		for (std::vector<ei_base *>::iterator b = bases.begin(); b != bases.end(); ++b)
+			delete *b;
+	}
+};
+
+static std::string ei_key_str(const struct eblob_key &key)
+{
+	std::ostringstream out;
+
+	out << std::hex << std::setfill('0');
+	for (size_t i = 0; i < sizeof(key.id); ++i)
+		out << std::setw(2) << (unsigned int)key.id[i];
+	return out.str();
+}
+
+static void ei_process(ei_ctl &ctl, ei_base &base)
+{
+	const struct eblob_disk_control *index;
+	struct stat st;
+	size_t size, num;
+	void *map = NULL;
+	int fd;
+
+	fd = open(base.path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		base.error = strerror(errno);
+		return;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		base.error = strerror(errno);
+		goto err_out_close;
+	}
+
+	num = st.st_size / sizeof(struct eblob_disk_control);
+	size = num * sizeof(struct eblob_disk_control);
+	if (size == 0)
+		goto err_out_close;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		base.error = strerror(errno);
+		goto err_out_close;
+	}
+	madvise(map, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+	index = (const struct eblob_disk_control *)map;
+	for (size_t i = 0; i < num; ++i) {
+		struct eblob_disk_control dc = index[i];
+
+		eblob_convert_disk_control(&dc);
+
+		base.total++;
+		base.disk_bytes += dc.disk_size;
+
+		if (dc.flags & BLOB_DISK_CTL_REMOVE) {
+			base.removed++;
+			base.removed_bytes += dc.disk_size;
+		} else {
+			base.data_bytes += dc.data_size;
+			base.data_size.add(dc.data_size);
+			base.disk_size.add(dc.disk_size);
+			base.keys.add(dc.key);
+		}
+
+		if (eblob_id_cmp(dc.key.id, base.min_key.id) < 0)
+			base.min_key = dc.key;
+		if (eblob_id_cmp(dc.key.id, base.max_key.id) > 0)
+			base.max_key = dc.key;
+
+		if (ctl.check_key_len && memcmp(dc.key.id, ctl.key.id, ctl.check_key_len) == 0) {
+			boost::mutex::scoped_lock guard(ctl.print_lock);
+			std::cout << base.path << ": " << ioremap::eblob::eblob_dump_control(&dc,
+					i * sizeof(struct eblob_disk_control), 1, 0) << std::endl;
 		}
+	}
+
+	munmap(map, size);
+err_out_close:
+	close(fd);
+}
+
+static void ei_worker(ei_ctl &ctl)
+{
+	size_t idx;
+
+	while ((idx = __sync_fetch_and_add(&ctl.next, 1)) < ctl.bases.size())
+		ei_process(ctl, *ctl.bases[idx]);
+}
+
+static bool ei_has_suffix(const std::string &str, const std::string &suffix)
+{
+	return str.size() >= suffix.size() &&
+		str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void ei_add_path(ei_ctl &ctl, const std::string &path)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st) == -1)
+		throw std::runtime_error(path + ": " + strerror(errno));
+
+	if (!S_ISDIR(st.st_mode)) {
+		ctl.bases.push_back(new ei_base(path));
+		return;
+	}
+
+	DIR *dir = opendir(path.c_str());
+	if (!dir)
+		throw std::runtime_error(path + ": " + strerror(errno));
+
+	std::vector<std::string> names;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		/* Sorted index is a hardlink to index, do not count it twice */
+		if (ei_has_suffix(ent->d_name, ".index"))
+			names.push_back(path + "/" + ent->d_name);
+	}
+	closedir(dir);
+
+	std::sort(names.begin(), names.end());
+	for (std::vector<std::string>::iterator n = names.begin(); n != names.end(); ++n)
+		ctl.bases.push_back(new ei_base(*n));
+}
+
+static void ei_json_hist(std::ostream &out, const char *name, const ei_hist &h)
+{
+	bool first = true;
+
+	out << "\"" << name << "\":{";
+	for (int i = 0; i < EI_HIST_BUCKETS; ++i) {
+		if (!h.count[i])
+			continue;
+		out << (first ? "" : ",") << "\"" << (i ? 1ULL << (i - 1) : 0) << "\":" << h.count[i];
+		first = false;
+	}
+	out << "}";
+}
+
+static void ei_text_hist(std::ostream &out, const char *name, const ei_hist &h)
+{
+	out << name << ":" << std::endl;
+	for (int i = 0; i < EI_HIST_BUCKETS; ++i) {
+		if (h.count[i])
+			out << "  >= " << std::setw(20) << (i ? 1ULL << (i - 1) : 0) << ": " << h.count[i] << std::endl;
+	}
+}
+
+static void ei_json_base(std::ostream &out, const ei_base &b)
+{
+	out << "{\"path\":\"" << b.path << "\"";
+	if (!b.error.empty())
+		out << ",\"error\":\"" << b.error << "\"";
+	out << ",\"total\":" << b.total <<
+		",\"removed\":" << b.removed <<
+		",\"removed_ratio\":" << (b.total ? (double)b.removed / b.total : 0) <<
+		",\"data_bytes\":" << b.data_bytes <<
+		",\"disk_bytes\":" << b.disk_bytes <<
+		",\"removed_bytes\":" << b.removed_bytes;
+	if (b.total)
+		out << ",\"min_key\":\"" << ei_key_str(b.min_key) << "\"" <<
+			",\"max_key\":\"" << ei_key_str(b.max_key) << "\"";
+	out << ",";
+	ei_json_hist(out, "data_size", b.data_size);
+	out << ",";
+	ei_json_hist(out, "disk_size", b.disk_size);
+	out << "}";
+}
+
+int main(int argc, char *argv[])
+{
+	int ch, threads = boost::thread::hardware_concurrency();
+	bool json = false, per_base = false;
+	std::vector<std::string> paths;
+	ei_ctl ctl;
+
+	memset(&ctl.key, 0, sizeof(struct eblob_key));
+
+	while ((ch = getopt(argc, argv, "k:t:jbh")) != -1) {
+		switch (ch) {
+			case 'k':
+				dnet_parse_numeric_id(optarg, ctl.key.id);
+				ctl.check_key_len = strlen(optarg) / 2;
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'j':
+				json = true;
+				break;
+			case 'b':
+				per_base = true;
+				break;
+			case 'h':
+			default:
+				ei_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	for (int i = optind; i < argc; ++i)
+		paths.push_back(argv[i]);
+
+	/* Old style invocation: eblob_index_info eblob.index <id> */
+	if (paths.size() == 2 && !ctl.check_key_len && access(paths[1].c_str(), F_OK) != 0) {
+		std::vector<char> id(paths[1].begin(), paths[1].end());
+
+		id.push_back('\0');
+		dnet_parse_numeric_id(&id[0], ctl.key.id);
+		ctl.check_key_len = paths[1].size() / 2;
+		paths.pop_back();
+	}
+
+	if (paths.empty())
+		ei_usage(argv[0]);
+
+	if (threads <= 0)
+		threads = 1;
+
+	try {
+		for (std::vector<std::string>::iterator p = paths.begin(); p != paths.end(); ++p)
+			ei_add_path(ctl, *p);
 	} catch (const std::exception &e) {
 		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+
+	boost::thread_group group;
+	for (int i = 0; i < std::min<int>(threads, ctl.bases.size()); ++i)
+		group.create_thread(boost::bind(ei_worker, boost::ref(ctl)));
+	group.join_all();
+
+	ei_base sum("");
+	double base_keys = 0;
+	for (std::vector<ei_base *>::iterator it = ctl.bases.begin(); it != ctl.bases.end(); ++it) {
+		const ei_base &b = **it;
+
+		if (!b.error.empty())
+			std::cerr << b.path << ": " << b.error << std::endl;
+
+		sum.total += b.total;
+		sum.removed += b.removed;
+		sum.data_bytes += b.data_bytes;
+		sum.disk_bytes += b.disk_bytes;
+		sum.removed_bytes += b.removed_bytes;
+		sum.data_size.merge(b.data_size);
+		sum.disk_size.merge(b.disk_size);
+		sum.keys.merge(b.keys);
+		base_keys += b.keys.estimate();
+		if (b.total && eblob_id_cmp(b.min_key.id, sum.min_key.id) < 0)
+			sum.min_key = b.min_key;
+		if (b.total && eblob_id_cmp(b.max_key.id, sum.max_key.id) > 0)
+			sum.max_key = b.max_key;
+	}
+
+	/*
+	 * Live keys are unique within base, so keys present in several bases
+	 * are what per-base estimates count above estimate of their union.
+	 * Both are approximate, hence error bound is reported along.
+	 */
+	const double union_keys = sum.keys.estimate();
+	uint64_t live = sum.total - sum.removed;
+	uint64_t unique = std::min<uint64_t>(llround(union_keys), live);
+	uint64_t duplicates = 0, duplicates_error = 0;
+	if (ctl.bases.size() > 1) {
+		duplicates = llround(std::max(base_keys - union_keys, 0.0));
+		duplicates_error = llround(ei_hll::error() * (base_keys + union_keys));
+	}
+
+	if (json) {
+		std::ostream &out = std::cout;
+
+		out << "{\"bases\":" << ctl.bases.size() <<
+			",\"total\":" << sum.total <<
+			",\"removed\":" << sum.removed <<
+			",\"removed_ratio\":" << (sum.total ? (double)sum.removed / sum.total : 0) <<
+			",\"data_bytes\":" << sum.data_bytes <<
+			",\"disk_bytes\":" << sum.disk_bytes <<
+			",\"removed_bytes\":" << sum.removed_bytes <<
+			",\"unique_keys_estimate\":" << unique <<
+			",\"duplicate_keys_estimate\":" << duplicates <<
+			",\"duplicate_keys_error\":" << duplicates_error;
+		if (sum.total)
+			out << ",\"min_key\":\"" << ei_key_str(sum.min_key) << "\"" <<
+				",\"max_key\":\"" << ei_key_str(sum.max_key) << "\"";
+		out << ",";
+		ei_json_hist(out, "data_size", sum.data_size);
+		out << ",";
+		ei_json_hist(out, "disk_size", sum.disk_size);
+		if (per_base) {
+			out << ",\"per_base\":[";
+			for (size_t i = 0; i < ctl.bases.size(); ++i) {
+				out << (i ? "," : "");
+				ei_json_base(out, *ctl.bases[i]);
+			}
+			out << "]";
+		}
+		out << "}" << std::endl;
+		return 0;
 	}
 
-	std::cout << "Total records: " << total << std::endl;
-	std::cout << "Removed records: " << removed << std::endl;
+	if (per_base) {
+		for (std::vector<ei_base *>::iterator it = ctl.bases.begin(); it != ctl.bases.end(); ++it) {
+			const ei_base &b = **it;
+			std::cout << b.path << ": total: " << b.total << ", removed: " << b.removed <<
+				", removed bytes: " << b.removed_bytes << "/" << b.disk_bytes << std::endl;
+		}
+	}
+
+	std::cout << "Total records: " << sum.total << std::endl;
+	std::cout << "Removed records: " << sum.removed << std::endl;
+	std::cout << "Data bytes: " << sum.data_bytes << std::endl;
+	std::cout << "Disk bytes: " << sum.disk_bytes << std::endl;
+	std::cout << "Removed bytes: " << sum.removed_bytes << std::endl;
+	std::cout << "Duplicate keys (estimate): " << duplicates << " +/- " << duplicates_error << std::endl;
+	if (sum.total) {
+		std::cout << "Key range: " << ei_key_str(sum.min_key) << " - " << ei_key_str(sum.max_key) << std::endl;
+		ei_text_hist(std::cout, "Data size histogram", sum.data_size);
+		ei_text_hist(std::cout, "Disk size histogram", sum.disk_size);
+	}
 
 	return 0;
 }
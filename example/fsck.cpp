@@ -0,0 +1,598 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <eblob/eblob.hpp>
+#include "common.hpp"
+
+static void ef_usage(char *p)
+{
+	std::cerr << "Usage: " << p << " [OPTION]... PATH...\n\n"
+		"  This utility scans eblob data files, verifies records and rebuilds\n"
+		"  their indexes from data headers. PATH is either data file or directory,\n"
+		"  in which case all data files in it are processed.\n"
+		"  Without -f nothing is modified, only report is printed.\n\n"
+		"Options\n"
+		"  -f                  - fix: rewrite broken indexes, mark records with bad checksum removed\n"
+		"  -n                  - do not verify checksums\n"
+		"  -t threads          - number of threads (default: number of CPUs)\n"
+		"  -s size             - size of data chunk scanned by one thread in megabytes (default: 256)\n"
+		"  -h                  - this help\n"
+		"\n";
+	exit(-1);
+}
+
+/*
+ * Every flag eblob may put into a header, anything else means garbage:
+ * library flags and user metadata (user flags and write time) in upper bits
+ */
+static const uint64_t ef_known_flags = ((BLOB_DISK_CTL_TXN_COMMIT << 1) - 1)
+	| BLOB_DISK_CTL_USER_MASK | BLOB_DISK_CTL_TIME_MASK;
+
+/* Number of records checksummed by one task */
+static const size_t ef_csum_batch = 4096;
+
+struct ef_chunk {
+	uint64_t				start, end;
+	uint64_t				next;
+	std::vector<struct eblob_disk_control>	records;
+};
+
+struct ef_base {
+	std::string				path;
+	std::string				error;
+	std::string				index_status, sorted_status;
+	const unsigned char			*data;
+	uint64_t				size;
+
+	std::vector<ef_chunk>			chunks;
+	std::vector<struct eblob_disk_control>	records;
+	std::vector<char>			bad_csum;
+
+	uint64_t				removed, csum_errors;
+
+	ef_base(const std::string &p) : path(p), data(NULL), size(0), removed(0), csum_errors(0) {}
+	~ef_base() {
+		if (data)
+			munmap((void *)data, size);
+	}
+};
+
+typedef boost::shared_ptr<ef_base> ef_base_ptr;
+
+struct ef_ctl {
+	std::vector<ef_base_ptr>		bases;
+	bool					fix, csum;
+	uint64_t				chunk_size;
+	int					threads;
+
+	ef_ctl() : fix(false), csum(true), chunk_size(256 * 1024 * 1024), threads(1) {}
+};
+
+static std::string ef_errno(const std::string &what, int err)
+{
+	std::ostringstream str;
+	str << what << ": " << strerror(err);
+	return str.str();
+}
+
+/*
+ * Runs @tasks on a pool of @threads threads.
+ */
+static void ef_worker(std::vector<boost::function<void ()> > &tasks, size_t &next)
+{
+	size_t idx;
+
+	while ((idx = __sync_fetch_and_add(&next, 1)) < tasks.size())
+		tasks[idx]();
+}
+
+static void ef_run(std::vector<boost::function<void ()> > &tasks, int threads)
+{
+	boost::thread_group group;
+	size_t next = 0;
+
+	for (int i = 0; i < std::min<int>(threads, tasks.size()); ++i)
+		group.create_thread(boost::bind(ef_worker, boost::ref(tasks), boost::ref(next)));
+	group.join_all();
+}
+
+/*
+ * Checks whether there is a sane record header at @offset: it must point to
+ * itself, fit into the file and have only known flags. Footer offset is not
+ * checked since datasort does not update it when moving records.
+ */
+static bool ef_header_ok(const ef_base &base, uint64_t offset, struct eblob_disk_control *dc)
+{
+	if (offset + sizeof(*dc) > base.size)
+		return false;
+
+	memcpy(dc, base.data + offset, sizeof(*dc));
+	eblob_convert_disk_control(dc);
+
+	if (dc->position != offset || (dc->flags & ~ef_known_flags))
+		return false;
+	if (dc->data_size > base.size || dc->disk_size < dc->data_size + sizeof(*dc)
+			|| dc->disk_size > base.size - offset)
+		return false;
+
+	return true;
+}
+
+/*
+ * Finds first offset in [@offset, @end) with sane header followed by either
+ * end of file or another sane header, returns @end if there is none.
+ */
+static uint64_t ef_resync(const ef_base &base, uint64_t offset, uint64_t end)
+{
+	const size_t pos_off = offsetof(struct eblob_disk_control, position);
+	struct eblob_disk_control dc, next;
+	uint64_t position;
+
+	for (; offset < end && offset + sizeof(dc) <= base.size; ++offset) {
+		/* Cheap test first: header position must be equal to its offset */
+		memcpy(&position, base.data + offset + pos_off, sizeof(position));
+		if (eblob_bswap64(position) != offset)
+			continue;
+
+		if (!ef_header_ok(base, offset, &dc))
+			continue;
+		if (offset + dc.disk_size == base.size || ef_header_ok(base, offset + dc.disk_size, &next))
+			return offset;
+	}
+
+	return end;
+}
+
+/*
+ * Walks records from @offset until record start reaches @end, skipping
+ * garbage. Returns offset where walk stopped.
+ */
+static uint64_t ef_walk(const ef_base &base, uint64_t offset, uint64_t end,
+		std::vector<struct eblob_disk_control> &records)
+{
+	struct eblob_disk_control dc;
+
+	while (offset < end) {
+		if (ef_header_ok(base, offset, &dc)) {
+			records.push_back(dc);
+			offset += dc.disk_size;
+			continue;
+		}
+
+		offset = ef_resync(base, offset + 1, end);
+	}
+
+	return offset;
+}
+
+static void ef_scan_chunk(ef_base &base, ef_chunk &chunk)
+{
+	chunk.next = ef_walk(base, chunk.start, chunk.end, chunk.records);
+}
+
+static bool ef_position_less(const struct eblob_disk_control &dc, uint64_t position)
+{
+	return dc.position < position;
+}
+
+/*
+ * Glues chunks together. Chunk scan starts at arbitrary offset, so it may
+ * have synchronized on something inside a record of previous chunk - its
+ * records are only trusted from the point where previous chunk ended. If
+ * chunks do not meet, the gap is walked here.
+ */
+static void ef_stitch(ef_base &base)
+{
+	uint64_t offset = 0;
+
+	for (std::vector<ef_chunk>::iterator c = base.chunks.begin(); c != base.chunks.end(); ++c) {
+		std::vector<struct eblob_disk_control>::iterator r;
+
+		while (true) {
+			r = std::lower_bound(c->records.begin(), c->records.end(), offset, ef_position_less);
+			if (r == c->records.end() || r->position == offset)
+				break;
+			offset = ef_walk(base, offset, r->position, base.records);
+		}
+
+		if (r == c->records.end()) {
+			/* Previous chunk covered every record found here */
+			offset = ef_walk(base, offset, c->end, base.records);
+		} else {
+			base.records.insert(base.records.end(), r, c->records.end());
+			offset = c->next;
+		}
+
+		std::vector<struct eblob_disk_control>().swap(c->records);
+	}
+}
+
+static void ef_csum(ef_base &base, size_t start, size_t end)
+{
+	static const unsigned char zero[EBLOB_ID_SIZE] = {0};
+	unsigned char csum[EBLOB_ID_SIZE];
+
+	for (size_t i = start; i < end; ++i) {
+		const struct eblob_disk_control &dc = base.records[i];
+		struct eblob_disk_footer f;
+
+		if (dc.flags & (BLOB_DISK_CTL_REMOVE | BLOB_DISK_CTL_NOCSUM))
+			continue;
+		if (dc.disk_size < dc.data_size + sizeof(dc) + sizeof(f))
+			continue;
+
+		memcpy(&f, base.data + dc.position + dc.disk_size - sizeof(f), sizeof(f));
+		if (!memcmp(f.csum, zero, sizeof(f.csum)))
+			continue;
+
+		eblob_hash(NULL, csum, sizeof(csum), base.data + dc.position + sizeof(dc), dc.data_size);
+		if (memcmp(csum, f.csum, sizeof(csum)))
+			base.bad_csum[i] = 1;
+	}
+}
+
+static bool ef_key_less(const struct eblob_disk_control &d1, const struct eblob_disk_control &d2)
+{
+	int cmp = eblob_id_cmp(d1.key.id, d2.key.id);
+	if (cmp != 0)
+		return cmp < 0;
+	return d1.position < d2.position;
+}
+
+static int ef_read_index(const std::string &path, std::vector<struct eblob_disk_control> &index)
+{
+	struct stat st;
+	int fd, err = 0;
+
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st) == -1) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	index.resize(st.st_size / sizeof(struct eblob_disk_control));
+	if (!index.empty()) {
+		size_t size = index.size() * sizeof(struct eblob_disk_control);
+		if (pread(fd, &index[0], size, 0) != (ssize_t)size) {
+			err = -EIO;
+			goto err_out_close;
+		}
+	}
+
+	for (std::vector<struct eblob_disk_control>::iterator it = index.begin(); it != index.end(); ++it)
+		eblob_convert_disk_control(&*it);
+
+err_out_close:
+	close(fd);
+	return err;
+}
+
+static int ef_write_index(const std::string &path, const std::vector<struct eblob_disk_control> &index)
+{
+	std::string tmp = path + ".fsck";
+	int fd, err = 0;
+
+	fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	for (size_t i = 0; i < index.size(); ++i) {
+		struct eblob_disk_control dc = index[i];
+
+		eblob_convert_disk_control(&dc);
+		if (pwrite(fd, &dc, sizeof(dc), i * sizeof(dc)) != sizeof(dc)) {
+			err = -errno;
+			goto err_out_unlink;
+		}
+	}
+
+	if (fsync(fd) == -1 || rename(tmp.c_str(), path.c_str()) == -1) {
+		err = -errno;
+		goto err_out_unlink;
+	}
+
+	close(fd);
+	return 0;
+
+err_out_unlink:
+	unlink(tmp.c_str());
+	close(fd);
+	return err;
+}
+
+static bool ef_index_equal(const std::vector<struct eblob_disk_control> &i1,
+		const std::vector<struct eblob_disk_control> &i2)
+{
+	return i1.size() == i2.size() &&
+		(i1.empty() || !memcmp(&i1[0], &i2[0], i1.size() * sizeof(i1[0])));
+}
+
+/*
+ * Compares index at @path with @expected and rewrites it in fix mode.
+ * Returns status string for report.
+ */
+static std::string ef_check_index(ef_ctl &ctl, const std::string &path,
+		std::vector<struct eblob_disk_control> &expected, bool sorted)
+{
+	std::vector<struct eblob_disk_control> index;
+	int err;
+
+	err = ef_read_index(path, index);
+	if (err && err != -ENOENT)
+		return ef_errno("read failed", -err);
+
+	/* Equal keys may come in any order in sorted index */
+	if (sorted)
+		std::sort(index.begin(), index.end(), ef_key_less);
+
+	if (err == 0 && ef_index_equal(index, expected))
+		return "ok";
+
+	if (!ctl.fix)
+		return err ? "missing" : "broken";
+
+	err = ef_write_index(path, expected);
+	if (err)
+		return ef_errno("rebuild failed", -err);
+	return "rebuilt";
+}
+
+static void ef_finish(ef_ctl &ctl, ef_base &base)
+{
+	std::string index_path = base.path + ".index";
+	std::string sorted_path = index_path + ".sorted";
+	struct stat ist, sst;
+	bool linked, has_sorted;
+	int fd;
+
+	for (size_t i = 0; i < base.records.size(); ++i) {
+		struct eblob_disk_control &dc = base.records[i];
+
+		if (base.bad_csum.size() && base.bad_csum[i]) {
+			base.csum_errors++;
+
+			if (ctl.fix) {
+				uint64_t flags = eblob_bswap64(dc.flags | BLOB_DISK_CTL_REMOVE);
+
+				fd = open(base.path.c_str(), O_WRONLY | O_CLOEXEC);
+				if (fd == -1 || pwrite(fd, &flags, sizeof(flags),
+							dc.position + offsetof(struct eblob_disk_control, flags)) != sizeof(flags))
+					base.error = ef_errno("could not mark record removed", errno);
+				else
+					dc.flags |= BLOB_DISK_CTL_REMOVE;
+				if (fd != -1) {
+					fdatasync(fd);
+					close(fd);
+				}
+			}
+		}
+
+		if (dc.flags & BLOB_DISK_CTL_REMOVE)
+			base.removed++;
+	}
+
+	has_sorted = stat(sorted_path.c_str(), &sst) == 0;
+	linked = has_sorted && stat(index_path.c_str(), &ist) == 0 &&
+		ist.st_ino == sst.st_ino && ist.st_dev == sst.st_dev;
+
+	/* Index is in data order */
+	base.index_status = ef_check_index(ctl, index_path, base.records, false);
+	if (!has_sorted)
+		return;
+
+	std::vector<struct eblob_disk_control> sorted(base.records);
+	std::sort(sorted.begin(), sorted.end(), ef_key_less);
+
+	/* Sorted data: index and sorted index are the same file */
+	if (linked && ef_index_equal(sorted, base.records)) {
+		base.sorted_status = base.index_status;
+		if (base.index_status == "rebuilt") {
+			if (unlink(sorted_path.c_str()) == -1 || link(index_path.c_str(), sorted_path.c_str()) == -1)
+				base.sorted_status = ef_errno("link failed", errno);
+		}
+		return;
+	}
+
+	base.sorted_status = ef_check_index(ctl, sorted_path, sorted, true);
+}
+
+static void ef_open(ef_base &base, uint64_t chunk_size)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(base.path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		throw std::runtime_error(ef_errno(base.path + ": open failed", errno));
+
+	if (fstat(fd, &st) == -1) {
+		int err = errno;
+		close(fd);
+		throw std::runtime_error(ef_errno(base.path + ": stat failed", err));
+	}
+
+	base.size = st.st_size;
+	if (base.size) {
+		data = mmap(NULL, base.size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED) {
+			int err = errno;
+			close(fd);
+			throw std::runtime_error(ef_errno(base.path + ": mmap failed", err));
+		}
+		madvise(data, base.size, MADV_SEQUENTIAL);
+		base.data = (const unsigned char *)data;
+	}
+	close(fd);
+
+	for (uint64_t offset = 0; offset < base.size; offset += chunk_size) {
+		ef_chunk chunk;
+
+		chunk.start = offset;
+		chunk.end = std::min(offset + chunk_size, base.size);
+		chunk.next = chunk.end;
+		base.chunks.push_back(chunk);
+	}
+}
+
+/* Data files are named as <prefix>-<type>.<index> */
+static bool ef_is_data_file(const std::string &name)
+{
+	size_t dot = name.rfind('.');
+
+	if (dot == std::string::npos || dot + 1 == name.size())
+		return false;
+	return name.find_first_not_of("0123456789", dot + 1) == std::string::npos;
+}
+
+static void ef_add_path(ef_ctl &ctl, const std::string &path)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st) == -1)
+		throw std::runtime_error(ef_errno(path, errno));
+
+	if (!S_ISDIR(st.st_mode)) {
+		ctl.bases.push_back(ef_base_ptr(new ef_base(path)));
+		return;
+	}
+
+	DIR *dir = opendir(path.c_str());
+	if (!dir)
+		throw std::runtime_error(ef_errno(path, errno));
+
+	std::vector<std::string> names;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ef_is_data_file(ent->d_name))
+			names.push_back(path + "/" + ent->d_name);
+	}
+	closedir(dir);
+
+	std::sort(names.begin(), names.end());
+	for (std::vector<std::string>::iterator n = names.begin(); n != names.end(); ++n)
+		ctl.bases.push_back(ef_base_ptr(new ef_base(*n)));
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<boost::function<void ()> > tasks;
+	int ch, ret = 0;
+	ef_ctl ctl;
+
+	ctl.threads = boost::thread::hardware_concurrency();
+
+	while ((ch = getopt(argc, argv, "fnt:s:h")) != -1) {
+		switch (ch) {
+			case 'f':
+				ctl.fix = true;
+				break;
+			case 'n':
+				ctl.csum = false;
+				break;
+			case 't':
+				ctl.threads = atoi(optarg);
+				break;
+			case 's':
+				ctl.chunk_size = strtoull(optarg, NULL, 0) * 1024 * 1024;
+				break;
+			case 'h':
+			default:
+				ef_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (optind == argc || ctl.chunk_size == 0)
+		ef_usage(argv[0]);
+	if (ctl.threads <= 0)
+		ctl.threads = 1;
+
+	try {
+		for (int i = optind; i < argc; ++i)
+			ef_add_path(ctl, argv[i]);
+		for (std::vector<ef_base_ptr>::iterator b = ctl.bases.begin(); b != ctl.bases.end(); ++b)
+			ef_open(**b, ctl.chunk_size);
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+
+	/* Scan chunks of all bases in parallel */
+	for (std::vector<ef_base_ptr>::iterator b = ctl.bases.begin(); b != ctl.bases.end(); ++b)
+		for (std::vector<ef_chunk>::iterator c = (*b)->chunks.begin(); c != (*b)->chunks.end(); ++c)
+			tasks.push_back(boost::bind(ef_scan_chunk, boost::ref(**b), boost::ref(*c)));
+	ef_run(tasks, ctl.threads);
+	tasks.clear();
+
+	for (std::vector<ef_base_ptr>::iterator b = ctl.bases.begin(); b != ctl.bases.end(); ++b)
+		ef_stitch(**b);
+
+	/* Verify checksums in batches of records */
+	if (ctl.csum) {
+		for (std::vector<ef_base_ptr>::iterator b = ctl.bases.begin(); b != ctl.bases.end(); ++b) {
+			ef_base &base = **b;
+
+			base.bad_csum.resize(base.records.size());
+			for (size_t i = 0; i < base.records.size(); i += ef_csum_batch)
+				tasks.push_back(boost::bind(ef_csum, boost::ref(base), i,
+							std::min(i + ef_csum_batch, base.records.size())));
+		}
+		ef_run(tasks, ctl.threads);
+		tasks.clear();
+	}
+
+	for (std::vector<ef_base_ptr>::iterator b = ctl.bases.begin(); b != ctl.bases.end(); ++b)
+		tasks.push_back(boost::bind(ef_finish, boost::ref(ctl), boost::ref(**b)));
+	ef_run(tasks, ctl.threads);
+
+	for (std::vector<ef_base_ptr>::iterator b = ctl.bases.begin(); b != ctl.bases.end(); ++b) {
+		const ef_base &base = **b;
+		uint64_t used = 0;
+
+		for (std::vector<struct eblob_disk_control>::const_iterator r = base.records.begin();
+				r != base.records.end(); ++r)
+			used += r->disk_size;
+
+		std::cout << base.path <<
+			": records: " << base.records.size() <<
+			", removed: " << base.removed <<
+			", checksum errors: " << base.csum_errors <<
+			", unparsed bytes: " << base.size - used <<
+			", index: " << base.index_status;
+		if (!base.sorted_status.empty())
+			std::cout << ", sorted index: " << base.sorted_status;
+		if (!base.error.empty())
+			std::cout << ", error: " << base.error;
+		std::cout << std::endl;
+
+		if (!base.error.empty()
+				|| (base.index_status != "ok" && base.index_status != "rebuilt")
+				|| (!base.sorted_status.empty() && base.sorted_status != "ok" && base.sorted_status != "rebuilt")
+				|| (base.csum_errors && !ctl.fix))
+			ret = 1;
+	}
+
+	return ret;
+}
@@ -1,158 +1,585 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
 
-#include <fstream>
+#include <algorithm>
 #include <iostream>
+#include <queue>
+#include <sstream>
 #include <string>
 #include <stdexcept>
 #include <vector>
 
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include <eblob/eblob.hpp>
 #include "common.hpp"
 
 using namespace ioremap::eblob;
 
-static void copy_data(std::ifstream &src, std::ofstream &dst, size_t size)
-{
-	size_t sz = 1024 * 1024;
-
-	char *buf = new char[sz];
-
-	try {
-		while (size != 0) {
-			size_t tmp = sz;
-			if (tmp > size)
-				tmp = size;
-
-			if (!src.read(buf, tmp))
-				throw std::runtime_error("copy: read failed\n");
-			if (!dst.write(buf, tmp))
-				throw std::runtime_error("copy: write failed\n");
-
-			size -= tmp;
-		}
-	} catch (...) {
-		delete [] buf;
-		throw;
-	}
-
-	delete [] buf;
-}
-
 static void em_usage(char *p)
 {
 	std::cerr << "Usage: " << p << " [OPTION]... -i SRC [-i SRC]... -o DST\n\n"
-		"  This utility will defragment and merge one or more blobs into one\n\n"
+		"  This utility will defragment and merge one or more blobs into one sorted blob.\n"
+		"  If the same key is present in several inputs, the one from input specified\n"
+		"  later in the command line wins.\n\n"
 		"Options\n"
 		"  -i path             - input blob path (can be specified multiple times)\n"
 		"  -o path             - output blob path\n"
 		"  -p                  - print all copied IDs\n"
 		"  -m                  - max entry size\n"
+		"  -t threads          - number of threads processing independent key ranges (default: 1)\n"
+		"  -P seconds          - progress report interval, 0 disables it (default: 10)\n"
 		"  -d                  - dry-run, do not copy data, only perform all index/data checks\n"
 		"  -h                  - this help\n"
 		"\n";
 	exit(-1);
 }
 
+static std::string em_errno(const std::string &what, const std::string &path, int err)
+{
+	std::ostringstream str;
+	str << what << ": " << path << ": " << strerror(err);
+	return str.str();
+}
+
+static inline bool em_key_less(const struct eblob_disk_control &d1, const struct eblob_disk_control &d2)
+{
+	return eblob_id_cmp(d1.key.id, d2.key.id) < 0;
+}
+
+/*
+ * Input blob: data file and its index, mmapped. Sorted index is used when it
+ * exists, otherwise index is sorted in memory.
+ */
 struct em_blob {
-	int					completed;
-	std::ifstream				index, data;
 	std::string				path_;
-	std::streampos				data_size;
-
-	em_blob(const char *path) : completed(0), path_(path) {
+	int					order_;
+	int					data_fd;
+	uint64_t				data_size;
+	const struct eblob_disk_control		*index;
+	size_t					num;
+
+	em_blob(const char *path, int order) : path_(path), order_(order), data_fd(-1),
+			data_size(0), index(NULL), num(0), map_(NULL), map_size_(0) {
 		try {
-			// Open data file
-			data.open(path, std::ios_base::in | std::ios_base::binary);
-			if (!data)
-				throw std::runtime_error("data open failed");
-
-			// Get data file size
-			data.seekg(0, std::ios::end);
-			data_size = data.tellg();
-			data.seekg(0, std::ios::beg);
-
-			// Open index
-			std::string index_path(path);
-			index_path += ".index";
-			index.open(index_path.c_str(), std::ios_base::in | std::ios_base::binary);
-			if (!index)
-				throw std::runtime_error("index open failed");
-		} catch (...) {
-			data.close();
-			index.close();
+			struct stat st;
+
+			data_fd = open(path, O_RDONLY | O_CLOEXEC);
+			if (data_fd == -1)
+				throw std::runtime_error(em_errno("data open failed", path_, errno));
+			if (fstat(data_fd, &st) == -1)
+				throw std::runtime_error(em_errno("data stat failed", path_, errno));
+			data_size = st.st_size;
+
+			if (!map_index(path_ + ".index.sorted"))
+				map_index(path_ + ".index");
+
+			if (!is_sorted()) {
+				sorted_.assign(index, index + num);
+				std::stable_sort(sorted_.begin(), sorted_.end(), em_key_less);
+				index = sorted_.empty() ? NULL : &sorted_[0];
+			}
 
+			posix_fadvise(data_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		} catch (...) {
+			cleanup();
 			throw;
 		}
 	}
 
-	em_blob(const struct em_blob &e) {
-		em_blob(e.path_.c_str());
-	}
-
 	~em_blob() {
-		data.close();
-		index.close();
+		cleanup();
 	}
+
+	private:
+		void				*map_;
+		size_t				map_size_;
+		std::vector<struct eblob_disk_control>	sorted_;
+
+		em_blob(const em_blob &);
+		em_blob &operator =(const em_blob &);
+
+		bool map_index(const std::string &index_path) {
+			struct stat st;
+			int fd;
+
+			fd = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd == -1) {
+				if (errno == ENOENT)
+					return false;
+				throw std::runtime_error(em_errno("index open failed", index_path, errno));
+			}
+
+			if (fstat(fd, &st) == -1) {
+				int err = errno;
+				close(fd);
+				throw std::runtime_error(em_errno("index stat failed", index_path, err));
+			}
+
+			num = st.st_size / sizeof(struct eblob_disk_control);
+			map_size_ = num * sizeof(struct eblob_disk_control);
+			if (map_size_) {
+				map_ = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+				if (map_ == MAP_FAILED) {
+					int err = errno;
+					map_ = NULL;
+					close(fd);
+					throw std::runtime_error(em_errno("index mmap failed", index_path, err));
+				}
+				madvise(map_, map_size_, MADV_SEQUENTIAL | MADV_WILLNEED);
+			}
+			close(fd);
+
+			index = (const struct eblob_disk_control *)map_;
+			return true;
+		}
+
+		bool is_sorted() const {
+			for (size_t i = 1; i < num; ++i)
+				if (em_key_less(index[i], index[i - 1]))
+					return false;
+			return true;
+		}
+
+		void cleanup() {
+			if (map_)
+				munmap(map_, map_size_);
+			map_ = NULL;
+			if (data_fd >= 0)
+				close(data_fd);
+			data_fd = -1;
+		}
 };
 
 typedef boost::shared_ptr<em_blob> em_blob_ptr;
 
-struct em_ctl {
+/* Output record: header to write and blob to copy its body from */
+struct em_record {
 	struct eblob_disk_control		dc;
-	em_blob_ptr				blob;
+	const em_blob				*blob;
+};
+
+struct em_stat {
+	uint64_t				total, removed, written, broken;
+	uint64_t				bytes;
+
+	em_stat() : total(0), removed(0), written(0), broken(0), bytes(0) {}
+};
+
+/*
+ * Part of key space processed by single thread, [start, end) of each input.
+ */
+struct em_range {
+	std::vector<size_t>			start, end;
+	std::vector<em_record>			out;
+	uint64_t				data_size;
+	uint64_t				data_offset, index_offset;
 
-	em_ctl(em_blob_ptr b) : blob(b) {
-		memset(&dc, 0, sizeof(struct eblob_disk_control));
+	em_range() : data_size(0), data_offset(0), index_offset(0) {}
+};
+
+struct em_ctl {
+	std::vector<em_blob_ptr>		blobs;
+	std::vector<em_range>			ranges;
+	std::string				output;
+	int					data_fd, index_fd;
+	long long				max_size;
+	bool					print_all, dry_run;
+	boost::mutex				print_lock;
+
+	/* Progress, updated atomically by workers */
+	uint64_t				done, copied, total;
+	std::vector<std::string>		errors;
+
+	em_ctl() : data_fd(-1), index_fd(-1), max_size(10LL * 1024LL * 1024LL * 1024LL),
+			print_all(false), dry_run(false), done(0), copied(0), total(0) {}
+
+	void print(const std::string &str) {
+		boost::mutex::scoped_lock guard(print_lock);
+		std::cout << str << std::endl;
+	}
+
+	void error(const std::string &str) {
+		boost::mutex::scoped_lock guard(print_lock);
+		errors.push_back(str);
 	}
 };
 
-struct em_compare {
-		bool operator () (const em_ctl &s1, const em_ctl &s2) const {
-			return memcmp(s1.dc.key.id, s2.dc.key.id, EBLOB_ID_SIZE);
-		}
+/* Heap entry of k-way merge */
+struct em_head {
+	const struct eblob_disk_control		*dc;
+	size_t					blob;
 };
 
-int main(int argc, char *argv[])
+struct em_head_greater {
+	bool operator () (const em_head &h1, const em_head &h2) const {
+		int cmp = eblob_id_cmp(h1.dc->key.id, h2.dc->key.id);
+		if (cmp != 0)
+			return cmp > 0;
+		return h1.blob > h2.blob;
+	}
+};
+
+/*
+ * Checks index entry and its data header, returns false if record should not
+ * be copied.
+ */
+static bool em_check(em_ctl &ctl, const em_blob &blob, struct eblob_disk_control &dc, em_stat &st)
 {
-	int ch;
-	int total_input = 0;
-	int print_all = 0;
-	long long flag_max_size = 10LL * 1024LL * 1024LL * 1024LL; // 10G
 	struct eblob_disk_control ddc;
-	long long total = 0, removed = 0, written = 0, broken = 0;
-	long long position = 0;
-	int dry_run = 0;
 
-	std::vector<em_blob_ptr> blobs;
-	std::string output;
+	if (ctl.print_all)
+		ctl.print("INDEX: " + blob.path_ + ": " + eblob_dump_control(&dc, dc.position, 1, 0));
+
+	if (dc.flags & BLOB_DISK_CTL_REMOVE) {
+		st.removed++;
+		return false;
+	}
+
+	if (dc.disk_size == sizeof(struct eblob_disk_control)) {
+		// very old blobs - their indexes always had 96 bytes in 'disk_size' field
+		ctl.print("ERROR: old blob detected: disk_size is too small: blob: " + blob.path_ +
+				": " + eblob_dump_control(&dc, dc.position, 1, 0));
+		st.broken++;
+		return false;
+	} else if (dc.disk_size < dc.data_size + sizeof(struct eblob_disk_control)) {
+		ctl.print("ERROR: disk_size is too small: blob: " + blob.path_ +
+				": " + eblob_dump_control(&dc, dc.position, 1, 0));
+		st.broken++;
+		return false;
+	}
+	if (dc.disk_size + dc.position > blob.data_size) {
+		ctl.print("ERROR: disk_size + position outside of blob: blob: " + blob.path_ +
+				": " + eblob_dump_control(&dc, dc.position, 1, 0));
+		st.broken++;
+		return false;
+	}
+	if (dc.disk_size > (uint64_t)ctl.max_size) {
+		ctl.print("ERROR: disk size is greater than max size: blob: " + blob.path_ +
+				": " + eblob_dump_control(&dc, dc.position, 1, 0));
+		st.broken++;
+		return false;
+	}
+
+	if (pread(blob.data_fd, &ddc, sizeof(ddc), dc.position) != sizeof(ddc)) {
+		ctl.print("ERROR: data header read failed, skipping entry: " + blob.path_ +
+				": " + eblob_dump_control(&dc, dc.position, 1, 0));
+		st.broken++;
+		return false;
+	}
+	eblob_convert_disk_control(&ddc);
+
+	if (ctl.print_all)
+		ctl.print("blob: " + blob.path_ + ": " + eblob_dump_control(&ddc, ddc.position, 1, 0));
+
+	if (memcmp(&ddc.key, &dc.key, sizeof(struct eblob_key)) != 0
+			|| ddc.position != dc.position
+			|| ddc.disk_size != dc.disk_size) {
+		ctl.print("ERROR: data and index header mismatch: blob: " + blob.path_ +
+				", data: " + eblob_dump_control(&ddc, ddc.position, 1, 0) +
+				", index: " + eblob_dump_control(&dc, dc.position, 1, 0));
+		st.broken++;
+		return false;
+	}
+
+	if (ddc.flags & BLOB_DISK_CTL_REMOVE) {
+		st.removed++;
+		return false;
+	}
+
+	dc = ddc;
+	return true;
+}
+
+/*
+ * First pass: k-way merge of index entries of the range. Among entries with
+ * the same key only the live one from the latest input survives.
+ */
+static void em_merge_range(em_ctl &ctl, em_range &range, em_stat &st)
+{
+	std::priority_queue<em_head, std::vector<em_head>, em_head_greater> heap;
+	std::vector<size_t> pos(range.start);
+
+	for (size_t i = 0; i < ctl.blobs.size(); ++i) {
+		if (pos[i] < range.end[i]) {
+			em_head h = { &ctl.blobs[i]->index[pos[i]], i };
+			heap.push(h);
+		}
+	}
+
+	while (!heap.empty()) {
+		em_record rec;
+		bool found = false;
+		const struct eblob_key key = heap.top().dc->key;
+
+		/* Consume every entry of this key, later inputs come later */
+		while (!heap.empty() && !memcmp(&heap.top().dc->key, &key, sizeof(struct eblob_key))) {
+			em_head h = heap.top();
+			const em_blob &blob = *ctl.blobs[h.blob];
+			struct eblob_disk_control dc = *h.dc;
+
+			heap.pop();
+			if (++pos[h.blob] < range.end[h.blob]) {
+				em_head next = { &blob.index[pos[h.blob]], h.blob };
+				heap.push(next);
+			}
+
+			st.total++;
+			__sync_fetch_and_add(&ctl.done, 1);
+
+			eblob_convert_disk_control(&dc);
+			if (dc.disk_size == 0)
+				continue;
+
+			if (em_check(ctl, blob, dc, st)) {
+				/* Previous version is overridden */
+				if (found)
+					st.removed++;
+				rec.dc = dc;
+				rec.blob = &blob;
+				found = true;
+			}
+		}
+
+		if (found) {
+			range.out.push_back(rec);
+			range.data_size += rec.dc.disk_size;
+		}
+	}
+}
+
+/*
+ * Copies @size bytes between files, in-kernel if possible.
+ */
+static int em_copy_data(int fd_in, uint64_t off_in, int fd_out, uint64_t off_out, uint64_t size)
+{
+#ifdef __NR_copy_file_range
+	static int copy_file_range_works = 1;
+
+	while (size != 0 && copy_file_range_works) {
+		loff_t in = off_in, out = off_out;
+		ssize_t bytes = syscall(__NR_copy_file_range, fd_in, &in, fd_out, &out, size, 0);
+
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+				copy_file_range_works = 0;
+				break;
+			}
+			return -errno;
+		}
+		if (bytes == 0)
+			return -ESPIPE;
+
+		off_in += bytes;
+		off_out += bytes;
+		size -= bytes;
+	}
+#endif
+
+	if (size != 0) {
+		const size_t buf_size = 1024 * 1024;
+		std::vector<char> buf(std::min<uint64_t>(size, buf_size));
+
+		while (size != 0) {
+			size_t tmp = std::min<uint64_t>(size, buf.size());
+			ssize_t bytes = pread(fd_in, &buf[0], tmp, off_in);
+			if (bytes <= 0)
+				return bytes < 0 ? -errno : -ESPIPE;
+			if (pwrite(fd_out, &buf[0], bytes, off_out) != bytes)
+				return -errno;
+
+			off_in += bytes;
+			off_out += bytes;
+			size -= bytes;
+		}
+	}
+
+	return 0;
+}
 
-	while ((ch = getopt(argc, argv, "di:o:phm:")) != -1) {
+/*
+ * Second pass: writes records of the range into its slice of output, index
+ * is accumulated in memory and written with one call.
+ */
+static void em_write_range(em_ctl &ctl, em_range &range, em_stat &st)
+{
+	std::vector<struct eblob_disk_control> index;
+	uint64_t position = range.data_offset;
+	int err;
+
+	index.reserve(range.out.size());
+
+	for (std::vector<em_record>::iterator r = range.out.begin(); r != range.out.end(); ++r) {
+		struct eblob_disk_control dc = r->dc;
+		uint64_t size = dc.disk_size;
+
+		dc.position = position;
+		if (ctl.print_all)
+			ctl.print("OUT: " + eblob_dump_control(&dc, position, 1, 0));
+		eblob_convert_disk_control(&dc);
+
+		if (pwrite(ctl.data_fd, &dc, sizeof(dc), position) != sizeof(dc)) {
+			ctl.error(em_errno("data: header write failed", ctl.output, errno));
+			return;
+		}
+
+		err = em_copy_data(r->blob->data_fd, r->dc.position + sizeof(dc),
+				ctl.data_fd, position + sizeof(dc), size - sizeof(dc));
+		if (err) {
+			ctl.error(em_errno("data: copy failed from " + r->blob->path_, ctl.output, -err));
+			return;
+		}
+
+		index.push_back(dc);
+		position += size;
+		st.written++;
+		st.bytes += size;
+		__sync_fetch_and_add(&ctl.copied, size);
+	}
+
+	if (!index.empty()) {
+		size_t size = index.size() * sizeof(struct eblob_disk_control);
+		if (pwrite(ctl.index_fd, &index[0], size, range.index_offset) != (ssize_t)size)
+			ctl.error(em_errno("index: write failed", ctl.output, errno));
+	}
+}
+
+/*
+ * Splits key space into @num ranges of roughly equal number of index entries
+ * using evenly spaced samples of all inputs.
+ */
+static void em_split(em_ctl &ctl, size_t num)
+{
+	std::vector<struct eblob_disk_control> samples;
+	const size_t per_blob = 64 * num;
+
+	for (std::vector<em_blob_ptr>::iterator b = ctl.blobs.begin(); b != ctl.blobs.end(); ++b) {
+		const em_blob &blob = **b;
+		for (size_t i = 0; i < per_blob && blob.num; ++i)
+			samples.push_back(blob.index[i * blob.num / per_blob]);
+	}
+	std::sort(samples.begin(), samples.end(), em_key_less);
+
+	ctl.ranges.resize(num);
+	for (size_t r = 0; r < num; ++r) {
+		em_range &range = ctl.ranges[r];
+
+		for (size_t i = 0; i < ctl.blobs.size(); ++i) {
+			const em_blob &blob = *ctl.blobs[i];
+			const struct eblob_disk_control *begin = blob.index, *end = blob.index + blob.num;
+			size_t start = 0, stop = blob.num;
+
+			/* Ranges are bounded by keys, so same key never crosses them */
+			if (r != 0 && !samples.empty())
+				start = std::lower_bound(begin, end, samples[r * samples.size() / num], em_key_less) - begin;
+			if (r != num - 1 && !samples.empty())
+				stop = std::lower_bound(begin, end, samples[(r + 1) * samples.size() / num], em_key_less) - begin;
+
+			range.start.push_back(start);
+			range.end.push_back(std::max(start, stop));
+		}
+	}
+}
+
+static void em_progress(em_ctl &ctl, int interval)
+{
+	struct timeval start, now;
+
+	gettimeofday(&start, NULL);
+	try {
+		while (true) {
+			boost::this_thread::sleep(boost::posix_time::seconds(interval));
+
+			gettimeofday(&now, NULL);
+			double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1000000.;
+			uint64_t copied = ctl.copied;
+
+			std::ostringstream str;
+			str << "Progress: index entries: " << ctl.done << "/" << ctl.total <<
+				", copied: " << copied / (1024 * 1024) << " MB" <<
+				", throughput: " << (elapsed > 0 ? copied / elapsed / (1024 * 1024) : 0) << " MB/s";
+			ctl.print(str.str());
+		}
+	} catch (const boost::thread_interrupted &) {
+	}
+}
+
+static void em_run(int threads, void (*func)(em_ctl &, em_range &, em_stat &),
+		em_ctl &ctl, std::vector<em_stat> &stats)
+{
+	boost::thread_group group;
+
+	for (int i = 0; i < threads; ++i)
+		group.create_thread(boost::bind(func, boost::ref(ctl), boost::ref(ctl.ranges[i]), boost::ref(stats[i])));
+	group.join_all();
+}
+
+static void em_finish_output(const std::string &output)
+{
+	std::string index_path = output + ".index";
+	std::string sorted_path = index_path + ".sorted";
+	std::string mark_path = output + ".data_is_sorted";
+	int fd;
+
+	/* Output is written in key order, so its index is sorted already */
+	unlink(sorted_path.c_str());
+	if (link(index_path.c_str(), sorted_path.c_str()) == -1)
+		throw std::runtime_error(em_errno("sorted index link failed", sorted_path, errno));
+
+	fd = open(mark_path.c_str(), O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1)
+		throw std::runtime_error(em_errno("sorted mark creation failed", mark_path, errno));
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	int ch, threads = 1, interval = 10;
+	struct timeval start, end;
+	em_ctl ctl;
+	em_stat sum;
+
+	while ((ch = getopt(argc, argv, "di:o:phm:t:P:")) != -1) {
 		switch (ch) {
 			case 'i':
 				try {
-					em_blob_ptr b(new em_blob(optarg));
+					em_blob_ptr b(new em_blob(optarg, ctl.blobs.size()));
 
-					blobs.push_back(b);
-					total_input++;
+					ctl.blobs.push_back(b);
+					ctl.total += b->num;
 				} catch (const std::exception &e) {
 					std::cerr << "Could not open data or index file for blob: "
 						<< optarg << ": " << e.what() << std::endl;
 				}
 				break;
 			case 'o':
-				output.assign(optarg);
+				ctl.output.assign(optarg);
 				break;
 			case 'p':
-				print_all = 1;
+				ctl.print_all = true;
 				break;
 			case 'm':
-				flag_max_size = atoll(optarg);
+				ctl.max_size = atoll(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'P':
+				interval = atoi(optarg);
 				break;
 			case 'd':
-				dry_run = 1;
+				ctl.dry_run = true;
 				break;
 			case 'h':
 			default:
@@ -161,210 +588,93 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (output.size() && dry_run)
+	if (ctl.output.size() && ctl.dry_run)
 		std::cerr << "WARNING: -d (dry-run) specified, -o (output) is ignored\n";
 
-	if (!blobs.size() || (!output.size() && !dry_run)) {
+	if (!ctl.blobs.size() || (!ctl.output.size() && !ctl.dry_run)) {
 		std::cerr << "You must specify input and output parameters\n\n";
 		em_usage(argv[0]);
 	}
 
-	try {
-		std::ofstream index_out;
-		std::ofstream data_out;
-
-		if (!dry_run) {
-			std::string data_path = output;
-			std::string index_path = output + ".index";
-			index_out.open(index_path.c_str(), std::ios_base::out | std::ios_base::binary | std::ios::trunc);
-			data_out.open(data_path.c_str(), std::ios_base::out | std::ios_base::binary | std::ios::trunc);
-		}
-
-		while (true) {
-			std::vector<struct em_ctl> ctl;
-
-			for (std::vector<em_blob_ptr>::iterator b = blobs.begin(); b < blobs.end(); ++b) {
-				struct em_ctl c(*b);
+	if (threads <= 0)
+		threads = 1;
 
-				struct em_blob *blob = b->get();
+	gettimeofday(&start, NULL);
 
-				if (blob->completed)
-					continue;
+	std::vector<em_stat> stats(threads);
+	boost::thread progress;
+	int err = 0;
 
-				do {
-					blob->index.read((char *)&c.dc, sizeof(struct eblob_disk_control));
-					if (blob->index.gcount() != sizeof(struct eblob_disk_control)) {
-						blob->completed = 1;
-
-						std::cout << "Completed input stream " << blob->path_ <<
-							": total: " << total_input <<
-							", rest: " << blobs.size() << std::endl;
-						break;
-
-					}
-				} while (c.dc.disk_size == 0);
-
-				if (blob->completed)
-					continue;
-
-				blob->index.seekg(-sizeof(struct eblob_disk_control), std::ios_base::cur);
-
-				eblob_convert_disk_control(&c.dc);
-				ctl.push_back(c);
-			}
-
-			if (!ctl.size()) {
-				std::cout << "Completed all blobs" << std::endl;
-				break;
-			}
-
-			total++;
-
-			std::sort(ctl.begin(), ctl.end(), em_compare());
-			struct em_ctl c = ctl[0];
-
-			c.blob->index.seekg(sizeof(struct eblob_disk_control), std::ios_base::cur);
-			if (print_all) {
-				std::cout << "INDEX: " << c.blob->path_ << ": " <<
-					eblob_dump_control(&c.dc, c.dc.position, 1, 0) << std::endl;
-			}
-
-			// Sanity checks
-			if (c.dc.disk_size == sizeof(struct eblob_disk_control)) {
-				static int old_blobs_detected = 0;
-				// very old blobs - their indexes always had 96 bytes in 'disk_size' field
-
-				if (!old_blobs_detected) {
-					std::cout << "ERROR: old blob detected: disk_size is too small" <<
-						": blob: " << c.blob->path_ <<
-						": " << eblob_dump_control(&c.dc, c.dc.position, 1, 0) <<
-						std::endl;
-
-					old_blobs_detected = 1;
-				}
-			} else if (c.dc.disk_size < c.dc.data_size + sizeof(struct eblob_disk_control)) {
-				std::cout << "ERROR: disk_size is too small" <<
-					": blob: " << c.blob->path_ <<
-					": " << eblob_dump_control(&c.dc, c.dc.position, 1, 0) <<
-					std::endl;
-				broken++;
-				continue;
-			}
-			if (c.dc.disk_size + c.dc.position > (uint64_t)c.blob->data_size) {
-				std::cout << "ERROR: disk_size + position outside of blob: " <<
-					c.dc.disk_size + c.dc.position << " vs " <<
-					c.blob->data_size <<
-					": blob: " << c.blob->path_ <<
-					": " << eblob_dump_control(&c.dc, c.dc.position, 1, 0) <<
-					std::endl;
-				broken++;
-				continue;
-			}
-			if (c.dc.disk_size > (uint64_t)flag_max_size) {
-				std::cout << "ERROR: disk size is greater than max size: " <<
-					c.dc.disk_size << " vs " << flag_max_size <<
-					": blob: " << c.blob->path_ <<
-					": " << eblob_dump_control(&c.dc, c.dc.position, 1, 0) <<
-					std::endl;
-				broken++;
-				continue;
-			}
-
-			if (c.dc.flags & BLOB_DISK_CTL_REMOVE) {
-				removed++;
-				continue;
-			}
+	try {
+		if (!ctl.dry_run) {
+			std::string index_path = ctl.output + ".index";
+
+			ctl.data_fd = open(ctl.output.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (ctl.data_fd == -1)
+				throw std::runtime_error(em_errno("data open failed", ctl.output, errno));
+			ctl.index_fd = open(index_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (ctl.index_fd == -1)
+				throw std::runtime_error(em_errno("index open failed", index_path, errno));
+		}
 
-			c.blob->data.seekg(c.dc.position, std::ios::beg);
-			c.blob->data.read((char *)&ddc, sizeof(struct eblob_disk_control));
-			if (c.blob->data.gcount() != sizeof(struct eblob_disk_control)) {
-				std::cout << "ERROR: data header read failed, skipping entry: "
-					<< c.blob->path_ << ": " << eblob_dump_control(&c.dc, c.dc.position, 1, 0) << std::endl;
-				c.blob->data.clear();
-				broken++;
-				continue;
-			}
+		if (interval > 0)
+			progress = boost::thread(boost::bind(em_progress, boost::ref(ctl), interval));
 
-			eblob_convert_disk_control(&ddc);
-			if (print_all) {
-				std::cout << "blob: " << c.blob->path_ <<
-					": " << eblob_dump_control(&ddc, ddc.position, 1, 0) <<
-					std::endl;
-			}
+		em_split(ctl, threads);
+		em_run(threads, em_merge_range, ctl, stats);
 
-			// Sanity
-			if (memcmp(&ddc.key, &c.dc.key, sizeof(eblob_key)) != 0
-					|| ddc.position != c.dc.position
-					|| ((ddc.disk_size != c.dc.disk_size) && (c.dc.disk_size != sizeof(struct eblob_disk_control)))) {
-				std::cout << "ERROR: data and index header mismatch: " <<
-					"blob: " << c.blob->path_ <<
-					", data: " << eblob_dump_control(&ddc, ddc.position, 1, 0) <<
-					", index: " << eblob_dump_control(&c.dc, c.dc.position, 1, 0) <<
-					std::endl;
-				broken++;
-				continue;
-			}
-
-			if (ddc.disk_size + ddc.position > (uint64_t)c.blob->data_size) {
-				std::cout << "ERROR: blob disk_size + position outside of blob: " <<
-					ddc.disk_size + ddc.position << " vs " <<
-					c.blob->data_size <<
-					": blob: " << c.blob->path_ <<
-					": " << eblob_dump_control(&ddc, ddc.position, 1, 0) <<
-					std::endl;
-				broken++;
-				continue;
-			}
-
-			if (ddc.flags & BLOB_DISK_CTL_REMOVE) {
-				removed++;
-				continue;
-			}
-
-			size_t size = ddc.disk_size;
+		/* Lay ranges out one after another */
+		uint64_t data_offset = 0, index_offset = 0;
+		for (std::vector<em_range>::iterator r = ctl.ranges.begin(); r != ctl.ranges.end(); ++r) {
+			r->data_offset = data_offset;
+			r->index_offset = index_offset;
+			data_offset += r->data_size;
+			index_offset += r->out.size() * sizeof(struct eblob_disk_control);
+		}
 
-			ddc.position = position;
+		if (!ctl.dry_run) {
+			if (data_offset && posix_fallocate(ctl.data_fd, 0, data_offset) != 0)
+				std::cerr << "WARNING: could not preallocate " << data_offset << " bytes\n";
 
-			if (print_all) {
-				std::cout << "OUT: " << eblob_dump_control(&ddc, position, 1, 0) << std::endl;
-			}
+			em_run(threads, em_write_range, ctl, stats);
+			if (!ctl.errors.empty())
+				throw std::runtime_error(ctl.errors.front());
 
-			if (size > sizeof(struct eblob_disk_control)) {
-				eblob_convert_disk_control(&ddc);
-
-				if (!dry_run) {
-					try {
-						if (!data_out.write((char *)&ddc, sizeof(struct eblob_disk_control)))
-							throw std::runtime_error("data: header write failed\n");
-						copy_data(c.blob->data, data_out, size - sizeof(struct eblob_disk_control));
-						if (!index_out.write((char *)&ddc, sizeof(struct eblob_disk_control)))
-							throw std::runtime_error("index: header write failed\n");
-					} catch (...) {
-						std::cout << "ERROR: data copy failed, skipping entry: "
-							<< c.blob->path_ << ": " << eblob_dump_control(&ddc, ddc.position, 1, 0) << std::endl;
-						c.blob->data.clear();
-						data_out.clear();
-						data_out.seekp(position, std::ios::beg);
-						broken++;
-						continue;
-					}
-				}
+			if (fsync(ctl.data_fd) == -1 || fsync(ctl.index_fd) == -1)
+				throw std::runtime_error(em_errno("fsync failed", ctl.output, errno));
 
-				position += size;
-				written++;
-			} else {
-				broken++;
-			}
+			em_finish_output(ctl.output);
 		}
 	} catch (const std::exception &e) {
 		std::cerr << e.what() << std::endl;
+		err = -1;
 	}
 
-	std::cout << "Total records: " << total << std::endl;
-	std::cout << "Written records: " << written << std::endl;
-	std::cout << "Removed records: " << removed << std::endl;
-	std::cout << "Broken records: " << broken << std::endl;
+	progress.interrupt();
+	progress.join();
 
-	return 0;
-}
+	if (ctl.data_fd >= 0)
+		close(ctl.data_fd);
+	if (ctl.index_fd >= 0)
+		close(ctl.index_fd);
+
+	for (std::vector<em_stat>::iterator s = stats.begin(); s != stats.end(); ++s) {
+		sum.total += s->total;
+		sum.removed += s->removed;
+		sum.written += s->written;
+		sum.broken += s->broken;
+		sum.bytes += s->bytes;
+	}
 
+	gettimeofday(&end, NULL);
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.;
+
+	std::cout << "Total records: " << sum.total << std::endl;
+	std::cout << "Written records: " << sum.written << std::endl;
+	std::cout << "Removed records: " << sum.removed << std::endl;
+	std::cout << "Broken records: " << sum.broken << std::endl;
+	std::cout << "Written bytes: " << sum.bytes << ", time: " << elapsed << " s, throughput: " <<
+		(elapsed > 0 ? sum.bytes / elapsed / (1024 * 1024) : 0) << " MB/s" << std::endl;
+
+	return err;
+}
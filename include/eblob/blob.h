@@ -195,6 +195,50 @@ enum eblob_read_flavour {
  * changes blob behaviour in various ways. Only user of this flag is elliptics.
  */
 #define BLOB_DISK_CTL_EXTHDR	(1<<6)
+/*
+ * Blind write: caller guarantees that key does not exist in the backend, so
+ * write goes straight to the end of the last base without any lookup of the
+ * old record. Used for keys that are known to be new, e.g. random ones.
+ * This flag is never stored on disk.
+ */
+#define BLOB_DISK_CTL_NEW	(1<<7)
+/*
+ * Atomic batch write (see eblob_write_atomic()). Records of a batch occupy
+ * consecutive index entries, all of them are marked with TXN and last one is
+ * also marked with TXN_LAST. Batch becomes valid only after TXN_COMMIT is set
+ * on its last entry; batches without it are dropped on base open. Flags are
+ * cleared as soon as batch is committed.
+ */
+#define BLOB_DISK_CTL_TXN	(1<<8)
+#define BLOB_DISK_CTL_TXN_LAST	(1<<9)
+#define BLOB_DISK_CTL_TXN_COMMIT	(1<<10)
+#define BLOB_DISK_CTL_TXN_MASK	(BLOB_DISK_CTL_TXN | BLOB_DISK_CTL_TXN_LAST | BLOB_DISK_CTL_TXN_COMMIT)
+/*
+ * Upper bits of flags are user metadata, which is stored both in record header
+ * and in index entry, so that iteration can filter records by it without
+ * touching their data (see struct eblob_iterate_control):
+ *  - bits 16..31 are user flags, caller passes them in write flags with
+ *    BLOB_DISK_CTL_USER();
+ *  - bits 32..63 are time of the last write in seconds since the Epoch, it is
+ *    set by the library, zero for records written before it was introduced.
+ *    It is not kept in memory cache, so flags returned by reads and lookups
+ *    have these bits cleared, iteration filters and reports them.
+ */
+#define BLOB_DISK_CTL_USER_SHIFT	16
+#define BLOB_DISK_CTL_USER_MASK		(0xffffULL << BLOB_DISK_CTL_USER_SHIFT)
+#define BLOB_DISK_CTL_USER(f)		(((uint64_t)(f) << BLOB_DISK_CTL_USER_SHIFT) & BLOB_DISK_CTL_USER_MASK)
+#define BLOB_DISK_CTL_TIME_SHIFT	32
+#define BLOB_DISK_CTL_TIME_MASK		(0xffffffffULL << BLOB_DISK_CTL_TIME_SHIFT)
+
+static inline uint16_t eblob_flags_user(uint64_t flags)
+{
+	return (flags & BLOB_DISK_CTL_USER_MASK) >> BLOB_DISK_CTL_USER_SHIFT;
+}
+
+static inline uint32_t eblob_flags_time(uint64_t flags)
+{
+	return (flags & BLOB_DISK_CTL_TIME_MASK) >> BLOB_DISK_CTL_TIME_SHIFT;
+}
 
 struct eblob_disk_control {
 	/* key data */
@@ -268,9 +312,53 @@ static inline void eblob_convert_disk_control(struct eblob_disk_control *ctl)
  */
 #define EBLOB_SCHEDULED_DATASORT		(1<<9)
 /*
- * Disables starting permanent threads (sync, defrag, periodic)
+ * Disables background tasks (sync, defrag, periodic) in shared scheduler
  */
 #define EBLOB_DISABLE_THREADS			(1<<10)
+/*
+ * Enables write admission control: new writes are delayed and then rejected
+ * with -EBUSY as backend pressure grows, see eblob_get_pressure().
+ */
+#define EBLOB_ADMISSION_CONTROL			(1<<11)
+/*
+ * Picks base rollover thresholds automatically from observed record size,
+ * in-memory index budget, remove rate and number of bases. blob_size and
+ * records_in_blob become upper bounds, blob_size_min and records_in_blob_min
+ * lower ones.
+ */
+#define EBLOB_AUTO_BASE_SIZE			(1<<12)
+/*
+ * Starts due data-sort only when device and backend have been idle for
+ * defrag_idle_time seconds and pauses it while foreground load is high.
+ * Data-sort forced by defrag_timeout or eblob_start_defrag() is not paused.
+ * Without EBLOB_TIMED_DATASORT and EBLOB_SCHEDULED_DATASORT data-sort is due
+ * every defrag_timeout seconds.
+ */
+#define EBLOB_IDLE_DATASORT			(1<<13)
+/*
+ * Tracks how often keys are updated and makes data-sort of two or more bases
+ * put frequently updated keys and stable ones into different bases, so that
+ * bases of stable keys stay clean and are rarely rewritten.
+ */
+#define EBLOB_HOT_COLD_DATASORT			(1<<14)
+/*
+ * Registers sorted bases on startup from summaries persisted when they were
+ * closed and opens their files only when lookup or iteration needs them.
+ * Bases idle for a while are closed again once more than max_open_bases
+ * sorted bases are open.
+ */
+#define EBLOB_LAZY_BASES			(1<<15)
+/*
+ * Stages new small records of the open base in memory and writes them to
+ * data and index files with one pwrite(2) each when buffer of
+ * write_buffer_size bytes is full, write_buffer_timeout milliseconds after
+ * the first of them, on sync and before anything else touches them on disk.
+ * Buffered records are readable, but are lost on crash until flushed. Flush
+ * itself does not sync: flushed records become durable with the next
+ * eblob_sync() (every sync seconds) like any other write with sync > 0,
+ * eblob_cleanup() flushes and syncs them. Ignored with sync == 0.
+ */
+#define EBLOB_WRITE_BUFFER			(1<<16)
 
 struct eblob_config {
 	/* blob flags above */
@@ -356,9 +444,83 @@ struct eblob_config {
 	 */
 	int			defrag_splay;
 
+	/*
+	 * Write admission control limits, used if EBLOB_ADMISSION_CONTROL is
+	 * set. Pressure of each resource is its usage relative to the limit,
+	 * zero limit disables corresponding check:
+	 *  admission_unsorted_limit:	bytes of data in not yet sorted bases
+	 *  admission_index_limit:	bytes of in-memory index
+	 *  admission_latency:		average write latency in microseconds
+	 * Free space is always checked against the same reserve as in
+	 * free space check. Writes are delayed up to admission_max_delay
+	 * milliseconds (default 100) when pressure exceeds 75% and rejected
+	 * when it reaches 100%.
+	 */
+	uint64_t		admission_unsorted_limit;
+	uint64_t		admission_index_limit;
+	int			admission_latency;
+	int			admission_max_delay;
+
+	/*
+	 * Lower bounds of base size and number of records in it used with
+	 * EBLOB_AUTO_BASE_SIZE. By default 1 Gb and 1M records or upper bounds
+	 * if they are smaller.
+	 */
+	uint64_t		blob_size_min;
+	uint64_t		records_in_blob_min;
+
+	/*
+	 * Idleness thresholds used with EBLOB_IDLE_DATASORT. Backend is idle
+	 * when utilization of its device is at most defrag_idle_util percents
+	 * (default 10) and it serves at most defrag_idle_ops reads and writes
+	 * per second (default 10). Due data-sort starts after defrag_idle_time
+	 * seconds (default 60) of idleness or, if device never gets idle, after
+	 * waiting for defrag_timeout seconds. Running data-sort pauses while
+	 * backend serves more than defrag_idle_ops operations per second, unless
+	 * it was started on busy device or by eblob_start_defrag().
+	 */
+	int			defrag_idle_util;
+	int			defrag_idle_ops;
+	int			defrag_idle_time;
+
+	/*
+	 * With EBLOB_HOT_COLD_DATASORT key is hot when it was moved by update
+	 * at least hot_key_updates times (default 2, at most 255) recently.
+	 */
+	int			hot_key_updates;
+
+	/*
+	 * With EBLOB_LAZY_BASES at most max_open_bases (default 256) sorted
+	 * bases are kept open, each costs three file descriptors and two
+	 * mappings. It is a soft limit: recently used bases are never closed.
+	 */
+	uint64_t		max_open_bases;
+
+	/*
+	 * Size of EBLOB_WRITE_BUFFER in bytes (default 2 Mb) and maximal age of
+	 * buffered records in milliseconds (default 100). Records bigger than
+	 * quarter of the buffer or 64 Kb are written directly.
+	 */
+	uint32_t		write_buffer_size;
+	uint32_t		write_buffer_timeout;
+
+	/*
+	 * Memory budget in bytes for bloom filters and index blocks of sorted
+	 * bases (0, default, is unlimited). Over budget least used bases get
+	 * coarser index blocks, then summaries of EBLOB_LAZY_BASES closed bases
+	 * are dropped and re-read from disk on demand.
+	 */
+	uint64_t		summary_memory_limit;
+
+	/*
+	 * Number of threads serving eblob_read_data_async() requests which data
+	 * is not in page cache (default 4). They are started with the first
+	 * such request.
+	 */
+	uint32_t		read_threads;
+
 	/* for future use */
-	uint64_t		__pad_64[8];
-	int			__pad_int[6];
+	uint32_t		__pad_32[1];
 	char			__pad_char[8];
 	void			*__pad_voidp[8];
 };
@@ -371,11 +533,61 @@ struct eblob_ram_control {
 	uint64_t		data_offset, index_offset;
 	uint64_t		size;
 	struct eblob_base_ctl	*bctl;
+	/*
+	 * Part of on-disk record's disk control so that lookup does not need
+	 * to re-read it from index: system and user flags (time of the last
+	 * write is not kept) and disk size as space taken on disk beyond @size,
+	 * EBLOB_RAM_DISK_EXTRA_UNKNOWN if it does not fit.
+	 */
+	uint32_t		flags;
+	uint32_t		disk_extra;
 };
+#define EBLOB_RAM_DISK_EXTRA_UNKNOWN	(0xffffffffU)
 
 struct eblob_backend *eblob_init(struct eblob_config *c);
 void eblob_cleanup(struct eblob_backend *b);
 
+/*
+ * Namespaces.
+ *
+ * Namespace is a separate key space inside backend @b with its own bases,
+ * stored next to backend's ones as <file>.<name>-0.N, and own statistics.
+ * It has no lock file or in-memory index of its own: its keys live in @b's
+ * cache keyed by (namespace, key). Like any backend it has no threads either,
+ * see eblob_scheduler_config().
+ *
+ * Returned handle is a regular backend and can be used with any data access
+ * function. Size and defrag settings (blob_size, records_in_blob, their
+ * *_min bounds, blob_size_limit, defrag_*) are taken from @c, zero values and
+ * NULL @c mean inheriting them from @b; everything else is always inherited.
+ *
+ * Namespace is closed with eblob_cleanup(), eblob_cleanup() of @b closes all
+ * its namespaces. Not supported with EBLOB_L2HASH.
+ * Returns NULL and sets errno on error.
+ */
+struct eblob_backend *eblob_namespace_open(struct eblob_backend *b, const char *name,
+		const struct eblob_config *c);
+
+/*
+ * Background work of all backends in the process (sync, statistics and free
+ * space updates, defragmentation) is done by one shared pool of threads.
+ * Data-sort is the heavy task: at most @device_limit of them run on one
+ * block device at once (default 1). Size of the pool is @threads (default 4,
+ * at least 2: one worker is always left for sync and periodic tasks), it can
+ * only be changed while no backend with threads is open.
+ * Zero value leaves corresponding setting unchanged.
+ */
+int eblob_scheduler_config(int threads, int device_limit);
+
+/*
+ * Returns write pressure of the backend in percents: the highest usage of
+ * resources limited by admission control (see struct eblob_config). Value
+ * is updated every second by background task and may exceed 100. Useful to
+ * shed load before writes start failing, works without
+ * EBLOB_ADMISSION_CONTROL as well.
+ */
+int eblob_get_pressure(struct eblob_backend *b);
+
 struct eblob_iterate_control;
 struct eblob_iterate_callbacks {
 
@@ -457,6 +669,17 @@ struct eblob_iterate_control {
 	unsigned long long		data_size;
 
 	void				*data;
+
+	/*
+	 * Filter on user metadata of index entries (see BLOB_DISK_CTL_USER_MASK):
+	 * records whose user flags masked with @user_flags_mask differ from
+	 * @user_flags or whose time is outside of [@time_start, @time_end) are
+	 * skipped without touching their data. Zero @time_end means no upper
+	 * bound, all zeroes disable filter. Times are 32-bit seconds since the
+	 * Epoch, same as ones kept in flags (see BLOB_DISK_CTL_TIME_MASK).
+	 */
+	uint16_t			user_flags_mask, user_flags;
+	uint32_t			time_start, time_end;
 };
 
 int eblob_iterate(struct eblob_backend *b, struct eblob_iterate_control *ctl);
@@ -493,6 +716,60 @@ int eblob_read_data(struct eblob_backend *b, struct eblob_key *key,
 int eblob_read_data_nocsum(struct eblob_backend *b, struct eblob_key *key,
 		uint64_t offset, char **dst, uint64_t *size);
 
+/*
+ * Non-blocking eblob_read_data(): data (and whole record if checksum is
+ * verified) is read only if it is in page cache, otherwise -EAGAIN is
+ * returned without waiting for disk. Lookup of @key is done as usual, it may
+ * still touch sorted indexes and open EBLOB_LAZY_BASES closed bases.
+ */
+int eblob_read_data_nowait(struct eblob_backend *b, struct eblob_key *key,
+		enum eblob_read_flavour csum, uint64_t offset, char **dst, uint64_t *size);
+
+/*
+ * Completion of eblob_read_data_async(): @err and @data/@size are the ones
+ * eblob_read_data() would return, @data should be freed by callback.
+ */
+typedef void (*eblob_read_callback)(void *priv, int err, char *data, uint64_t size);
+
+/*
+ * Reads data like eblob_read_data() and passes it to @callback. Data that is
+ * in page cache is read and passed in the calling thread before return,
+ * other reads are queued to read_threads workers of @b, which call @callback.
+ * Queued reads are completed by eblob_cleanup().
+ *
+ * Returns zero if @callback is called or will be called, negative error
+ * otherwise.
+ */
+int eblob_read_data_async(struct eblob_backend *b, struct eblob_key *key,
+		enum eblob_read_flavour csum, uint64_t offset, uint64_t size,
+		eblob_read_callback callback, void *priv);
+
+/*
+ * Checks whether entry with given @key exists without reading its data:
+ * answer comes from RAM index and sorted indexes of bases.
+ *
+ * Returns zero if entry exists, -ENOENT if it doesn't or other negative error.
+ */
+int eblob_exists(struct eblob_backend *b, struct eblob_key *key);
+
+/*
+ * Accept "maybe" answers of bloom filters and index blocks of sorted bases,
+ * i.e. do not open and search sorted indexes. Entry reported as existing
+ * may be absent or removed, absent entry is never reported as existing.
+ */
+#define EBLOB_EXISTS_MAYBE		(1<<0)
+
+/*
+ * Batched eblob_exists(): bit i of @bitmap (bit i % 8 of byte i / 8) is set
+ * if @keys[i] exists, @bitmap should have room for at least (@n + 7) / 8
+ * bytes. Keys are probed in sorted order base by base.
+ * @flags are EBLOB_EXISTS_* constants above.
+ *
+ * Returns negative error value or zero on success.
+ */
+int eblob_exists_multi(struct eblob_backend *b, struct eblob_key *keys, uint32_t n,
+		uint64_t flags, uint8_t *bitmap);
+
 /*
  * Sync write: we will put data into some blob and index it by provided @key.
  * @flags can specify whether entry is removed and whether library will perform
@@ -571,6 +848,80 @@ int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
 int eblob_write_commit(struct eblob_backend *b, struct eblob_key *key,
 		uint64_t size, uint64_t flags);
 
+/*
+ * Write session.
+ *
+ * Same as prepare/plain_write/commit sequence above, but key is looked up only
+ * once - in eblob_write_session_open(), which reserves @size bytes for the
+ * record. Session remembers reserved location, so writes through it are plain
+ * pwrite(2)s and commit finalizes record without another lookup.
+ * @size and @flags of commit have the same meaning as in eblob_write_commit(),
+ * ~0ULL size means "everything written so far".
+ *
+ * Session must be freed with eblob_write_session_close() whether it was
+ * committed or not. -EAGAIN from write or commit means that record was lost
+ * by data-sort of the base and session should be started over. -ESTALE from
+ * commit means that key was removed or written by someone else after session
+ * was opened, session's record is not committed then.
+ */
+struct eblob_write_session;
+int eblob_write_session_open(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags, struct eblob_write_session **session);
+int eblob_write_session_write(struct eblob_write_session *s,
+		void *data, uint64_t offset, uint64_t size);
+int eblob_write_session_writev(struct eblob_write_session *s,
+		const struct eblob_iovec *iov, uint16_t iovcnt);
+int eblob_write_session_commit(struct eblob_write_session *s,
+		uint64_t size, uint64_t flags);
+void eblob_write_session_close(struct eblob_write_session *s);
+
+/*
+ * Atomic batch write.
+ *
+ * Writes all @n records so that either all or none of them survive a crash:
+ * payloads are written first, then single commit mark is made durable, and
+ * only after that records become visible to readers, all at once.
+ * Records with the same key in one batch are not allowed, APPEND is not
+ * supported. Batch must fit into single base.
+ */
+#define EBLOB_WRITE_ATOMIC_MAX	1024
+
+struct eblob_write_record {
+	struct eblob_key		key;
+	void				*data;
+	uint64_t			size;
+	uint64_t			flags;
+};
+
+int eblob_write_atomic(struct eblob_backend *b, struct eblob_write_record *records, uint32_t n);
+
+/*
+ * Offline builder of sorted bases.
+ *
+ * Produces ready-to-use sorted base at @path (data file plus ".index",
+ * ".index.sorted" and ".data_is_sorted" mark) from records added in strictly
+ * increasing key order. Only EBLOB_NO_FOOTER is honoured in @blob_flags, it
+ * must match configuration of the backend base will be ingested into.
+ * Base is complete only after eblob_base_builder_finish() succeeded, closing
+ * unfinished builder removes everything it wrote.
+ */
+struct eblob_base_builder;
+int eblob_base_builder_open(const char *path, uint64_t blob_flags,
+		struct eblob_base_builder **builder);
+int eblob_base_builder_add(struct eblob_base_builder *bb, struct eblob_key *key,
+		const void *data, uint64_t size, uint64_t flags);
+int eblob_base_builder_finish(struct eblob_base_builder *bb);
+void eblob_base_builder_close(struct eblob_base_builder *bb);
+
+/*
+ * Moves sorted base built at @path into backend as its newest base.
+ * Files must reside on the same filesystem as the backend. Ingested records
+ * override existing records with the same keys, old versions are removed.
+ * Writes of the same keys that race with ingest are kept if they finish
+ * after ingested base became visible.
+ */
+int eblob_ingest_base(struct eblob_backend *b, const char *path);
+
 struct eblob_disk_footer {
 	unsigned char			csum[EBLOB_ID_SIZE];
 	uint64_t			offset;
@@ -606,6 +957,48 @@ void eblob_remove_blobs(struct eblob_backend *b);
 int eblob_start_defrag(struct eblob_backend *b);
 int eblob_defrag_status(struct eblob_backend *b);
 
+/*
+ * Phases data-sort goes through for every group of bases. Only swap is
+ * done under backend lock, defrag can be paused or stopped in any other.
+ */
+enum eblob_defrag_phase {
+	EBLOB_DEFRAG_PHASE_NONE,
+	EBLOB_DEFRAG_PHASE_SPLIT,
+	EBLOB_DEFRAG_PHASE_SORT,
+	EBLOB_DEFRAG_PHASE_MERGE,
+	EBLOB_DEFRAG_PHASE_SWAP,
+};
+
+struct eblob_defrag_progress {
+	/* enum eblob_defrag_phase, EBLOB_DEFRAG_PHASE_NONE if defrag is not running */
+	int			phase;
+	/* Set while defrag waits for eblob_resume_defrag() or lower load */
+	int			paused;
+	/* Bases selected by current run and already processed */
+	int			bases_total;
+	int			bases_done;
+	/* Records and bytes of current group: to process and processed by current phase */
+	uint64_t		records_total;
+	uint64_t		records_done;
+	uint64_t		bytes_total;
+	uint64_t		bytes_done;
+	/* Seconds run has been working excluding pauses */
+	uint64_t		elapsed;
+	/* Seconds till end of run estimated from throughput, -1 if not known yet */
+	int64_t			eta;
+};
+
+/*
+ * Progress and control of running defrag. Pause and resume return -ENOENT if
+ * defrag is not running, stop drops requested but not started defrag and
+ * returns -ENOENT if there is none either. Stopped defrag removes its
+ * temporary files and leaves bases untouched.
+ */
+int eblob_defrag_progress(struct eblob_backend *b, struct eblob_defrag_progress *p);
+int eblob_pause_defrag(struct eblob_backend *b);
+int eblob_resume_defrag(struct eblob_backend *b);
+int eblob_stop_defrag(struct eblob_backend *b);
+
 /* Per backend stats */
 enum eblob_stat_global_flavour {
 	EBLOB_GST_MIN,
@@ -621,6 +1014,42 @@ enum eblob_stat_global_flavour {
 	EBLOB_GST_INDEX_READS,
 	EBLOB_GST_DATASORT_COMPLETION_TIME,
 	EBLOB_GST_DATASORT_COMPLETION_STATUS,
+	EBLOB_GST_INDEX_HEADER_READS,
+	EBLOB_GST_WRITE_LATENCY,
+	EBLOB_GST_ADMISSION_PRESSURE,
+	EBLOB_GST_ADMISSION_DELAYED,
+	EBLOB_GST_ADMISSION_REJECTED,
+	EBLOB_GST_AUTO_BLOB_SIZE,
+	EBLOB_GST_AUTO_RECORDS_IN_BLOB,
+	EBLOB_GST_AUTO_BASE_SIZE_REASON,
+	EBLOB_GST_DEVICE_UTIL,
+	EBLOB_GST_DEVICE_IN_FLIGHT,
+	EBLOB_GST_FOREGROUND_OPS,
+	EBLOB_GST_IDLE_TIME,
+	EBLOB_GST_DEFRAG_PAUSED,
+	EBLOB_GST_WRITTEN_LOGICAL,
+	EBLOB_GST_WRITTEN_FOREGROUND,
+	EBLOB_GST_WRITTEN_RCU,
+	EBLOB_GST_WRITTEN_INDEX,
+	EBLOB_GST_WRITTEN_DATASORT_SPLIT,
+	EBLOB_GST_WRITTEN_DATASORT_SORT,
+	EBLOB_GST_WRITTEN_DATASORT_MERGE,
+	EBLOB_GST_DATASORT_HOT_RECORDS,
+	EBLOB_GST_DATASORT_COLD_RECORDS,
+	EBLOB_GST_BASES_CLOSED,
+	EBLOB_GST_BASES_OPENED,
+	EBLOB_GST_BASES_EVICTED,
+	EBLOB_GST_WRITE_BUFFER_RECORDS,
+	EBLOB_GST_WRITE_BUFFER_FLUSHES,
+	EBLOB_GST_WRITE_BUFFER_READS,
+	EBLOB_GST_EXISTS_PROBES,
+	EBLOB_GST_EXISTS_MAYBE,
+	EBLOB_GST_SUMMARY_RESIDENT,
+	EBLOB_GST_SUMMARY_EVICTED,
+	EBLOB_GST_SUMMARY_RELOADS,
+	EBLOB_GST_READ_NOWAIT_HITS,
+	EBLOB_GST_READ_NOWAIT_MISSES,
+	EBLOB_GST_READ_QUEUED,
 	EBLOB_GST_MAX,
 };
 
@@ -636,6 +1065,7 @@ enum eblob_stat_local_flavour {
 	EBLOB_LST_INDEX_BLOCKS_SIZE,
 	EBLOB_LST_WANT_DEFRAG,
 	EBLOB_LST_IS_SORTED,
+	EBLOB_LST_LIVE_SIZE,
 	EBLOB_LST_MAX,
 };
 
@@ -0,0 +1,189 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Write admission control.
+ *
+ * Once a second backend's write pressure is computed as the highest usage of
+ * limited resources: average write latency, amount of unsorted data,
+ * in-memory index size and free space. New records are admitted freely
+ * while pressure is low, above EBLOB_ADMISSION_SOFT they are delayed
+ * proportionally and at 100% they are rejected with -EBUSY, so clients can
+ * back off or go elsewhere long before writes fail with -ENOSPC.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Pressure in percents at which writes start to be delayed */
+#define EBLOB_ADMISSION_SOFT		(75)
+/* Weight of new sample in write latency moving average is 1/2^N */
+#define EBLOB_ADMISSION_LATENCY_SHIFT	(3)
+
+static int64_t eblob_admission_percents(uint64_t used, uint64_t limit)
+{
+	if (limit == 0)
+		return 0;
+	return used * 100 / limit;
+}
+
+/*
+ * Pressure of free space: for blob_size_limit usage relative to it,
+ * otherwise space writers must leave untouched relative to free space, i.e.
+ * 100% when writes start to fail with -ENOSPC.
+ */
+static int64_t eblob_admission_space(struct eblob_backend *b)
+{
+	struct eblob_space_stat st;
+	uint64_t avail;
+
+	if (b->cfg.blob_flags & EBLOB_NO_FREE_SPACE_CHECK)
+		return 0;
+
+	eblob_space_get_stat(b, &st);
+	if (b->cfg.blob_size_limit)
+		return eblob_admission_percents(st.used, b->cfg.blob_size_limit);
+
+	/* st.datasort is already reduced by what data-sort wrote by the sample */
+	avail = st.avail > st.reserved + st.datasort ? st.avail - st.reserved - st.datasort : 0;
+	if (avail == 0)
+		return st.total ? 100 : 0;
+	return eblob_admission_percents(st.keep, avail);
+}
+
+/**
+ * eblob_admission_update() - recomputes write pressure of @b.
+ * Runs every second in scheduler.
+ */
+int eblob_admission_update(struct eblob_backend *b)
+{
+	struct eblob_base_ctl *bctl;
+	uint64_t unsorted = 0;
+	int64_t latency, pressure, old, p;
+	int err;
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(bctl, &b->bases, base_entry)
+		if (bctl->sorted != 1)
+			unsorted += bctl->data_offset;
+	pthread_mutex_unlock(&b->lock);
+
+	err = eblob_space_update(b);
+
+	/* Forget latency of the past when there are no writes to measure it */
+	latency = eblob_stat_get(b->stat, EBLOB_GST_WRITE_LATENCY);
+	if (atomic_read(&b->admission_samples) == 0) {
+		latency /= 2;
+		eblob_stat_set(b->stat, EBLOB_GST_WRITE_LATENCY, latency);
+	}
+	atomic_set(&b->admission_samples, 0);
+
+	pressure = eblob_admission_percents(latency, b->cfg.admission_latency);
+	p = eblob_admission_percents(unsorted, b->cfg.admission_unsorted_limit);
+	if (p > pressure)
+		pressure = p;
+	p = eblob_admission_percents(eblob_stat_get(b->stat, EBLOB_GST_CACHED),
+			b->cfg.admission_index_limit);
+	if (p > pressure)
+		pressure = p;
+	p = eblob_admission_space(b);
+	if (p > pressure)
+		pressure = p;
+
+	old = eblob_stat_get(b->stat, EBLOB_GST_ADMISSION_PRESSURE);
+	eblob_stat_set(b->stat, EBLOB_GST_ADMISSION_PRESSURE, pressure);
+
+	if ((old < EBLOB_ADMISSION_SOFT) != (pressure < EBLOB_ADMISSION_SOFT))
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: write pressure %s: %" PRId64 "%%, "
+				"latency: %" PRId64 " us, unsorted: %" PRIu64 ", index: %" PRId64 "\n",
+				b->cfg.file, pressure < EBLOB_ADMISSION_SOFT ? "released" : "high",
+				pressure, latency, unsorted, eblob_stat_get(b->stat, EBLOB_GST_CACHED));
+
+	return err;
+}
+
+/**
+ * eblob_admission_check() - decides whether new record can be written to @b.
+ * Delays caller proportionally to pressure above EBLOB_ADMISSION_SOFT and
+ * returns -EBUSY when pressure reached 100%.
+ * NB! Must be called without locks held.
+ */
+int eblob_admission_check(struct eblob_backend *b)
+{
+	int64_t pressure;
+
+	if (!(b->cfg.blob_flags & EBLOB_ADMISSION_CONTROL))
+		return 0;
+
+	pressure = eblob_stat_get(b->stat, EBLOB_GST_ADMISSION_PRESSURE);
+	if (pressure < EBLOB_ADMISSION_SOFT)
+		return 0;
+
+	if (pressure >= 100) {
+		eblob_stat_inc(b->stat, EBLOB_GST_ADMISSION_REJECTED);
+		return -EBUSY;
+	}
+
+	eblob_stat_inc(b->stat, EBLOB_GST_ADMISSION_DELAYED);
+	usleep(1000ULL * b->cfg.admission_max_delay * (pressure - EBLOB_ADMISSION_SOFT)
+			/ (100 - EBLOB_ADMISSION_SOFT));
+	return 0;
+}
+
+/**
+ * eblob_admission_start() - returns start time of measured write.
+ */
+uint64_t eblob_admission_start(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * eblob_admission_account() - adds latency of write started at @start to
+ * moving average of @b.
+ */
+void eblob_admission_account(struct eblob_backend *b, uint64_t start)
+{
+	int64_t sample = eblob_admission_start() - start;
+	int64_t latency = eblob_stat_get(b->stat, EBLOB_GST_WRITE_LATENCY);
+
+	if (latency == 0)
+		latency = sample;
+	else
+		latency += (sample - latency) / (1 << EBLOB_ADMISSION_LATENCY_SHIFT);
+
+	eblob_stat_set(b->stat, EBLOB_GST_WRITE_LATENCY, latency);
+	atomic_inc(&b->admission_samples);
+}
+
+int eblob_get_pressure(struct eblob_backend *b)
+{
+	if (b == NULL)
+		return -EINVAL;
+
+	return eblob_stat_get(b->stat, EBLOB_GST_ADMISSION_PRESSURE);
+}
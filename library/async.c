@@ -0,0 +1,223 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Asynchronous reads.
+ *
+ * eblob_read_data_async() first tries eblob_read_data_nowait(), so records
+ * that are in write buffer or page cache are served by the calling thread
+ * without waiting for disk. Reads that would block are queued to a pool of
+ * read_threads workers of the backend, which do ordinary blocking reads and
+ * call completion callbacks. Event-loop callers never stall behind disk
+ * misses this way.
+ *
+ * Pool is started with the first queued read and stopped by eblob_cleanup()
+ * once all queued reads are completed.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct eblob_read_request {
+	struct list_head	req_entry;
+	struct eblob_key	key;
+	enum eblob_read_flavour	csum;
+	uint64_t		offset, size;
+	eblob_read_callback	callback;
+	void			*priv;
+};
+
+static void eblob_read_complete(struct eblob_backend *b, struct eblob_read_request *req)
+{
+	char *data = NULL;
+	uint64_t size = req->size;
+	int err;
+
+	if (req->csum == EBLOB_READ_NOCSUM)
+		err = eblob_read_data_nocsum(b, &req->key, req->offset, &data, &size);
+	else
+		err = eblob_read_data(b, &req->key, req->offset, &data, &size);
+
+	req->callback(req->priv, err, err ? NULL : data, err ? 0 : size);
+}
+
+static void *eblob_read_worker(void *data)
+{
+	struct eblob_backend *b = data;
+	struct eblob_read_request *req;
+
+	pthread_mutex_lock(&b->read_lock);
+	for (;;) {
+		if (list_empty(&b->read_queue)) {
+			if (b->read_need_exit)
+				break;
+			pthread_cond_wait(&b->read_cond, &b->read_lock);
+			continue;
+		}
+
+		req = list_first_entry(&b->read_queue, struct eblob_read_request, req_entry);
+		list_del(&req->req_entry);
+		eblob_stat_dec(b->stat, EBLOB_GST_READ_QUEUED);
+		pthread_mutex_unlock(&b->read_lock);
+
+		eblob_read_complete(b, req);
+		free(req);
+
+		pthread_mutex_lock(&b->read_lock);
+	}
+	pthread_mutex_unlock(&b->read_lock);
+
+	return NULL;
+}
+
+/*
+ * Starts read workers of @b, pool is usable if at least one of them started.
+ * NB! Caller should hold b->read_lock.
+ */
+static int eblob_read_pool_start(struct eblob_backend *b)
+{
+	int err = 0, i;
+
+	b->read_tids = calloc(b->cfg.read_threads, sizeof(pthread_t));
+	if (b->read_tids == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < (int)b->cfg.read_threads; ++i) {
+		err = pthread_create(&b->read_tids[i], NULL, eblob_read_worker, b);
+		if (err != 0)
+			break;
+	}
+
+	b->read_started = i;
+	if (i == 0) {
+		free(b->read_tids);
+		b->read_tids = NULL;
+		return -err;
+	}
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: read workers started: %d\n",
+			b->cfg.file, b->read_started);
+	return 0;
+}
+
+/**
+ * eblob_read_pool_init() - prepares queue of async reads of @b, workers are
+ * started on demand.
+ */
+int eblob_read_pool_init(struct eblob_backend *b)
+{
+	int err;
+
+	err = eblob_mutex_init(&b->read_lock);
+	if (err != 0)
+		return err;
+
+	err = eblob_cond_init(&b->read_cond);
+	if (err != 0) {
+		pthread_mutex_destroy(&b->read_lock);
+		return err;
+	}
+
+	INIT_LIST_HEAD(&b->read_queue);
+	b->read_tids = NULL;
+	b->read_started = 0;
+	b->read_need_exit = 0;
+	return 0;
+}
+
+/**
+ * eblob_read_pool_cleanup() - waits for queued reads of @b to complete and
+ * stops its workers.
+ */
+void eblob_read_pool_cleanup(struct eblob_backend *b)
+{
+	int i;
+
+	pthread_mutex_lock(&b->read_lock);
+	b->read_need_exit = 1;
+	pthread_cond_broadcast(&b->read_cond);
+	pthread_mutex_unlock(&b->read_lock);
+
+	for (i = 0; i < b->read_started; ++i)
+		pthread_join(b->read_tids[i], NULL);
+
+	free(b->read_tids);
+	b->read_tids = NULL;
+	b->read_started = 0;
+
+	pthread_cond_destroy(&b->read_cond);
+	pthread_mutex_destroy(&b->read_lock);
+}
+
+int eblob_read_data_async(struct eblob_backend *b, struct eblob_key *key,
+		enum eblob_read_flavour csum, uint64_t offset, uint64_t size,
+		eblob_read_callback callback, void *priv)
+{
+	struct eblob_read_request *req;
+	char *data = NULL;
+	uint64_t read_size = size;
+	int err;
+
+	if (b == NULL || key == NULL || callback == NULL)
+		return -EINVAL;
+
+	err = eblob_read_data_nowait(b, key, csum, offset, &data, &read_size);
+	if (err != -EAGAIN) {
+		callback(priv, err, err ? NULL : data, err ? 0 : read_size);
+		return 0;
+	}
+
+	req = malloc(sizeof(struct eblob_read_request));
+	if (req == NULL)
+		return -ENOMEM;
+
+	memcpy(&req->key, key, sizeof(struct eblob_key));
+	req->csum = csum;
+	req->offset = offset;
+	req->size = size;
+	req->callback = callback;
+	req->priv = priv;
+
+	pthread_mutex_lock(&b->read_lock);
+	if (b->read_need_exit) {
+		err = -ESHUTDOWN;
+		goto err_out_unlock;
+	}
+	if (b->read_started == 0) {
+		err = eblob_read_pool_start(b);
+		if (err != 0)
+			goto err_out_unlock;
+	}
+
+	list_add_tail(&req->req_entry, &b->read_queue);
+	eblob_stat_inc(b->stat, EBLOB_GST_READ_QUEUED);
+	pthread_cond_signal(&b->read_cond);
+	pthread_mutex_unlock(&b->read_lock);
+
+	return 0;
+
+err_out_unlock:
+	pthread_mutex_unlock(&b->read_lock);
+	free(req);
+	return err;
+}
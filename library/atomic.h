@@ -67,6 +67,12 @@ static inline long atomic_dec(atomic_t *a)
 
 #define atomic_dec_and_test(a) (atomic_dec(a) == 0)
 
+/* Full memory barrier */
+static inline void atomic_mb(void)
+{
+	__sync_synchronize();
+}
+
 #else
 
 #include "lock.h"
@@ -136,6 +142,11 @@ static inline long atomic_dec(atomic_t *a)
 
 #define atomic_dec_and_test(a) (atomic_dec(a) == 0)
 
+/* Without __sync users of atomic_t are expected to serialize under locks */
+static inline void atomic_mb(void)
+{
+}
+
 #endif
 
 #ifdef __cplusplus
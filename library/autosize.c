@@ -0,0 +1,195 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Workload-adaptive base sizing (EBLOB_AUTO_BASE_SIZE).
+ *
+ * Keys of unsorted bases live in memory, so number of records in base is
+ * limited by in-memory index budget, and base size follows from it and
+ * average record size. High remove rate shrinks bases, so defragmentation
+ * reclaims space rewriting less live data. Too many bases make lookups probe
+ * more indexes and hold more descriptors, so bases grow when their number
+ * exceeds EBLOB_AUTOSIZE_MAX_BASES. Result is clamped to configured bounds.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+#include "hash.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Number of bases after which bases are grown */
+#define EBLOB_AUTOSIZE_MAX_BASES	(256)
+/* Bases whose keys are in memory at once: the active one and one being sorted */
+#define EBLOB_AUTOSIZE_RAM_BASES	(2)
+/* Share of physical memory used as index budget without admission_index_limit */
+#define EBLOB_AUTOSIZE_RAM_SHARE	(8)
+/* Approximate memory used by one cached key including allocator overhead */
+#define EBLOB_AUTOSIZE_RAM_PER_RECORD	\
+	(EBLOB_HASH_ENTRY_ALLOC_SIZE(sizeof(struct eblob_ram_control)) + 16)
+
+enum eblob_autosize_reason {
+	EBLOB_AUTOSIZE_BOUNDS,
+	EBLOB_AUTOSIZE_RECORD_SIZE,
+	EBLOB_AUTOSIZE_MEMORY,
+	EBLOB_AUTOSIZE_REMOVES,
+	EBLOB_AUTOSIZE_BASES,
+};
+
+static const char *eblob_autosize_reason_str[] = {
+	[EBLOB_AUTOSIZE_BOUNDS] = "bounds",
+	[EBLOB_AUTOSIZE_RECORD_SIZE] = "record size",
+	[EBLOB_AUTOSIZE_MEMORY] = "memory",
+	[EBLOB_AUTOSIZE_REMOVES] = "remove rate",
+	[EBLOB_AUTOSIZE_BASES] = "number of bases",
+};
+
+/**
+ * eblob_base_limits() - returns base size and number of records at which
+ * base of @b is closed.
+ */
+void eblob_base_limits(struct eblob_backend *b, uint64_t *size, uint64_t *records)
+{
+	if (b->cfg.blob_flags & EBLOB_AUTO_BASE_SIZE) {
+		*size = b->auto_blob_size;
+		*records = b->auto_records_in_blob;
+	} else {
+		*size = b->cfg.blob_size;
+		*records = b->cfg.records_in_blob;
+	}
+}
+
+/**
+ * eblob_autosize_init() - starts with lower bounds, so that on load every
+ * base that may have been closed by auto-sizing is treated as closed.
+ */
+void eblob_autosize_init(struct eblob_backend *b)
+{
+	b->auto_blob_size = b->cfg.blob_size_min;
+	b->auto_records_in_blob = b->cfg.records_in_blob_min;
+	eblob_stat_set(b->stat, EBLOB_GST_AUTO_BLOB_SIZE, b->auto_blob_size);
+	eblob_stat_set(b->stat, EBLOB_GST_AUTO_RECORDS_IN_BLOB, b->auto_records_in_blob);
+	eblob_stat_set(b->stat, EBLOB_GST_AUTO_BASE_SIZE_REASON, EBLOB_AUTOSIZE_BOUNDS);
+}
+
+/*
+ * In-memory index budget of @b: admission_index_limit or share of physical
+ * memory.
+ */
+static uint64_t eblob_autosize_ram(struct eblob_backend *b)
+{
+	long pages, page_size;
+
+	if (b->cfg.admission_index_limit)
+		return b->cfg.admission_index_limit;
+
+	pages = sysconf(_SC_PHYS_PAGES);
+	page_size = sysconf(_SC_PAGESIZE);
+	if (pages <= 0 || page_size <= 0)
+		return 0;
+	return (uint64_t)pages * page_size / EBLOB_AUTOSIZE_RAM_SHARE;
+}
+
+/**
+ * eblob_autosize_update() - recomputes rollover thresholds of @b from its
+ * statistics. Called from eblob_periodic() after statistics are updated.
+ */
+void eblob_autosize_update(struct eblob_backend *b)
+{
+	enum eblob_autosize_reason reason = EBLOB_AUTOSIZE_RECORD_SIZE;
+	struct eblob_base_ctl *bctl;
+	uint64_t total, removed, base_size, record_size, bases = 0, used = 0;
+	uint64_t size, records, ram_records, ram, needed;
+
+	if (!(b->cfg.blob_flags & EBLOB_AUTO_BASE_SIZE))
+		return;
+
+	total = eblob_stat_get(b->stat_summary, EBLOB_LST_RECORDS_TOTAL);
+	removed = eblob_stat_get(b->stat_summary, EBLOB_LST_RECORDS_REMOVED);
+	base_size = eblob_stat_get(b->stat_summary, EBLOB_LST_BASE_SIZE);
+	/* Nothing is known about workload yet */
+	if (total == 0 || removed > total)
+		return;
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(bctl, &b->bases, base_entry) {
+		used += bctl->data_offset;
+		bases++;
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	record_size = base_size / total;
+	if (record_size == 0)
+		record_size = 1;
+
+	/* Base that fits records_in_blob average records, but no more than blob_size */
+	records = b->cfg.records_in_blob;
+	size = records * record_size;
+	if (size / record_size != records || size > b->cfg.blob_size) {
+		size = b->cfg.blob_size;
+		records = size / record_size;
+	}
+
+	/* Shrink bases proportionally to share of removed records */
+	if (removed * 100 / total >= 10) {
+		size = size / 100 * (100 - removed * 100 / total);
+		records = records / 100 * (100 - removed * 100 / total);
+		reason = EBLOB_AUTOSIZE_REMOVES;
+	}
+
+	/* Grow bases when there are too many of them */
+	needed = used / EBLOB_AUTOSIZE_MAX_BASES;
+	if (bases > EBLOB_AUTOSIZE_MAX_BASES && size < needed) {
+		size = needed;
+		records = size / record_size + 1;
+		reason = EBLOB_AUTOSIZE_BASES;
+	}
+
+	/* Keys of unsorted bases must fit into memory in any case */
+	ram = eblob_autosize_ram(b);
+	ram_records = ram / (EBLOB_AUTOSIZE_RAM_PER_RECORD * EBLOB_AUTOSIZE_RAM_BASES);
+	if (ram != 0 && records > ram_records) {
+		records = ram_records;
+		size = records * record_size;
+		reason = EBLOB_AUTOSIZE_MEMORY;
+	}
+
+	if (size < b->cfg.blob_size_min || size > b->cfg.blob_size
+			|| records < b->cfg.records_in_blob_min || records > b->cfg.records_in_blob)
+		reason = EBLOB_AUTOSIZE_BOUNDS;
+	size = EBLOB_MIN(EBLOB_MAX(size, b->cfg.blob_size_min), b->cfg.blob_size);
+	records = EBLOB_MIN(EBLOB_MAX(records, b->cfg.records_in_blob_min), b->cfg.records_in_blob);
+
+	if (size != b->auto_blob_size || records != b->auto_records_in_blob)
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: auto base size: %" PRIu64 " bytes, "
+				"%" PRIu64 " records, limited by %s: record size: %" PRIu64
+				", removed: %" PRIu64 "/%" PRIu64 ", bases: %" PRIu64 ", memory: %" PRIu64 "\n",
+				b->cfg.file, size, records, eblob_autosize_reason_str[reason],
+				record_size, removed, total, bases, ram);
+
+	pthread_mutex_lock(&b->lock);
+	b->auto_blob_size = size;
+	b->auto_records_in_blob = records;
+	pthread_mutex_unlock(&b->lock);
+
+	eblob_stat_set(b->stat, EBLOB_GST_AUTO_BLOB_SIZE, size);
+	eblob_stat_set(b->stat, EBLOB_GST_AUTO_RECORDS_IN_BLOB, records);
+	eblob_stat_set(b->stat, EBLOB_GST_AUTO_BASE_SIZE_REASON, reason);
+}
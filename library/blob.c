@@ -27,16 +27,18 @@
 
 #include "blob.h"
 #include "crypto/sha512.h"
+#include "scheduler.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/statvfs.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -273,6 +275,9 @@ int eblob_get_index_fd(struct eblob_base_ctl *bctl)
 /**
  * eblob_base_wait_locked() - wait until number of bctl users inside critical
  * region reaches zero.
+ * Users enter it without taking bctl->lock, see eblob_bctl_hold(), so
+ * @exclusive is raised first: users that come after it back off and sleep
+ * on bctl->lock until eblob_base_unlock().
  * NB! To avoid race conditions bctl remains locked.
  */
 void eblob_base_wait_locked(struct eblob_base_ctl *bctl)
@@ -280,30 +285,55 @@ void eblob_base_wait_locked(struct eblob_base_ctl *bctl)
 	assert(bctl != NULL);
 
 	pthread_mutex_lock(&bctl->lock);
-	while (bctl->critness != 0) {
+	bctl->exclusive = 1;
+	atomic_mb();
+	while (atomic_read(&bctl->critness) != 0) {
 		pthread_cond_wait(&bctl->critness_wait, &bctl->lock);
 	}
 }
 
+/**
+ * eblob_base_unlock() - leaves section entered by eblob_base_wait_locked().
+ */
+void eblob_base_unlock(struct eblob_base_ctl *bctl)
+{
+	assert(bctl != NULL);
+
+	bctl->exclusive = 0;
+	pthread_mutex_unlock(&bctl->lock);
+}
+
 /**
  * eblob_base_wait() - wait until all pending writes are finished.
  */
 void eblob_base_wait(struct eblob_base_ctl *bctl)
 {
 	eblob_base_wait_locked(bctl);
-	pthread_mutex_unlock(&bctl->lock);
+	eblob_base_unlock(bctl);
 }
 
 /**
  * eblob_bctl_hold() - prevents iterators from seeing inconsistent data state.
+ *
+ * Lookups hold every base they pass, so common case is a single atomic
+ * increment. Only if someone waits for bctl users in
+ * eblob_base_wait_locked() increment is undone and retried under bctl->lock.
  */
 void eblob_bctl_hold(struct eblob_base_ctl *bctl)
 {
 	assert(bctl != NULL);
-	assert(bctl->critness >= 0);
+	assert(atomic_read(&bctl->critness) >= 0);
+
+#ifdef HAVE_SYNC_ATOMIC_SUPPORT
+	/* Full barrier of increment orders it before the check */
+	atomic_inc(&bctl->critness);
+	if (!bctl->exclusive)
+		return;
+	eblob_bctl_release(bctl);
+#endif
 
 	pthread_mutex_lock(&bctl->lock);
-	bctl->critness++;
+	atomic_inc(&bctl->critness);
 	pthread_mutex_unlock(&bctl->lock);
 }
 
@@ -313,12 +343,19 @@ void eblob_bctl_hold(struct eblob_base_ctl *bctl)
 void eblob_bctl_release(struct eblob_base_ctl *bctl)
 {
 	assert(bctl != NULL);
-	assert(bctl->critness > 0);
+	assert(atomic_read(&bctl->critness) > 0);
+
+	if (atomic_dec(&bctl->critness) != 0)
+		return;
+
+#ifdef HAVE_SYNC_ATOMIC_SUPPORT
+	/* Nobody waits: waiter raises @exclusive before checking counter */
+	if (!bctl->exclusive)
+		return;
+#endif
 
 	pthread_mutex_lock(&bctl->lock);
-	bctl->critness--;
-	if (bctl->critness == 0)
-		pthread_cond_broadcast(&bctl->critness_wait);
+	pthread_cond_broadcast(&bctl->critness_wait);
 	pthread_mutex_unlock(&bctl->lock);
 }
 
@@ -372,6 +409,9 @@ static int eblob_writev_raw(struct eblob_key *key, struct eblob_write_control *w
 		err = __eblob_write_ll(wc->bctl->data_fd, tmp->base, tmp->size, offset);
 		if (err != 0)
 			goto err_exit;
+
+		eblob_stat_add(wc->bctl->back->stat, EBLOB_GST_WRITTEN_LOGICAL, tmp->size);
+		eblob_stat_add(wc->bctl->back->stat, EBLOB_GST_WRITTEN_FOREGROUND, tmp->size);
 	}
 
 err_exit:
@@ -426,6 +466,25 @@ int eblob_check_record(const struct eblob_base_ctl *bctl,
 	return 0;
 }
 
+/**
+ * eblob_iterate_match() - checks user metadata of @dc against filter of @ctl
+ * Returns non-zero if record should be passed to iterator.
+ */
+static int eblob_iterate_match(const struct eblob_iterate_control *ctl,
+		const struct eblob_disk_control *dc)
+{
+	const uint32_t ts = eblob_flags_time(dc->flags);
+
+	if ((eblob_flags_user(dc->flags) ^ ctl->user_flags) & ctl->user_flags_mask)
+		return 0;
+	if (ts < ctl->time_start)
+		return 0;
+	if (ctl->time_end != 0 && ts >= ctl->time_end)
+		return 0;
+
+	return 1;
+}
+
 /**
  * eblob_check_disk_one() - checks one entry of a blob and calls iterator
  * callback on it
@@ -459,6 +518,12 @@ static int eblob_check_disk_one(struct eblob_iterate_local *loc)
 	loc->last_valid_offset = loc->index_offset;
 	loc->last_valid_dc = dc;
 
+	/* Filter is checked on index entry alone, data is not touched */
+	if (!eblob_iterate_match(ctl, dc)) {
+		err = 0;
+		goto err_out_exit;
+	}
+
 	rc.index_offset = loc->index_offset;
 	rc.data_offset = dc->position;
 	rc.size = dc->data_size;
@@ -477,8 +542,11 @@ static int eblob_check_disk_one(struct eblob_iterate_local *loc)
 					sizeof(struct eblob_disk_control), loc->index_offset);
 			if (err)
 				goto err_out_exit;
+			eblob_stat_add(bc->back->stat, EBLOB_GST_WRITTEN_INDEX,
+					sizeof(struct eblob_disk_control));
 		}
 	}
+	eblob_rctl_set_disk(&rc, dc->disk_size, dc->flags);
 
 	eblob_log(ctl->log, EBLOB_LOG_DEBUG, "blob: %s: pos: %" PRIu64 ", disk_size: %" PRIu64
 			", data_size: %" PRIu64 ", flags: 0x%" PRIx64 "\n",
@@ -545,6 +613,8 @@ static int eblob_fill_range_offsets(struct eblob_base_ctl *bctl, struct eblob_it
 	memset(&st, 0, sizeof(struct eblob_disk_search_stat));
 	memset(&local_dc, 0, sizeof(struct eblob_disk_control));
 
+	/* Index blocks may be replaced by eblob_summary_balance() */
+	pthread_rwlock_rdlock(&bctl->index_blocks_lock);
 	for (i = 0; i < ctl->range_num; ++i) {
 		struct eblob_index_block *range = &ctl->range[i];
 
@@ -600,6 +670,7 @@ static int eblob_fill_range_offsets(struct eblob_base_ctl *bctl, struct eblob_it
 				(unsigned long long)range->start_offset,
 				(unsigned long long)range->end_offset);
 	}
+	pthread_rwlock_unlock(&bctl->index_blocks_lock);
 
 	ctl->index_offset = ctl->range[0].start_offset;
 	return 0;
@@ -792,6 +863,7 @@ static int eblob_blob_iterator(struct eblob_iterate_priv *iter_priv)
 		 * invalidate bctl->data
 		 */
 		eblob_bctl_hold(bctl);
+		eblob_lazy_touch(bctl);
 		err = eblob_check_disk(&loc);
 		eblob_bctl_release(bctl);
 		if (err)
@@ -880,19 +952,37 @@ int eblob_blob_iterate(struct eblob_iterate_control *ctl)
 		qsort(ctl->range, ctl->range_num, sizeof(struct eblob_index_block), eblob_index_block_cmp);
 	}
 
+	/*
+	 * Sorted base may be closed with EBLOB_LAZY_BASES, it is kept open
+	 * till iteration is done.
+	 */
+	eblob_lazy_hold(ctl->base);
+	err = eblob_lazy_open(ctl->base);
+	if (err) {
+		ctl->err = err;
+		goto err_out_release;
+	}
+
+	/* Open base may have buffered records */
+	err = eblob_wbuf_flush_base(ctl->b, ctl->base);
+	if (err) {
+		ctl->err = err;
+		goto err_out_release;
+	}
+
 	/* Wait until nobody uses bctl->data */
 	eblob_base_wait_locked(ctl->base);
 	err = eblob_base_setup_data(ctl->base, 0);
 	if (err) {
-		pthread_mutex_unlock(&ctl->base->lock);
+		eblob_base_unlock(ctl->base);
 		ctl->err = err;
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
 	ctl->index_offset = 0;
 	ctl->data_size = ctl->base->data_size;
-	ctl->index_size = ctl->base->index_size;
-	pthread_mutex_unlock(&ctl->base->lock);
+	ctl->index_size = eblob_wbuf_index_flushed(ctl->b, ctl->base);
+	eblob_base_unlock(ctl->base);
 
 	iter_priv.ctl = ctl;
 	iter_priv.thread_priv = NULL;
@@ -902,7 +992,7 @@ int eblob_blob_iterate(struct eblob_iterate_control *ctl)
 		if (err) {
 			ctl->err = err;
 			eblob_log(ctl->log, EBLOB_LOG_ERROR, "blob: failed to init iterator: %d.\n", err);
-			goto err_out_exit;
+			goto err_out_release;
 		}
 	}
 
@@ -910,7 +1000,7 @@ int eblob_blob_iterate(struct eblob_iterate_control *ctl)
 	if (err) {
 		ctl->err = err;
 		eblob_log(ctl->log, EBLOB_LOG_ERROR, "blob: iterator failed: %d.\n", err);
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
 	if (ctl->iterator_cb.iterator_free)
@@ -919,7 +1009,8 @@ int eblob_blob_iterate(struct eblob_iterate_control *ctl)
 	if ((ctl->err == -ENOENT) && eblob_total_elements(ctl->b))
 		ctl->err = 0;
 
-err_out_exit:
+err_out_release:
+	eblob_lazy_release(ctl->base);
 	return ctl->err;
 }
 
@@ -930,7 +1021,17 @@ err_out_exit:
  */
 int eblob_mark_index_removed(int fd, uint64_t offset)
 {
-	uint64_t flags = eblob_bswap64(BLOB_DISK_CTL_REMOVE);
+	return eblob_write_index_flags(fd, offset, BLOB_DISK_CTL_REMOVE);
+}
+
+/**
+ * eblob_write_index_flags() - overwrites flags of entry in index/data file
+ * @fd:		opened for write file descriptor of index
+ * @offset:	position of entry's disk control in index
+ */
+int eblob_write_index_flags(int fd, uint64_t offset, uint64_t flags)
+{
+	flags = eblob_bswap64(flags);
 
 	return __eblob_write_ll(fd, &flags, sizeof(flags), offset + offsetof(struct eblob_disk_control, flags));
 }
@@ -968,6 +1069,11 @@ static int eblob_mark_entry_removed(struct eblob_backend *b,
 {
 	int err;
 
+	/* Record should be on disk to be marked removed there */
+	err = eblob_wbuf_flush_record(b, old);
+	if (err != 0)
+		goto err;
+
 	/* Add entry to list of removed entries */
 	if (eblob_binlog_enabled(&old->bctl->binlog)) {
 		struct eblob_binlog_entry *entry;
@@ -1011,6 +1117,8 @@ static int eblob_mark_entry_removed(struct eblob_backend *b,
 		goto err;
 	}
 
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_INDEX, sizeof(uint64_t));
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_FOREGROUND, sizeof(uint64_t));
 	eblob_stat_inc(old->bctl->stat, EBLOB_LST_RECORDS_REMOVED);
 	eblob_stat_add(old->bctl->stat, EBLOB_LST_REMOVED_SIZE, old->size);
 
@@ -1029,7 +1137,7 @@ err:
  * eblob_mark_entry_removed_purge() - remove entry from disk and memory.
  * FIXME: Rename!
  */
-static int eblob_mark_entry_removed_purge(struct eblob_backend *b,
+int eblob_mark_entry_removed_purge(struct eblob_backend *b,
 		struct eblob_key *key, struct eblob_ram_control *old)
 {
 	int err;
@@ -1047,8 +1155,8 @@ static int eblob_mark_entry_removed_purge(struct eblob_backend *b,
 	if (err)
 		goto err;
 
-	/* Remove from memory */
-	err = eblob_cache_remove(b, key);
+	/* Remove from memory unless key was written again meanwhile */
+	err = eblob_cache_remove_old(b, key, old);
 	if (err != 0 && err != -ENOENT) {
 		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_NOTICE, -err,
 				"%s: eblob_cache_remove: FAILED: %d",
@@ -1063,16 +1171,32 @@ err:
 	return err;
 }
 
+/**
+ * eblob_stamp_flags() - sets time of the write in user metadata of @flags,
+ * see BLOB_DISK_CTL_TIME_MASK
+ */
+uint64_t eblob_stamp_flags(uint64_t flags)
+{
+	uint64_t now = (uint32_t)time(NULL);
+
+	return (flags & ~BLOB_DISK_CTL_TIME_MASK) | (now << BLOB_DISK_CTL_TIME_SHIFT);
+}
+
 /**
  * eblob_wc_to_dc() - convert write control to disk control
+ * Also stamps @wc->flags with time of the write and drops flags that are
+ * never stored (BLOB_DISK_CTL_NEW), so that flags kept in RAM index match
+ * ones on disk.
  */
-static void eblob_wc_to_dc(const struct eblob_key *key, const struct eblob_write_control *wc,
+static void eblob_wc_to_dc(const struct eblob_key *key, struct eblob_write_control *wc,
 		struct eblob_disk_control *dc)
 {
 	assert(key != NULL);
 	assert(wc != NULL);
 	assert(dc != NULL);
 
+	wc->flags = eblob_stamp_flags(wc->flags & ~BLOB_DISK_CTL_NEW);
+
 	memcpy(&dc->key, key, sizeof(struct eblob_key));
 	dc->flags = wc->flags;
 	dc->data_size = wc->total_data_size;
@@ -1082,6 +1206,36 @@ static void eblob_wc_to_dc(const struct eblob_key *key, const struct eblob_write
 	eblob_convert_disk_control(dc);
 }
 
+/**
+ * eblob_commit_disk_ll() - writes disk control constructed from write control
+ * to both index and data file without syncing them
+ */
+static int eblob_commit_disk_ll(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc)
+{
+	struct eblob_disk_control dc;
+	int err;
+
+	eblob_wc_to_dc(key, wc, &dc);
+
+	err = __eblob_write_ll(wc->index_fd, &dc, sizeof(dc), wc->ctl_index_offset);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_commit_disk: ERROR-write-index", err);
+		return err;
+	}
+
+	err = __eblob_write_ll(wc->data_fd, &dc, sizeof(dc), wc->ctl_data_offset);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_commit_disk: ERROR-write-data", err);
+		return err;
+	}
+
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_INDEX, sizeof(dc));
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_FOREGROUND, sizeof(dc));
+
+	return 0;
+}
+
 /**
  * eblob_commit_disk() - update on disk index with data from write control
  * @wc:		new data
@@ -1092,7 +1246,6 @@ static int eblob_commit_disk(struct eblob_backend *b, struct eblob_key *key,
 {
 	react_start_action(ACTION_EBLOB_COMMIT_DISK);
 
-	struct eblob_disk_control dc;
 	int err;
 
 	if (remove)
@@ -1100,19 +1253,9 @@ static int eblob_commit_disk(struct eblob_backend *b, struct eblob_key *key,
 	else
 		wc->flags &= ~BLOB_DISK_CTL_REMOVE;
 
-	eblob_wc_to_dc(key, wc, &dc);
-
-	err = __eblob_write_ll(wc->index_fd, &dc, sizeof(dc), wc->ctl_index_offset);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_commit_disk: ERROR-write-index", err);
-		goto err_out_exit;
-	}
-
-	err = __eblob_write_ll(wc->data_fd, &dc, sizeof(dc), wc->ctl_data_offset);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_commit_disk: ERROR-write-data", err);
+	err = eblob_commit_disk_ll(b, key, wc);
+	if (err)
 		goto err_out_exit;
-	}
 
 	if (!b->cfg.sync)
 		fsync(wc->index_fd);
@@ -1174,6 +1317,51 @@ again:
 	return 0;
 }
 
+/**
+ * __eblob_read_nowait_ll() - like __eblob_read_ll() but reads only data that
+ * is in page cache using preadv2(2) with RWF_NOWAIT, returns -EAGAIN if some
+ * of it is not. Without kernel support every read is reported as -EAGAIN.
+ */
+int __eblob_read_nowait_ll(int fd, void *data, size_t size, off_t offset)
+{
+#if defined(HAVE_PREADV2) && defined(RWF_NOWAIT)
+	static volatile int unsupported;
+	struct iovec iov;
+	ssize_t bytes;
+
+	if (unsupported)
+		return -EAGAIN;
+
+	while (size) {
+		iov.iov_base = data;
+		iov.iov_len = size;
+
+		bytes = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			/* Old kernel or file system without RWF_NOWAIT */
+			if (errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL) {
+				unsupported = 1;
+				return -EAGAIN;
+			}
+			return -errno;
+		} else if (bytes == 0)
+			return -ESPIPE;
+		data += bytes;
+		size -= bytes;
+		offset += bytes;
+	}
+	return 0;
+#else
+	(void)fd;
+	(void)data;
+	(void)size;
+	(void)offset;
+	return -EAGAIN;
+#endif
+}
+
 /**
  * eblob_calculate_size() - calculate size of data with respect to
  * header/footer and alignment
@@ -1197,6 +1385,7 @@ static void eblob_wc_to_rctl(const struct eblob_write_control *wc,
 	assert(rctl != NULL);
 
 	rctl->size = wc->total_data_size;
+	eblob_rctl_set_disk(rctl, wc->total_size, wc->flags);
 	rctl->data_offset = wc->ctl_data_offset;
 	rctl->index_offset = wc->ctl_index_offset;
 	rctl->bctl = wc->bctl;
@@ -1395,7 +1584,6 @@ static int eblob_fill_write_control_from_ram(struct eblob_backend *b, struct ebl
 	react_start_action(ACTION_EBLOB_FILL_WRITE_CONTROL_FROM_RAM);
 
 	struct eblob_ram_control ctl;
-	struct eblob_disk_control dc;
 	uint64_t orig_offset = wc->offset;
 	ssize_t err;
 
@@ -1409,6 +1597,11 @@ static int eblob_fill_write_control_from_ram(struct eblob_backend *b, struct ebl
 		memcpy(old, &ctl, sizeof(struct eblob_ram_control));
 	}
 
+	/* Record is going to be accessed on disk */
+	err = eblob_wbuf_flush_record(b, &ctl);
+	if (err)
+		goto err_out_exit;
+
 	/* only for write */
 	if (for_write && (wc->flags & BLOB_DISK_CTL_APPEND)) {
 		wc->offset = orig_offset + ctl.size;
@@ -1425,28 +1618,36 @@ static int eblob_fill_write_control_from_ram(struct eblob_backend *b, struct ebl
 	wc->data_offset = wc->ctl_data_offset + sizeof(struct eblob_disk_control) + wc->offset;
 	wc->bctl = ctl.bctl;
 
-	err = __eblob_read_ll(wc->index_fd, &dc, sizeof(dc), ctl.index_offset);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_fill_write_control_from_ram: ERROR-pread-index", err);
-		goto err_out_exit;
-	}
-	eblob_convert_disk_control(&dc);
+	/*
+	 * Flags and sizes are cached along with offsets, so there is no need
+	 * to re-read disk control from index here unless disk size did not fit.
+	 */
+	wc->flags = ctl.flags;
+	if (ctl.disk_extra != EBLOB_RAM_DISK_EXTRA_UNKNOWN) {
+		wc->total_size = ctl.size + ctl.disk_extra;
+	} else {
+		struct eblob_disk_control dc;
 
-	wc->flags = dc.flags;
-	wc->total_size = dc.disk_size;
-	if (dc.data_size < wc->offset + wc->size)
+		eblob_stat_inc(b->stat, EBLOB_GST_INDEX_HEADER_READS);
+		err = __eblob_read_ll(wc->index_fd, &dc, sizeof(dc), ctl.index_offset);
+		if (err)
+			goto err_out_exit;
+		eblob_convert_disk_control(&dc);
+		wc->total_size = dc.disk_size;
+	}
+	if (ctl.size < wc->offset + wc->size)
 		wc->total_data_size = wc->offset + wc->size;
 	else
-		wc->total_data_size = dc.data_size;
+		wc->total_data_size = ctl.size;
 
 	if (!wc->size)
-		wc->size = dc.data_size;
+		wc->size = ctl.size;
 
-	if (for_write && (dc.disk_size < eblob_calculate_size(b, wc->offset, wc->size))) {
+	if (for_write && (wc->total_size < eblob_calculate_size(b, wc->offset, wc->size))) {
 		err = -E2BIG;
 		eblob_log(b->cfg.log, EBLOB_LOG_DEBUG,
 					"%s: %s: size check failed: disk-size: %llu, calculated: %llu\n",
-					__func__, eblob_dump_id(key->id), (unsigned long long)dc.disk_size,
+					__func__, eblob_dump_id(key->id), (unsigned long long)wc->total_size,
 					(unsigned long long)eblob_calculate_size(b, wc->offset, wc->size));
 		goto err_out_exit;
 	}
@@ -1459,47 +1660,38 @@ err_out_exit:
 }
 
 /**
- * eblob_check_free_space() - checks if there is enough space for yet another
- * blob or there is at least 10% of free space available on this FS.
+ * eblob_get_writable_base() - returns last base if it has room for @records
+ * more entries, otherwise closes it and creates a new one.
+ * NB! Caller should hold "backend" lock.
  */
-static int eblob_check_free_space(struct eblob_backend *b, uint64_t size)
+static int eblob_get_writable_base(struct eblob_backend *b, uint64_t records,
+		struct eblob_base_ctl **bctlp)
 {
-	unsigned long long total, avail;
-	static int print_once;
+	struct eblob_base_ctl *ctl;
+	uint64_t blob_size, records_in_blob;
+	int err;
 
-	if (!(b->cfg.blob_flags & EBLOB_NO_FREE_SPACE_CHECK)) {
-		avail = b->vfs_stat.f_bsize * b->vfs_stat.f_bavail;
-		total = b->vfs_stat.f_frsize * b->vfs_stat.f_blocks;
-		if (avail < size)
-			return -ENOSPC;
-
-		if (b->cfg.blob_size_limit) {
-			if (eblob_stat_get(b->stat_summary, EBLOB_LST_BASE_SIZE) + size > b->cfg.blob_size_limit) {
-				if (!print_once) {
-					print_once = 1;
-
-					eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "OUT OF FREE SPACE: available: %llu Mb, "
-							"total: %llu Mb, current size: %" PRIu64 " Mb, limit: %" PRIu64 "Mb\n",
-							avail / EBLOB_1_M, total / EBLOB_1_M,
-							(eblob_stat_get(b->stat_summary, EBLOB_LST_BASE_SIZE) + size) / EBLOB_1_M,
-							b->cfg.blob_size_limit / EBLOB_1_M);
-				}
-				return -ENOSPC;
-			}
-		} else if (((b->cfg.blob_flags & EBLOB_RESERVE_10_PERCENTS) && (avail < total * 0.1)) ||
-				(!(b->cfg.blob_flags & EBLOB_RESERVE_10_PERCENTS) && (avail < 2 * b->cfg.blob_size))) {
-			if (!print_once) {
-				print_once = 1;
-
-				eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "OUT OF FREE SPACE: available: %llu Mb, "
-						"total: %llu Mb, blob size: %" PRIu64 " Mb\n",
-						avail / EBLOB_1_M, total / EBLOB_1_M, b->cfg.blob_size / EBLOB_1_M);
-			}
+	if (list_empty(&b->bases)) {
+		err = eblob_add_new_base(b);
+		if (err)
+			return err;
+	}
 
-			return -ENOSPC;
-		}
+	eblob_base_limits(b, &blob_size, &records_in_blob);
+	ctl = list_last_entry(&b->bases, struct eblob_base_ctl, base_entry);
+	if ((ctl->data_offset >= (off_t)blob_size) || (ctl->sort.fd >= 0) ||
+			(ctl->index_size / sizeof(struct eblob_disk_control) + records > records_in_blob)) {
+		err = eblob_add_new_base(b);
+		if (err)
+			return err;
+
+		if (ctl->sort.fd < 0)
+			datasort_force_sort(b);
+
+		ctl = list_last_entry(&b->bases, struct eblob_base_ctl, base_entry);
 	}
 
+	*bctlp = ctl;
 	return 0;
 }
 
@@ -1517,24 +1709,14 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 	struct eblob_base_ctl *ctl = NULL;
 	ssize_t err = 0;
 
-	if (list_empty(&b->bases)) {
-		err = eblob_add_new_base(b);
-		if (err)
-			goto err_out_exit;
-	}
-
-	ctl = list_last_entry(&b->bases, struct eblob_base_ctl, base_entry);
-	if ((ctl->data_offset >= (off_t)b->cfg.blob_size) || (ctl->sort.fd >= 0) ||
-			(ctl->index_size / sizeof(struct eblob_disk_control) >= b->cfg.records_in_blob)) {
-		err = eblob_add_new_base(b);
-		if (err)
-			goto err_out_exit;
-
-		if (ctl->sort.fd < 0)
-			datasort_force_sort(b);
+	err = eblob_get_writable_base(b, 1, &ctl);
+	if (err)
+		goto err_out_exit;
 
-		ctl = list_last_entry(&b->bases, struct eblob_base_ctl, base_entry);
-	}
+	/* Record is written directly, so it should follow buffered ones on disk */
+	err = eblob_wbuf_flush(b);
+	if (err)
+		goto err_out_exit;
 
 	if (old != NULL) {
 		/* Check that bctl is still valid */
@@ -1674,8 +1856,10 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 		else
 			err = eblob_copy_data(old->bctl->data_fd, off_in, wc->data_fd, off_out, size);
 
-		if (err == 0)
+		if (err == 0) {
 			eblob_stat_inc(b->stat, EBLOB_GST_READ_COPY_UPDATE);
+			eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_RCU, size);
+		}
 
 		EBLOB_WARNX(b->cfg.log, err < 0 ? EBLOB_LOG_ERROR : EBLOB_LOG_NOTICE,
 				"copy: %s: src offset: %" PRIu64 ", dst offset: %" PRIu64
@@ -1701,6 +1885,7 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 			 */
 			goto err_out_exit;
 		}
+		eblob_hotkey_update(b, key);
 	}
 
 	eblob_stat_add(ctl->stat, EBLOB_LST_BASE_SIZE,
@@ -1733,15 +1918,21 @@ static int eblob_write_prepare_disk(struct eblob_backend *b, struct eblob_key *k
 	react_start_action(ACTION_EBLOB_WRITE_PREPARE_DISK);
 
 	ssize_t err = 0;
-	uint64_t size;
+	uint64_t size, reserve;
 
 	eblob_log(b->cfg.log, EBLOB_LOG_NOTICE,
 			"blob: %s: eblob_write_prepare_disk: start: "
 			"size: %" PRIu64 ", offset: %" PRIu64 ", prepare: %" PRIu64 "\n",
 			eblob_dump_id(key->id), wc->size, wc->offset, prepare_disk_size);
 
+	/* Rejected writes should not hold reservations */
+	err = eblob_admission_check(b);
+	if (err)
+		goto err_out_exit;
+
 	size = prepare_disk_size > wc->size + wc->offset ? prepare_disk_size : wc->size + wc->offset;
-	err = eblob_check_free_space(b, eblob_calculate_size(b, 0, size));
+	reserve = eblob_calculate_size(b, 0, size);
+	err = eblob_space_reserve(b, reserve);
 	if (err)
 		goto err_out_exit;
 
@@ -1753,57 +1944,87 @@ static int eblob_write_prepare_disk(struct eblob_backend *b, struct eblob_key *k
 	err = eblob_write_prepare_disk_ll(b, key, wc, prepare_disk_size, copy,
 			copy_offset, old);
 	pthread_mutex_unlock(&b->lock);
+	if (err)
+		eblob_space_release(b, reserve);
 
 err_out_exit:
 	react_stop_action(ACTION_EBLOB_WRITE_PREPARE_DISK);
 	return err;
 }
 
-/**
- * eblob_write_prepare() - prepare phase reserves space in blob file.
+/*!
+ * Low-level counterpart of \fn eblob_write_prepare() that leaves reserved
+ * record's location in \a wc.
  */
-int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
-		uint64_t size, uint64_t flags)
+static int eblob_write_prepare_ll(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags, struct eblob_write_control *wc)
 {
-	react_start_action(ACTION_EBLOB_WRITE_PREPARE);
-
-	struct eblob_write_control wc = { .offset = 0 };
 	struct eblob_ram_control old;
+	uint64_t user_changed;
 	int err;
 
-	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_DEBUG,
-			"key: %s, size: %" PRIu64 ", flags 0x%" PRIx64,
-			eblob_dump_id(key->id), size, flags);
-
-	/* Sanity */
-	if (b == NULL || key == NULL) {
-		err = -EINVAL;
-		goto err_out_exit;
-	}
-
 	/*
 	 * For eblob_write_prepare() this can not fail with -E2BIG, since
 	 * size/offset are zero.
 	 */
-	err = eblob_fill_write_control_from_ram(b, key, &wc, 1, &old);
+	err = eblob_fill_write_control_from_ram(b, key, wc, 1, &old);
 	if (err && err != -ENOENT)
 		goto err_out_exit;
 
-	if (err == 0 && (wc.total_size >= eblob_calculate_size(b, 0, size))) {
+	/*
+	 * Header of reused record is rewritten on commit with cached flags, so
+	 * user flags of this write replace old ones in cache right away.
+	 * Records of sorted bases are not cached, so they are copied instead.
+	 */
+	user_changed = (wc->flags ^ flags) & BLOB_DISK_CTL_USER_MASK;
+	if (err == 0 && (wc->total_size >= eblob_calculate_size(b, 0, size))
+			&& !(user_changed && wc->on_disk)) {
 		eblob_stat_inc(b->stat, EBLOB_GST_PREPARE_REUSED);
+		if (user_changed) {
+			wc->flags = (wc->flags & ~BLOB_DISK_CTL_USER_MASK)
+				| (flags & BLOB_DISK_CTL_USER_MASK);
+			err = eblob_cache_update_flags(b, key, &old, wc->flags);
+		}
 		goto err_out_exit;
 	} else {
-		wc.flags = flags;
+		wc->flags = flags & ~BLOB_DISK_CTL_NEW;
 		if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
-			wc.flags |= BLOB_DISK_CTL_NOCSUM;
-		err = eblob_write_prepare_disk(b, key, &wc, size, EBLOB_COPY_RECORD, 0, err == -ENOENT ? NULL : &old);
+			wc->flags |= BLOB_DISK_CTL_NOCSUM;
+		err = eblob_write_prepare_disk(b, key, wc, size, EBLOB_COPY_RECORD, 0, err == -ENOENT ? NULL : &old);
 		if (err)
 			goto err_out_exit;
-		err = eblob_commit_ram(b, key, &wc);
+		err = eblob_commit_ram(b, key, wc);
 		if (err)
 			goto err_out_exit;
 	}
 
+err_out_exit:
+	return err;
+}
+
+/**
+ * eblob_write_prepare() - prepare phase reserves space in blob file.
+ */
+int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags)
+{
+	react_start_action(ACTION_EBLOB_WRITE_PREPARE);
+
+	struct eblob_write_control wc = { .offset = 0 };
+	int err;
+
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_DEBUG,
+			"key: %s, size: %" PRIu64 ", flags 0x%" PRIx64,
+			eblob_dump_id(key->id), size, flags);
+
+	/* Sanity */
+	if (b == NULL || key == NULL) {
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	err = eblob_write_prepare_ll(b, key, size, flags, &wc);
+
 err_out_exit:
 	react_stop_action(ACTION_EBLOB_WRITE_PREPARE);
 	eblob_dump_wc(b, key, &wc, "eblob_write_prepare: finished", err);
@@ -1859,11 +2080,11 @@ err_out_exit:
 }
 
 /**
- * eblob_write_commit_footer() - low-level commit phase computes checksum and
- * writes footer.
+ * eblob_write_commit_footer_ll() - low-level commit phase computes checksum and
+ * writes footer without syncing data file.
  */
-static int eblob_write_commit_footer(struct eblob_backend *b, struct eblob_key *key,
-                                     struct eblob_write_control *wc)
+static int eblob_write_commit_footer_ll(struct eblob_backend *b, struct eblob_key *key,
+                                        struct eblob_write_control *wc)
 {
 	react_start_action(ACTION_EBLOB_WRITE_COMMIT_FOOTER);
 	off_t offset = wc->ctl_data_offset + wc->total_size - sizeof(struct eblob_disk_footer);
@@ -1875,7 +2096,7 @@ static int eblob_write_commit_footer(struct eblob_backend *b, struct eblob_key *
 	end = start;
 
 	if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
-		goto err_out_sync;
+		goto err_out_exit;
 
 	memset(&f, 0, sizeof(f));
 
@@ -1894,11 +2115,7 @@ static int eblob_write_commit_footer(struct eblob_backend *b, struct eblob_key *
 	err = __eblob_write_ll(wc->data_fd, &f, sizeof(f), offset);
 	if (err)
 		goto err_out_exit;
-
-err_out_sync:
-	if (!b->cfg.sync)
-		fsync(wc->data_fd);
-	err = 0;
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_FOREGROUND, sizeof(f));
 
 err_out_exit:
 	react_stop_action(ACTION_EBLOB_WRITE_COMMIT_FOOTER);
@@ -1913,18 +2130,36 @@ err_out_exit:
 }
 
 /**
- * eblob_write_commit_nolock() - commit phase - writes to disk, updates on-disk
- * index and puts entry to hash.
+ * eblob_write_commit_footer() - writes footer and syncs data file if needed
  */
-static int eblob_write_commit_nolock(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_write_control *wc)
+static int eblob_write_commit_footer(struct eblob_backend *b, struct eblob_key *key,
+                                     struct eblob_write_control *wc)
 {
-	react_start_action(ACTION_EBLOB_WRITE_COMMIT_NOLOCK);
-
 	int err;
 
-	err = eblob_write_commit_footer(b, key, wc);
-	if (err) {
+	err = eblob_write_commit_footer_ll(b, key, wc);
+	if (err)
+		return err;
+
+	if (!b->cfg.sync)
+		fsync(wc->data_fd);
+
+	return 0;
+}
+
+/**
+ * eblob_write_commit_nolock() - commit phase - writes to disk, updates on-disk
+ * index and puts entry to hash.
+ */
+static int eblob_write_commit_nolock(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc)
+{
+	react_start_action(ACTION_EBLOB_WRITE_COMMIT_NOLOCK);
+
+	int err;
+
+	err = eblob_write_commit_footer(b, key, wc);
+	if (err) {
 		eblob_dump_wc(b, key, wc, "eblob_write_commit_footer: ERROR", err);
 		goto err_out_exit;
 	}
@@ -1978,9 +2213,10 @@ int eblob_write_commit(struct eblob_backend *b, struct eblob_key *key,
 
 	/*
 	 * We can only overwrite keys inplace if data-sort is not processing
-	 * this base (so binlog for it is not enabled)
+	 * this base (so binlog for it is not enabled) and base is not being
+	 * shadowed by ingest.
 	 */
-	if (eblob_binlog_enabled(&wc.bctl->binlog)) {
+	if (eblob_binlog_enabled(&wc.bctl->binlog) || eblob_ingest_shadows(b, wc.bctl)) {
 		struct eblob_ram_control rctl;
 		uint64_t orig_flags = wc.flags;
 
@@ -2002,7 +2238,7 @@ int eblob_write_commit(struct eblob_backend *b, struct eblob_key *key,
 	if (size != ~0ULL)
 		wc.size = wc.total_data_size = size;
 	if (flags != ~0ULL)
-		wc.flags = flags;
+		wc.flags = flags & ~BLOB_DISK_CTL_NEW;
 
 	if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
 		wc.flags |= BLOB_DISK_CTL_NOCSUM;
@@ -2018,6 +2254,258 @@ err_out_exit:
 	return err;
 }
 
+/*!
+ * Reads flags of session's record from index, cached ones lack time of write.
+ */
+static int eblob_write_session_disk_flags(struct eblob_write_session *s, uint64_t *flags)
+{
+	int err;
+
+	err = __eblob_read_ll(s->wc.index_fd, flags, sizeof(*flags),
+			s->wc.ctl_index_offset + offsetof(struct eblob_disk_control, flags));
+	if (err != 0)
+		return err;
+
+	*flags = eblob_bswap64(*flags);
+	return 0;
+}
+
+/*!
+ * Opens write session for \a key and reserves \a size bytes for it.
+ */
+int eblob_write_session_open(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags, struct eblob_write_session **session)
+{
+	struct eblob_write_session *s;
+	int err;
+
+	if (b == NULL || key == NULL || session == NULL)
+		return -EINVAL;
+	/* Writes through session are positional */
+	if (flags & (BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_REMOVE))
+		return -ENOTSUP;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return -ENOMEM;
+	s->b = b;
+	s->key = *key;
+
+	err = eblob_write_prepare_ll(b, &s->key, size, flags, &s->wc);
+	if (err != 0)
+		goto err_out_free;
+	err = eblob_write_session_disk_flags(s, &s->disk_flags);
+	if (err != 0)
+		goto err_out_free;
+
+	/* Reused record may have been written with append */
+	s->wc.flags &= ~BLOB_DISK_CTL_APPEND;
+
+	eblob_dump_wc(b, key, &s->wc, "eblob_write_session_open", err);
+	*session = s;
+	return 0;
+
+err_out_free:
+	eblob_dump_wc(b, key, &s->wc, "eblob_write_session_open: FAILED", err);
+	free(s);
+	return err;
+}
+
+/*!
+ * Moves session's record out of the base that is being data-sorted, same way
+ * eblob_plain_writev() does it.
+ * NB! Caller should hold "backend" lock.
+ */
+static int eblob_write_session_relocate(struct eblob_write_session *s)
+{
+	struct eblob_write_control *wc = &s->wc;
+	struct eblob_ram_control rctl;
+	const uint64_t flags = wc->flags, total_data_size = wc->total_data_size;
+	int err;
+
+	if (wc->bctl->index_fd == -1)
+		return -EAGAIN;
+
+	eblob_wc_to_rctl(wc, &rctl);
+
+	/* Do not set any flags for prepare */
+	wc->flags = 0;
+	wc->offset = 0;
+	wc->size = 0;
+	err = eblob_write_prepare_disk_ll(s->b, &s->key, wc,
+			wc->total_size - eblob_calculate_size(s->b, 0, 0),
+			EBLOB_COPY_RECORD, 0, &rctl);
+	s->disk_flags = wc->flags;
+	wc->flags = flags;
+	wc->total_data_size = total_data_size;
+	if (err != 0)
+		return err;
+
+	return eblob_commit_ram(s->b, &s->key, wc);
+}
+
+/*!
+ * Checks that record reserved by session is still the live one: it was
+ * neither removed nor replaced by concurrent write since session was opened.
+ * NB! Caller should hold s->wc.bctl->lock, record is removed under it.
+ */
+static int eblob_write_session_check(struct eblob_write_session *s)
+{
+	struct eblob_write_control *wc = &s->wc;
+	struct eblob_ram_control rctl;
+	uint64_t flags;
+	int err;
+
+	/* Record reused in sorted base is not cached, new write of key is */
+	err = eblob_cache_lookup_ram(s->b, &s->key, &rctl);
+	if (err == -ENOENT && !wc->on_disk)
+		return -ESTALE;
+	if (err != 0 && err != -ENOENT)
+		return err;
+	if (err == 0 && (rctl.bctl != wc->bctl || rctl.data_offset != wc->ctl_data_offset))
+		return -ESTALE;
+
+	/*
+	 * Overwrite marks old record removed before it replaces cached one,
+	 * and inplace one rewrites its header, either changes flags on disk.
+	 */
+	err = eblob_write_session_disk_flags(s, &flags);
+	if (err != 0)
+		return err;
+	if (flags != s->disk_flags)
+		return -ESTALE;
+
+	return 0;
+}
+
+/*!
+ * Writes \a iov into record reserved by session.
+ */
+int eblob_write_session_writev(struct eblob_write_session *s,
+		const struct eblob_iovec *iov, uint16_t iovcnt)
+{
+	struct eblob_iovec_bounds bounds;
+	struct eblob_base_ctl *bctl;
+	int err;
+
+	if (s == NULL || iov == NULL)
+		return -EINVAL;
+	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
+		return -E2BIG;
+
+	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
+
+	/* Do not let data-sort start or finish while we are writing */
+	bctl = s->wc.bctl;
+	eblob_bctl_hold(bctl);
+	if (bctl->index_fd == -1) {
+		err = -EAGAIN;
+		eblob_bctl_release(bctl);
+	} else if (eblob_binlog_enabled(&bctl->binlog)) {
+		eblob_bctl_release(bctl);
+
+		pthread_mutex_lock(&s->b->lock);
+		err = eblob_write_session_relocate(s);
+		if (err == 0)
+			err = eblob_writev_raw(&s->key, &s->wc, iov, iovcnt);
+		pthread_mutex_unlock(&s->b->lock);
+	} else {
+		err = eblob_writev_raw(&s->key, &s->wc, iov, iovcnt);
+		eblob_bctl_release(bctl);
+	}
+
+	if (err == 0 && bounds.max > s->wc.total_data_size)
+		s->wc.total_data_size = bounds.max;
+
+	eblob_log(s->b->cfg.log, err ? EBLOB_LOG_ERROR : EBLOB_LOG_NOTICE,
+			"blob: %s: %s: fd: %d: size: %" PRIu64 ", offset: %" PRIu64 ": %d.\n",
+			eblob_dump_id(s->key.id), __func__, s->wc.data_fd, bounds.max - bounds.min,
+			s->wc.data_offset + bounds.min, err);
+	return err;
+}
+
+int eblob_write_session_write(struct eblob_write_session *s,
+		void *data, uint64_t offset, uint64_t size)
+{
+	const struct eblob_iovec iov = {
+		.base = data,
+		.size = size,
+		.offset = offset,
+	};
+
+	return eblob_write_session_writev(s, &iov, 1);
+}
+
+/*!
+ * Commits record written through session: writes footer, index and data file
+ * headers and updates data in ram.
+ * Returns -ESTALE if key was removed or written by someone else meanwhile,
+ * record of the session is left removed then.
+ */
+int eblob_write_session_commit(struct eblob_write_session *s,
+		uint64_t size, uint64_t flags)
+{
+	struct eblob_write_control *wc;
+	struct eblob_base_ctl *bctl;
+	int err;
+
+	if (s == NULL)
+		return -EINVAL;
+
+	/* Shortcut */
+	wc = &s->wc;
+
+	/* Sanity - we can't commit more than we've reserved */
+	if (size != ~0ULL && size > wc->total_size)
+		return -ERANGE;
+
+	if (size != ~0ULL)
+		wc->total_data_size = size;
+	wc->size = wc->total_data_size;
+	if (flags != ~0ULL)
+		wc->flags = flags & ~BLOB_DISK_CTL_NEW;
+	if (s->b->cfg.blob_flags & EBLOB_NO_FOOTER)
+		wc->flags |= BLOB_DISK_CTL_NOCSUM;
+
+	bctl = wc->bctl;
+	eblob_bctl_hold(bctl);
+	if (bctl->index_fd == -1) {
+		err = -EAGAIN;
+		eblob_bctl_release(bctl);
+	} else if (eblob_binlog_enabled(&bctl->binlog)) {
+		eblob_bctl_release(bctl);
+
+		pthread_mutex_lock(&s->b->lock);
+		pthread_mutex_lock(&bctl->lock);
+		err = eblob_write_session_check(s);
+		pthread_mutex_unlock(&bctl->lock);
+		if (err == 0)
+			err = eblob_write_session_relocate(s);
+		if (err == 0)
+			err = eblob_write_commit_nolock(s->b, &s->key, wc);
+		pthread_mutex_unlock(&s->b->lock);
+	} else {
+		/* Removal or overwrite of the record can not sneak in before commit */
+		pthread_mutex_lock(&bctl->lock);
+		err = eblob_write_session_check(s);
+		if (err == 0)
+			err = eblob_write_commit_nolock(s->b, &s->key, wc);
+		pthread_mutex_unlock(&bctl->lock);
+		eblob_bctl_release(bctl);
+	}
+
+	eblob_dump_wc(s->b, &s->key, wc, "eblob_write_session_commit: finished", err);
+	return err;
+}
+
+/*!
+ * Frees write session. Nothing written through it is rolled back.
+ */
+void eblob_write_session_close(struct eblob_write_session *s)
+{
+	free(s);
+}
+
 static int eblob_try_overwritev(struct eblob_backend *b, struct eblob_key *key,
 		const struct eblob_iovec *iov, uint16_t iovcnt, struct eblob_write_control *wc, struct eblob_ram_control *old)
 {
@@ -2049,14 +2537,15 @@ static int eblob_try_overwritev(struct eblob_backend *b, struct eblob_key *key,
 
 	/*
 	 * We can only overwrite keys inplace if data-sort is not processing
-	 * this base (so binlog for it is not enabled)
+	 * this base (so binlog for it is not enabled) and base is not being
+	 * shadowed by ingest.
 	 */
-	if (eblob_binlog_enabled(&wc->bctl->binlog)) {
+	if (eblob_binlog_enabled(&wc->bctl->binlog) || eblob_ingest_shadows(b, wc->bctl)) {
 		err = -EROFS;
 		goto err_out_release;
 	}
 
-	wc->flags = flags;
+	wc->flags = flags & ~BLOB_DISK_CTL_NEW;
 	wc->size = size;
 	wc->total_data_size = wc->offset + wc->size;
 
@@ -2134,9 +2623,10 @@ int eblob_plain_writev(struct eblob_backend *b, struct eblob_key *key,
 
 	/*
 	 * We can only overwrite keys inplace if data-sort is not processing
-	 * this base (so binlog for it is not enabled)
+	 * this base (so binlog for it is not enabled) and base is not being
+	 * shadowed by ingest.
 	 */
-	if (eblob_binlog_enabled(&wc.bctl->binlog)) {
+	if (eblob_binlog_enabled(&wc.bctl->binlog) || eblob_ingest_shadows(b, wc.bctl)) {
 		struct eblob_ram_control rctl;
 
 		err = eblob_cache_lookup(b, key, &rctl, NULL);
@@ -2153,7 +2643,7 @@ int eblob_plain_writev(struct eblob_backend *b, struct eblob_key *key,
 		prepared = 1;
 	}
 
-	wc.flags = flags;
+	wc.flags = flags & ~BLOB_DISK_CTL_NEW;
 	if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
 		wc.flags |= BLOB_DISK_CTL_NOCSUM;
 	err = eblob_writev_raw(key, &wc, iov, iovcnt);
@@ -2236,11 +2726,137 @@ static int check_writev_return_flags(uint64_t flags, uint16_t iovcnt) {
 	/* write()-functions must not be used as a replacement for remove */
 	if (flags & BLOB_DISK_CTL_REMOVE)
 		return -ENOTSUP;
+	/* Transaction flags are internal to eblob_write_atomic() */
+	if (flags & BLOB_DISK_CTL_TXN_MASK)
+		return -EINVAL;
 	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
 		return -E2BIG;
 	return 0;
 }
 
+/**
+ * eblob_write_buffered() - writes new copy of small record @key through
+ * EBLOB_WRITE_BUFFER. Place for it is reserved in the open base as
+ * eblob_write_prepare_disk() does, but header, data, footer and index entry
+ * are staged in the buffer at once instead of being written one by one.
+ */
+static int eblob_write_buffered(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc, const struct eblob_iovec *iov, uint16_t iovcnt,
+		struct eblob_ram_control *old)
+{
+	struct eblob_base_ctl *ctl = NULL;
+	struct eblob_disk_control dc;
+	struct eblob_disk_footer *f = NULL;
+	uint64_t start;
+	char *record;
+	uint16_t i;
+	int err;
+
+	wc->offset = 0;
+	wc->on_disk = 0;
+	wc->total_data_size = wc->size;
+	wc->total_size = eblob_calculate_size(b, 0, wc->size);
+
+	/* Whole disk image is built outside of locks */
+	record = calloc(1, wc->total_size);
+	if (record == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < iovcnt; ++i)
+		memcpy(record + sizeof(struct eblob_disk_control) + iov[i].offset,
+				iov[i].base, iov[i].size);
+
+	if (!(b->cfg.blob_flags & EBLOB_NO_FOOTER)) {
+		f = (struct eblob_disk_footer *)(record + wc->total_size - sizeof(struct eblob_disk_footer));
+		if (!(wc->flags & BLOB_DISK_CTL_NOCSUM))
+			eblob_hash(b, f->csum, sizeof(f->csum),
+					record + sizeof(struct eblob_disk_control), wc->total_data_size);
+	}
+
+	err = eblob_admission_check(b);
+	if (err)
+		goto err_out_free;
+
+	err = eblob_space_reserve(b, wc->total_size);
+	if (err)
+		goto err_out_free;
+
+	start = eblob_admission_start();
+	pthread_mutex_lock(&b->lock);
+
+	err = eblob_get_writable_base(b, 1, &ctl);
+	if (err)
+		goto err_out_release;
+
+	/* Check that bctl is still valid */
+	if (old != NULL && old->bctl->index_fd == -1) {
+		err = -EAGAIN;
+		goto err_out_release;
+	}
+
+	wc->data_fd = ctl->data_fd;
+	wc->index_fd = ctl->index_fd;
+	wc->index = ctl->index;
+	wc->ctl_index_offset = ctl->index_size;
+	wc->ctl_data_offset = ctl->data_offset;
+	wc->data_offset = wc->ctl_data_offset + sizeof(struct eblob_disk_control);
+	wc->bctl = ctl;
+
+	eblob_wc_to_dc(key, wc, &dc);
+	memcpy(record, &dc, sizeof(dc));
+	if (f != NULL) {
+		f->offset = wc->ctl_data_offset;
+		eblob_convert_disk_footer(f);
+	}
+
+	err = eblob_wbuf_append(b, wc, record, &dc);
+	if (err)
+		goto err_out_release;
+
+	ctl->data_offset += wc->total_size;
+	ctl->index_size += sizeof(struct eblob_disk_control);
+
+	eblob_stat_add(ctl->stat, EBLOB_LST_BASE_SIZE,
+			wc->total_size + sizeof(struct eblob_disk_control));
+	eblob_stat_inc(ctl->stat, EBLOB_LST_RECORDS_TOTAL);
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_LOGICAL, wc->size);
+
+	err = eblob_commit_ram(b, key, wc);
+	if (err)
+		goto err_out_unlock;
+
+	if (old != NULL) {
+		pthread_mutex_lock(&old->bctl->lock);
+		err = eblob_mark_entry_removed(b, key, old);
+		pthread_mutex_unlock(&old->bctl->lock);
+		if (err != 0) {
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
+					"%s: %s: eblob_mark_entry_removed: %d\n",
+					__func__, eblob_dump_id(key->id), -err);
+			goto err_out_unlock;
+		}
+		eblob_hotkey_update(b, key);
+	}
+
+	pthread_mutex_unlock(&b->lock);
+	eblob_admission_account(b, start);
+
+	eblob_dump_wc(b, key, wc, "eblob_write_buffered: complete", 0);
+	free(record);
+	return 0;
+
+err_out_release:
+	pthread_mutex_unlock(&b->lock);
+	eblob_space_release(b, wc->total_size);
+	free(record);
+	return err;
+err_out_unlock:
+	pthread_mutex_unlock(&b->lock);
+err_out_free:
+	free(record);
+	return err;
+}
+
 /*!
  * Writes \a iovcnt number of iovecs to the key and returns information in \a wc
  */
@@ -2253,7 +2869,7 @@ int eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
 	struct eblob_iovec_bounds bounds;
 	struct eblob_ram_control old;
 	enum eblob_copy_flavour copy = EBLOB_DONT_COPY_RECORD;
-	uint64_t copy_offset = 0;
+	uint64_t copy_offset = 0, start;
 	int err;
 
 	if (b == NULL || key == NULL || iov == NULL || wc == NULL)
@@ -2268,12 +2884,27 @@ int eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
 	memset(wc, 0, sizeof(struct eblob_write_control));
 	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
 	wc->size = bounds.max;
-	wc->flags = flags;
+	wc->flags = flags & ~BLOB_DISK_CTL_NEW;
 	if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
 		wc->flags |= BLOB_DISK_CTL_NOCSUM;
 	wc->index = -1;
 
-	err = eblob_try_overwritev(b, key, iov, iovcnt, wc, &old);
+	if (flags & BLOB_DISK_CTL_NEW) {
+#ifndef NDEBUG
+		/* Catch misuse of blind writes in debug builds */
+		if (eblob_cache_lookup(b, key, &old, NULL) == 0) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR,
+					"%s: blind write of existing key", eblob_dump_id(key->id));
+			err = -EEXIST;
+			goto err_out_exit;
+		}
+#endif
+		/* Key is new - skip overwrite detection and old record removal */
+		err = -ENOENT;
+	} else {
+		err = eblob_try_overwritev(b, key, iov, iovcnt, wc, &old);
+	}
+
 	if (err == 0) {
 		/* We have overwritten old data - bail out */
 		goto err_out_exit;
@@ -2309,15 +2940,25 @@ int eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
 
 		/* overwrite can modify offset and flags */
 		wc->offset = 0;
-		wc->flags = flags;
+		wc->flags = flags & ~BLOB_DISK_CTL_NEW;
 		if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
 			wc->flags |= BLOB_DISK_CTL_NOCSUM;
 	}
 
+	/* New copy of small record that does not reuse old one can be buffered */
+	if (copy == EBLOB_DONT_COPY_RECORD && !(wc->flags & BLOB_DISK_CTL_APPEND)
+			&& eblob_wbuf_fits(b, eblob_calculate_size(b, 0, wc->size))) {
+		err = eblob_write_buffered(b, key, wc, iov, iovcnt, err == -ENOENT ? NULL : &old);
+		if (err)
+			goto err_out_exit;
+		goto out_written;
+	}
+
 	err = eblob_write_prepare_disk(b, key, wc, 0, copy, copy_offset, err == -ENOENT ? NULL : &old);
 	if (err)
 		goto err_out_exit;
 
+	start = eblob_admission_start();
 	err = eblob_writev_raw(key, wc, iov, iovcnt);
 	if (err) {
 		eblob_dump_wc(b, key, wc, "eblob_writev: eblob_writev_raw: FAILED", err);
@@ -2329,6 +2970,11 @@ int eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
 		eblob_dump_wc(b, key, wc, "eblob_writev: eblob_write_commit_nolock: FAILED", err);
 		goto err_out_exit;
 	}
+	eblob_admission_account(b, start);
+
+out_written:
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITES_NUMBER);
+	eblob_stat_add(b->stat, EBLOB_GST_WRITES_SIZE, wc->size);
 
 err_out_exit:
 	eblob_dump_wc(b, key, wc, "eblob_writev: finished", err);
@@ -2337,18 +2983,262 @@ err_out_exit:
 }
 
 /**
- * eblob_remove() - remove entry from backend
+ * eblob_write_atomic() - writes @n records as single unit.
+ *
+ * All records are reserved at once in the last base, so their index entries
+ * are consecutive. Payloads are written and synced first, then TXN_COMMIT is
+ * set on the last entry - this single write is the commit point. Until then
+ * base is held, so neither iterators nor data-sort can see half-written batch,
+ * and after crash eblob_txn_recover() drops batches without commit mark.
+ * Records become visible in RAM index at once under hash lock and only
+ * after that old versions of keys are removed.
  */
-int eblob_remove(struct eblob_backend *b, struct eblob_key *key)
+int eblob_write_atomic(struct eblob_backend *b, struct eblob_write_record *records, uint32_t n)
 {
-	react_start_action(ACTION_EBLOB_REMOVE);
-	struct eblob_ram_control ctl;
-	int err, disk;
+	struct eblob_write_control *wc;
+	struct eblob_ram_control *old, rctl;
+	struct eblob_base_ctl *bctl = NULL;
+	uint64_t total_size = 0;
+	uint32_t i, j, held = 0;
+	int err, err_ram = 0;
+
+	if (b == NULL || records == NULL || n == 0)
+		return -EINVAL;
+	if (n > EBLOB_WRITE_ATOMIC_MAX)
+		return -E2BIG;
 
-	err = eblob_cache_lookup(b, key, &ctl, &disk);
-	if (err) {
-		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: %s: %s: eblob_cache_lookup: %d.\n",
-				eblob_dump_id(key->id), __func__, err);
+	for (i = 0; i < n; ++i) {
+		err = check_writev_return_flags(records[i].flags, EBLOB_IOVCNT_MIN);
+		if (err)
+			return err;
+		if (records[i].flags & BLOB_DISK_CTL_APPEND)
+			return -ENOTSUP;
+		if (records[i].data == NULL && records[i].size != 0)
+			return -EINVAL;
+		for (j = 0; j < i; ++j)
+			if (eblob_id_cmp(records[i].key.id, records[j].key.id) == 0)
+				return -EINVAL;
+	}
+
+	wc = calloc(n, sizeof(struct eblob_write_control));
+	if (wc == NULL) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	old = calloc(n, sizeof(struct eblob_ram_control));
+	if (old == NULL) {
+		err = -ENOMEM;
+		goto err_out_free_wc;
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (!(records[i].flags & BLOB_DISK_CTL_NEW)) {
+			err = eblob_cache_lookup(b, &records[i].key, &old[i], NULL);
+			if (err == -ENOENT)
+				memset(&old[i], 0, sizeof(struct eblob_ram_control));
+			else if (err)
+				goto err_out_free_old;
+		}
+
+		wc[i].index = -1;
+		wc[i].size = records[i].size;
+		wc[i].flags = (records[i].flags & ~BLOB_DISK_CTL_NEW) | BLOB_DISK_CTL_TXN;
+		if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
+			wc[i].flags |= BLOB_DISK_CTL_NOCSUM;
+		if (i == n - 1)
+			wc[i].flags |= BLOB_DISK_CTL_TXN_LAST;
+		wc[i].total_data_size = wc[i].size;
+		wc[i].total_size = eblob_calculate_size(b, 0, wc[i].size);
+		total_size += wc[i].total_size;
+	}
+
+	err = eblob_admission_check(b);
+	if (err)
+		goto err_out_free_old;
+
+	err = eblob_space_reserve(b, total_size);
+	if (err)
+		goto err_out_free_old;
+
+	pthread_mutex_lock(&b->lock);
+
+	/* Old records must stay where they are until they are removed */
+	for (held = 0; held < n; ++held) {
+		if (old[held].bctl == NULL)
+			continue;
+		if (old[held].bctl->index_fd == -1) {
+			pthread_mutex_unlock(&b->lock);
+			err = -EAGAIN;
+			goto err_out_release_old;
+		}
+		eblob_bctl_hold(old[held].bctl);
+	}
+
+	err = eblob_get_writable_base(b, n, &bctl);
+	if (err == 0)
+		err = eblob_wbuf_flush(b);
+	if (err) {
+		pthread_mutex_unlock(&b->lock);
+		goto err_out_release_old;
+	}
+
+	for (i = 0; i < n; ++i) {
+		wc[i].data_fd = bctl->data_fd;
+		wc[i].index_fd = bctl->index_fd;
+		wc[i].index = bctl->index;
+		wc[i].bctl = bctl;
+		wc[i].ctl_index_offset = bctl->index_size + i * sizeof(struct eblob_disk_control);
+		wc[i].ctl_data_offset = bctl->data_offset;
+		wc[i].data_offset = wc[i].ctl_data_offset + sizeof(struct eblob_disk_control);
+
+		bctl->data_offset += wc[i].total_size;
+
+		err = eblob_commit_disk_ll(b, &records[i].key, &wc[i]);
+		if (err) {
+			bctl->data_offset = wc[0].ctl_data_offset;
+			pthread_mutex_unlock(&b->lock);
+			goto err_out_release_old;
+		}
+	}
+	bctl->index_size += n * sizeof(struct eblob_disk_control);
+
+	for (i = 0; i < n; ++i) {
+		eblob_stat_add(bctl->stat, EBLOB_LST_BASE_SIZE,
+				wc[i].total_size + sizeof(struct eblob_disk_control));
+		eblob_stat_inc(bctl->stat, EBLOB_LST_RECORDS_TOTAL);
+	}
+
+	eblob_bctl_hold(bctl);
+	pthread_mutex_unlock(&b->lock);
+
+	for (i = 0; i < n; ++i) {
+		const struct eblob_iovec iov = {
+			.base = records[i].data,
+			.size = records[i].size,
+			.offset = 0,
+		};
+
+		err = eblob_writev_raw(&records[i].key, &wc[i], &iov, 1);
+		if (err) {
+			eblob_dump_wc(b, &records[i].key, &wc[i], "eblob_write_atomic: eblob_writev_raw: FAILED", err);
+			goto err_out_abort;
+		}
+
+		err = eblob_write_commit_footer_ll(b, &records[i].key, &wc[i]);
+		if (err) {
+			eblob_dump_wc(b, &records[i].key, &wc[i], "eblob_write_atomic: eblob_write_commit_footer_ll: FAILED", err);
+			goto err_out_abort;
+		}
+	}
+
+	/*
+	 * Barrier: whole batch must be on disk before commit mark, regardless
+	 * of sync settings, otherwise recovery may accept torn batch.
+	 */
+	err = eblob_fdatasync(bctl->data_fd);
+	if (err)
+		goto err_out_abort;
+	err = eblob_fdatasync(bctl->index_fd);
+	if (err)
+		goto err_out_abort;
+
+	err = eblob_write_index_flags(bctl->index_fd, wc[n - 1].ctl_index_offset,
+			wc[n - 1].flags | BLOB_DISK_CTL_TXN_COMMIT);
+	if (err)
+		goto err_out_abort;
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_INDEX, sizeof(uint64_t));
+
+	if (!b->cfg.sync)
+		eblob_fdatasync(bctl->index_fd);
+
+	/*
+	 * Batch is committed, so there is no way back. Transaction flags are
+	 * cleared in index order - recovery relies on it.
+	 */
+	for (i = 0; i < n; ++i) {
+		wc[i].flags &= ~BLOB_DISK_CTL_TXN_MASK;
+		err = eblob_commit_disk_ll(b, &records[i].key, &wc[i]);
+		if (err)
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+					"%s: eblob_write_atomic: clearing transaction flags: FAILED",
+					eblob_dump_id(records[i].key.id));
+	}
+
+	pthread_rwlock_wrlock(&b->root->hash.root_lock);
+	for (i = 0; i < n; ++i) {
+		eblob_wc_to_rctl(&wc[i], &rctl);
+		err = eblob_cache_insert_nolock(b, &records[i].key, &rctl);
+		if (err) {
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+					"%s: eblob_write_atomic: eblob_cache_insert_nolock: FAILED",
+					eblob_dump_id(records[i].key.id));
+			err_ram = err;
+		}
+	}
+	pthread_rwlock_unlock(&b->root->hash.root_lock);
+
+	eblob_bctl_release(bctl);
+
+	for (i = 0; i < n; ++i) {
+		if (old[i].bctl == NULL)
+			continue;
+
+		pthread_mutex_lock(&old[i].bctl->lock);
+		err = eblob_mark_entry_removed(b, &records[i].key, &old[i]);
+		pthread_mutex_unlock(&old[i].bctl->lock);
+		if (err)
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+					"%s: eblob_write_atomic: eblob_mark_entry_removed: FAILED",
+					eblob_dump_id(records[i].key.id));
+		eblob_bctl_release(old[i].bctl);
+	}
+
+	for (i = 0; i < n; ++i) {
+		eblob_stat_inc(b->stat, EBLOB_GST_WRITES_NUMBER);
+		eblob_stat_add(b->stat, EBLOB_GST_WRITES_SIZE, wc[i].size);
+	}
+
+	free(old);
+	free(wc);
+	return err_ram;
+
+err_out_abort:
+	for (i = 0; i < n; ++i) {
+		eblob_mark_index_removed(bctl->index_fd, wc[i].ctl_index_offset);
+		eblob_mark_index_removed(bctl->data_fd, wc[i].ctl_data_offset);
+		eblob_stat_inc(bctl->stat, EBLOB_LST_RECORDS_REMOVED);
+		eblob_stat_add(bctl->stat, EBLOB_LST_REMOVED_SIZE, wc[i].total_data_size);
+	}
+	eblob_bctl_release(bctl);
+	/* Aborted records keep their space on disk */
+	total_size = 0;
+err_out_release_old:
+	for (i = 0; i < held; ++i)
+		if (old[i].bctl != NULL)
+			eblob_bctl_release(old[i].bctl);
+	eblob_space_release(b, total_size);
+err_out_free_old:
+	free(old);
+err_out_free_wc:
+	free(wc);
+err_out_exit:
+	return err;
+}
+
+/**
+ * eblob_remove() - remove entry from backend
+ */
+int eblob_remove(struct eblob_backend *b, struct eblob_key *key)
+{
+	react_start_action(ACTION_EBLOB_REMOVE);
+	struct eblob_ram_control ctl;
+	int err, disk;
+
+	err = eblob_cache_lookup(b, key, &ctl, &disk);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: %s: %s: eblob_cache_lookup: %d.\n",
+				eblob_dump_id(key->id), __func__, err);
 		goto err_out_exit;
 	}
 
@@ -2369,17 +3259,45 @@ err_out_exit:
 	return err;
 }
 
+/**
+ * eblob_mapped_hold() - returns pointer to @size bytes at @offset of data
+ * file of @wc inside mapping of its base that eblob_base_setup_data() keeps
+ * for the whole base, and holds the base, so that mapping is not replaced
+ * while caller reads it. Caller should release wc->bctl afterwards.
+ *
+ * Returns NULL if data is not mapped: record was written to open base after
+ * it was mapped, base was replaced by data-sort or closed with
+ * EBLOB_LAZY_BASES.
+ */
+static void *eblob_mapped_hold(struct eblob_write_control *wc, uint64_t offset, uint64_t size)
+{
+	struct eblob_base_ctl *bctl = wc->bctl;
+
+	if (bctl == NULL)
+		return NULL;
+
+	eblob_bctl_hold(bctl);
+	if (bctl->data == NULL || bctl->data_fd != wc->data_fd
+			|| offset > bctl->data_size || size > bctl->data_size - offset) {
+		eblob_bctl_release(bctl);
+		return NULL;
+	}
+
+	return bctl->data + offset;
+}
+
 /**
  * eblob_csum_ok() - verifies checksum of entry pointed by @wc.
- * If entry is bigger than alloc_size - mmap(2) it, otherwise malloc
+ * Entry is read through existing mapping of its base if possible. Otherwise
+ * if entry is bigger than alloc_size - mmap(2) it, otherwise malloc
  * space for it.
  */
-static int eblob_csum_ok(struct eblob_backend *b, struct eblob_write_control *wc)
+static int eblob_csum_ok(struct eblob_backend *b, struct eblob_write_control *wc, int nowait)
 {
 	struct eblob_disk_footer *f;
 	unsigned char csum[EBLOB_ID_SIZE];
 	struct eblob_map_fd m;
-	void *adata = NULL;
+	void *adata = NULL, *mapped = NULL;
 	int err;
 
 	if (wc->total_size < sizeof(struct eblob_disk_footer)
@@ -2407,9 +3325,12 @@ static int eblob_csum_ok(struct eblob_backend *b, struct eblob_write_control *wc
 	m.size = wc->total_size;
 	m.offset = wc->ctl_data_offset;
 
-	/* If record is big - mmap it, otherwise alloc in heap */
-	if (m.size > EBLOB_1_M) {
-		/* TODO: Here we can use existing data mapping in case of closed blob */
+	/* Use mapping of the base if record is inside it, accessing it may block */
+	mapped = nowait ? NULL : eblob_mapped_hold(wc, m.offset, m.size);
+	if (mapped != NULL) {
+		m.data = mapped;
+	} else if (m.size > EBLOB_1_M && !nowait) {
+		/* If record is big - mmap it, otherwise alloc in heap */
 		err = eblob_data_map(&m);
 		if (err)
 			goto err_out_exit;
@@ -2420,7 +3341,10 @@ static int eblob_csum_ok(struct eblob_backend *b, struct eblob_write_control *wc
 			goto err_out_unmap;
 		}
 
-		err = __eblob_read_ll(wc->data_fd, adata, m.size, wc->ctl_data_offset);
+		if (nowait)
+			err = __eblob_read_nowait_ll(wc->data_fd, adata, m.size, wc->ctl_data_offset);
+		else
+			err = __eblob_read_ll(wc->data_fd, adata, m.size, wc->ctl_data_offset);
 		if (err)
 			goto err_out_unmap;
 		m.data = adata;
@@ -2443,7 +3367,9 @@ static int eblob_csum_ok(struct eblob_backend *b, struct eblob_write_control *wc
 	err = 0;
 
 err_out_unmap:
-	if (adata)
+	if (mapped)
+		eblob_bctl_release(wc->bctl);
+	else if (adata)
 		free(adata);
 	else
 		eblob_data_unmap(&m);
@@ -2454,9 +3380,13 @@ err_out_exit:
 /**
  * _eblob_read_ll() - returns @fd, @offset and @size of data for given key.
  * Caller should the read data manually.
+ * On success wc->bctl is held, so that its fds are not closed by lazy close
+ * or replaced by data-sort. Caller should release it after use.
+ * @nowait:	checksum is verified only if record is in page cache,
+ *		-EAGAIN is returned otherwise
  */
 static int _eblob_read_ll(struct eblob_backend *b, struct eblob_key *key,
-		enum eblob_read_flavour csum, struct eblob_write_control *wc)
+		enum eblob_read_flavour csum, struct eblob_write_control *wc, int nowait)
 {
 	int err;
 	struct timeval start, end;
@@ -2468,6 +3398,7 @@ static int _eblob_read_ll(struct eblob_backend *b, struct eblob_key *key,
 
 	eblob_stat_inc(b->stat, EBLOB_GST_LOOKUP_READS_NUMBER);
 
+again:
 	memset(wc, 0, sizeof(struct eblob_write_control));
 	err = eblob_fill_write_control_from_ram(b, key, wc, 0, NULL);
 	if (err < 0) {
@@ -2477,18 +3408,27 @@ static int _eblob_read_ll(struct eblob_backend *b, struct eblob_key *key,
 		goto err_out_exit;
 	}
 
+	/* Base could be closed or replaced since lookup, look it up once more */
+	eblob_bctl_hold(wc->bctl);
+	if (wc->bctl->data_fd != wc->data_fd) {
+		eblob_bctl_release(wc->bctl);
+		goto again;
+	}
+
 	if (wc->flags & BLOB_DISK_CTL_COMPRESS) {
 		err = -ENOTSUP;
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
 	gettimeofday(&start, NULL);
 
 	if ((csum != EBLOB_READ_NOCSUM) && !(b->cfg.blob_flags & EBLOB_NO_FOOTER)) {
-		err = eblob_csum_ok(b, wc);
+		err = eblob_csum_ok(b, wc, nowait);
+		if (err == -EAGAIN && nowait)
+			goto err_out_release;
 		if (err) {
 			eblob_dump_wc(b, key, wc, "_eblob_read_ll: checksum verification failed", err);
-			goto err_out_exit;
+			goto err_out_release;
 		}
 	}
 
@@ -2502,7 +3442,10 @@ static int _eblob_read_ll(struct eblob_backend *b, struct eblob_key *key,
 			eblob_dump_id(key->id), wc->data_fd, wc->ctl_data_offset, wc->data_offset,
 			wc->index_fd, wc->ctl_index_offset, wc->size, wc->total_size, wc->on_disk,
 			csum, csum_time, err);
+	return 0;
 
+err_out_release:
+	eblob_bctl_release(wc->bctl);
 err_out_exit:
 	return err;
 }
@@ -2521,10 +3464,14 @@ static int eblob_read_ll(struct eblob_backend *b, struct eblob_key *key, int *fd
 	if (b == NULL || key == NULL || fd == NULL || offset == NULL || size == NULL)
 		return -EINVAL;
 
-	err = _eblob_read_ll(b, key, csum, &wc);
+	err = _eblob_read_ll(b, key, csum, &wc, 0);
 	if (err < 0)
 		goto err;
 
+	/* Caller uses fd after we return */
+	eblob_lazy_pin(wc.bctl);
+	eblob_bctl_release(wc.bctl);
+
 	*fd = wc.data_fd;
 	*size = wc.size;
 	*offset = wc.data_offset;
@@ -2548,10 +3495,19 @@ int eblob_read_nocsum(struct eblob_backend *b, struct eblob_key *key,
 int eblob_read_return(struct eblob_backend *b, struct eblob_key *key,
 		enum eblob_read_flavour csum, struct eblob_write_control *wc)
 {
+	int err;
+
 	if (b == NULL || key == NULL || wc == NULL)
 		return -EINVAL;
 
-	return _eblob_read_ll(b, key, csum, wc);
+	err = _eblob_read_ll(b, key, csum, wc, 0);
+	if (err < 0)
+		return err;
+
+	/* Caller uses fds after we return */
+	eblob_lazy_pin(wc->bctl);
+	eblob_bctl_release(wc->bctl);
+	return err;
 }
 
 /**
@@ -2586,6 +3542,48 @@ void eblob_data_unmap(struct eblob_map_fd *map)
 	}
 }
 
+/**
+ * eblob_read_buffered() - reads record @key if it is still in
+ * EBLOB_WRITE_BUFFER, returns -ENOENT otherwise.
+ */
+static int eblob_read_buffered(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t offset, char **dst, uint64_t *size)
+{
+	struct eblob_ram_control rctl;
+	uint64_t record_size;
+	void *data;
+	int err;
+
+	if (b->wbuf_data == NULL)
+		return -ENOENT;
+
+	err = eblob_cache_lookup(b, key, &rctl, NULL);
+	if (err != 0 || rctl.bctl != b->wbuf_bctl || offset >= rctl.size)
+		return -ENOENT;
+
+	record_size = rctl.size - offset;
+	if (*size && record_size > *size)
+		record_size = *size;
+
+	data = malloc(record_size);
+	if (!data)
+		return -ENOMEM;
+
+	err = eblob_wbuf_read(b, &rctl, sizeof(struct eblob_disk_control) + offset, data, record_size);
+	if (err) {
+		free(data);
+		return err;
+	}
+
+	eblob_stat_inc(b->stat, EBLOB_GST_LOOKUP_READS_NUMBER);
+	eblob_stat_inc(b->stat, EBLOB_GST_DATA_READS_NUMBER);
+	eblob_stat_add(b->stat, EBLOB_GST_READS_SIZE, record_size);
+
+	*size = record_size;
+	*dst = data;
+	return 0;
+}
+
 /**
  * eblob_read_data_ll() - unlike eblob_read it mmaps data, reads it
  * adjusting @dst pointer;
@@ -2593,22 +3591,32 @@ void eblob_data_unmap(struct eblob_map_fd *map)
  * @offset:	offset inside record
  * @dst:	pointer to destination pointer
  * @size:	pointer to store size of data, also constraint to read size
+ * @nowait:	read only data that is in page cache, -EAGAIN otherwise
  */
 static int eblob_read_data_ll(struct eblob_backend *b, struct eblob_key *key,
-		uint64_t offset, char **dst, uint64_t *size, enum eblob_read_flavour csum)
+		uint64_t offset, char **dst, uint64_t *size, enum eblob_read_flavour csum, int nowait)
 {
 	react_start_action(ACTION_EBLOB_READ_DATA);
-	int err, fd;
-	void *data;
+	struct eblob_write_control wc;
+	int err;
+	void *data, *mapped;
 	uint64_t record_offset, record_size;
 
-	err = eblob_read_ll(b, key, &fd, &record_offset, &record_size, csum);
+	/* Buffered data was checksummed by us, so there is nothing to verify */
+	err = eblob_read_buffered(b, key, offset, dst, size);
+	if (err != -ENOENT)
+		goto err_out_exit;
+
+	err = _eblob_read_ll(b, key, csum, &wc, nowait);
 	if (err < 0)
 		goto err_out_exit;
 
+	record_offset = wc.data_offset;
+	record_size = wc.size;
+
 	if (offset >= record_size) {
 		err = -E2BIG;
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
 	record_offset += offset;
@@ -2620,12 +3628,24 @@ static int eblob_read_data_ll(struct eblob_backend *b, struct eblob_key *key,
 	data = malloc(record_size);
 	if (!data) {
 		err = -ENOMEM;
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
-	err = __eblob_read_ll(fd, data, record_size, record_offset);
-	if (err != 0)
-		goto err_out_free;
+	/* Copy from mapping of the base, so that no syscall is needed */
+	mapped = nowait ? NULL : eblob_mapped_hold(&wc, record_offset, record_size);
+	if (mapped != NULL) {
+		memcpy(data, mapped, record_size);
+		eblob_bctl_release(wc.bctl);
+	} else if (nowait) {
+		err = __eblob_read_nowait_ll(wc.data_fd, data, record_size, record_offset);
+		if (err != 0)
+			goto err_out_free;
+	} else {
+		err = __eblob_read_ll(wc.data_fd, data, record_size, record_offset);
+		if (err != 0)
+			goto err_out_free;
+	}
+	eblob_bctl_release(wc.bctl);
 
 	eblob_stat_inc(b->stat, EBLOB_GST_DATA_READS_NUMBER);
 	eblob_stat_add(b->stat, EBLOB_GST_READS_SIZE, record_size);
@@ -2638,6 +3658,8 @@ static int eblob_read_data_ll(struct eblob_backend *b, struct eblob_key *key,
 
 err_out_free:
 	free(data);
+err_out_release:
+	eblob_bctl_release(wc.bctl);
 err_out_exit:
 	react_stop_action(ACTION_EBLOB_READ_DATA);
 	return err;
@@ -2645,30 +3667,31 @@ err_out_exit:
 
 int eblob_read_data(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, char **dst, uint64_t *size)
 {
-	return eblob_read_data_ll(b, key, offset, dst, size, EBLOB_READ_CSUM);
+	return eblob_read_data_ll(b, key, offset, dst, size, EBLOB_READ_CSUM, 0);
 }
 
 int eblob_read_data_nocsum(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, char **dst, uint64_t *size)
 {
-	return eblob_read_data_ll(b, key, offset, dst, size, EBLOB_READ_NOCSUM);
+	return eblob_read_data_ll(b, key, offset, dst, size, EBLOB_READ_NOCSUM, 0);
 }
 
-
-/**
- * eblob_sync_thread() - sync thread.
- * Ones in a while syncs all bases of current blob to disk.
- */
-static void *eblob_sync_thread(void *data)
+int eblob_read_data_nowait(struct eblob_backend *b, struct eblob_key *key,
+		enum eblob_read_flavour csum, uint64_t offset, char **dst, uint64_t *size)
 {
-	struct eblob_backend *b = data;
+	int err;
 
-	while (b->cfg.sync && (eblob_event_wait(&b->exit_event, b->cfg.sync) == -ETIMEDOUT)) {
-		eblob_sync(b);
-	}
+	if (b == NULL || key == NULL || dst == NULL || size == NULL)
+		return -EINVAL;
 
-	return NULL;
+	err = eblob_read_data_ll(b, key, offset, dst, size, csum, 1);
+	if (err == 0)
+		eblob_stat_inc(b->stat, EBLOB_GST_READ_NOWAIT_HITS);
+	else if (err == -EAGAIN)
+		eblob_stat_inc(b->stat, EBLOB_GST_READ_NOWAIT_MISSES);
+	return err;
 }
 
+
 /**
  * eblob_sync() - sync (blocking call, synchronized)
  * Syncs all bases of current blob to disk.
@@ -2676,6 +3699,11 @@ static void *eblob_sync_thread(void *data)
 int eblob_sync(struct eblob_backend *b)
 {
 	struct eblob_base_ctl *ctl;
+	int err;
+
+	err = eblob_wbuf_flush(b);
+	if (err != 0)
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "eblob_wbuf_flush: FAILED");
 
 	pthread_mutex_lock(&b->sync_lock);
 
@@ -2689,47 +3717,48 @@ int eblob_sync(struct eblob_backend *b)
 	return 0;
 }
 
-/*!
- * Cache vfs statistics
+/**
+ * eblob_start_tasks() - registers background tasks of @b (sync, statistics
+ * and free space updates, write pressure updates, defrag) in process-wide
+ * scheduler.
  */
-static int eblob_cache_statvfs(struct eblob_backend *b)
+int eblob_start_tasks(struct eblob_backend *b)
 {
-	char dir_base[PATH_MAX], *tmp;
-
-	if (b == NULL || b->cfg.file == NULL)
-		return -EINVAL;
+	int err;
 
-	/* TODO: It's waste of CPU to do it every iteration */
-	if (snprintf(dir_base, PATH_MAX, "%s", b->cfg.file) >= PATH_MAX)
-		return -ENAMETOOLONG;
+	if (b->cfg.blob_flags & EBLOB_DISABLE_THREADS)
+		return 0;
 
-	/* TODO: Create eblob_dirname function */
-	tmp = strrchr(dir_base, '/');
-	if (tmp != NULL)
-		*tmp = '\0';
+	if (b->cfg.sync > 0) {
+		err = eblob_scheduler_add(b, EBLOB_TASK_SYNC, eblob_sync, b->cfg.sync * 1000ULL, 0);
+		if (err != 0)
+			goto err_out_cancel;
+	}
 
-	if (statvfs(dir_base, &b->vfs_stat) == -1)
-		return -errno;
+	err = eblob_scheduler_add(b, EBLOB_TASK_PERIODIC, eblob_periodic, 30 * 1000, 0);
+	if (err != 0)
+		goto err_out_cancel;
 
-	return 0;
-}
+	err = eblob_scheduler_add(b, EBLOB_TASK_PERIODIC, eblob_admission_update, 1000, 0);
+	if (err != 0)
+		goto err_out_cancel;
 
-/**
- * This is thread for various periodic tasks e.g: statistics update and free
- * space calculations.
- *
- * TODO: We can generalize periodic thread to be simple task scheduler that
- * pulls taks of the queue and executes it.
- */
-static void *eblob_periodic_thread(void *data)
-{
-	struct eblob_backend *b = data;
+	err = eblob_scheduler_add(b, EBLOB_TASK_DEFRAG, eblob_defrag_tick, 1000, 1);
+	if (err != 0)
+		goto err_out_cancel;
 
-	while (eblob_event_wait(&b->exit_event, 30) == -ETIMEDOUT) {
-		eblob_periodic(b);
+	if (b->wbuf_data != NULL) {
+		err = eblob_scheduler_add(b, EBLOB_TASK_SYNC, eblob_wbuf_tick,
+				b->cfg.write_buffer_timeout, 0);
+		if (err != 0)
+			goto err_out_cancel;
 	}
 
-	return NULL;
+	return 0;
+
+err_out_cancel:
+	eblob_scheduler_cancel(b);
+	return err;
 }
 
 /**
@@ -2745,32 +3774,96 @@ int eblob_periodic(struct eblob_backend *b)
 		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
 		"eblob_stat_commit: FAILED");
 
+	eblob_autosize_update(b);
+	eblob_lazy_evict(b);
+	eblob_summary_balance(b);
+
 	if (!(b->cfg.blob_flags & EBLOB_NO_FREE_SPACE_CHECK)) {
-		err = eblob_cache_statvfs(b);
+		err = eblob_space_update(b);
 		if (err != 0)
 			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
-			"eblob_cache_statvfs: FAILED");
+			"eblob_space_update: FAILED");
 	}
 
 	pthread_mutex_unlock(&b->periodic_lock);
 
+	/* Without threads pressure is only updated and buffer aged here */
+	if (b->cfg.blob_flags & EBLOB_DISABLE_THREADS) {
+		eblob_admission_update(b);
+		eblob_wbuf_tick(b);
+	}
+
 	return err;
 }
 
+/**
+ * eblob_namespace_close() - waits till background tasks of @ns are done,
+ * drops its entries from the cache and frees it.
+ */
+static void eblob_namespace_close(struct eblob_backend *ns)
+{
+	struct eblob_backend *b = ns->root;
+	uint64_t removed;
+
+	eblob_event_set(&ns->exit_event);
+	eblob_scheduler_cancel(ns);
+	eblob_read_pool_cleanup(ns);
+
+	pthread_mutex_lock(&b->ns_lock);
+	list_del(&ns->ns_entry);
+	pthread_mutex_unlock(&b->ns_lock);
+
+	pthread_rwlock_wrlock(&b->hash.root_lock);
+	removed = eblob_hash_remove_ns_nolock(&b->hash, ns->ns_id);
+	pthread_rwlock_unlock(&b->hash.root_lock);
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: namespace %s closed, cached entries dropped: %" PRIu64 "\n",
+			ns->cfg.file, removed);
+
+	eblob_wbuf_flush_sync(ns);
+	eblob_lazy_cleanup(ns);
+	eblob_bases_cleanup(ns);
+	eblob_wbuf_cleanup(ns);
+	pthread_mutex_destroy(&ns->lazy_lock);
+	eblob_event_destroy(&ns->exit_event);
+	eblob_space_detach(ns);
+	eblob_hotkey_cleanup(ns);
+
+	free(ns->cfg.file);
+
+	eblob_stat_destroy(ns->stat);
+	eblob_stat_destroy(ns->stat_summary);
+
+	free(ns);
+}
+
 void eblob_cleanup(struct eblob_backend *b)
 {
-	eblob_event_set(&b->exit_event);
+	struct eblob_backend *ns, *tmp;
 
-	if (!(b->cfg.blob_flags & EBLOB_DISABLE_THREADS)) {
-		pthread_join(b->sync_tid, NULL);
-		pthread_join(b->defrag_tid, NULL);
-		pthread_join(b->periodic_tid, NULL);
+	if (b->root != b) {
+		eblob_namespace_close(b);
+		return;
 	}
 
+	eblob_event_set(&b->exit_event);
+	eblob_scheduler_cancel(b);
+	eblob_read_pool_cleanup(b);
+
+	list_for_each_entry_safe(ns, tmp, &b->namespaces, ns_entry)
+		eblob_namespace_close(ns);
+	pthread_mutex_destroy(&b->ns_lock);
+
+	eblob_wbuf_flush_sync(b);
+	eblob_lazy_cleanup(b);
 	eblob_bases_cleanup(b);
+	eblob_wbuf_cleanup(b);
+	pthread_mutex_destroy(&b->lazy_lock);
 
 	eblob_hash_destroy(&b->hash);
 	eblob_l2hash_destroy(&b->l2hash);
+	eblob_space_detach(b);
+	eblob_hotkey_cleanup(b);
 
 	free(b->cfg.file);
 
@@ -2817,6 +3910,59 @@ static int eblob_lock_blob(struct eblob_backend *b)
 	return 0;
 }
 
+/**
+ * eblob_config_defaults() - replaces unset or invalid values of @c with
+ * defaults.
+ */
+static void eblob_config_defaults(struct eblob_config *c)
+{
+	if (!c->index_block_size)
+		c->index_block_size = EBLOB_INDEX_DEFAULT_BLOCK_SIZE;
+	if (!c->index_block_bloom_length)
+		c->index_block_bloom_length = EBLOB_INDEX_DEFAULT_BLOCK_BLOOM_LENGTH;
+	if (!c->blob_size)
+		c->blob_size = EBLOB_BLOB_DEFAULT_BLOB_SIZE;
+	if (!c->records_in_blob)
+		c->records_in_blob = EBLOB_BLOB_DEFAULT_RECORDS_IN_BLOB;
+	if (!c->defrag_timeout)
+		c->defrag_timeout = EBLOB_DEFAULT_DEFRAG_TIMEOUT;
+	if (!c->defrag_percentage || (c->defrag_percentage < 0) || (c->defrag_percentage > 100))
+		c->defrag_percentage = EBLOB_DEFAULT_DEFRAG_PERCENTAGE;
+	if ((c->defrag_time < 0 || c->defrag_time > 24)
+			|| (c->defrag_splay < 0 || c->defrag_time > 24)) {
+		c->defrag_time = EBLOB_DEFAULT_DEFRAG_TIME;
+		c->defrag_splay = EBLOB_DEFAULT_DEFRAG_SPLAY;
+	}
+	if (!c->blob_size_min)
+		c->blob_size_min = EBLOB_AUTO_DEFAULT_BLOB_SIZE_MIN;
+	if (c->blob_size_min > c->blob_size)
+		c->blob_size_min = c->blob_size;
+	if (!c->records_in_blob_min)
+		c->records_in_blob_min = EBLOB_AUTO_DEFAULT_RECORDS_IN_BLOB_MIN;
+	if (c->records_in_blob_min > c->records_in_blob)
+		c->records_in_blob_min = c->records_in_blob;
+	if (c->admission_max_delay <= 0)
+		c->admission_max_delay = EBLOB_DEFAULT_ADMISSION_MAX_DELAY;
+	if (c->admission_latency < 0)
+		c->admission_latency = 0;
+	if (c->defrag_idle_util <= 0 || c->defrag_idle_util > 100)
+		c->defrag_idle_util = EBLOB_DEFAULT_DEFRAG_IDLE_UTIL;
+	if (c->defrag_idle_ops <= 0)
+		c->defrag_idle_ops = EBLOB_DEFAULT_DEFRAG_IDLE_OPS;
+	if (c->defrag_idle_time <= 0)
+		c->defrag_idle_time = EBLOB_DEFAULT_DEFRAG_IDLE_TIME;
+	if (c->hot_key_updates <= 0 || c->hot_key_updates > UINT8_MAX)
+		c->hot_key_updates = EBLOB_DEFAULT_HOT_KEY_UPDATES;
+	if (c->max_open_bases == 0)
+		c->max_open_bases = EBLOB_DEFAULT_MAX_OPEN_BASES;
+	if (c->write_buffer_size == 0)
+		c->write_buffer_size = EBLOB_DEFAULT_WRITE_BUFFER_SIZE;
+	if (c->write_buffer_timeout == 0)
+		c->write_buffer_timeout = EBLOB_DEFAULT_WRITE_BUFFER_TIMEOUT;
+	if (c->read_threads == 0)
+		c->read_threads = EBLOB_DEFAULT_READ_THREADS;
+}
+
 struct eblob_backend *eblob_init(struct eblob_config *c)
 {
 	struct eblob_backend *b;
@@ -2848,25 +3994,10 @@ struct eblob_backend *eblob_init(struct eblob_config *c)
 		goto err_out_stat_free;
 	}
 
-	if (!c->index_block_size)
-		c->index_block_size = EBLOB_INDEX_DEFAULT_BLOCK_SIZE;
-	if (!c->index_block_bloom_length)
-		c->index_block_bloom_length = EBLOB_INDEX_DEFAULT_BLOCK_BLOOM_LENGTH;
-	if (!c->blob_size)
-		c->blob_size = EBLOB_BLOB_DEFAULT_BLOB_SIZE;
-	if (!c->records_in_blob)
-		c->records_in_blob = EBLOB_BLOB_DEFAULT_RECORDS_IN_BLOB;
-	if (!c->defrag_timeout)
-		c->defrag_timeout = EBLOB_DEFAULT_DEFRAG_TIMEOUT;
-	if (!c->defrag_percentage || (c->defrag_percentage < 0) || (c->defrag_percentage > 100))
-		c->defrag_percentage = EBLOB_DEFAULT_DEFRAG_PERCENTAGE;
-	if ((c->defrag_time < 0 || c->defrag_time > 24)
-			|| (c->defrag_splay < 0 || c->defrag_time > 24)) {
-		c->defrag_time = EBLOB_DEFAULT_DEFRAG_TIME;
-		c->defrag_splay = EBLOB_DEFAULT_DEFRAG_SPLAY;
-	}
+	eblob_config_defaults(c);
 
 	memcpy(&b->cfg, c, sizeof(struct eblob_config));
+	eblob_autosize_init(b);
 
 	b->cfg.file = strdup(c->file);
 	if (!b->cfg.file) {
@@ -2874,29 +4005,56 @@ struct eblob_backend *eblob_init(struct eblob_config *c)
 		goto err_out_stat_free_local;
 	}
 
+	err = eblob_hotkey_init(b);
+	if (err != 0) {
+		eblob_log(c->log, EBLOB_LOG_ERROR, "blob: eblob_hotkey_init failed: %s: %d.\n", strerror(-err), err);
+		goto err_out_free_file;
+	}
+
 	err = eblob_lock_blob(b);
 	if (err != 0) {
 		eblob_log(c->log, EBLOB_LOG_ERROR, "blob: eblob_lock_blob: FAILED: %s: %d.\n", strerror(-err), err);
-		goto err_out_free_file;
+		goto err_out_hotkey_cleanup;
 	}
 
-	err = eblob_cache_statvfs(b);
+	err = eblob_space_attach(b);
 	if (err != 0) {
-		eblob_log(c->log, EBLOB_LOG_ERROR, "blob: eblob_cache_statvfs failed: %s: %d.\n", strerror(-err), err);
+		eblob_log(c->log, EBLOB_LOG_ERROR, "blob: eblob_space_attach failed: %s: %d.\n", strerror(-err), err);
 		goto err_out_lockf;
 	}
 
 	err = eblob_mutex_init(&b->lock);
 	if (err != 0)
-		goto err_out_lockf;
+		goto err_out_space_detach;
 
 	INIT_LIST_HEAD(&b->bases);
 	b->max_index = -1;
 
+	b->root = b;
+	INIT_LIST_HEAD(&b->namespaces);
+
+	err = eblob_mutex_init(&b->ns_lock);
+	if (err != 0)
+		goto err_out_lock_destroy;
+
+	err = eblob_mutex_init(&b->lazy_lock);
+	if (err != 0)
+		goto err_out_ns_lock_destroy;
+
+	err = eblob_wbuf_init(b);
+	if (err != 0) {
+		eblob_log(c->log, EBLOB_LOG_ERROR, "blob: eblob_wbuf_init failed: %s: %d.\n", strerror(-err), err);
+		goto err_out_lazy_lock_destroy;
+	}
+
+	err = eblob_read_pool_init(b);
+	if (err != 0)
+		goto err_out_wbuf_cleanup;
+
 	err = eblob_l2hash_init(&b->l2hash);
 	if (err) {
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: l2hash initialization failed: %s %d.\n", strerror(-err), err);
-		goto err_out_lock_destroy;
+		goto err_out_read_pool_cleanup;
 	}
 
 	err = eblob_hash_init(&b->hash, sizeof(struct eblob_ram_control));
@@ -2911,6 +4069,7 @@ struct eblob_backend *eblob_init(struct eblob_config *c)
 		goto err_out_hash_destroy;
 	}
 	eblob_stat_summary_update(b);
+	eblob_autosize_update(b);
 
 	err = eblob_event_init(&b->exit_event);
 	if (err != 0)
@@ -2928,36 +4087,17 @@ struct eblob_backend *eblob_init(struct eblob_config *c)
 	if (err != 0)
 		goto err_out_sync_lock_destroy;
 
-	if (!(b->cfg.blob_flags & EBLOB_DISABLE_THREADS)) {
-
-		err = pthread_create(&b->sync_tid, NULL, eblob_sync_thread, b);
-		if (err) {
-			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: eblob sync thread creation failed: %d.\n", err);
-			goto err_out_periodic_lock_destroy;
-		}
-
-		err = pthread_create(&b->defrag_tid, NULL, eblob_defrag_thread, b);
-		if (err) {
-			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: eblob defrag thread creation failed: %d.\n", err);
-			goto err_out_join_sync;
-		}
-
-		err = pthread_create(&b->periodic_tid, NULL, eblob_periodic_thread, b);
-		if (err) {
-			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: eblob periodic thread creation failed: %d.\n", err);
-			goto err_out_join_defrag;
-		}
+	/* Close bases that could not be registered lazily if there are too many */
+	eblob_lazy_evict(b);
 
+	err = eblob_start_tasks(b);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: eblob background tasks start failed: %d.\n", err);
+		goto err_out_periodic_lock_destroy;
 	}
 
 	return b;
 
-err_out_join_defrag:
-	eblob_event_set(&b->exit_event);
-	pthread_join(b->defrag_tid, NULL);
-err_out_join_sync:
-	eblob_event_set(&b->exit_event);
-	pthread_join(b->sync_tid, NULL);
 err_out_periodic_lock_destroy:
 	pthread_mutex_destroy(&b->periodic_lock);
 err_out_sync_lock_destroy:
@@ -2972,11 +4112,23 @@ err_out_l2hash_destroy:
 	eblob_l2hash_destroy(&b->l2hash);
 err_out_hash_destroy:
 	eblob_hash_destroy(&b->hash);
+err_out_read_pool_cleanup:
+	eblob_read_pool_cleanup(b);
+err_out_wbuf_cleanup:
+	eblob_wbuf_cleanup(b);
+err_out_lazy_lock_destroy:
+	pthread_mutex_destroy(&b->lazy_lock);
+err_out_ns_lock_destroy:
+	pthread_mutex_destroy(&b->ns_lock);
 err_out_lock_destroy:
 	pthread_mutex_destroy(&b->lock);
+err_out_space_detach:
+	eblob_space_detach(b);
 err_out_lockf:
 	(void)lockf(b->lock_fd, F_ULOCK, 0);
 	(void)close(b->lock_fd);
+err_out_hotkey_cleanup:
+	eblob_hotkey_cleanup(b);
 err_out_free_file:
 	free(b->cfg.file);
 err_out_stat_free_local:
@@ -2989,6 +4141,210 @@ err_out_exit:
 	return NULL;
 }
 
+/**
+ * eblob_namespace_name_ok() - namespace name becomes part of file names, so
+ * only alphanumeric characters and underscores are allowed.
+ */
+static int eblob_namespace_name_ok(const char *name)
+{
+	const char *p;
+
+	if (*name == '\0' || strlen(name) > NAME_MAX / 2)
+		return 0;
+
+	for (p = name; *p != '\0'; ++p)
+		if (!isalnum((unsigned char)*p) && *p != '_')
+			return 0;
+
+	return 1;
+}
+
+struct eblob_backend *eblob_namespace_open(struct eblob_backend *b, const char *name,
+		const struct eblob_config *c)
+{
+	struct eblob_backend *ns, *tmp;
+	char path[PATH_MAX], stat_file[PATH_MAX];
+	int err;
+
+	if (b == NULL || name == NULL || b->root != b || !eblob_namespace_name_ok(name)) {
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	/* l2hash can not tell keys of different namespaces apart */
+	if (b->cfg.blob_flags & EBLOB_L2HASH) {
+		err = -ENOTSUP;
+		goto err_out_exit;
+	}
+
+	if (snprintf(path, sizeof(path), "%s.%s", b->cfg.file, name) >= (int)sizeof(path)
+			|| snprintf(stat_file, sizeof(stat_file), "%s.stat", path) >= (int)sizeof(stat_file)) {
+		err = -ENAMETOOLONG;
+		goto err_out_exit;
+	}
+
+	/* Opening is rare, so hold the list for the whole duration to prevent double open */
+	pthread_mutex_lock(&b->ns_lock);
+
+	list_for_each_entry(tmp, &b->namespaces, ns_entry) {
+		if (strcmp(tmp->cfg.file, path) == 0) {
+			err = -EEXIST;
+			goto err_out_unlock;
+		}
+	}
+
+	ns = calloc(1, sizeof(struct eblob_backend));
+	if (ns == NULL) {
+		err = -ENOMEM;
+		goto err_out_unlock;
+	}
+
+	err = eblob_stat_init_backend(ns, stat_file);
+	if (err != 0)
+		goto err_out_free;
+
+	err = eblob_stat_init_local(&ns->stat_summary);
+	if (err != 0)
+		goto err_out_stat_free;
+
+	memcpy(&ns->cfg, &b->cfg, sizeof(struct eblob_config));
+	if (c != NULL) {
+		if (c->blob_size)
+			ns->cfg.blob_size = c->blob_size;
+		if (c->records_in_blob)
+			ns->cfg.records_in_blob = c->records_in_blob;
+		if (c->blob_size_min)
+			ns->cfg.blob_size_min = c->blob_size_min;
+		if (c->records_in_blob_min)
+			ns->cfg.records_in_blob_min = c->records_in_blob_min;
+		if (c->blob_size_limit)
+			ns->cfg.blob_size_limit = c->blob_size_limit;
+		if (c->defrag_percentage)
+			ns->cfg.defrag_percentage = c->defrag_percentage;
+		if (c->defrag_timeout)
+			ns->cfg.defrag_timeout = c->defrag_timeout;
+		if (c->defrag_time || c->defrag_splay) {
+			ns->cfg.defrag_time = c->defrag_time;
+			ns->cfg.defrag_splay = c->defrag_splay;
+		}
+		eblob_config_defaults(&ns->cfg);
+	}
+
+	ns->cfg.file = strdup(path);
+	if (ns->cfg.file == NULL) {
+		err = -ENOMEM;
+		goto err_out_stat_free_local;
+	}
+	eblob_autosize_init(ns);
+
+	/* Root's lock file covers the namespace */
+	ns->lock_fd = -1;
+	ns->root = b;
+	ns->ns_id = ++b->ns_next_id;
+
+	err = eblob_hotkey_init(ns);
+	if (err != 0)
+		goto err_out_free_file;
+
+	err = eblob_space_attach(ns);
+	if (err != 0)
+		goto err_out_hotkey_cleanup;
+
+	err = eblob_mutex_init(&ns->lock);
+	if (err != 0)
+		goto err_out_space_detach;
+
+	INIT_LIST_HEAD(&ns->bases);
+	ns->max_index = -1;
+
+	err = eblob_mutex_init(&ns->lazy_lock);
+	if (err != 0)
+		goto err_out_lock_destroy;
+
+	err = eblob_wbuf_init(ns);
+	if (err != 0)
+		goto err_out_lazy_lock_destroy;
+
+	err = eblob_read_pool_init(ns);
+	if (err != 0)
+		goto err_out_wbuf_cleanup;
+
+	err = eblob_event_init(&ns->exit_event);
+	if (err != 0)
+		goto err_out_read_pool_cleanup;
+
+	err = eblob_mutex_init(&ns->defrag_lock);
+	if (err != 0)
+		goto err_out_exit_event_destroy;
+
+	err = eblob_mutex_init(&ns->sync_lock);
+	if (err != 0)
+		goto err_out_defrag_lock_destroy;
+
+	err = eblob_mutex_init(&ns->periodic_lock);
+	if (err != 0)
+		goto err_out_sync_lock_destroy;
+
+	err = eblob_load_data(ns);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: namespace %s: index iteration failed: %d.\n",
+				name, err);
+		goto err_out_cleanup;
+	}
+	eblob_stat_summary_update(ns);
+	eblob_autosize_update(ns);
+	eblob_lazy_evict(ns);
+
+	err = eblob_start_tasks(ns);
+	if (err)
+		goto err_out_cleanup;
+
+	list_add_tail(&ns->ns_entry, &b->namespaces);
+	pthread_mutex_unlock(&b->ns_lock);
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: namespace %s opened: id: %" PRIu32 "\n",
+			ns->cfg.file, ns->ns_id);
+	return ns;
+
+err_out_cleanup:
+	pthread_rwlock_wrlock(&b->hash.root_lock);
+	eblob_hash_remove_ns_nolock(&b->hash, ns->ns_id);
+	pthread_rwlock_unlock(&b->hash.root_lock);
+	eblob_bases_cleanup(ns);
+	pthread_mutex_destroy(&ns->periodic_lock);
+err_out_sync_lock_destroy:
+	pthread_mutex_destroy(&ns->sync_lock);
+err_out_defrag_lock_destroy:
+	pthread_mutex_destroy(&ns->defrag_lock);
+err_out_exit_event_destroy:
+	eblob_event_destroy(&ns->exit_event);
+err_out_read_pool_cleanup:
+	eblob_read_pool_cleanup(ns);
+err_out_wbuf_cleanup:
+	eblob_wbuf_cleanup(ns);
+err_out_lazy_lock_destroy:
+	pthread_mutex_destroy(&ns->lazy_lock);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&ns->lock);
+err_out_space_detach:
+	eblob_space_detach(ns);
+err_out_hotkey_cleanup:
+	eblob_hotkey_cleanup(ns);
+err_out_free_file:
+	free(ns->cfg.file);
+err_out_stat_free_local:
+	eblob_stat_destroy(ns->stat_summary);
+err_out_stat_free:
+	eblob_stat_destroy(ns->stat);
+err_out_free:
+	free(ns);
+err_out_unlock:
+	pthread_mutex_unlock(&b->ns_lock);
+err_out_exit:
+	errno = -err;
+	return NULL;
+}
+
 unsigned long long eblob_total_elements(struct eblob_backend *b)
 {
 	return eblob_stat_get(b->stat_summary, EBLOB_LST_RECORDS_TOTAL)
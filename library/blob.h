@@ -71,6 +71,7 @@
 
 #define EBLOB_BLOB_INDEX_CORRUPT_MAX		(1024ULL)
 #define EBLOB_BLOB_INDEX_SUFFIX			".index"
+#define EBLOB_BLOB_SUMMARY_SUFFIX		".summary"
 #define EBLOB_BLOB_DEFAULT_BLOB_SIZE		(50 * EBLOB_1_G)
 #define EBLOB_BLOB_DEFAULT_RECORDS_IN_BLOB	(50000000)
 #define EBLOB_DEFAULT_DEFRAG_TIMEOUT		(86400)
@@ -78,10 +79,24 @@
 #define EBLOB_DEFAULT_DEFRAG_TIME		(3)
 #define EBLOB_DEFAULT_DEFRAG_SPLAY		(3)
 #define EBLOB_DEFAULT_DEFRAG_MIN_TIMEOUT	(60)
+#define EBLOB_DEFAULT_ADMISSION_MAX_DELAY	(100)
+#define EBLOB_AUTO_DEFAULT_BLOB_SIZE_MIN	(EBLOB_1_G)
+#define EBLOB_AUTO_DEFAULT_RECORDS_IN_BLOB_MIN	(1000000)
+#define EBLOB_DEFAULT_DEFRAG_IDLE_UTIL		(10)
+#define EBLOB_DEFAULT_DEFRAG_IDLE_OPS		(10)
+#define EBLOB_DEFAULT_DEFRAG_IDLE_TIME		(60)
+#define EBLOB_DEFAULT_HOT_KEY_UPDATES		(2)
+#define EBLOB_DEFAULT_MAX_OPEN_BASES		(256)
+#define EBLOB_DEFAULT_WRITE_BUFFER_SIZE		(2 * 1024 * 1024)
+#define EBLOB_DEFAULT_WRITE_BUFFER_TIMEOUT	(100)
+#define EBLOB_DEFAULT_READ_THREADS		(4)
+
+/* Index blocks of cold bases are at most 1 << EBLOB_SUMMARY_MAX_SHIFT times coarser */
+#define EBLOB_SUMMARY_MAX_SHIFT			4
 
 /* Size of one entry in cache */
-static const size_t EBLOB_HASH_ENTRY_SIZE = sizeof(struct eblob_ram_control)
-	+ sizeof(struct eblob_hash_entry);
+static const size_t EBLOB_HASH_ENTRY_SIZE =
+	EBLOB_HASH_ENTRY_ALLOC_SIZE(sizeof(struct eblob_ram_control));
 /* Approx. size of l2hash entry (considering there wasn't a collision) */
 static const size_t EBLOB_L2HASH_ENTRY_SIZE = sizeof(struct eblob_l2hash_entry);
 
@@ -150,7 +165,9 @@ struct eblob_base_ctl {
 	 * Bloom
 	 */
 	unsigned char		*bloom;
+	/* Size of @bloom in bytes and number of its bits used */
 	uint64_t		bloom_size;
+	uint64_t		bloom_bits;
 	/* Number of hash functions */
 	uint8_t			bloom_func_num;
 
@@ -158,8 +175,41 @@ struct eblob_base_ctl {
 	struct eblob_index_block	*index_blocks;
 	pthread_rwlock_t	index_blocks_lock;
 
-	/* Number of bctl users inside a critical section */
-	int			critness;
+	/*
+	 * Memory budget of summaries (summary_memory_limit): each index block
+	 * covers index_block_size << @index_block_shift records, @summary_evicted
+	 * is set while bloom and index blocks of closed base are dropped and
+	 * @summary_heat counts searches in index blocks, see summary.c
+	 */
+	int			index_block_shift;
+	volatile int		summary_evicted;
+	atomic_t		summary_heat;
+
+	/*
+	 * Number of bctl users inside a critical section, it is changed
+	 * without bctl->lock unless @exclusive is set by
+	 * eblob_base_wait_locked()
+	 */
+	atomic_t		critness;
+	volatile int		exclusive;
+
+	/*
+	 * EBLOB_LAZY_BASES: set while files of sorted base are closed and
+	 * only its summary (bloom, index blocks, stats) is in memory, and time
+	 * of last access in milliseconds of monotonic clock, see lazy.c
+	 */
+	volatile int		lazy_closed;
+	volatile uint64_t	lazy_access;
+	/*
+	 * Set once fd of base was returned to caller by eblob_read() and
+	 * friends, such base is never closed lazily since nothing tells when
+	 * caller is done with fd.
+	 */
+	volatile int		lazy_pinned;
+	/* Number of running iterations, base is not closed while they run */
+	atomic_t		lazy_users;
+	/* Set once files of base are unlinked by eblob_remove_blobs() */
+	volatile int		removed;
 
 	/* Binary log rudiment: if enabled stores key removals in list */
 	struct eblob_binlog_cfg	binlog;
@@ -176,6 +226,19 @@ struct eblob_base_ctl {
 	char			name[];
 };
 
+/*
+ * Write session: location of the record reserved by
+ * eblob_write_session_open(), so that following writes and commit do not need
+ * to look key up again.
+ */
+struct eblob_write_session {
+	struct eblob_backend		*b;
+	struct eblob_key		key;
+	struct eblob_write_control	wc;
+	/* Flags of reserved record on disk, see eblob_write_session_check() */
+	uint64_t			disk_flags;
+};
+
 /* Defragmentation types */
 enum eblob_defrag_type {
 	/* Defrag thresholds weren't met */
@@ -264,15 +327,15 @@ inline static void __eblob_bloom_calc(const struct eblob_key *key, uint64_t bloo
 }
 
 __attribute_always_inline__
-inline static int eblob_bloom_ll(struct eblob_base_ctl *bctl, const struct eblob_key *key,
-		enum eblob_bloom_cmd cmd)
+inline static int __eblob_bloom_ll(unsigned char *bloom, uint64_t bloom_bits, uint8_t func_num,
+		const struct eblob_key *key, enum eblob_bloom_cmd cmd)
 {
 	uint64_t i, bit, byte, h1, h2;
 
 	/* Sanity */
-	if (key == NULL || bctl == NULL)
+	if (key == NULL)
 		return -EINVAL;
-	if (bctl->bloom_size == 0 || bctl->bloom == NULL)
+	if (bloom_bits == 0 || bloom == NULL)
 		return -EINVAL;
 
 	/*
@@ -289,30 +352,30 @@ inline static int eblob_bloom_ll(struct eblob_base_ctl *bctl, const struct eblob
 
 	switch (cmd) {
 	case EBLOB_BLOOM_CMD_GET:
-		__eblob_bloom_calc(key, bctl->bloom_size, &byte, &bit, &h1, EBLOB_BLOOM_HASH_KNR);
-		if (!(bctl->bloom[byte] & (1<<bit)))
+		__eblob_bloom_calc(key, bloom_bits, &byte, &bit, &h1, EBLOB_BLOOM_HASH_KNR);
+		if (!(bloom[byte] & (1<<bit)))
 			return 0;
-		__eblob_bloom_calc(key, bctl->bloom_size, &byte, &bit, &h2, EBLOB_BLOOM_HASH_FNV);
-		if (!(bctl->bloom[byte] & (1<<bit)))
+		__eblob_bloom_calc(key, bloom_bits, &byte, &bit, &h2, EBLOB_BLOOM_HASH_FNV);
+		if (!(bloom[byte] & (1<<bit)))
 			return 0;
 
 		/* A Simple Construction Using Two Hash Functions */
-		for (i = 2; i < bctl->bloom_func_num; ++i) {
-			const uint64_t bitpos = (h1 + i*h2) % bctl->bloom_size;
-			if (!(bctl->bloom[bitpos / 8] & (1<<(bitpos % 8))))
+		for (i = 2; i < func_num; ++i) {
+			const uint64_t bitpos = (h1 + i*h2) % bloom_bits;
+			if (!(bloom[bitpos / 8] & (1<<(bitpos % 8))))
 				return 0;
 		}
 		return 1;
 	case EBLOB_BLOOM_CMD_SET:
-		__eblob_bloom_calc(key, bctl->bloom_size, &byte, &bit, &h1, EBLOB_BLOOM_HASH_KNR);
-		bctl->bloom[byte] |= 1<<bit;
-		__eblob_bloom_calc(key, bctl->bloom_size, &byte, &bit, &h2, EBLOB_BLOOM_HASH_FNV);
-		bctl->bloom[byte] |= 1<<bit;
+		__eblob_bloom_calc(key, bloom_bits, &byte, &bit, &h1, EBLOB_BLOOM_HASH_KNR);
+		bloom[byte] |= 1<<bit;
+		__eblob_bloom_calc(key, bloom_bits, &byte, &bit, &h2, EBLOB_BLOOM_HASH_FNV);
+		bloom[byte] |= 1<<bit;
 
 		/* A Simple Construction Using Two Hash Functions */
-		for (i = 2; i < bctl->bloom_func_num; ++i) {
-			const uint64_t bitpos = (h1 + i*h2) % bctl->bloom_size;
-			bctl->bloom[bitpos / 8] |= 1<<(bitpos % 8);
+		for (i = 2; i < func_num; ++i) {
+			const uint64_t bitpos = (h1 + i*h2) % bloom_bits;
+			bloom[bitpos / 8] |= 1<<(bitpos % 8);
 		}
 		return 0;
 	default:
@@ -320,6 +383,15 @@ inline static int eblob_bloom_ll(struct eblob_base_ctl *bctl, const struct eblob
 	}
 }
 
+__attribute_always_inline__
+inline static int eblob_bloom_ll(struct eblob_base_ctl *bctl, const struct eblob_key *key,
+		enum eblob_bloom_cmd cmd)
+{
+	if (bctl == NULL)
+		return -EINVAL;
+	return __eblob_bloom_ll(bctl->bloom, bctl->bloom_bits, bctl->bloom_func_num, key, cmd);
+}
+
 /*!
  * Returns non-null if \a key is present in \a bctl bloom fileter
  */
@@ -413,6 +485,36 @@ int eblob_event_set(struct eblob_event *event);
 int eblob_event_reset(struct eblob_event *event);
 int eblob_event_wait(struct eblob_event *event, long timeout);
 
+/*
+ * State of running defrag, see eblob_defrag_progress(). Everything but
+ * @pause and @stop is written only by defrag itself.
+ */
+struct eblob_defrag_state {
+	volatile int		phase;
+	volatile int		pause;
+	volatile int		stop;
+	/* Set while defrag is paused by request or load */
+	volatile int		waiting;
+	int			bases_total;
+	int			bases_done;
+	uint64_t		records_total;
+	uint64_t		records_done;
+	uint64_t		bytes_total;
+	uint64_t		bytes_done;
+	/* Bytes to be processed by all phases of the run and processed so far */
+	uint64_t		work_total;
+	uint64_t		work_done;
+	/* Work of groups already processed */
+	uint64_t		work_done_groups;
+	/*
+	 * Start of the run, of current pause and time spent paused,
+	 * milliseconds of monotonic clock. @started is 0 if defrag is not running.
+	 */
+	uint64_t		started;
+	uint64_t		wait_start;
+	uint64_t		wait_time;
+};
+
 struct eblob_backend {
 	struct eblob_config	cfg;
 
@@ -420,6 +522,12 @@ struct eblob_backend {
 
 	struct list_head	bases;
 	int			max_index;
+	/*
+	 * Index of the newest base being ingested while old versions of its
+	 * keys are removed, 0 otherwise. Records of older bases can not be
+	 * overwritten inplace meanwhile. Protected by @lock.
+	 */
+	int			ingest_index;
 
 	/* In memory cache */
 	struct eblob_hash	hash;
@@ -433,18 +541,20 @@ struct eblob_backend {
 	pthread_mutex_t		sync_lock;
 	pthread_mutex_t		periodic_lock;
 
-	pthread_t		defrag_tid;
-	pthread_t		sync_tid;
-	pthread_t		periodic_tid;
-
 	/*
 	 * Set when defrag/data-sort are explicitly requested
 	 * 1:	data-sort is explicitly requested via eblob_start_defrag()
 	 * 0:	data-sort should be preformed according to defrag_timeout
 	 */
 	volatile int		want_defrag;
-	/* Cached vfs stats */
-	struct statvfs		vfs_stat;
+	/*
+	 * Free space accountant of the device backend lives on. Size of
+	 * backend's bases as of @space_sampled plus reservations made since.
+	 * Protected by accountant's lock.
+	 */
+	struct eblob_space	*space;
+	uint64_t		space_used;
+	uint64_t		space_sampled;
 	/* File descriptor used for database locking */
 	int			lock_fd;
 
@@ -456,36 +566,227 @@ struct eblob_backend {
 
 	/* Tree for time monitoring, global time stat */
 	void			*time_stats_tree;
+
+	/*
+	 * Namespaces. @root is the backend itself for backends created by
+	 * eblob_init() and owning backend for namespaces. Root owns lock file
+	 * and in-memory cache, where entries are keyed by (@ns_id, key).
+	 */
+	struct eblob_backend	*root;
+	uint32_t		ns_id;
+	/* Root only: list of opened namespaces and id of the next one */
+	struct list_head	namespaces;
+	pthread_mutex_t		ns_lock;
+	uint32_t		ns_next_id;
+	/* Namespace only: entry in root's list */
+	struct list_head	ns_entry;
+
+	/* Time of next timed defrag, -1 if there is none */
+	uint64_t		defrag_next;
+	struct eblob_defrag_state	defrag_state;
+
+	/* Number of write latency samples since last pressure update */
+	atomic_t		admission_samples;
+
+	/* Base rollover thresholds picked by EBLOB_AUTO_BASE_SIZE */
+	uint64_t		auto_blob_size;
+	uint64_t		auto_records_in_blob;
+
+	/*
+	 * Load samples of EBLOB_IDLE_DATASORT, touched only by defrag task.
+	 * Times are milliseconds of monotonic clock, @idle_since is 0 while
+	 * backend is busy and @idle_due is 0 while defrag is not waiting.
+	 */
+	char			idle_stat_path[PATH_MAX];
+	uint64_t		idle_sampled;
+	uint64_t		idle_io_ticks;
+	uint64_t		idle_ops;
+	uint64_t		idle_since;
+	uint64_t		idle_due;
+	int			idle_device_busy;
+	int			idle_foreground_busy;
+	/*
+	 * Set while data-sort started on busy device or by eblob_start_defrag()
+	 * runs, it is not paused by foreground load then.
+	 */
+	int			idle_forced;
+
+	/*
+	 * Count-min sketch of key updates used by EBLOB_HOT_COLD_DATASORT,
+	 * rows of @hotkey_width counters, see hotkey.c. NULL without the flag.
+	 */
+	uint8_t			*hotkey_sketch;
+	uint64_t		hotkey_width;
+
+	/* Serializes opening and closing of bases with EBLOB_LAZY_BASES */
+	pthread_mutex_t		lazy_lock;
+
+	/*
+	 * Records staged by EBLOB_WRITE_BUFFER, see wbuf.c: tail of data and
+	 * index files of @wbuf_bctl starting at @wbuf_data_offset and
+	 * @wbuf_index_offset respectively, that is not written yet.
+	 * @wbuf_data is NULL without the flag.
+	 */
+	pthread_mutex_t		wbuf_lock;
+	struct eblob_base_ctl	*wbuf_bctl;
+	char			*wbuf_data, *wbuf_index;
+	uint64_t		wbuf_data_offset, wbuf_data_len;
+	uint64_t		wbuf_index_offset, wbuf_index_len;
+	uint64_t		wbuf_since;
+
+	/*
+	 * Reads queued by eblob_read_data_async() and workers serving them,
+	 * see async.c. Workers exit once @read_need_exit is set and queue is
+	 * empty.
+	 */
+	pthread_mutex_t		read_lock;
+	pthread_cond_t		read_cond;
+	struct list_head	read_queue;
+	pthread_t		*read_tids;
+	int			read_started;
+	int			read_need_exit;
 };
 
+int eblob_start_tasks(struct eblob_backend *b);
+
 int eblob_add_new_base(struct eblob_backend *b);
 int eblob_load_data(struct eblob_backend *b);
 void eblob_bases_cleanup(struct eblob_backend *b);
 
+/*
+ * Caches @flags and @disk_size of record in @rctl, @rctl->size should be set.
+ * Only low 32 bits of flags are kept, time of the last write is dropped.
+ */
+static inline void eblob_rctl_set_disk(struct eblob_ram_control *rctl,
+		uint64_t disk_size, uint64_t flags)
+{
+	rctl->flags = flags;
+	if (disk_size >= rctl->size && disk_size - rctl->size < EBLOB_RAM_DISK_EXTRA_UNKNOWN)
+		rctl->disk_extra = disk_size - rctl->size;
+	else
+		rctl->disk_extra = EBLOB_RAM_DISK_EXTRA_UNKNOWN;
+}
+
 int eblob_cache_lookup(struct eblob_backend *b, struct eblob_key *key, struct eblob_ram_control *res, int *diskp);
+int eblob_cache_lookup_ram(struct eblob_backend *b, struct eblob_key *key, struct eblob_ram_control *res);
+int eblob_cache_update_flags(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_ram_control *old, uint64_t flags);
 int eblob_cache_remove(struct eblob_backend *b, struct eblob_key *key);
+int eblob_cache_remove_old(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_ram_control *old);
 int eblob_cache_remove_nolock(struct eblob_backend *b, struct eblob_key *key);
 int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
 		struct eblob_ram_control *ctl);
+int eblob_cache_insert_nolock(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_ram_control *ctl);
 
 int eblob_disk_index_lookup(struct eblob_backend *b, struct eblob_key *key,
 		struct eblob_ram_control *rctl);
+int eblob_disk_index_lookup_older(struct eblob_backend *b, struct eblob_key *key,
+		int index, struct eblob_ram_control *rctl);
+int eblob_ingest_shadows(struct eblob_backend *b, struct eblob_base_ctl *bctl);
 
 int eblob_check_record(const struct eblob_base_ctl *bctl,
 		const struct eblob_disk_control *dc);
 
 int eblob_blob_iterate(struct eblob_iterate_control *ctl);
 
-void *eblob_defrag_thread(void *data);
+int eblob_defrag_tick(struct eblob_backend *b);
+int eblob_defrag_stopped(struct eblob_backend *b);
+int eblob_defrag_throttle(struct eblob_backend *b);
+void eblob_defrag_phase(struct eblob_backend *b, enum eblob_defrag_phase phase,
+		uint64_t records, uint64_t bytes);
+void eblob_defrag_account(struct eblob_backend *b, uint64_t bytes);
+
+struct eblob_space_stat {
+	/* Filesystem size and available space as of the last sample */
+	uint64_t		total;
+	uint64_t		avail;
+	/*
+	 * Reserved by writers since the sample and by running data-sorts, the
+	 * latter without what they had written by the sample
+	 */
+	uint64_t		reserved;
+	uint64_t		datasort;
+	/* Free space writers of the backend leave untouched */
+	uint64_t		keep;
+	/* Size of backend's bases */
+	uint64_t		used;
+};
+
+int eblob_space_attach(struct eblob_backend *b);
+void eblob_space_detach(struct eblob_backend *b);
+int eblob_space_reserve(struct eblob_backend *b, uint64_t size);
+void eblob_space_release(struct eblob_backend *b, uint64_t size);
+int eblob_space_reserve_datasort(struct eblob_backend *b, uint64_t size);
+void eblob_space_account_datasort(struct eblob_backend *b, uint64_t *written, int64_t size);
+void eblob_space_release_datasort(struct eblob_backend *b, uint64_t size, uint64_t written);
+int eblob_space_update(struct eblob_backend *b);
+void eblob_space_get_stat(struct eblob_backend *b, struct eblob_space_stat *st);
+
+void eblob_base_limits(struct eblob_backend *b, uint64_t *size, uint64_t *records);
+void eblob_autosize_init(struct eblob_backend *b);
+void eblob_autosize_update(struct eblob_backend *b);
+
+int eblob_admission_update(struct eblob_backend *b);
+int eblob_admission_check(struct eblob_backend *b);
+uint64_t eblob_admission_start(void);
+void eblob_admission_account(struct eblob_backend *b, uint64_t start);
+
+void eblob_idle_sample(struct eblob_backend *b);
+int eblob_idle_busy(struct eblob_backend *b, int device);
+int eblob_defrag_idle(struct eblob_backend *b);
+
+int eblob_hotkey_init(struct eblob_backend *b);
+void eblob_hotkey_cleanup(struct eblob_backend *b);
+void eblob_hotkey_update(struct eblob_backend *b, const struct eblob_key *key);
+int eblob_hotkey_is_hot(struct eblob_backend *b, const struct eblob_key *key);
+void eblob_hotkey_age(struct eblob_backend *b);
+
+int eblob_lazy_register(struct eblob_backend *b, struct eblob_base_ctl *bctl);
+int eblob_lazy_open(struct eblob_base_ctl *bctl);
+void eblob_lazy_touch(struct eblob_base_ctl *bctl);
+void eblob_lazy_hold(struct eblob_base_ctl *bctl);
+void eblob_lazy_release(struct eblob_base_ctl *bctl);
+void eblob_lazy_pin(struct eblob_base_ctl *bctl);
+void eblob_lazy_evict(struct eblob_backend *b);
+void eblob_lazy_cleanup(struct eblob_backend *b);
+int eblob_lazy_load_summary(struct eblob_base_ctl *bctl);
+
+int eblob_summary_rdlock(struct eblob_base_ctl *bctl);
+int eblob_summary_reload(struct eblob_base_ctl *bctl);
+void eblob_summary_balance(struct eblob_backend *b);
 void eblob_base_remove(struct eblob_base_ctl *bctl);
 
+int eblob_wbuf_init(struct eblob_backend *b);
+void eblob_wbuf_cleanup(struct eblob_backend *b);
+
+int eblob_read_pool_init(struct eblob_backend *b);
+void eblob_read_pool_cleanup(struct eblob_backend *b);
+int eblob_wbuf_fits(struct eblob_backend *b, uint64_t size);
+int eblob_wbuf_append(struct eblob_backend *b, const struct eblob_write_control *wc,
+		const void *record, const struct eblob_disk_control *dc);
+int eblob_wbuf_read(struct eblob_backend *b, const struct eblob_ram_control *rctl,
+		uint64_t offset, void *dst, uint64_t size);
+int eblob_wbuf_read_index(struct eblob_backend *b, const struct eblob_ram_control *rctl,
+		struct eblob_disk_control *dc);
+int eblob_wbuf_flush(struct eblob_backend *b);
+int eblob_wbuf_flush_sync(struct eblob_backend *b);
+int eblob_wbuf_flush_base(struct eblob_backend *b, struct eblob_base_ctl *bctl);
+int eblob_wbuf_flush_record(struct eblob_backend *b, const struct eblob_ram_control *rctl);
+uint64_t eblob_wbuf_index_flushed(struct eblob_backend *b, struct eblob_base_ctl *bctl);
+int eblob_wbuf_tick(struct eblob_backend *b);
+
 int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *bctl);
+int eblob_txn_recover(struct eblob_backend *b, struct eblob_base_ctl *bctl);
 
 int eblob_index_blocks_destroy(struct eblob_base_ctl *bctl);
 
 int eblob_index_blocks_fill(struct eblob_base_ctl *bctl);
+uint64_t eblob_bloom_bits(const struct eblob_base_ctl *bctl);
 int __eblob_write_ll(int fd, void *data, size_t size, off_t offset);
 int __eblob_read_ll(int fd, void *data, size_t size, off_t offset);
+int __eblob_read_nowait_ll(int fd, void *data, size_t size, off_t offset);
 
 struct eblob_disk_search_stat {
 	int			loops;			// number of bctls checked
@@ -517,9 +818,14 @@ int eblob_preallocate(int fd, off_t offset, off_t size);
 int eblob_pagecache_hint(int fd, uint64_t flag);
 
 int eblob_mark_index_removed(int fd, uint64_t offset);
+int eblob_mark_entry_removed_purge(struct eblob_backend *b,
+		struct eblob_key *key, struct eblob_ram_control *old);
+int eblob_write_index_flags(int fd, uint64_t offset, uint64_t flags);
+uint64_t eblob_stamp_flags(uint64_t flags);
 int eblob_get_index_fd(struct eblob_base_ctl *bctl);
 void eblob_base_wait(struct eblob_base_ctl *bctl);
 void eblob_base_wait_locked(struct eblob_base_ctl *bctl);
+void eblob_base_unlock(struct eblob_base_ctl *bctl);
 
 void eblob_bctl_hold(struct eblob_base_ctl *bctl);
 void eblob_bctl_release(struct eblob_base_ctl *bctl);
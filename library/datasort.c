@@ -378,8 +378,12 @@ static void datasort_destroy_chunk(struct datasort_cfg *dcfg, struct datasort_ch
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_NOTICE, "defrag: destroying chunk: %s, fd: %d", chunk->path, chunk->fd);
 
 	if (chunk->path != NULL) {
-		if (unlink(chunk->path) == -1)
+		if (unlink(chunk->path) == -1) {
 			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: unlink: %s", chunk->path);
+		} else {
+			eblob_space_account_datasort(dcfg->b, &dcfg->space_written,
+					-(int64_t)chunk->offset);
+		}
 	}
 	if (chunk->fd >= 0) {
 		if (eblob_pagecache_hint(chunk->fd, EBLOB_FLAGS_HINT_DONTNEED))
@@ -436,6 +440,10 @@ static int datasort_split_iterator(struct eblob_disk_control *dc,
 	if (dc->disk_size < (uint64_t)hdr_size)
 		return -EINVAL;
 
+	/* Base is held by iterator, so split can not be paused, only stopped */
+	if (eblob_defrag_stopped(dcfg->b))
+		return -EINTR;
+
 	/* Shortcut */
 	c = local->current;
 
@@ -502,6 +510,9 @@ static int datasort_split_iterator(struct eblob_disk_control *dc,
 
 	c->offset += dc->disk_size - hdr_size;
 	c->count++;
+	eblob_space_account_datasort(dcfg->b, &dcfg->space_written, dc->disk_size);
+	eblob_stat_add(dcfg->b->stat, EBLOB_GST_WRITTEN_DATASORT_SPLIT, dc->disk_size);
+	eblob_defrag_account(dcfg->b, dc->disk_size);
 	return 0;
 
 err:
@@ -548,6 +559,10 @@ static int datasort_split(struct datasort_cfg *dcfg)
 	for (n = 0; n < dcfg->bctl_cnt; ++n) {
 		assert(dcfg->bctl[n] != NULL);
 
+		err = eblob_defrag_throttle(dcfg->b);
+		if (err != 0)
+			goto err;
+
 		memset(&ictl, 0, sizeof(ictl));
 		ictl.priv = dcfg;
 		ictl.b = dcfg->b;
@@ -690,6 +705,7 @@ static struct datasort_chunk *datasort_sort_chunk(struct datasort_cfg *dcfg,
 				sorted_chunk->fd, sorted_chunk->offset);
 		goto err_destroy_chunk;
 	}
+	eblob_space_account_datasort(dcfg->b, &dcfg->space_written, sorted_chunk->offset);
 
 	/* Save entires in sorted order */
 	for (i = 0, offset = 0; i < sorted_chunk->count; ++i) {
@@ -702,8 +718,16 @@ static struct datasort_chunk *datasort_sort_chunk(struct datasort_cfg *dcfg,
 			goto err_destroy_chunk;
 		}
 		offset += dc->disk_size;
+		eblob_defrag_account(dcfg->b, dc->disk_size);
+
+		if (((i + 1) % EBLOB_DATASORT_THROTTLE_RECORDS) == 0
+				&& eblob_defrag_throttle(dcfg->b) != 0) {
+			EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR, "defrag: exit requested - aborting sort");
+			goto err_destroy_chunk;
+		}
 	}
 	assert(offset == unsorted_chunk->offset);
+	eblob_stat_add(dcfg->b->stat, EBLOB_GST_WRITTEN_DATASORT_SORT, offset);
 
 	if (eblob_pagecache_hint(unsorted_chunk->fd, EBLOB_FLAGS_HINT_DONTNEED))
 		EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR,
@@ -725,6 +749,7 @@ err:
 static int datasort_sort(struct datasort_cfg *dcfg)
 {
 	struct datasort_chunk *chunk, *sorted_chunk, *tmp;
+	uint64_t records = 0, bytes = 0;
 
 	assert(dcfg != NULL);
 	assert(list_empty(&dcfg->sorted_chunks) == 1);
@@ -745,6 +770,12 @@ static int datasort_sort(struct datasort_cfg *dcfg)
 		return 0;
 	}
 
+	list_for_each_entry(chunk, &dcfg->unsorted_chunks, list) {
+		records += chunk->count;
+		bytes += chunk->offset;
+	}
+	eblob_defrag_phase(dcfg->b, EBLOB_DEFRAG_PHASE_SORT, records, bytes);
+
 	/* Base is not sorted - sort it */
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: sort: start");
 	list_for_each_entry_safe(chunk, tmp, &dcfg->unsorted_chunks, list) {
@@ -757,7 +788,7 @@ static int datasort_sort(struct datasort_cfg *dcfg)
 		list_del(&chunk->list);
 		datasort_destroy_chunk(dcfg, chunk);
 
-		if (eblob_event_get(&dcfg->b->exit_event)) {
+		if (eblob_defrag_throttle(dcfg->b) != 0) {
 			EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR, "defrag: exit requested - aborting sort");
 			goto err;
 		}
@@ -825,11 +856,14 @@ static inline uint64_t datasort_merge_index_size(struct list_head *lst)
  * - While we can find non-EOF chunk with smallest key
  * - Copy first entry from it
  * - Repeat
+ *
+ * With EBLOB_HOT_COLD_DATASORT and more than one base hot keys are copied
+ * into separate chunk @dcfg->hot_result, unless either chunk ends up empty.
  */
 static struct datasort_chunk *datasort_merge(struct datasort_cfg *dcfg)
 {
-	struct datasort_chunk *chunk, *merged_chunk;
-	uint64_t total_items;
+	struct datasort_chunk *chunk, *merged_chunk, *hot_chunk = NULL, *target;
+	uint64_t total_items, total_size = 0, hot_index_size = 0, merged = 0;
 	int err;
 
 	assert(dcfg != NULL);
@@ -848,6 +882,10 @@ static struct datasort_chunk *datasort_merge(struct datasort_cfg *dcfg)
 	if (total_items == 0)
 		goto err;
 
+	list_for_each_entry(chunk, &dcfg->sorted_chunks, list)
+		total_size += chunk->offset;
+	eblob_defrag_phase(dcfg->b, EBLOB_DEFRAG_PHASE_MERGE, total_items, total_size);
+
 	merged_chunk->index = calloc(total_items, sizeof(struct eblob_disk_control));
 	if (merged_chunk->index == NULL) {
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno,
@@ -855,16 +893,36 @@ static struct datasort_chunk *datasort_merge(struct datasort_cfg *dcfg)
 		goto err;
 	}
 
+	/* Hot keys need base of their own to go to */
+	if ((dcfg->b->cfg.blob_flags & EBLOB_HOT_COLD_DATASORT) && dcfg->bctl_cnt > 1) {
+		hot_chunk = datasort_add_chunk(dcfg);
+		if (hot_chunk == NULL)
+			goto err;
+	}
+
 	while ((chunk = datasort_merge_get_smallest(dcfg)) != NULL) {
 		struct eblob_disk_control *dc;
-		uint64_t total_count, current_count;
+		uint64_t current_count;
 
 		/* Shortcut */
-		total_count = merged_chunk->count;
 		current_count = chunk->merge_count - 1;
 		dc = &chunk->index[current_count];
 
-		err = datasort_copy_record(dcfg, chunk, merged_chunk, dc, merged_chunk->offset);
+		target = merged_chunk;
+		if (hot_chunk != NULL && eblob_hotkey_is_hot(dcfg->b, &dc->key)) {
+			void *index = hot_chunk->index;
+
+			target = hot_chunk;
+			target->index = datasort_reallocf(&index,
+					sizeof(struct eblob_disk_control), &hot_index_size, target->count);
+			if (target->index == NULL) {
+				EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, ENOMEM, "defrag: realloc: hot index: %"
+						PRIu64, hot_index_size * sizeof(struct eblob_disk_control));
+				goto err;
+			}
+		}
+
+		err = datasort_copy_record(dcfg, chunk, target, dc, target->offset);
 		if (err != 0) {
 			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err,
 					"defrag: datasort_copy_record: FAILED");
@@ -872,14 +930,43 @@ static struct datasort_chunk *datasort_merge(struct datasort_cfg *dcfg)
 		}
 
 		/* Rewrite on-disk position */
-		dc->position = merged_chunk->offset;
+		dc->position = target->offset;
 
 		/* Save merged chunk */
-		merged_chunk->index[total_count] = *dc;
-		merged_chunk->offset += dc->disk_size;
-		merged_chunk->count++;
+		target->index[target->count] = *dc;
+		target->offset += dc->disk_size;
+		target->count++;
+		eblob_space_account_datasort(dcfg->b, &dcfg->space_written, dc->disk_size);
+		eblob_stat_add(dcfg->b->stat, EBLOB_GST_WRITTEN_DATASORT_MERGE, dc->disk_size);
+		eblob_defrag_account(dcfg->b, dc->disk_size);
+
+		if ((++merged % EBLOB_DATASORT_THROTTLE_RECORDS) == 0
+				&& eblob_defrag_throttle(dcfg->b) != 0) {
+			EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR, "defrag: exit requested - aborting merge");
+			goto err;
+		}
+	}
+
+	if (hot_chunk != NULL) {
+		assert(total_items == merged_chunk->count + hot_chunk->count);
+		eblob_stat_add(dcfg->b->stat, EBLOB_GST_DATASORT_HOT_RECORDS, hot_chunk->count);
+		eblob_stat_add(dcfg->b->stat, EBLOB_GST_DATASORT_COLD_RECORDS, merged_chunk->count);
+		EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: merge: hot: count: %" PRIu64
+				", size: %" PRIu64, hot_chunk->count, hot_chunk->offset);
+
+		/* Separation makes sense only if both parts are not empty */
+		if (hot_chunk->count == 0) {
+			datasort_destroy_chunk(dcfg, hot_chunk);
+			hot_chunk = NULL;
+		} else if (merged_chunk->count == 0) {
+			datasort_destroy_chunk(dcfg, merged_chunk);
+			merged_chunk = hot_chunk;
+			hot_chunk = NULL;
+		}
+	} else {
+		assert(total_items == merged_chunk->count);
 	}
-	assert(total_items == merged_chunk->count);
+	dcfg->hot_result = hot_chunk;
 
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO,
 			"defrag: merge: stop: fd: %d, count: %" PRIu64 ", size: %" PRIu64 ", path: %s",
@@ -890,6 +977,8 @@ static struct datasort_chunk *datasort_merge(struct datasort_cfg *dcfg)
 
 err:
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR, "merge: FAILED");
+	if (hot_chunk != NULL)
+		datasort_destroy_chunk(dcfg, hot_chunk);
 	datasort_destroy_chunk(dcfg, merged_chunk);
 	datasort_destroy_chunks(dcfg, &dcfg->sorted_chunks);
 	return NULL;
@@ -924,7 +1013,45 @@ static uint64_t datasort_index_search(const struct eblob_key *key,
 }
 
 /*!
- * Removes from resulting blob entries that were removed during data-sort
+ * Marks entry of @key removed in @chunk if it is there
+ */
+static int datasort_binlog_remove(struct datasort_cfg *dcfg, struct datasort_chunk *chunk,
+		const struct eblob_key *key, uint64_t *total)
+{
+	const uint64_t index = datasort_index_search(key, chunk->index, chunk->count);
+	struct eblob_disk_control dc;
+	int err;
+
+	/* Entry was not found - it's OK */
+	if (index == -1ULL)
+		return 0;
+
+	/* Shortcut */
+	dc = chunk->index[index];
+
+	/* Mark entry removed in both index and data file */
+	EBLOB_WARNX(dcfg->log, EBLOB_LOG_DEBUG, "%s: defrag: removing: dc: "
+			"flags: 0x%" PRIx64 ", data_size: %" PRIu64,
+			eblob_dump_id(dc.key.id), dc.flags, dc.data_size);
+	chunk->index[index].flags |= BLOB_DISK_CTL_REMOVE;
+
+	EBLOB_WARNX(dcfg->log, EBLOB_LOG_DEBUG,
+			"%s: defrag: removing: fd: %d, offset: %" PRIu64,
+			eblob_dump_id(key->id), chunk->fd, dc.position);
+	err = eblob_mark_index_removed(chunk->fd, dc.position);
+	if (err != 0) {
+		EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR,
+				"%s: defrag: eblob_mark_index_removed: FAILED: fd: %d, offset: %" PRIu64,
+				eblob_dump_id(key->id), chunk->fd, dc.position);
+		return err;
+	}
+
+	(*total)++;
+	return 0;
+}
+
+/*!
+ * Removes from resulting blob(s) entries that were removed during data-sort
  */
 static int datasort_binlog_apply(struct datasort_cfg *dcfg)
 {
@@ -941,38 +1068,11 @@ static int datasort_binlog_apply(struct datasort_cfg *dcfg)
 		EBLOB_WARNX(dcfg->log, EBLOB_LOG_NOTICE,
 				"applying binlog to: %s", dcfg->bctl[n]->name);
 		while ((it = eblob_binlog_iterate(bcfg, it)) != NULL) {
-			const uint64_t index = datasort_index_search(&it->key,
-					dcfg->result->index, dcfg->result->count);
-			struct eblob_disk_control dc;
-
-			/* Entry was not found - it's OK */
-			if (index == -1ULL) {
-				EBLOB_WARNX(dcfg->log, EBLOB_LOG_DEBUG, "%s: skipped",
-						eblob_dump_id(it->key.id));
-				continue;
-			}
-
-			/* Shortcut */
-			dc = dcfg->result->index[index];
-
-			/* Mark entry removed in both index and data file */
-			EBLOB_WARNX(dcfg->log, EBLOB_LOG_DEBUG, "%s: defrag: removing: dc: "
-					"flags: 0x%" PRIx64 ", data_size: %" PRIu64,
-					eblob_dump_id(dc.key.id), dc.flags, dc.data_size);
-			dcfg->result->index[index].flags |= BLOB_DISK_CTL_REMOVE;
-
-			EBLOB_WARNX(dcfg->log, EBLOB_LOG_DEBUG,
-					"%s: defrag: removing: fd: %d, offset: %" PRIu64,
-					eblob_dump_id(it->key.id), dcfg->result->fd, dc.position);
-			err = eblob_mark_index_removed(dcfg->result->fd, dc.position);
-			if (err != 0) {
-				EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR,
-						"%s: defrag: eblob_mark_index_removed: FAILED: fd: %d, offset: %" PRIu64,
-						eblob_dump_id(it->key.id), dcfg->result->fd, dc.position);
+			err = datasort_binlog_remove(dcfg, dcfg->result, &it->key, &total);
+			if (err == 0 && dcfg->hot_result != NULL)
+				err = datasort_binlog_remove(dcfg, dcfg->hot_result, &it->key, &total);
+			if (err != 0)
 				goto err_out_exit;
-			}
-
-			total++;
 		}
 	}
 
@@ -983,31 +1083,22 @@ err_out_exit:
 }
 
 /*
- * Swaps original base with new shiny sorted one.
+ * Constructs new base aka "sorted" from @chunk that takes place of
+ * @unsorted_bctl.
  *
- * - construct new base aka "sorted"
  * - move sorted data from chunk to new base
  * - construct index
- * - flush "unsorted" cache
  *
  * TODO: Move index management to separate function
  */
-static int datasort_swap_memory(struct datasort_cfg *dcfg)
+static int datasort_swap_memory_base(struct datasort_cfg *dcfg, struct datasort_chunk *chunk,
+		struct eblob_base_ctl *unsorted_bctl, struct eblob_base_ctl **sorted)
 {
-	struct eblob_base_ctl *sorted_bctl, *unsorted_bctl;
+	struct eblob_base_ctl *sorted_bctl;
 	struct eblob_map_fd index;
 	char tmp_index_path[PATH_MAX], data_path[PATH_MAX];
-	uint64_t i, offset;
-	int err, n;
-
-	assert(dcfg != NULL);
-	assert(dcfg->bctl != NULL);
-	assert(dcfg->result != NULL);
-
-	/* Shortcut */
-	unsorted_bctl = dcfg->bctl[0];
+	int err;
 
-	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: %s: starting", __func__);
 	/*
 	 * Manually add new base.
 	 */
@@ -1033,7 +1124,7 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 	 * FIXME: Copy permissions from original fd
 	 */
 	memset(&index, 0, sizeof(index));
-	index.size = dcfg->result->count * sizeof(struct eblob_disk_control);
+	index.size = chunk->count * sizeof(struct eblob_disk_control);
 	index.fd = open(tmp_index_path, O_RDWR | O_CLOEXEC | O_TRUNC | O_CREAT, 0644);
 	if (index.fd == -1) {
 		err = -errno;
@@ -1048,6 +1139,7 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 				"defrag: eblob_preallocate: fd: %d, size: %" PRIu64, index.fd, index.size);
 		goto err_free_base;
 	}
+	eblob_space_account_datasort(dcfg->b, &dcfg->space_written, index.size);
 
 	/* mmap index */
 	if (index.size > 0) {
@@ -1059,13 +1151,14 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 		}
 
 		/* Save index on disk */
-		memcpy(index.data, dcfg->result->index, index.size);
+		memcpy(index.data, chunk->index, index.size);
 		if ((err = msync(index.data, index.size, MS_SYNC)) == -1) {
 			err = -errno;
 			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err,
 					"defrag: msync: %p, size: %" PRIu64, index.data, index.size);
 			goto err_unmap;
 		}
+		eblob_stat_add(dcfg->b->stat, EBLOB_GST_WRITTEN_INDEX, index.size);
 	} else {
 		EBLOB_WARNX(dcfg->log, EBLOB_LOG_NOTICE, "defrag: index size is zero: %s", tmp_index_path);
 	}
@@ -1073,7 +1166,7 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 	/*
 	 * Setup sorted base
 	 */
-	sorted_bctl->data_fd = dcfg->result->fd;
+	sorted_bctl->data_fd = chunk->fd;
 	sorted_bctl->index_fd = index.fd;
 	sorted_bctl->sort = index;
 
@@ -1082,7 +1175,7 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: eblob_base_setup_data: FAILED");
 		goto err_unmap;
 	}
-	assert(sorted_bctl->data_size == dcfg->result->offset);
+	assert(sorted_bctl->data_size == chunk->offset);
 	assert(sorted_bctl->index_size == index.size);
 
 	sorted_bctl->data_offset = sorted_bctl->data_size;
@@ -1093,20 +1186,36 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 		goto err_unmap;
 	}
 
-	/* Protect l2hash/hash from accessing stale fds */
-	if ((err = pthread_rwlock_wrlock(&dcfg->b->hash.root_lock)) != 0) {
-		err = -err;
-		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: pthread_mutex_lock");
-		goto err_unmap;
-	}
+	/* Account for new size */
+	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_BASE_SIZE,
+			sorted_bctl->index_size + sorted_bctl->data_size);
+	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_RECORDS_TOTAL, chunk->count);
 
-	/*
-	 * Flush hash
-	 */
-	for (offset = 0, i = 0; offset < dcfg->result->offset;
-			offset += dcfg->result->index[i++].disk_size) {
+	*sorted = sorted_bctl;
+	return 0;
+
+err_unmap:
+	eblob_data_unmap(&index);
+err_free_base:
+	eblob_base_ctl_cleanup(sorted_bctl);
+	free(sorted_bctl);
+err:
+	return err;
+}
+
+/*
+ * Drops cached entries of keys in @chunk.
+ * NB! Caller should hold hash root_lock.
+ */
+static void datasort_swap_memory_flush(struct datasort_cfg *dcfg, struct datasort_chunk *chunk)
+{
+	uint64_t i, offset;
+	int err;
+
+	for (offset = 0, i = 0; offset < chunk->offset;
+			offset += chunk->index[i++].disk_size) {
 		/* This entry was removed in binlog_apply */
-		if (dcfg->result->index[i].flags & BLOB_DISK_CTL_REMOVE)
+		if (chunk->index[i].flags & BLOB_DISK_CTL_REMOVE)
 			continue;
 		/*
 		 * This entry exists in sorted blob - it's position most likely
@@ -1114,43 +1223,93 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 		 * FIXME: Make it batch for speedup - for example add function
 		 * like "remove all keys with given bctl"
 		 */
-		err = eblob_cache_remove_nolock(dcfg->b, &dcfg->result->index[i].key);
+		err = eblob_cache_remove_nolock(dcfg->b, &chunk->index[i].key);
 		if (err != 0)
 			EBLOB_WARNC(dcfg->log, EBLOB_LOG_DEBUG, -err,
 					"defrag: eblob_hash_remove_nolock: %s, offset: %" PRIu64,
-					eblob_dump_id(dcfg->result->index[i].key.id), offset);
+					eblob_dump_id(chunk->index[i].key.id), offset);
 	}
-	assert(i == dcfg->result->count);
-	assert(offset == dcfg->result->offset);
+	assert(i == chunk->count);
+	assert(offset == chunk->offset);
+}
 
-	/* Account for new size */
-	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_BASE_SIZE,
-			sorted_bctl->index_size + sorted_bctl->data_size);
-	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_RECORDS_TOTAL, dcfg->result->count);
+/*
+ * Swaps original base(s) with new shiny sorted one(s).
+ *
+ * - construct new base(s) aka "sorted", hot keys go to the second one
+ * - flush "unsorted" cache
+ * - replace original bases in the list
+ */
+static int datasort_swap_memory(struct datasort_cfg *dcfg)
+{
+	struct eblob_base_ctl *sorted_bctl, *hot_bctl = NULL;
+	int err, n;
+
+	assert(dcfg != NULL);
+	assert(dcfg->bctl != NULL);
+	assert(dcfg->result != NULL);
+	assert(dcfg->hot_result == NULL || dcfg->bctl_cnt > 1);
+
+	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: %s: starting", __func__);
+
+	err = datasort_swap_memory_base(dcfg, dcfg->result, dcfg->bctl[0], &sorted_bctl);
+	if (err != 0)
+		goto err;
+
+	if (dcfg->hot_result != NULL) {
+		err = datasort_swap_memory_base(dcfg, dcfg->hot_result, dcfg->bctl[1], &hot_bctl);
+		if (err != 0)
+			goto err_free_sorted;
+	}
+
+	/* Protect l2hash/hash from accessing stale fds */
+	if ((err = pthread_rwlock_wrlock(&dcfg->b->root->hash.root_lock)) != 0) {
+		err = -err;
+		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: pthread_mutex_lock");
+		goto err_free_hot;
+	}
+
+	/*
+	 * Flush hash
+	 */
+	datasort_swap_memory_flush(dcfg, dcfg->result);
+	if (hot_bctl != NULL)
+		datasort_swap_memory_flush(dcfg, dcfg->hot_result);
 
 	/*
-	 * Replace unsorted bctl(s) with sorted one
-	 * Replace first one, delete all following if any.
+	 * Replace unsorted bctl(s) with sorted one(s)
+	 * Replace first one, and second one with hot keys if any,
+	 * delete all following.
 	 *
 	 * TODO: Here we purposely leak unsorted bctl - we don't have any control
 	 * over it and it can still be used anywhere in code.
 	 */
-	list_replace(&unsorted_bctl->base_entry, &sorted_bctl->base_entry);
-	for (n = 1; n < dcfg->bctl_cnt; ++n)
+	list_replace(&dcfg->bctl[0]->base_entry, &sorted_bctl->base_entry);
+	n = 1;
+	if (hot_bctl != NULL)
+		list_replace(&dcfg->bctl[n++]->base_entry, &hot_bctl->base_entry);
+	for (; n < dcfg->bctl_cnt; ++n)
 		__list_del(dcfg->bctl[n]->base_entry.prev, dcfg->bctl[n]->base_entry.next);
 
 	/* Unlock hash */
-	pthread_rwlock_unlock(&dcfg->b->hash.root_lock);
+	pthread_rwlock_unlock(&dcfg->b->root->hash.root_lock);
 
-	/* Save pointer to sorted_bctl for datasort_swap_disk() */
+	/* Save pointers to sorted bctls for datasort_swap_disk() */
 	dcfg->sorted_bctl = sorted_bctl;
+	dcfg->hot_sorted_bctl = hot_bctl;
 
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: %s: finished", __func__);
 	return 0;
 
-err_unmap:
-	eblob_data_unmap(&index);
-err_free_base:
+err_free_hot:
+	if (hot_bctl != NULL) {
+		/* Data file belongs to the chunk */
+		hot_bctl->data_fd = -1;
+		eblob_base_ctl_cleanup(hot_bctl);
+		free(hot_bctl);
+	}
+err_free_sorted:
+	sorted_bctl->data_fd = -1;
 	eblob_base_ctl_cleanup(sorted_bctl);
 	free(sorted_bctl);
 err:
@@ -1158,24 +1317,16 @@ err:
 }
 
 /**
- * datasort_swap_disk() - swap unsorted base with sorted one on disk.
+ * datasort_swap_disk_base() - moves files of @sorted_bctl made from @chunk
+ * to the place of @unsorted_bctl.
  */
-static int datasort_swap_disk(struct datasort_cfg *dcfg)
+static int datasort_swap_disk_base(struct datasort_cfg *dcfg, struct datasort_chunk *chunk,
+		struct eblob_base_ctl *unsorted_bctl, struct eblob_base_ctl *sorted_bctl)
 {
-	struct eblob_base_ctl *sorted_bctl, *unsorted_bctl;
 	char tmp_index_path[PATH_MAX], index_path[PATH_MAX];
 	char sorted_index_path[PATH_MAX], data_path[PATH_MAX];
 	char mark_path[PATH_MAX];
-	int err, n;
-
-	assert(dcfg != NULL);
-	assert(dcfg->bctl != NULL);
-	assert(dcfg->result != NULL);
-	assert(dcfg->sorted_bctl != NULL);
-
-	/* Shortcuts */
-	unsorted_bctl = dcfg->bctl[0];
-	sorted_bctl = dcfg->sorted_bctl;
+	int err;
 
 	/* Construct index paths */
 	err = datasort_base_get_path(dcfg->b, unsorted_bctl, data_path, PATH_MAX);
@@ -1185,41 +1336,26 @@ static int datasort_swap_disk(struct datasort_cfg *dcfg)
 	}
 
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: data swap start: data: %s -> %s\n",
-			dcfg->result->path, data_path);
+			chunk->path, data_path);
 
 	snprintf(mark_path, PATH_MAX, "%s" EBLOB_DATASORT_SORTED_MARK_SUFFIX, data_path);
 	snprintf(index_path, PATH_MAX, "%s.index", data_path);
 	snprintf(sorted_index_path, PATH_MAX, "%s.sorted", index_path);
 	snprintf(tmp_index_path, PATH_MAX, "%s.tmp", sorted_index_path);
 
-	/*
-	 * Remove old base.
-	 *
-	 * XXX: Removal of files on some file systems is rather heavyweight
-	 * operation - move it out of the lock.
-	 */
-	for (n = 0; n < dcfg->bctl_cnt; ++n)
-		eblob_base_remove(dcfg->bctl[n]);
-
-	/*
-	 * No way back from here!
-	 * FIXME: There is small window when old base is already deleted and
-	 * new still not moved to original location.
-	 */
-
 	/*
 	 * Original file created by mkstemp may have too restrictive
 	 * permissions for use.
 	 *
 	 * TODO: Copy permissions from original file
 	 */
-	if (fchmod(dcfg->result->fd, 0644) == -1)
-		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: fchmod: %d", dcfg->result->fd);
+	if (fchmod(chunk->fd, 0644) == -1)
+		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: fchmod: %d", chunk->fd);
 
 	/* Move files */
-	if (rename(dcfg->result->path, data_path) == -1)
+	if (rename(chunk->path, data_path) == -1)
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: rename: %s -> %s",
-				dcfg->result->path, data_path);
+				chunk->path, data_path);
 	if (rename(tmp_index_path, sorted_index_path) == -1)
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: rename: %s -> %s",
 				tmp_index_path, index_path);
@@ -1240,7 +1376,7 @@ static int datasort_swap_disk(struct datasort_cfg *dcfg)
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO,
 			"defrag: swapped: data: %s -> %s, "
 			"data_fd: %d -> %d, index_fd: %d -> %d",
-			dcfg->result->path, data_path,
+			chunk->path, data_path,
 			sorted_bctl->data_fd, unsorted_bctl->data_fd,
 			eblob_get_index_fd(sorted_bctl),
 			eblob_get_index_fd(unsorted_bctl));
@@ -1250,6 +1386,39 @@ err:
 	return err;
 }
 
+/**
+ * datasort_swap_disk() - swap unsorted base(s) with sorted one(s) on disk.
+ */
+static int datasort_swap_disk(struct datasort_cfg *dcfg)
+{
+	int err, n;
+
+	assert(dcfg != NULL);
+	assert(dcfg->bctl != NULL);
+	assert(dcfg->result != NULL);
+	assert(dcfg->sorted_bctl != NULL);
+
+	/*
+	 * Remove old base.
+	 *
+	 * XXX: Removal of files on some file systems is rather heavyweight
+	 * operation - move it out of the lock.
+	 */
+	for (n = 0; n < dcfg->bctl_cnt; ++n)
+		eblob_base_remove(dcfg->bctl[n]);
+
+	/*
+	 * No way back from here!
+	 * FIXME: There is small window when old base is already deleted and
+	 * new still not moved to original location.
+	 */
+	err = datasort_swap_disk_base(dcfg, dcfg->result, dcfg->bctl[0], dcfg->sorted_bctl);
+	if (err == 0 && dcfg->hot_sorted_bctl != NULL)
+		err = datasort_swap_disk_base(dcfg, dcfg->hot_result, dcfg->bctl[1],
+				dcfg->hot_sorted_bctl);
+	return err;
+}
+
 /**
  * datasort_cleanup() - performs "slow" cleanups.
  */
@@ -1290,8 +1459,9 @@ static void datasort_cleanup(struct datasort_cfg *dcfg)
 	if (rmdir(dcfg->dir) == -1)
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: rmdir: %s", dcfg->dir);
 
-	/* Free resulting chunk and dcfg */
+	/* Free resulting chunk(s) and dcfg */
 	_datasort_destroy_chunk(dcfg->result);
+	_datasort_destroy_chunk(dcfg->hot_result);
 	datasort_destroy(dcfg);
 }
 
@@ -1308,14 +1478,15 @@ static void datasort_cleanup(struct datasort_cfg *dcfg)
  *  - Enable binlog for original base(s)
  *  - Split base(s) into unsorted chunks
  *  - Sort each chunk in ram
- *  - Merge-sort resulted sorted chunks
+ *  - Merge-sort resulted sorted chunks, putting hot keys aside if needed
  *  - Lock original base(s)
- *  - Apply binlog ontop of sorted base
- *  - Replace original base(s) with sorted one
+ *  - Apply binlog ontop of sorted base(s)
+ *  - Replace original base(s) with sorted one(s)
  *  - Unlock now-sorted base
  */
 int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 {
+	uint64_t reserve = 0, records = 0, bytes = 0;
 	int err, n;
 
 	/* Sanity */
@@ -1336,14 +1507,34 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 	if (dcfg->chunk_limit == 0)
 		dcfg->chunk_limit = EBLOB_DATASORT_DEFAULTS_CHUNK_LIMIT;
 
+	/*
+	 * Sorted chunks and merged result co-exist till the end of merge.
+	 * NB! data_offset is not known for bases loaded with sorted index.
+	 */
+	for (n = 0; n < dcfg->bctl_cnt; ++n)
+		reserve += 2 * dcfg->bctl[n]->data_size + dcfg->bctl[n]->index_size;
+	err = eblob_space_reserve_datasort(dcfg->b, reserve);
+	if (err) {
+		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err,
+				"defrag: eblob_space_reserve_datasort: %" PRIu64, reserve);
+		goto err;
+	}
+
 	err = pthread_mutex_init(&dcfg->lock, NULL);
 	if (err) {
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: pthread_mutex_init");
-		goto err;
+		goto err_release;
 	}
 	INIT_LIST_HEAD(&dcfg->unsorted_chunks);
 	INIT_LIST_HEAD(&dcfg->sorted_chunks);
 
+	/* Open bases closed with EBLOB_LAZY_BASES, they stay open till the end */
+	for (n = 0; n < dcfg->bctl_cnt; ++n) {
+		err = eblob_lazy_open(dcfg->bctl[n]);
+		if (err != 0)
+			goto err_mutex;
+	}
+
 	/* Soon we'll be using it */
 	for (n = 0; n < dcfg->bctl_cnt; ++n) {
 		err = eblob_pagecache_hint(dcfg->bctl[n]->data_fd, EBLOB_FLAGS_HINT_WILLNEED);
@@ -1359,7 +1550,7 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 
 		eblob_base_wait_locked(bctl);
 		err = eblob_binlog_start(&bctl->binlog);
-		pthread_mutex_unlock(&bctl->lock);
+		eblob_base_unlock(bctl);
 		if (err != 0) {
 			pthread_mutex_unlock(&dcfg->b->lock);
 			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: eblob_binlog_start: %s",
@@ -1380,6 +1571,13 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 	/*
 	 * Split blob into unsorted chunks
 	 */
+	for (n = 0; n < dcfg->bctl_cnt; ++n) {
+		records += eblob_stat_get(dcfg->bctl[n]->stat, EBLOB_LST_RECORDS_TOTAL)
+			- eblob_stat_get(dcfg->bctl[n]->stat, EBLOB_LST_RECORDS_REMOVED);
+		bytes += dcfg->bctl[n]->data_offset;
+	}
+	eblob_defrag_phase(dcfg->b, EBLOB_DEFRAG_PHASE_SPLIT, records, bytes);
+
 	err = datasort_split(dcfg);
 	if (err) {
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: datasort_split: %s", dcfg->dir);
@@ -1413,6 +1611,18 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 		goto err_rmdir;
 	}
 
+	/* Last chance to stop: swap can not be interrupted */
+	err = eblob_defrag_throttle(dcfg->b);
+	if (err != 0)
+		goto err_destroy_result;
+	records = dcfg->result->count;
+	bytes = dcfg->result->offset;
+	if (dcfg->hot_result != NULL) {
+		records += dcfg->hot_result->count;
+		bytes += dcfg->hot_result->offset;
+	}
+	eblob_defrag_phase(dcfg->b, EBLOB_DEFRAG_PHASE_SWAP, records, bytes);
+
 	/* Lock backend */
 	pthread_mutex_lock(&dcfg->b->lock);
 	/* Wait for pending writes to finish and lock bctl(s) */
@@ -1456,21 +1666,28 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 	 */
 	datasort_cleanup(dcfg);
 
-	/* Mark base as sorted */
+	/* Mark base(s) as sorted */
 	dcfg->sorted_bctl->sorted = 1;
+	if (dcfg->hot_sorted_bctl != NULL)
+		dcfg->hot_sorted_bctl->sorted = 1;
 
 	/* Unlock */
 	for (n = 0; n < dcfg->bctl_cnt; ++n)
-		pthread_mutex_unlock(&dcfg->bctl[n]->lock);
+		eblob_base_unlock(dcfg->bctl[n]);
 	pthread_mutex_unlock(&dcfg->b->lock);
 
+	eblob_space_release_datasort(dcfg->b, reserve, dcfg->space_written);
+
 	eblob_log(dcfg->log, EBLOB_LOG_INFO, "blob: defrag: datasort: success\n");
 	return 0;
 
 err_unlock_bctl:
 	for (n = 0; n < dcfg->bctl_cnt; ++n)
-		pthread_mutex_unlock(&dcfg->bctl[n]->lock);
+		eblob_base_unlock(dcfg->bctl[n]);
 	pthread_mutex_unlock(&dcfg->b->lock);
+err_destroy_result:
+	if (dcfg->hot_result != NULL)
+		datasort_destroy_chunk(dcfg, dcfg->hot_result);
 	datasort_destroy_chunk(dcfg, dcfg->result);
 err_rmdir:
 	if (rmdir(dcfg->dir) == -1)
@@ -1481,7 +1698,14 @@ err_stop:
 			EBLOB_WARNX(dcfg->log, EBLOB_LOG_ERROR, "defrag: eblob_binlog_stop: FAILED");
 err_mutex:
 	datasort_destroy(dcfg);
+err_release:
+	eblob_space_release_datasort(dcfg->b, reserve, dcfg->space_written);
 err:
+	/* Steps report their own errors, but stopped data-sort is not a failure */
+	if (eblob_defrag_stopped(dcfg->b)) {
+		eblob_log(dcfg->log, EBLOB_LOG_INFO, "blob: defrag: datasort: stopped\n");
+		return -EINTR;
+	}
 	eblob_log(dcfg->log, EBLOB_LOG_ERROR, "blob: defrag: datasort: FAILED\n");
 	return err;
 }
@@ -34,6 +34,8 @@
 #define EBLOB_DATASORT_DEFAULTS_CHUNK_SIZE	(1 * 1<<30)
 /* Maximum number of records in chunk */
 #define EBLOB_DATASORT_DEFAULTS_CHUNK_LIMIT	(1 << 17)
+/* Number of merged records between checks of foreground load */
+#define EBLOB_DATASORT_THROTTLE_RECORDS		(1 << 10)
 /* Suffix for flag-file that is created after data is sorted */
 #define EBLOB_DATASORT_SORTED_MARK_SUFFIX	".data_is_sorted"
 
@@ -81,6 +83,8 @@ struct datasort_cfg {
 	struct list_head		sorted_chunks;
 	/* Result of mergesort */
 	struct datasort_chunk		*result;
+	/* Hot keys of the result if they are separated, otherwise NULL */
+	struct datasort_chunk		*hot_result;
 	/* Datasort directory */
 	char				*dir;
 	/* Pointer to backend */
@@ -93,6 +97,10 @@ struct datasort_cfg {
 	int				bctl_cnt;
 	/* Pointer to sorted bctl */
 	struct eblob_base_ctl		*sorted_bctl;
+	/* Sorted bctl of hot keys, it replaces the second original base */
+	struct eblob_base_ctl		*hot_sorted_bctl;
+	/* Bytes of temporary files on disk, see eblob_space_account_datasort() */
+	uint64_t			space_written;
 };
 
 /*
@@ -42,8 +42,136 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+static uint64_t eblob_defrag_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void eblob_defrag_start(struct eblob_backend *b)
+{
+	struct eblob_defrag_state *s = &b->defrag_state;
+
+	s->phase = EBLOB_DEFRAG_PHASE_NONE;
+	s->pause = s->stop = s->waiting = 0;
+	s->bases_total = s->bases_done = 0;
+	s->records_total = s->records_done = 0;
+	s->bytes_total = s->bytes_done = 0;
+	s->work_total = s->work_done = s->work_done_groups = 0;
+	s->wait_start = s->wait_time = 0;
+	s->started = eblob_defrag_now();
+}
+
+static void eblob_defrag_finish(struct eblob_backend *b)
+{
+	struct eblob_defrag_state *s = &b->defrag_state;
+
+	s->phase = EBLOB_DEFRAG_PHASE_NONE;
+	s->started = 0;
+	s->pause = s->stop = s->waiting = 0;
+}
+
+/**
+ * eblob_defrag_stopped() - returns 1 if running defrag of @b should be
+ * abandoned: it was stopped or backend is being closed.
+ */
+int eblob_defrag_stopped(struct eblob_backend *b)
+{
+	return b->defrag_state.stop || eblob_event_get(&b->exit_event);
+}
+
+/*
+ * Returns 1 if load is too high for data-sort of @b, see eblob_idle_busy().
+ * Load is sampled for forced data-sort as well to keep statistics fresh.
+ */
+static int eblob_defrag_busy(struct eblob_backend *b, int device)
+{
+	const int busy = eblob_idle_busy(b, device);
+
+	return busy && !b->idle_forced;
+}
+
+/**
+ * eblob_defrag_throttle() - waits while defrag of @b is paused by
+ * eblob_pause_defrag() or, with EBLOB_IDLE_DATASORT, foreground load is
+ * high and data-sort was not forced. Called by data-sort between units of work.
+ * Returns -EINTR if defrag is stopped or backend is being closed.
+ * NB! Must be called without locks held.
+ */
+int eblob_defrag_throttle(struct eblob_backend *b)
+{
+	struct eblob_defrag_state *s = &b->defrag_state;
+	uint64_t waited;
+
+	if (eblob_defrag_stopped(b))
+		return -EINTR;
+
+	if (!s->pause && !eblob_defrag_busy(b, 0))
+		return 0;
+
+	s->wait_start = eblob_defrag_now();
+	s->waiting = 1;
+	eblob_stat_set(b->stat, EBLOB_GST_DEFRAG_PAUSED, 1);
+	if (s->pause)
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: defrag: paused on request\n",
+				b->cfg.file);
+	else
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: defrag: paused: foreground load: %"
+				PRId64 " ops/s\n", b->cfg.file,
+				eblob_stat_get(b->stat, EBLOB_GST_FOREGROUND_OPS));
+
+	/* Resumed only when device has calmed down too */
+	while (!eblob_defrag_stopped(b)) {
+		if (!s->pause && !eblob_defrag_busy(b, 1))
+			break;
+		eblob_event_wait(&b->exit_event, 1);
+	}
+
+	waited = eblob_defrag_now() - s->wait_start;
+	s->wait_time += waited;
+	s->waiting = 0;
+	eblob_stat_set(b->stat, EBLOB_GST_DEFRAG_PAUSED, 0);
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: defrag: %s after %" PRIu64 " seconds\n",
+			b->cfg.file, eblob_defrag_stopped(b) ? "stopped" : "resumed", waited / 1000);
+
+	return eblob_defrag_stopped(b) ? -EINTR : 0;
+}
+
+/**
+ * eblob_defrag_phase() - data-sort of @b enters @phase that processes
+ * @records records of @bytes bytes in total.
+ */
+void eblob_defrag_phase(struct eblob_backend *b, enum eblob_defrag_phase phase,
+		uint64_t records, uint64_t bytes)
+{
+	struct eblob_defrag_state *s = &b->defrag_state;
+
+	s->phase = phase;
+	s->records_total = records;
+	s->records_done = 0;
+	s->bytes_total = bytes;
+	s->bytes_done = 0;
+}
+
+/**
+ * eblob_defrag_account() - current phase of data-sort of @b processed one
+ * record of @bytes bytes.
+ */
+void eblob_defrag_account(struct eblob_backend *b, uint64_t bytes)
+{
+	struct eblob_defrag_state *s = &b->defrag_state;
+
+	s->records_done++;
+	s->bytes_done += bytes;
+	if (s->phase != EBLOB_DEFRAG_PHASE_SWAP)
+		s->work_done += bytes;
+}
+
 /**
  * eblob_want_defrag() - runs iterator that counts number of non-removed
  * entries (aka good ones) and compares it with total.
@@ -52,6 +180,7 @@
 int eblob_want_defrag(struct eblob_base_ctl *bctl)
 {
 	struct eblob_backend *b = bctl->back;
+	uint64_t blob_size, records_in_blob;
 	int64_t total, removed, size;
 	int err = EBLOB_DEFRAG_NOT_NEEDED;
 
@@ -59,7 +188,7 @@ int eblob_want_defrag(struct eblob_base_ctl *bctl)
 	total = eblob_stat_get(bctl->stat, EBLOB_LST_RECORDS_TOTAL);
 	removed = eblob_stat_get(bctl->stat, EBLOB_LST_RECORDS_REMOVED);
 	size = eblob_stat_get(bctl->stat, EBLOB_LST_BASE_SIZE);
-	pthread_mutex_unlock(&bctl->lock);
+	eblob_base_unlock(bctl);
 
         /* Sanity: Do not remove seem-to-be empty blob if offsets are non-zero */
         if (((removed == 0) && (total == 0)) &&
@@ -76,10 +205,11 @@ int eblob_want_defrag(struct eblob_base_ctl *bctl)
 	 * in both record number AND base size.
 	 * Last condition is needed to properly merge "small" bases into one and is marked as EBLOB_MERGE_NEEDED.
 	 */
+	eblob_base_limits(b, &blob_size, &records_in_blob);
 	if (removed >= total * b->cfg.defrag_percentage / 100)
 		err = EBLOB_DEFRAG_NEEDED;
-	else if (((uint64_t)(total - removed) < b->cfg.records_in_blob / 10) &&
-	    ((uint64_t)size < b->cfg.blob_size / 10))
+	else if (((uint64_t)(total - removed) < records_in_blob / 10) &&
+	    ((uint64_t)size < blob_size / 10))
 		err = EBLOB_MERGE_NEEDED;
 
 	if (total == removed) {
@@ -119,12 +249,15 @@ int eblob_want_defrag(struct eblob_base_ctl *bctl)
  */
 int eblob_defrag(struct eblob_backend *b)
 {
+	struct eblob_defrag_state *s = &b->defrag_state;
 	struct eblob_base_ctl *bctl, **bctls = NULL;
-	int err = 0, bctl_cnt = 0, bctl_num = 0;
+	int err = 0, bctl_cnt = 0, bctl_num = 0, n;
+	uint64_t group_size;
 
 	pthread_mutex_lock(&b->defrag_lock);
 
 	eblob_stat_set(b->stat, EBLOB_GST_DATASORT_START_TIME, time(NULL));
+	eblob_defrag_start(b);
 
 	/* Count approximate number of bases */
 	list_for_each_entry(bctl, &b->bases, base_entry)
@@ -174,7 +307,7 @@ int eblob_defrag(struct eblob_backend *b)
 			/* Wait until bctl is unused */
 			eblob_base_wait_locked(bctl);
 			_eblob_base_ctl_cleanup(bctl);
-			pthread_mutex_unlock(&bctl->lock);
+			eblob_base_unlock(bctl);
 			pthread_mutex_unlock(&b->lock);
 			continue;
 		}
@@ -203,10 +336,18 @@ int eblob_defrag(struct eblob_backend *b)
 	}
 	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "defrag: bases to sort: %d", bctl_cnt);
 
+	/* Every byte is processed by split, sort and merge */
+	s->bases_total = bctl_cnt;
+	for (n = 0; n < bctl_cnt; ++n)
+		s->work_total += 3 * bctls[n]->data_offset;
+
 	/*
 	 * Process bctls in chunks that fit into blob_size and records_in_blob
 	 * limits.
 	 */
+	uint64_t blob_size, records_in_blob;
+	eblob_base_limits(b, &blob_size, &records_in_blob);
+
 	int current = 1, previous = 0;
 	uint64_t total_records = eblob_stat_get(bctls[previous]->stat, EBLOB_LST_RECORDS_TOTAL)
 		- eblob_stat_get(bctls[previous]->stat, EBLOB_LST_RECORDS_REMOVED);
@@ -230,8 +371,8 @@ int eblob_defrag(struct eblob_backend *b)
 			 * Otherwise sort selected bases and use this base in the next accumulation
 			 * NB! We always merge empty bases.
 			 */
-			if (((total_records + records <= b->cfg.records_in_blob)
-						&& (total_size + size <= b->cfg.blob_size))
+			if (((total_records + records <= records_in_blob)
+						&& (total_size + size <= blob_size))
 					|| records == 0) {
 				total_records += records;
 				total_size += size;
@@ -248,18 +389,31 @@ int eblob_defrag(struct eblob_backend *b)
 			.log = b->cfg.log,
 		};
 
+		group_size = 0;
+		for (n = 0; n < dcfg.bctl_cnt; ++n)
+			group_size += dcfg.bctl[n]->data_offset;
+
 		/*
 		 * Sort all bases between @previous and @current
 		 * Do not sort one base if its deframentation is not required.
 		 */
 		if (dcfg.bctl_cnt != 1 || eblob_want_defrag(*dcfg.bctl) == EBLOB_DEFRAG_NEEDED) {
+			if ((err = eblob_defrag_throttle(b)) != 0)
+				break;
 			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO,
 					"defrag: sorting: %d base(s)", current - previous);
 			if ((err = eblob_generate_sorted_data(&dcfg)) != 0)
 				EBLOB_WARNC(b->cfg.log, -err, EBLOB_LOG_ERROR,
 						"defrag: datasort: FAILED");
+			if (err == -EINTR)
+				break;
 		}
 
+		/* Phases estimate their work, so correct progress after each group */
+		s->bases_done += dcfg.bctl_cnt;
+		s->work_done = s->work_done_groups + 3 * group_size;
+		s->work_done_groups = s->work_done;
+
 		/*
 		 * Bump positions use current base in the next accumulation
 		 */
@@ -278,6 +432,8 @@ int eblob_defrag(struct eblob_backend *b)
 	}
 
 err_out_exit:
+	eblob_defrag_finish(b);
+	eblob_hotkey_age(b);
 	eblob_stat_set(b->stat, EBLOB_GST_DATASORT_COMPLETION_STATUS, err);
 	eblob_stat_set(b->stat, EBLOB_GST_DATASORT_COMPLETION_TIME, time(NULL));
 	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "defrag: completed: %d", err);
@@ -287,30 +443,45 @@ err_out_exit:
 }
 
 /**
- * eblob_defrag_thread() - defragmentation thread that runs defrag by timer
+ * eblob_defrag_schedule() - computes time of next timed defrag
  */
-void *eblob_defrag_thread(void *data)
+static void eblob_defrag_schedule(struct eblob_backend *b)
 {
-	struct eblob_backend *b = data;
-	uint64_t sleep_time;
+	uint64_t next = datasort_next_defrag(b);
 
-	if (b == NULL)
-		return NULL;
+	/* Idle data-sort alone is due every defrag_timeout */
+	if (next == -1ULL && (b->cfg.blob_flags & EBLOB_IDLE_DATASORT))
+		next = EBLOB_MAX(b->cfg.defrag_timeout, EBLOB_DEFAULT_DEFRAG_MIN_TIMEOUT);
 
-	sleep_time = datasort_next_defrag(b);
-	while (1) {
-		if ((sleep_time-- != 0) && (b->want_defrag == 0)) {
-			if (eblob_event_wait(&b->exit_event, 1) != -ETIMEDOUT)
-				break;
-			continue;
-		}
+	b->defrag_next = (next == -1ULL) ? -1ULL : (uint64_t)time(NULL) + next;
+}
 
-		eblob_defrag(b);
-		b->want_defrag = 0;
-		sleep_time = datasort_next_defrag(b);
-	}
+/**
+ * eblob_defrag_tick() - background task that runs defrag if it is requested
+ * or its time has come and, with EBLOB_IDLE_DATASORT, backend is idle.
+ */
+int eblob_defrag_tick(struct eblob_backend *b)
+{
+	if (b->defrag_next == 0)
+		eblob_defrag_schedule(b);
+
+	if (b->cfg.blob_flags & EBLOB_IDLE_DATASORT)
+		eblob_idle_sample(b);
 
-	return NULL;
+	if (((uint64_t)time(NULL) < b->defrag_next) && (b->want_defrag == 0))
+		return 0;
+
+	if (!eblob_defrag_idle(b))
+		return 0;
+
+	/* Data-sort requested by user is not paused by foreground load either */
+	if (b->want_defrag)
+		b->idle_forced = 1;
+	eblob_defrag(b);
+	b->idle_forced = 0;
+	b->want_defrag = 0;
+	eblob_defrag_schedule(b);
+	return 0;
 }
 
 /**
@@ -341,3 +512,83 @@ int eblob_defrag_status(struct eblob_backend *b)
 
 	return b->want_defrag;
 }
+
+int eblob_defrag_progress(struct eblob_backend *b, struct eblob_defrag_progress *p)
+{
+	struct eblob_defrag_state *s;
+	uint64_t started, now, active, work_total, work_done;
+
+	if (b == NULL || p == NULL)
+		return -EINVAL;
+
+	s = &b->defrag_state;
+	memset(p, 0, sizeof(struct eblob_defrag_progress));
+	p->eta = -1;
+
+	started = s->started;
+	if (started == 0)
+		return 0;
+
+	p->phase = s->phase;
+	p->paused = s->waiting;
+	p->bases_total = s->bases_total;
+	p->bases_done = s->bases_done;
+	p->records_total = s->records_total;
+	p->records_done = s->records_done;
+	p->bytes_total = s->bytes_total;
+	p->bytes_done = s->bytes_done;
+
+	/* Time spent paused does not count towards throughput */
+	now = eblob_defrag_now();
+	active = now - started - s->wait_time;
+	if (p->paused && now > s->wait_start)
+		active -= EBLOB_MIN(now - s->wait_start, active);
+	p->elapsed = active / 1000;
+
+	work_total = s->work_total;
+	work_done = s->work_done;
+	if (work_total != 0 && work_done >= work_total)
+		p->eta = 0;
+	else if (work_done != 0)
+		p->eta = (double)(work_total - work_done) * active / work_done / 1000 + 1;
+
+	return 0;
+}
+
+int eblob_pause_defrag(struct eblob_backend *b)
+{
+	if (b == NULL)
+		return -EINVAL;
+	if (b->defrag_state.started == 0)
+		return -ENOENT;
+
+	b->defrag_state.pause = 1;
+	return 0;
+}
+
+int eblob_resume_defrag(struct eblob_backend *b)
+{
+	if (b == NULL)
+		return -EINVAL;
+	if (b->defrag_state.started == 0)
+		return -ENOENT;
+
+	b->defrag_state.pause = 0;
+	return 0;
+}
+
+int eblob_stop_defrag(struct eblob_backend *b)
+{
+	if (b == NULL)
+		return -EINVAL;
+
+	if (b->defrag_state.started == 0) {
+		if (b->want_defrag == 0)
+			return -ENOENT;
+		b->want_defrag = 0;
+		return 0;
+	}
+
+	b->defrag_state.stop = 1;
+	return 0;
+}
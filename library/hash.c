@@ -54,10 +54,11 @@ static inline void eblob_hash_entry_put(struct eblob_hash *h __attribute_unused_
 	free(e);
 }
 
-static int eblob_hash_entry_add(struct eblob_hash *hash, struct eblob_key *key, void *data, int replace, int *replaced)
+static int eblob_hash_entry_add(struct eblob_hash *hash, uint32_t ns, struct eblob_key *key,
+		void *data, int replace, int *replaced)
 {
 	struct rb_node **n, *parent;
-	uint64_t esize = sizeof(struct eblob_hash_entry) + hash->dsize;
+	uint64_t esize = EBLOB_HASH_ENTRY_ALLOC_SIZE(hash->dsize);
 	struct eblob_hash_entry *e, *t;
 	int err, cmp;
 
@@ -69,7 +70,7 @@ static int eblob_hash_entry_add(struct eblob_hash *hash, struct eblob_key *key,
 
 		t = rb_entry(parent, struct eblob_hash_entry, node);
 
-		cmp = eblob_id_cmp(t->key.id, key->id);
+		cmp = eblob_hash_entry_cmp(t, ns, key->id);
 		if (cmp < 0)
 			n = &parent->rb_left;
 		else if (cmp > 0)
@@ -95,9 +96,10 @@ static int eblob_hash_entry_add(struct eblob_hash *hash, struct eblob_key *key,
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
-	memset(e, 0, sizeof(struct eblob_hash_entry));
+	memset(e, 0, offsetof(struct eblob_hash_entry, data));
 
 	memcpy(&e->key, key, sizeof(struct eblob_key));
+	e->ns = ns;
 	memcpy(e->data, data, hash->dsize);
 
 	rb_link_node(&e->node, parent, n);
@@ -145,12 +147,12 @@ void eblob_hash_destroy(struct eblob_hash *h)
 	pthread_rwlock_destroy(&h->root_lock);
 }
 
-int eblob_hash_replace_nolock(struct eblob_hash *h, struct eblob_key *key, void *data, int *replaced)
+int eblob_hash_replace_nolock(struct eblob_hash *h, uint32_t ns, struct eblob_key *key, void *data, int *replaced)
 {
-	return eblob_hash_entry_add(h, key, data, 1, replaced);
+	return eblob_hash_entry_add(h, ns, key, data, 1, replaced);
 }
 
-static struct eblob_hash_entry *eblob_hash_search(struct rb_root *root, struct eblob_key *key)
+static struct eblob_hash_entry *eblob_hash_search(struct rb_root *root, uint32_t ns, struct eblob_key *key)
 {
 	struct rb_node *n = root->rb_node;
 	struct eblob_hash_entry *t = NULL;
@@ -159,7 +161,7 @@ static struct eblob_hash_entry *eblob_hash_search(struct rb_root *root, struct e
 	while (n) {
 		t = rb_entry(n, struct eblob_hash_entry, node);
 
-		cmp = eblob_id_cmp(t->key.id, key->id);
+		cmp = eblob_hash_entry_cmp(t, ns, key->id);
 		if (cmp < 0)
 			n = n->rb_left;
 		else if (cmp > 0)
@@ -171,11 +173,11 @@ static struct eblob_hash_entry *eblob_hash_search(struct rb_root *root, struct e
 	return NULL;
 }
 
-int eblob_hash_remove_nolock(struct eblob_hash *h, struct eblob_key *key)
+int eblob_hash_remove_nolock(struct eblob_hash *h, uint32_t ns, struct eblob_key *key)
 {
 	struct eblob_hash_entry *e;
 
-	e = eblob_hash_search(&h->root, key);
+	e = eblob_hash_search(&h->root, ns, key);
 	if (e) {
 		rb_erase(&e->node, &h->root);
 		eblob_hash_entry_put(h, e);
@@ -185,14 +187,41 @@ int eblob_hash_remove_nolock(struct eblob_hash *h, struct eblob_key *key)
 	return -ENOENT;
 }
 
+/**
+ * eblob_hash_remove_ns_nolock() - drops all entries of namespace @ns,
+ * returns number of removed entries.
+ */
+uint64_t eblob_hash_remove_ns_nolock(struct eblob_hash *h, uint32_t ns)
+{
+	struct rb_node *n, *t;
+	uint64_t removed = 0;
+
+	for (n = rb_first(&h->root); n != NULL; n = t) {
+		struct eblob_hash_entry *e = rb_entry(n, struct eblob_hash_entry, node);
+
+		t = rb_next(n);
+		/* Tree is in descending order */
+		if (e->ns > ns)
+			continue;
+		if (e->ns < ns)
+			break;
+
+		rb_erase(n, &h->root);
+		eblob_hash_entry_put(h, e);
+		removed++;
+	}
+
+	return removed;
+}
+
 /**
  * eblob_hash_lookup_alloc_nolock() - returns copy of data stored in cache
  */
-int eblob_hash_lookup_nolock(struct eblob_hash *h, struct eblob_key *key, void *data)
+int eblob_hash_lookup_nolock(struct eblob_hash *h, uint32_t ns, struct eblob_key *key, void *data)
 {
 	struct eblob_hash_entry *e;
 
-	e = eblob_hash_search(&h->root, key);
+	e = eblob_hash_search(&h->root, ns, key);
 	if (e == NULL)
 		return -ENOENT;
 
@@ -200,12 +229,12 @@ int eblob_hash_lookup_nolock(struct eblob_hash *h, struct eblob_key *key, void *
 	return 0;
 }
 
-int eblob_hash_lookup(struct eblob_hash *h, struct eblob_key *key, void *data)
+int eblob_hash_lookup(struct eblob_hash *h, uint32_t ns, struct eblob_key *key, void *data)
 {
 	int err;
 
 	pthread_rwlock_rdlock(&h->root_lock);
-	err = eblob_hash_lookup_nolock(h, key, data);
+	err = eblob_hash_lookup_nolock(h, ns, key, data);
 	pthread_rwlock_unlock(&h->root_lock);
 	return err;
 }
@@ -24,6 +24,7 @@
 #include "list.h"
 #include "rbtree.h"
 
+#include <stddef.h>
 #include <strings.h>
 
 struct eblob_hash {
@@ -34,15 +35,36 @@ struct eblob_hash {
 
 int eblob_hash_init(struct eblob_hash *h, unsigned int dsize);
 void eblob_hash_destroy(struct eblob_hash *h);
-int eblob_hash_remove_nolock(struct eblob_hash *h, struct eblob_key *key);
-int eblob_hash_lookup_nolock(struct eblob_hash *h, struct eblob_key *key, void *datap);
-int eblob_hash_lookup(struct eblob_hash *h, struct eblob_key *key, void *datap);
-int eblob_hash_replace_nolock(struct eblob_hash *h, struct eblob_key *key, void *data, int *replaced);
+int eblob_hash_remove_nolock(struct eblob_hash *h, uint32_t ns, struct eblob_key *key);
+int eblob_hash_lookup_nolock(struct eblob_hash *h, uint32_t ns, struct eblob_key *key, void *datap);
+int eblob_hash_lookup(struct eblob_hash *h, uint32_t ns, struct eblob_key *key, void *datap);
+int eblob_hash_replace_nolock(struct eblob_hash *h, uint32_t ns, struct eblob_key *key, void *data, int *replaced);
+uint64_t eblob_hash_remove_ns_nolock(struct eblob_hash *h, uint32_t ns);
 
+/*
+ * Entries are ordered by namespace id first, so keys of one namespace form
+ * a contiguous range of the tree.
+ * @ns is placed last so that it takes alignment hole in front of @data,
+ * entries are allocated without tail padding, hence @data is not aligned and
+ * should be accessed by memcpy().
+ */
 struct eblob_hash_entry {
-	struct eblob_key	key;
 	struct rb_node		node;
+	struct eblob_key	key;
+	uint32_t		ns;
 	unsigned char		data[];
 };
 
+/* Size of entry with @dsize bytes of data */
+#define EBLOB_HASH_ENTRY_ALLOC_SIZE(dsize) \
+	(offsetof(struct eblob_hash_entry, data) + (dsize))
+
+static inline int eblob_hash_entry_cmp(const struct eblob_hash_entry *e,
+		uint32_t ns, const unsigned char *id)
+{
+	if (e->ns != ns)
+		return e->ns < ns ? -1 : 1;
+	return eblob_id_cmp(e->key.id, id);
+}
+
 #endif /* __EBLOB_HASH_H */
@@ -0,0 +1,163 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Update frequency of keys for hot/cold data-sort (EBLOB_HOT_COLD_DATASORT).
+ *
+ * Every update that moves existing record to the open base, leaving garbage
+ * in the old one, is counted in count-min sketch with conservative update
+ * and saturating 8-bit counters. Keys of sorted bases are not kept in memory,
+ * so sketch is the only place their history lives. Counters are halved after
+ * each data-sort run, so hotness reflects updates of the last few runs.
+ *
+ * Data-sort routes keys updated at least hot_key_updates times to separate
+ * base, so that bases of stable keys do not gather removed records and are
+ * rarely rewritten again.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Number of rows of the sketch */
+#define EBLOB_HOTKEY_DEPTH		(4)
+/* Bounds of row width, it follows records_in_blob in between */
+#define EBLOB_HOTKEY_MIN_WIDTH		(1ULL << 12)
+#define EBLOB_HOTKEY_MAX_WIDTH		(1ULL << 20)
+
+/*
+ * FNV-1a of the key, rows are indexed by double hashing of its halves.
+ */
+static uint64_t eblob_hotkey_hash(const struct eblob_key *key)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int i;
+
+	for (i = 0; i < EBLOB_ID_SIZE; ++i) {
+		h ^= key->id[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t eblob_hotkey_cell(const struct eblob_backend *b, uint64_t hash, int row)
+{
+	const uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+
+	return row * b->hotkey_width + ((h1 + (uint64_t)row * h2) & (b->hotkey_width - 1));
+}
+
+/**
+ * eblob_hotkey_init() - allocates sketch of @b if EBLOB_HOT_COLD_DATASORT
+ * is set.
+ */
+int eblob_hotkey_init(struct eblob_backend *b)
+{
+	uint64_t width = EBLOB_HOTKEY_MIN_WIDTH;
+
+	if (!(b->cfg.blob_flags & EBLOB_HOT_COLD_DATASORT))
+		return 0;
+
+	while (width < b->cfg.records_in_blob && width < EBLOB_HOTKEY_MAX_WIDTH)
+		width <<= 1;
+
+	b->hotkey_sketch = calloc(EBLOB_HOTKEY_DEPTH, width);
+	if (b->hotkey_sketch == NULL)
+		return -ENOMEM;
+	b->hotkey_width = width;
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: hot/cold datasort: sketch: %d x %" PRIu64
+			", hot after %d updates\n", b->cfg.file, EBLOB_HOTKEY_DEPTH, width,
+			b->cfg.hot_key_updates);
+	return 0;
+}
+
+void eblob_hotkey_cleanup(struct eblob_backend *b)
+{
+	free(b->hotkey_sketch);
+	b->hotkey_sketch = NULL;
+	b->hotkey_width = 0;
+}
+
+/**
+ * eblob_hotkey_update() - counts update of @key.
+ * NB! Caller should hold b->lock.
+ */
+void eblob_hotkey_update(struct eblob_backend *b, const struct eblob_key *key)
+{
+	const uint64_t hash = eblob_hotkey_hash(key);
+	uint8_t *cell[EBLOB_HOTKEY_DEPTH], min = UINT8_MAX;
+	int row;
+
+	if (b->hotkey_sketch == NULL)
+		return;
+
+	for (row = 0; row < EBLOB_HOTKEY_DEPTH; ++row) {
+		cell[row] = &b->hotkey_sketch[eblob_hotkey_cell(b, hash, row)];
+		if (*cell[row] < min)
+			min = *cell[row];
+	}
+
+	/* Conservative update: only the smallest counters are estimate of the key */
+	if (min == UINT8_MAX)
+		return;
+	for (row = 0; row < EBLOB_HOTKEY_DEPTH; ++row)
+		if (*cell[row] == min)
+			*cell[row] = min + 1;
+}
+
+/**
+ * eblob_hotkey_is_hot() - returns 1 if @key was updated at least
+ * hot_key_updates times recently.
+ * Called by data-sort without b->lock: counters are estimate anyway, and
+ * racing update can only shift decision for key being updated right now.
+ */
+int eblob_hotkey_is_hot(struct eblob_backend *b, const struct eblob_key *key)
+{
+	const uint64_t hash = eblob_hotkey_hash(key);
+	int row;
+
+	if (b->hotkey_sketch == NULL)
+		return 0;
+
+	for (row = 0; row < EBLOB_HOTKEY_DEPTH; ++row)
+		if (b->hotkey_sketch[eblob_hotkey_cell(b, hash, row)] < b->cfg.hot_key_updates)
+			return 0;
+	return 1;
+}
+
+/**
+ * eblob_hotkey_age() - halves all counters of @b, called after data-sort
+ * run.
+ */
+void eblob_hotkey_age(struct eblob_backend *b)
+{
+	uint64_t i;
+
+	if (b->hotkey_sketch == NULL)
+		return;
+
+	pthread_mutex_lock(&b->lock);
+	for (i = 0; i < EBLOB_HOTKEY_DEPTH * b->hotkey_width; ++i)
+		b->hotkey_sketch[i] >>= 1;
+	pthread_mutex_unlock(&b->lock);
+}
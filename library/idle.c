@@ -0,0 +1,213 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Idle-aware data-sort (EBLOB_IDLE_DATASORT).
+ *
+ * Defrag task samples utilization and queue of backend's block device from
+ * /sys/dev/block/<maj:min>/stat and rate of backend's own reads and writes.
+ * Due data-sort waits till both have been low for defrag_idle_time seconds.
+ * While it runs device utilization includes its own I/O, so only foreground
+ * operation rate is used to pause it, and it is resumed when both foreground
+ * rate and device load are low again, see eblob_defrag_throttle().
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Minimal interval between samples */
+#define EBLOB_IDLE_SAMPLE_MS		(1000)
+/* Device with more requests in flight is busy regardless of utilization */
+#define EBLOB_IDLE_MAX_IN_FLIGHT	(4)
+
+static uint64_t eblob_idle_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Finds statistics file of the device @b lives on. Devices without one
+ * (tmpfs, network filesystems) are judged by foreground rate only.
+ */
+static void eblob_idle_init(struct eblob_backend *b)
+{
+	char dir[PATH_MAX], *tmp;
+	struct stat st;
+
+	b->idle_stat_path[0] = '\0';
+
+	snprintf(dir, sizeof(dir), "%s", b->cfg.file);
+	tmp = strrchr(dir, '/');
+	if (tmp != NULL)
+		*tmp = '\0';
+	else
+		snprintf(dir, sizeof(dir), ".");
+
+	if (stat(dir, &st) == -1 || major(st.st_dev) == 0)
+		goto err_out_nodev;
+
+	snprintf(b->idle_stat_path, sizeof(b->idle_stat_path), "/sys/dev/block/%u:%u/stat",
+			major(st.st_dev), minor(st.st_dev));
+	if (access(b->idle_stat_path, R_OK) == 0)
+		return;
+
+	b->idle_stat_path[0] = '\0';
+err_out_nodev:
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: idle datasort: device statistics "
+			"are not available, using foreground operation rate only\n", b->cfg.file);
+}
+
+/*
+ * Reads time device was busy in milliseconds and number of requests in
+ * flight, see Documentation/block/stat.txt
+ */
+static int eblob_idle_read_device(const char *path, uint64_t *io_ticks, uint64_t *in_flight)
+{
+	unsigned long long v[11];
+	FILE *f;
+	int err;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -errno;
+
+	err = fscanf(f, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10]);
+	fclose(f);
+	if (err != 11)
+		return -EINVAL;
+
+	*in_flight = v[8];
+	*io_ticks = v[9];
+	return 0;
+}
+
+/**
+ * eblob_idle_sample() - samples load of @b if previous sample is older than
+ * EBLOB_IDLE_SAMPLE_MS and updates its idleness.
+ */
+void eblob_idle_sample(struct eblob_backend *b)
+{
+	const uint64_t now = eblob_idle_now();
+	uint64_t ops, io_ticks = 0, in_flight = 0, elapsed, rate, util = 0;
+	int device = 0;
+
+	if (b->idle_sampled == 0)
+		eblob_idle_init(b);
+	else if (now - b->idle_sampled < EBLOB_IDLE_SAMPLE_MS)
+		return;
+
+	ops = eblob_stat_get(b->stat, EBLOB_GST_WRITES_NUMBER)
+		+ eblob_stat_get(b->stat, EBLOB_GST_DATA_READS_NUMBER)
+		+ eblob_stat_get(b->stat, EBLOB_GST_LOOKUP_READS_NUMBER);
+
+	if (b->idle_stat_path[0] != '\0')
+		device = eblob_idle_read_device(b->idle_stat_path, &io_ticks, &in_flight) == 0;
+
+	if (b->idle_sampled != 0) {
+		elapsed = now - b->idle_sampled;
+		rate = (ops - b->idle_ops) * 1000 / elapsed;
+		if (device && io_ticks >= b->idle_io_ticks)
+			util = EBLOB_MIN((io_ticks - b->idle_io_ticks) * 100 / elapsed, 100);
+
+		b->idle_foreground_busy = rate > (uint64_t)b->cfg.defrag_idle_ops;
+		b->idle_device_busy = util > (uint64_t)b->cfg.defrag_idle_util
+			|| in_flight > EBLOB_IDLE_MAX_IN_FLIGHT;
+
+		if (b->idle_foreground_busy || b->idle_device_busy)
+			b->idle_since = 0;
+		else if (b->idle_since == 0)
+			b->idle_since = b->idle_sampled;
+
+		eblob_stat_set(b->stat, EBLOB_GST_DEVICE_UTIL, util);
+		eblob_stat_set(b->stat, EBLOB_GST_DEVICE_IN_FLIGHT, in_flight);
+		eblob_stat_set(b->stat, EBLOB_GST_FOREGROUND_OPS, rate);
+		eblob_stat_set(b->stat, EBLOB_GST_IDLE_TIME,
+				b->idle_since ? (now - b->idle_since) / 1000 : 0);
+	}
+
+	b->idle_sampled = now;
+	b->idle_ops = ops;
+	b->idle_io_ticks = io_ticks;
+}
+
+/**
+ * eblob_defrag_idle() - decides whether due data-sort of @b can start: with
+ * EBLOB_IDLE_DATASORT when backend has been idle for defrag_idle_time
+ * seconds or data-sort waits for it longer than defrag_timeout. In the latter
+ * case data-sort is forced: it is not paused by foreground load.
+ */
+int eblob_defrag_idle(struct eblob_backend *b)
+{
+	const uint64_t now = eblob_idle_now();
+
+	if (!(b->cfg.blob_flags & EBLOB_IDLE_DATASORT))
+		return 1;
+
+	if (b->idle_due == 0)
+		b->idle_due = now;
+
+	if (b->idle_since != 0 && now - b->idle_since >= 1000ULL * b->cfg.defrag_idle_time) {
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: idle datasort: starting after %" PRIu64
+				" seconds of idleness\n", b->cfg.file, (now - b->idle_since) / 1000);
+		b->idle_forced = 0;
+		goto out_start;
+	}
+
+	if (now - b->idle_due >= 1000ULL * b->cfg.defrag_timeout) {
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: idle datasort: starting on busy device "
+				"after waiting for %" PRIu64 " seconds\n", b->cfg.file, (now - b->idle_due) / 1000);
+		b->idle_forced = 1;
+		goto out_start;
+	}
+
+	return 0;
+
+out_start:
+	b->idle_due = 0;
+	return 1;
+}
+
+/**
+ * eblob_idle_busy() - samples load of @b and returns 1 if foreground load or,
+ * with @device, load of the device is too high for data-sort to run.
+ * Always 0 without EBLOB_IDLE_DATASORT.
+ */
+int eblob_idle_busy(struct eblob_backend *b, int device)
+{
+	if (!(b->cfg.blob_flags & EBLOB_IDLE_DATASORT))
+		return 0;
+
+	eblob_idle_sample(b);
+	return b->idle_foreground_busy || (device && b->idle_device_busy);
+}
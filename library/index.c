@@ -41,6 +41,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -178,6 +179,10 @@ struct eblob_index_block *eblob_index_blocks_search_nolock(struct eblob_base_ctl
 		return NULL;
 	}
 
+	/* Searches of base are only counted to balance summaries, see summary.c */
+	if (bctl->back->cfg.summary_memory_limit != 0)
+		atomic_inc(&bctl->summary_heat);
+
 	t = eblob_index_blocks_search_nolock_bsearch_nobloom(bctl, dc, st);
 	if (!t)
 		st->no_block++;
@@ -187,24 +192,22 @@ struct eblob_index_block *eblob_index_blocks_search_nolock(struct eblob_base_ctl
 }
 
 /*!
- * Calculate bloom filter size based on index file size
+ * Calculate number of bloom filter bits based on index file size
  */
-static uint64_t eblob_bloom_size(const struct eblob_base_ctl *bctl)
+uint64_t eblob_bloom_bits(const struct eblob_base_ctl *bctl)
 {
-	uint64_t bloom_size = 0;
+	uint64_t bloom_bits = 0;
 
 	/* Number of record in base */
-	bloom_size += bctl->sort.size / sizeof(struct eblob_disk_control);
+	bloom_bits += bctl->sort.size / sizeof(struct eblob_disk_control);
 	/* Number of index blocks in base */
-	bloom_size /= bctl->back->cfg.index_block_size;
+	bloom_bits /= bctl->back->cfg.index_block_size;
 	/* Add one for tiny bases */
-	bloom_size += 1;
+	bloom_bits += 1;
 	/* Number of bits in bloom for one block */
-	bloom_size *= bctl->back->cfg.index_block_bloom_length;
-	/* Size of byte */
-	bloom_size /= 8;
+	bloom_bits *= bctl->back->cfg.index_block_bloom_length;
 
-	return bloom_size;
+	return bloom_bits;
 }
 
 /*!
@@ -220,7 +223,7 @@ static uint8_t eblob_bloom_func_num(const struct eblob_base_ctl *bctl)
 	uint64_t bits_per_key;
 	uint8_t func_num = 0;
 
-	bits_per_key = 8 * bctl->bloom_size /
+	bits_per_key = bctl->bloom_bits /
 		(bctl->sort.size / sizeof(struct eblob_disk_control));
 	func_num = bits_per_key * 0.69;
 	if (func_num == 0)
@@ -240,8 +243,11 @@ int eblob_index_blocks_fill(struct eblob_base_ctl *bctl)
 	unsigned int i;
 	int err = 0;
 
+	bctl->index_block_shift = 0;
+
 	/* Allocate bloom filter */
-	bctl->bloom_size = eblob_bloom_size(bctl);
+	bctl->bloom_bits = eblob_bloom_bits(bctl);
+	bctl->bloom_size = howmany(bctl->bloom_bits, 8);
 	EBLOB_WARNX(bctl->back->cfg.log, EBLOB_LOG_NOTICE,
 			"index: bloom filter size: %" PRIu64, bctl->bloom_size);
 
@@ -339,39 +345,44 @@ static struct eblob_disk_control *eblob_find_on_disk(struct eblob_backend *b,
 	struct eblob_disk_control *sorted, *end, *sorted_orig, *start, *found = NULL;
 	struct eblob_disk_control *search_start, *search_end;
 	struct eblob_index_block *block;
+	uint64_t block_offset;
 	size_t num;
 	const int hdr_size = sizeof(struct eblob_disk_control);
 
 	st->search_on_disk++;
 
-	end = bctl->sort.data + bctl->sort.size;
-	start = bctl->sort.data;
-
-	pthread_rwlock_rdlock(&bctl->index_blocks_lock);
+	if (eblob_summary_rdlock(bctl) != 0)
+		goto out;
 	block = eblob_index_blocks_search_nolock(bctl, dc, st);
 	if (block) {
-		assert((bctl->sort.size - block->start_offset) / hdr_size > 0);
-		assert((bctl->sort.size - block->start_offset) % hdr_size == 0);
-
-		num = (bctl->sort.size - block->start_offset) / hdr_size;
+		assert((block->end_offset - block->start_offset) / hdr_size > 0);
+		assert((block->end_offset - block->start_offset) % hdr_size == 0);
 
-		if (num > b->cfg.index_block_size)
-			num = b->cfg.index_block_size;
+		/* Block may be coarser than index_block_size, see summary.c */
+		num = (block->end_offset - block->start_offset) / hdr_size;
 
-		search_start = bctl->sort.data + block->start_offset;
-		/*
-		 * We do not use @block->end_offset here, since it points to
-		 * the start offset of the *next* record, which potentially
-		 * can be outside of the index, i.e. be equal to the size of
-		 * the index.
-		 */
-		search_end = search_start + (num - 1);
+		block_offset = block->start_offset;
 	} else {
 		pthread_rwlock_unlock(&bctl->index_blocks_lock);
 		goto out;
 	}
 	pthread_rwlock_unlock(&bctl->index_blocks_lock);
 
+	/* Only now sorted index itself is needed */
+	if (eblob_lazy_open(bctl) != 0)
+		goto out;
+
+	end = bctl->sort.data + bctl->sort.size;
+	start = bctl->sort.data;
+	search_start = bctl->sort.data + block_offset;
+	/*
+	 * We do not use @block->end_offset here, since it points to
+	 * the start offset of the *next* record, which potentially
+	 * can be outside of the index, i.e. be equal to the size of
+	 * the index.
+	 */
+	search_end = search_start + (num - 1);
+
 	st->bsearch_reached++;
 
 	sorted_orig = bsearch(dc, search_start, num, sizeof(struct eblob_disk_control), eblob_disk_control_sort);
@@ -437,6 +448,95 @@ ssize_t eblob_get_actual_size(int fd)
 	return st.st_size;
 }
 
+/*
+ * Recovers batches written by eblob_write_atomic() that were interrupted by
+ * crash: batch is kept only if its last entry has TXN_COMMIT set, otherwise
+ * all its entries are marked removed. Either way transaction flags are
+ * dropped, so this must be done on base open before anybody reads the index.
+ *
+ * Entries are fixed strictly in index order - that keeps partially fixed
+ * batch resolvable if we crash again in the middle.
+ */
+int eblob_txn_recover(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	struct eblob_map_fd src;
+	struct eblob_disk_control *dc;
+	uint64_t i, k, end, num, flags, fixed = 0, dropped = 0;
+	int committed, err;
+
+	memset(&src, 0, sizeof(src));
+
+	src.fd = bctl->index_fd;
+	src.size = bctl->index_size;
+
+	num = src.size / sizeof(struct eblob_disk_control);
+	if (num == 0)
+		return 0;
+
+	err = eblob_data_map(&src);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: index: txn-map: index: %d, size: %llu: %s %d\n",
+				bctl->index, (unsigned long long)src.size, strerror(-err), err);
+		return err;
+	}
+
+	dc = src.data;
+	for (i = 0; i < num; i = end) {
+		flags = eblob_bswap64(dc[i].flags);
+		end = i + 1;
+		if (!(flags & BLOB_DISK_CTL_TXN) || (flags & BLOB_DISK_CTL_REMOVE))
+			continue;
+
+		/* Find the end of the batch, removed entry means it was aborted */
+		committed = 0;
+		for (end = i; end < num; ++end) {
+			flags = eblob_bswap64(dc[end].flags);
+			if (!(flags & BLOB_DISK_CTL_TXN) || (flags & BLOB_DISK_CTL_REMOVE))
+				break;
+			if (flags & BLOB_DISK_CTL_TXN_LAST) {
+				committed = !!(flags & BLOB_DISK_CTL_TXN_COMMIT);
+				end++;
+				break;
+			}
+		}
+
+		for (k = i; k < end; ++k) {
+			flags = eblob_bswap64(dc[k].flags);
+			if (committed)
+				flags &= ~BLOB_DISK_CTL_TXN_MASK;
+			else
+				flags = BLOB_DISK_CTL_REMOVE;
+
+			if (eblob_bswap64(dc[k].position) + sizeof(struct eblob_disk_control) <= bctl->data_size) {
+				err = eblob_write_index_flags(bctl->data_fd, eblob_bswap64(dc[k].position), flags);
+				if (err)
+					goto err_out_unmap;
+			}
+			dc[k].flags = eblob_bswap64(flags);
+		}
+
+		fixed += end - i;
+		if (!committed)
+			dropped += end - i;
+	}
+
+	if (fixed == 0)
+		goto err_out_unmap;
+
+	if (msync(src.data, src.size, MS_SYNC) == -1) {
+		err = -errno;
+		goto err_out_unmap;
+	}
+	eblob_fdatasync(bctl->data_fd);
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: index: %d: recovered transaction entries: %" PRIu64
+			", dropped as uncommitted: %" PRIu64 "\n", bctl->index, fixed, dropped);
+
+err_out_unmap:
+	eblob_data_unmap(&src);
+	return err;
+}
+
 int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *bctl)
 {
 	struct eblob_map_fd src, dst;
@@ -511,10 +611,12 @@ int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *
 	err = msync(dst.data, dst.size, MS_SYNC);
 	if (err == -1)
 		goto err_out_unmap_dst;
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_INDEX, dst.size);
 
-	pthread_mutex_lock(&bctl->lock);
+	/* Lookups read bctl->sort without bctl->lock */
+	eblob_base_wait_locked(bctl);
 	bctl->sort = dst;
-	pthread_mutex_unlock(&bctl->lock);
+	eblob_base_unlock(bctl);
 
 	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: index: generated sorted: index: %d, "
 			"index-size: %llu, data-size: %llu, file: %s\n",
@@ -555,8 +657,12 @@ static char *eblob_dump_search_stat(const struct eblob_disk_search_stat *st, int
 	return ss;
 }
 
-int eblob_disk_index_lookup(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_ram_control *rctl)
+/**
+ * eblob_disk_index_lookup_older() - looks up @key in sorted indexes of bases
+ * whose index is less than @index, newest first.
+ */
+int eblob_disk_index_lookup_older(struct eblob_backend *b, struct eblob_key *key,
+		int index, struct eblob_ram_control *rctl)
 {
 	react_start_action(ACTION_EBLOB_DISK_INDEX_LOOKUP);
 
@@ -570,6 +676,9 @@ int eblob_disk_index_lookup(struct eblob_backend *b, struct eblob_key *key,
 
 again:
 	list_for_each_entry_reverse(bctl, &b->bases, base_entry) {
+		if (bctl->index >= index)
+			continue;
+
 		/* Count number of loops before break */
 		++st.loops;
 		/* Protect against datasort */
@@ -582,15 +691,18 @@ again:
 		 * was mentioned - it's really rare case.
 		 * TODO: Probably we should check for this inside eblob_bctl_hold()
 		 */
-		if (bctl->index_fd < 0) {
+		if (bctl->index_fd < 0 && !bctl->lazy_closed) {
 			eblob_bctl_release(bctl);
 			if (tries++ > max_tries)
 				return -EDEADLK;
 			goto again;
 		}
 
-		/* If bctl does not have sorted index - skip it, all its keys are already in ram */
-		if (bctl->sort.fd < 0) {
+		/*
+		 * If bctl does not have sorted index - skip it, all its keys are
+		 * already in ram. Closed bases are sorted, see eblob_lazy_open().
+		 */
+		if (bctl->sort.fd < 0 && !bctl->lazy_closed) {
 			st.no_sort++;
 			eblob_log(b->cfg.log, EBLOB_LOG_DEBUG,
 					"blob: %s: index: disk: index: %d: no sorted index\n",
@@ -615,6 +727,7 @@ again:
 		rctl->data_offset = dc->position;
 		rctl->index_offset = (void *)dc - bctl->sort.data;
 		rctl->size = dc->data_size;
+		eblob_rctl_set_disk(rctl, dc->disk_size, dc->flags);
 		rctl->bctl = bctl;
 
 		eblob_bctl_release(bctl);
@@ -634,3 +747,185 @@ again:
 	react_stop_action(ACTION_EBLOB_DISK_INDEX_LOOKUP);
 	return err;
 }
+
+int eblob_disk_index_lookup(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_ram_control *rctl)
+{
+	return eblob_disk_index_lookup_older(b, key, INT_MAX, rctl);
+}
+
+/**
+ * eblob_exists() - checks whether @key exists looking only at RAM index and
+ * sorted indexes of bases, record itself is never read.
+ */
+int eblob_exists(struct eblob_backend *b, struct eblob_key *key)
+{
+	struct eblob_ram_control rctl;
+
+	if (b == NULL || key == NULL)
+		return -EINVAL;
+
+	eblob_stat_inc(b->stat, EBLOB_GST_EXISTS_PROBES);
+
+	return eblob_cache_lookup(b, key, &rctl, NULL);
+}
+
+/* Key of eblob_exists_multi() batch which was not found yet */
+struct eblob_exists_probe {
+	struct eblob_key	*key;
+	uint32_t		idx;
+};
+
+static int eblob_exists_probe_cmp(const void *p1, const void *p2)
+{
+	const struct eblob_exists_probe *e1 = p1;
+	const struct eblob_exists_probe *e2 = p2;
+
+	return eblob_key_sort(e1->key, e2->key);
+}
+
+/**
+ * eblob_exists_base() - looks up @*num sorted @probes in sorted index of @bctl
+ * (or only in its bloom filter and index blocks if EBLOB_EXISTS_MAYBE is set)
+ * and sets bits of found keys in @bitmap. Keys that were not found are kept
+ * at the beginning of @probes in the same order and their number is returned
+ * in @num.
+ */
+static int eblob_exists_base(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		struct eblob_exists_probe *probes, uint32_t *num, uint64_t flags,
+		uint8_t *bitmap, struct eblob_disk_search_stat *st)
+{
+	struct eblob_disk_control tmp;
+	uint32_t i, left = 0;
+	int err, found;
+
+	if (flags & EBLOB_EXISTS_MAYBE) {
+		err = eblob_summary_rdlock(bctl);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < *num; ++i) {
+		tmp.key = *probes[i].key;
+
+		if (flags & EBLOB_EXISTS_MAYBE)
+			found = eblob_index_blocks_search_nolock(bctl, &tmp, st) != NULL;
+		else
+			found = eblob_find_on_disk(b, bctl, &tmp, eblob_find_non_removed_callback, st) != NULL;
+
+		if (found)
+			bitmap[probes[i].idx / 8] |= 1 << (probes[i].idx % 8);
+		else
+			probes[left++] = probes[i];
+	}
+
+	if (flags & EBLOB_EXISTS_MAYBE) {
+		pthread_rwlock_unlock(&bctl->index_blocks_lock);
+		eblob_stat_add(b->stat, EBLOB_GST_EXISTS_MAYBE, *num - left);
+	}
+
+	*num = left;
+	return 0;
+}
+
+/**
+ * eblob_exists_multi() - batched eblob_exists(). Whole batch is looked up in
+ * RAM index under single lock, then the rest is sorted and probed base by
+ * base, newest first, so that each sorted index (and its index blocks) is
+ * walked once in key order.
+ */
+int eblob_exists_multi(struct eblob_backend *b, struct eblob_key *keys, uint32_t n,
+		uint64_t flags, uint8_t *bitmap)
+{
+	struct eblob_base_ctl *bctl;
+	struct eblob_ram_control rctl;
+	struct eblob_exists_probe *probes;
+	struct eblob_disk_search_stat st = { .bloom_null = 0, };
+	static const int max_tries = 10;
+	uint32_t i, left = 0;
+	int err = 0, tries = 0;
+
+	if (b == NULL || (n != 0 && (keys == NULL || bitmap == NULL)))
+		return -EINVAL;
+	if (flags & ~EBLOB_EXISTS_MAYBE)
+		return -EINVAL;
+	if (n == 0)
+		return 0;
+
+	memset(bitmap, 0, ((size_t)n + 7) / 8);
+
+	probes = malloc(n * sizeof(struct eblob_exists_probe));
+	if (probes == NULL)
+		return -ENOMEM;
+
+	eblob_stat_add(b->stat, EBLOB_GST_EXISTS_PROBES, n);
+
+	pthread_rwlock_rdlock(&b->root->hash.root_lock);
+	for (i = 0; i < n; ++i) {
+		if (b->cfg.blob_flags & EBLOB_L2HASH)
+			err = eblob_l2hash_lookup(&b->l2hash, &keys[i], &rctl);
+		else
+			err = eblob_hash_lookup_nolock(&b->root->hash, b->ns_id, &keys[i], &rctl);
+
+		if (err == 0) {
+			bitmap[i / 8] |= 1 << (i % 8);
+		} else if (err == -ENOENT) {
+			probes[left].key = &keys[i];
+			probes[left].idx = i;
+			++left;
+		} else {
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&b->root->hash.root_lock);
+
+	if (err && err != -ENOENT)
+		goto err_out_free;
+	err = 0;
+
+	if (left == 0)
+		goto err_out_free;
+
+	qsort(probes, left, sizeof(struct eblob_exists_probe), eblob_exists_probe_cmp);
+
+again:
+	list_for_each_entry_reverse(bctl, &b->bases, base_entry) {
+		if (left == 0)
+			break;
+
+		++st.loops;
+		/* Protect against datasort */
+		eblob_bctl_hold(bctl);
+
+		/* See eblob_disk_index_lookup_older() */
+		if (bctl->index_fd < 0 && !bctl->lazy_closed) {
+			eblob_bctl_release(bctl);
+			if (tries++ > max_tries) {
+				err = -EDEADLK;
+				goto err_out_free;
+			}
+			goto again;
+		}
+
+		/* Keys of unsorted base are all in RAM */
+		if (bctl->sort.fd < 0 && !bctl->lazy_closed) {
+			st.no_sort++;
+			eblob_bctl_release(bctl);
+			continue;
+		}
+
+		err = eblob_exists_base(b, bctl, probes, &left, flags, bitmap, &st);
+		eblob_bctl_release(bctl);
+		if (err)
+			goto err_out_free;
+	}
+
+	eblob_stat_add(b->stat, EBLOB_GST_INDEX_READS, st.loops);
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: exists: keys: %" PRIu32 ", not found: %" PRIu32
+			", flags: 0x%" PRIx64 ", stat: %s\n", n, left, flags, eblob_dump_search_stat(&st, 0));
+
+err_out_free:
+	free(probes);
+	return err;
+}
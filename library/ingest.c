@@ -0,0 +1,562 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bulk ingest of externally prepared bases.
+ *
+ * Builder writes records that come in key order straight into final sorted
+ * layout - the same one data-sort produces - so neither per-record index
+ * updates nor later data-sort are needed. Ingest then only validates such
+ * base, renames its files into backend's directory and links it as the newest
+ * base.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+#include "crypto/sha512.h"
+#include "datasort.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Size of write buffers of builder */
+#define EBLOB_BUILDER_BUF_SIZE		(4 * EBLOB_1_M)
+
+/* Appending writer with user-space buffer */
+struct eblob_builder_file {
+	int			fd;
+	uint64_t		offset;
+	char			*buf;
+	uint64_t		used;
+};
+
+struct eblob_base_builder {
+	struct eblob_builder_file	data, index;
+	uint64_t			blob_flags;
+	uint64_t			count;
+	struct eblob_key		last;
+	int				finished;
+	char				path[PATH_MAX];
+};
+
+static const char * const eblob_builder_suffixes[] = {
+	"",
+	".index",
+	".index.sorted",
+	EBLOB_DATASORT_SORTED_MARK_SUFFIX,
+};
+#define EBLOB_BUILDER_FILES	(sizeof(eblob_builder_suffixes) / sizeof(eblob_builder_suffixes[0]))
+
+/* Formats path of base file with @suffix into PATH_MAX-sized @dst */
+static int eblob_builder_path(char *dst, const char *path, const char *suffix)
+{
+	if (snprintf(dst, PATH_MAX, "%s%s", path, suffix) >= PATH_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/*
+ * Returns zero if names of all files of base @path fit into PATH_MAX,
+ * after that eblob_builder_path() can not fail for @path.
+ */
+static int eblob_builder_path_check(const char *path)
+{
+	char tmp[PATH_MAX];
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < EBLOB_BUILDER_FILES; ++i) {
+		err = eblob_builder_path(tmp, path, eblob_builder_suffixes[i]);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int eblob_builder_flush(struct eblob_builder_file *f)
+{
+	int err;
+
+	if (f->used == 0)
+		return 0;
+
+	err = __eblob_write_ll(f->fd, f->buf, f->used, f->offset);
+	if (err)
+		return err;
+
+	f->offset += f->used;
+	f->used = 0;
+	return 0;
+}
+
+static int eblob_builder_append(struct eblob_builder_file *f, const void *data, uint64_t size)
+{
+	int err;
+
+	if (f->used + size > EBLOB_BUILDER_BUF_SIZE) {
+		err = eblob_builder_flush(f);
+		if (err)
+			return err;
+	}
+
+	/* Big chunks go directly to disk */
+	if (size >= EBLOB_BUILDER_BUF_SIZE) {
+		err = __eblob_write_ll(f->fd, (void *)data, size, f->offset);
+		if (err)
+			return err;
+		f->offset += size;
+		return 0;
+	}
+
+	memcpy(f->buf + f->used, data, size);
+	f->used += size;
+	return 0;
+}
+
+static int eblob_builder_file_open(struct eblob_builder_file *f, const char *path)
+{
+	f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (f->fd == -1)
+		return -errno;
+
+	f->buf = malloc(EBLOB_BUILDER_BUF_SIZE);
+	if (f->buf == NULL) {
+		close(f->fd);
+		f->fd = -1;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void eblob_builder_file_close(struct eblob_builder_file *f)
+{
+	if (f->fd >= 0)
+		close(f->fd);
+	free(f->buf);
+}
+
+int eblob_base_builder_open(const char *path, uint64_t blob_flags,
+		struct eblob_base_builder **builder)
+{
+	struct eblob_base_builder *bb;
+	char index_path[PATH_MAX];
+	int err;
+
+	if (path == NULL || builder == NULL)
+		return -EINVAL;
+	err = eblob_builder_path_check(path);
+	if (err)
+		return err;
+
+	bb = calloc(1, sizeof(struct eblob_base_builder));
+	if (bb == NULL) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	bb->data.fd = bb->index.fd = -1;
+	bb->blob_flags = blob_flags & EBLOB_NO_FOOTER;
+	eblob_builder_path(bb->path, path, "");
+	eblob_builder_path(index_path, path, ".index");
+
+	err = eblob_builder_file_open(&bb->data, bb->path);
+	if (err)
+		goto err_out_free;
+
+	err = eblob_builder_file_open(&bb->index, index_path);
+	if (err)
+		goto err_out_close_data;
+
+	*builder = bb;
+	return 0;
+
+err_out_close_data:
+	eblob_builder_file_close(&bb->data);
+	unlink(bb->path);
+err_out_free:
+	free(bb);
+err_out_exit:
+	return err;
+}
+
+int eblob_base_builder_add(struct eblob_base_builder *bb, struct eblob_key *key,
+		const void *data, uint64_t size, uint64_t flags)
+{
+	struct eblob_disk_control dc;
+	struct eblob_disk_footer f;
+	int err;
+
+	if (bb == NULL || key == NULL || (data == NULL && size != 0))
+		return -EINVAL;
+	if (bb->finished)
+		return -EROFS;
+	if (flags & (BLOB_DISK_CTL_REMOVE | BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_NEW | BLOB_DISK_CTL_TXN_MASK))
+		return -EINVAL;
+
+	/* Sorted index requires strictly increasing keys */
+	if (bb->count != 0 && eblob_id_cmp(bb->last.id, key->id) >= 0)
+		return -EINVAL;
+
+	memset(&dc, 0, sizeof(dc));
+	dc.key = *key;
+	dc.flags = eblob_stamp_flags(flags);
+	dc.data_size = size;
+	dc.disk_size = size + sizeof(struct eblob_disk_control);
+	dc.position = bb->data.offset + bb->data.used;
+	if (bb->blob_flags & EBLOB_NO_FOOTER)
+		dc.flags |= BLOB_DISK_CTL_NOCSUM;
+	else
+		dc.disk_size += sizeof(struct eblob_disk_footer);
+
+	memset(&f, 0, sizeof(f));
+	f.offset = dc.position;
+	if (!(dc.flags & BLOB_DISK_CTL_NOCSUM))
+		sha512_buffer(data, size, f.csum);
+
+	eblob_convert_disk_control(&dc);
+	eblob_convert_disk_footer(&f);
+
+	err = eblob_builder_append(&bb->data, &dc, sizeof(dc));
+	if (err)
+		return err;
+	err = eblob_builder_append(&bb->data, data, size);
+	if (err)
+		return err;
+	if (!(bb->blob_flags & EBLOB_NO_FOOTER)) {
+		err = eblob_builder_append(&bb->data, &f, sizeof(f));
+		if (err)
+			return err;
+	}
+	err = eblob_builder_append(&bb->index, &dc, sizeof(dc));
+	if (err)
+		return err;
+
+	bb->last = *key;
+	bb->count++;
+	return 0;
+}
+
+int eblob_base_builder_finish(struct eblob_base_builder *bb)
+{
+	char path[PATH_MAX], index_path[PATH_MAX];
+	int fd, err;
+
+	if (bb == NULL)
+		return -EINVAL;
+	if (bb->finished)
+		return 0;
+
+	err = eblob_builder_flush(&bb->data);
+	if (err)
+		return err;
+	err = eblob_builder_flush(&bb->index);
+	if (err)
+		return err;
+
+	if (fsync(bb->data.fd) == -1 || fsync(bb->index.fd) == -1)
+		return -errno;
+
+	/* Index is written in key order, so it's sorted already */
+	eblob_builder_path(index_path, bb->path, ".index");
+	eblob_builder_path(path, bb->path, ".index.sorted");
+	unlink(path);
+	if (link(index_path, path) == -1)
+		return -errno;
+
+	eblob_builder_path(path, bb->path, EBLOB_DATASORT_SORTED_MARK_SUFFIX);
+	fd = open(path, O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+	close(fd);
+
+	bb->finished = 1;
+	return 0;
+}
+
+void eblob_base_builder_close(struct eblob_base_builder *bb)
+{
+	char path[PATH_MAX];
+	unsigned int i;
+
+	if (bb == NULL)
+		return;
+
+	eblob_builder_file_close(&bb->data);
+	eblob_builder_file_close(&bb->index);
+
+	if (!bb->finished) {
+		for (i = 0; i < EBLOB_BUILDER_FILES; ++i) {
+			eblob_builder_path(path, bb->path, eblob_builder_suffixes[i]);
+			unlink(path);
+		}
+	}
+
+	free(bb);
+}
+
+/**
+ * eblob_ingest_check() - sanity checks of base that is going to be ingested:
+ * its index must be sorted, have at most one live entry per key and all
+ * entries must point inside data file.
+ */
+static int eblob_ingest_check(struct eblob_backend *b, const char *path)
+{
+	struct eblob_map_fd index;
+	struct eblob_disk_control dc, prev;
+	char index_path[PATH_MAX];
+	struct stat st, st_index;
+	uint64_t i, num, data_size;
+	int have_prev = 0, err;
+
+	if (stat(path, &st) == -1)
+		return -errno;
+	data_size = st.st_size;
+
+	eblob_builder_path(index_path, path, ".index");
+	if (stat(index_path, &st_index) == -1)
+		return -errno;
+
+	memset(&index, 0, sizeof(index));
+	eblob_builder_path(index_path, path, ".index.sorted");
+	index.fd = open(index_path, O_RDWR | O_CLOEXEC);
+	if (index.fd == -1)
+		return -errno;
+
+	if (fstat(index.fd, &st) == -1) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	index.size = st.st_size;
+	if (index.size == 0 || index.size % sizeof(struct eblob_disk_control)
+			|| index.size != (uint64_t)st_index.st_size) {
+		err = -EINVAL;
+		goto err_out_close;
+	}
+
+	err = eblob_data_map(&index);
+	if (err)
+		goto err_out_close;
+
+	num = index.size / sizeof(struct eblob_disk_control);
+	for (i = 0; i < num; ++i) {
+		dc = ((struct eblob_disk_control *)index.data)[i];
+		eblob_convert_disk_control(&dc);
+
+		if (dc.disk_size < dc.data_size + sizeof(struct eblob_disk_control)
+				|| dc.position + dc.disk_size > data_size
+				|| (dc.flags & BLOB_DISK_CTL_TXN_MASK)) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "ingest: %s: malformed entry: %s: "
+					"position: %" PRIu64 ", data_size: %" PRIu64 ", disk_size: %" PRIu64
+					", flags: 0x%" PRIx64, path, eblob_dump_id(dc.key.id),
+					dc.position, dc.data_size, dc.disk_size, dc.flags);
+			err = -EINVAL;
+			goto err_out_unmap;
+		}
+
+		if (have_prev) {
+			int cmp = eblob_id_cmp(prev.key.id, dc.key.id);
+
+			if (cmp > 0 || (cmp == 0 && !(prev.flags & BLOB_DISK_CTL_REMOVE)
+						&& !(dc.flags & BLOB_DISK_CTL_REMOVE))) {
+				EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "ingest: %s: index is not sorted: %s",
+						path, eblob_dump_id(dc.key.id));
+				err = -EINVAL;
+				goto err_out_unmap;
+			}
+		}
+
+		prev = dc;
+		have_prev = 1;
+	}
+
+err_out_unmap:
+	eblob_data_unmap(&index);
+err_out_close:
+	close(index.fd);
+	return err;
+}
+
+/**
+ * eblob_ingest_shadows() - returns true if records of @bctl may be shadowed
+ * by base that is being ingested, so they must be written anew instead of
+ * inplace: purge of old versions can not tell inplace overwrite from the
+ * old record.
+ * NB! Caller should hold "backend" lock.
+ */
+int eblob_ingest_shadows(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	return bctl->index < b->ingest_index;
+}
+
+/**
+ * eblob_ingest_remove_old() - removes all versions of ingested keys that live
+ * in other bases.
+ */
+static void eblob_ingest_remove_old(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	struct eblob_disk_control dc;
+	struct eblob_ram_control old;
+	uint64_t i, num, removed = 0;
+	int err;
+
+	num = bctl->sort.size / sizeof(struct eblob_disk_control);
+	for (i = 0; i < num; ++i) {
+		dc = ((struct eblob_disk_control *)bctl->sort.data)[i];
+		eblob_convert_disk_control(&dc);
+
+		if (dc.flags & BLOB_DISK_CTL_REMOVE)
+			continue;
+
+		/*
+		 * Live record can be either in RAM or in some older sorted
+		 * base, which is now shadowed by ingested one.
+		 */
+		err = eblob_cache_lookup(b, &dc.key, &old, NULL);
+		if (err == 0 && old.bctl == bctl)
+			err = eblob_disk_index_lookup_older(b, &dc.key, bctl->index, &old);
+		if (err != 0)
+			continue;
+
+		/*
+		 * Key was written after ingested base was linked, so it lives
+		 * in a newer base and overrides ingested record, not vice versa.
+		 * Write racing with purge below is handled by the purge itself,
+		 * which keeps cached record if it is not @old anymore, and
+		 * inplace overwrites are disabled by eblob_ingest_shadows().
+		 */
+		if (old.bctl->index > bctl->index)
+			continue;
+
+		err = eblob_mark_entry_removed_purge(b, &dc.key, &old);
+		if (err != 0) {
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+					"ingest: %s: eblob_mark_entry_removed_purge: FAILED",
+					eblob_dump_id(dc.key.id));
+			continue;
+		}
+		removed++;
+	}
+
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "ingest: index: %d: records: %" PRIu64
+			", overridden: %" PRIu64, bctl->index, num, removed);
+}
+
+int eblob_ingest_base(struct eblob_backend *b, const char *path)
+{
+	struct eblob_base_ctl *bctl;
+	char src[PATH_MAX], dst[PATH_MAX], base[PATH_MAX];
+	unsigned int i, n;
+	int index, err;
+
+	if (b == NULL || path == NULL)
+		return -EINVAL;
+	err = eblob_builder_path_check(path);
+	if (err)
+		return err;
+
+	err = eblob_ingest_check(b, path);
+	if (err) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "ingest: %s: check failed", path);
+		return err;
+	}
+
+	pthread_mutex_lock(&b->lock);
+
+	/*
+	 * Data file goes first: if we crash in the middle base without index
+	 * is just an empty one, while index without data would be attached to
+	 * the next newly created base.
+	 */
+	index = b->max_index + 1;
+	n = 0;
+	if (snprintf(base, PATH_MAX, "%s-0.%d", b->cfg.file, index) >= PATH_MAX) {
+		err = -ENAMETOOLONG;
+		goto err_out_rollback;
+	}
+	for (n = 0; n < EBLOB_BUILDER_FILES; ++n) {
+		eblob_builder_path(src, path, eblob_builder_suffixes[n]);
+		err = eblob_builder_path(dst, base, eblob_builder_suffixes[n]);
+		if (err)
+			goto err_out_rollback;
+
+		/* Mark is optional - without it base will be sorted once more */
+		if (n == EBLOB_BUILDER_FILES - 1 && access(src, F_OK) == -1)
+			break;
+
+		if (access(dst, F_OK) == 0) {
+			err = -EEXIST;
+			goto err_out_rollback;
+		}
+		if (rename(src, dst) == -1) {
+			err = -errno;
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "ingest: rename: %s -> %s", src, dst);
+			goto err_out_rollback;
+		}
+	}
+
+	err = eblob_add_new_base(b);
+	if (err)
+		goto err_out_rollback;
+
+	bctl = list_last_entry(&b->bases, struct eblob_base_ctl, base_entry);
+	if (bctl->index != index || bctl->sort.fd < 0) {
+		/* Should not happen - base is already visible, so keep it */
+		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "ingest: %s: base %d was not opened as sorted",
+				path, index);
+		pthread_mutex_unlock(&b->lock);
+		return -EIO;
+	}
+	bctl->sorted = 1;
+	b->ingest_index = index;
+
+	pthread_mutex_unlock(&b->lock);
+
+	eblob_ingest_remove_old(b, bctl);
+
+	pthread_mutex_lock(&b->lock);
+	if (b->ingest_index == index)
+		b->ingest_index = 0;
+	pthread_mutex_unlock(&b->lock);
+
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "ingest: %s: ingested as index %d", path, index);
+	return 0;
+
+err_out_rollback:
+	for (i = 0; i < n; ++i) {
+		eblob_builder_path(src, path, eblob_builder_suffixes[i]);
+		eblob_builder_path(dst, base, eblob_builder_suffixes[i]);
+		if (rename(dst, src) == -1)
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, errno, "ingest: rename: %s -> %s", dst, src);
+	}
+	pthread_mutex_unlock(&b->lock);
+	return err;
+}
@@ -26,7 +26,44 @@ extern "C" {
  * 		"writes_size": 0,				// total size of written data
  * 		"index_files_reads_number": 0,	// number of index files that was processed by eblob while looking up records "on-disk".
  * 		"datasort_completion_time": 0,	// end timestamp of the last defragmentation
- * 		"datasort_completion_status": 0	// status of last deframentation
+ * 		"datasort_completion_status": 0,	// status of last deframentation
+ * 		"index_header_reads_number": 0,	// number of record headers that were re-read from index after lookup
+ * 		"write_latency": 0,				// average latency of new record writes in microseconds
+ * 		"admission_pressure": 0,		// write pressure in percents, see eblob_get_pressure()
+ * 		"admission_delayed": 0,			// number of writes delayed by admission control
+ * 		"admission_rejected": 0,		// number of writes rejected by admission control
+ * 		"auto_blob_size": 0,			// base size picked by EBLOB_AUTO_BASE_SIZE
+ * 		"auto_records_in_blob": 0,		// number of records in base picked by EBLOB_AUTO_BASE_SIZE
+ * 		"auto_base_size_reason": 0,		// what limits picked values: 0 - bounds, 1 - record size,
+ * 										// 2 - memory, 3 - remove rate, 4 - number of bases
+ * 		"device_util": 0,				// utilization of the device in percents sampled by EBLOB_IDLE_DATASORT
+ * 		"device_in_flight": 0,			// number of requests in flight on the device
+ * 		"foreground_ops": 0,			// number of reads and writes per second
+ * 		"idle_time": 0,					// seconds backend has been idle
+ * 		"defrag_paused": 0,				// 1 if data-sort is paused by request or foreground load
+ * 		"written_logical": 0,			// bytes of record data written by users
+ * 		"written_foreground": 0,		// bytes written to blobs by writes and removes: data, headers, footers and flags
+ * 		"written_rcu": 0,				// bytes of old records copied on read-copy-update
+ * 		"written_index": 0,				// bytes written to index files: entries, flags, sorted indexes
+ * 		"written_datasort_split": 0,	// bytes written by data-sort into unsorted chunks
+ * 		"written_datasort_sort": 0,		// bytes written by data-sort into sorted chunks
+ * 		"written_datasort_merge": 0,	// bytes written by data-sort into merged blob
+ * 		"datasort_hot_records": 0,		// records put by EBLOB_HOT_COLD_DATASORT into bases of hot keys
+ * 		"datasort_cold_records": 0,		// records put by EBLOB_HOT_COLD_DATASORT into bases of stable keys
+ * 		"bases_closed": 0,				// number of sorted bases with closed files with EBLOB_LAZY_BASES
+ * 		"bases_opened": 0,				// number of times closed base was opened on demand
+ * 		"bases_evicted": 0,				// number of times idle base was closed to stay within max_open_bases
+ * 		"write_buffer_records": 0,		// number of records staged in EBLOB_WRITE_BUFFER
+ * 		"write_buffer_flushes": 0,		// number of flushes of EBLOB_WRITE_BUFFER
+ * 		"write_buffer_reads": 0,		// number of reads served from EBLOB_WRITE_BUFFER
+ * 		"exists_probes": 0,			// number of keys checked by eblob_exists*()
+ * 		"exists_maybe": 0,			// number of keys reported by EBLOB_EXISTS_MAYBE from filters only
+ * 		"summary_resident": 0,		// bytes of bloom filters and index blocks of sorted bases in memory
+ * 		"summary_evicted": 0,		// bytes saved by coarser index blocks and dropped summaries
+ * 		"summary_reloads": 0,			// number of dropped summaries re-read from disk
+ * 		"read_nowait_hits": 0,			// number of non-blocking reads served from page cache
+ * 		"read_nowait_misses": 0,		// number of non-blocking reads that would wait for disk
+ * 		"read_queued": 0				// number of async reads waiting for read workers
  * 	},
  * 	"summary_stats": {					// summary statistics for all blobs
  * 		"records_total": 301,			// total number of records in all blobs both real and removed
@@ -37,7 +74,8 @@ extern "C" {
  * 		"memory_bloom_filter": 5120,	// total size of all in-memory bloom filter for all blobs
  * 		"memory_index_blocks": 1152,	// total size of all in-memory index blocks for all blobs
  * 		"want_defrag": 0,				// summ of "want_defrag" of all blobs
- * 		"is_sorted": 0					// number of sorted blobs
+ * 		"is_sorted": 0,					// number of sorted blobs
+ * 		"live_size": 105156713			// total size of not removed records and their index entries
  * 	},
  * 	"base_stats": {							// statistics per blobs
  * 		"data-0.0": {						// "data-0.0" statistics
@@ -49,7 +87,9 @@ extern "C" {
  * 			"memory_bloom_filter": 5120,	// size of in-memory bloom filter for the blob
  * 			"memory_index_blocks": 1152,	// size of all in-memory index block for the blob
  * 			"want_defrag": 0,				// the blob defragmentation status possible statuses can be found in \a eblob_defrag_type from blob.h
- * 			"is_sorted": 0					// shows if the blob is sorted
+ * 			"is_sorted": 0,					// shows if the blob is sorted
+ * 			"live_size": 105156713,			// size of not removed records and their index entries
+ * 			"space_amplification": 1.0		// base_size / live_size
  * 		}
  * 	},
  * 	"config": {								// configuration with which eblob is working
@@ -64,7 +104,22 @@ extern "C" {
  * 		"index_block_bloom_length": 5120,	// length of one index block bloom filter
  * 		"blob_size_limit": 0,				// maximum size of all blobs
  * 		"defrag_time": 0,					// scheduled defragmentation start time and splay
- * 		"defrag_splay": 0					// scheduled defragmentation start time and splay
+ * 		"defrag_splay": 0,					// scheduled defragmentation start time and splay
+ * 		"admission_unsorted_limit": 0,		// write admission limit of unsorted data
+ * 		"admission_index_limit": 0,			// write admission limit of in-memory index
+ * 		"admission_latency": 0,				// write admission limit of write latency in microseconds
+ * 		"admission_max_delay": 100,			// maximum delay of admitted write in milliseconds
+ * 		"blob_size_min": 1073741824,		// lower bound of base size with EBLOB_AUTO_BASE_SIZE
+ * 		"records_in_blob_min": 1000000,		// lower bound of records in base with EBLOB_AUTO_BASE_SIZE
+ * 		"defrag_idle_util": 10,				// device utilization in percents considered idle
+ * 		"defrag_idle_ops": 10,				// reads and writes per second considered idle
+ * 		"defrag_idle_time": 60,				// seconds of idleness before data-sort starts
+ * 		"hot_key_updates": 2,				// updates after which key is hot for EBLOB_HOT_COLD_DATASORT
+ * 		"max_open_bases": 256,				// soft limit of open sorted bases with EBLOB_LAZY_BASES
+ * 		"write_buffer_size": 2097152,		// size of EBLOB_WRITE_BUFFER
+ * 		"write_buffer_timeout": 100,		// maximal age of buffered records in milliseconds
+ * 		"summary_memory_limit": 0,			// memory budget of sorted bases summaries, 0 is unlimited
+ * 		"read_threads": 4					// number of workers of async reads
  * 	},
  * 	"vfs": {							// statvfs statistics
  * 		"bsize": 4096,					// file system block size
@@ -79,6 +134,34 @@ extern "C" {
  * 		"flag": 1024,					// mount flags
  * 		"namemax": 255					// maximum filename length
  * 	},
+ * 	"space": {							// free space accounting of the device
+ * 		"total": 3092110712832,			// size of file system as of the last sample
+ * 		"avail": 2931795136512,			// available space as of the last sample
+ * 		"reserved": 1048576,			// reserved by writers since the last sample
+ * 		"datasort_reserved": 0,			// reserved by running data-sorts
+ * 		"keep": 21474836480,			// free space writers of the backend leave untouched
+ * 		"used": 105156713				// size of backend's bases
+ * 	},
+ * 	"amplification": {					// derived from global and summary statistics
+ * 		"logical": 104857600,			// "written_logical"
+ * 		"physical": 210326528,			// sum of all other "written_*" counters
+ * 		"write": 2.005,					// physical / logical
+ * 		"allocated_size": 105156713,	// summary "base_size"
+ * 		"live_size": 105156713,			// summary "live_size"
+ * 		"space": 1.0					// allocated_size / live_size
+ * 	},
+ * 	"defrag": {							// progress of running defrag, see eblob_defrag_progress()
+ * 		"phase": 2,						// enum eblob_defrag_phase, 0 if defrag is not running
+ * 		"paused": 0,					// 1 if defrag waits for resume or lower load
+ * 		"bases_total": 4,				// bases selected by current run
+ * 		"bases_done": 1,				// bases already processed
+ * 		"records_total": 250000,		// records of current group to process by current phase
+ * 		"records_done": 120000,			// records processed by current phase
+ * 		"bytes_total": 262144000,		// bytes of current group to process by current phase
+ * 		"bytes_done": 125829120,		// bytes processed by current phase
+ * 		"elapsed": 42,					// seconds run has been working excluding pauses
+ * 		"eta": 96						// estimated seconds till end of run, -1 if not known yet
+ * 	},
  * 	"dstat": { //this statistics is gathered from sysfs and more details can be found at https://www.kernel.org/doc/Documentation/block/stat.txt
  * 		"read_ios": 4645,			// number of read I/Os processed
  * 		"read_merges": 0,			// number of read I/Os merged with in-queue I/O
@@ -109,6 +192,11 @@ int eblob_stat_summary_json(struct eblob_backend *b, rapidjson::Value &stat, rap
 	return 0;
 }
 
+static double eblob_stat_ratio(int64_t num, int64_t den)
+{
+	return den > 0 ? (double)num / den : 0;
+}
+
 int eblob_stat_base_json(struct eblob_backend *b, rapidjson::Value &stat, rapidjson::Document::AllocatorType &allocator)
 {
 	struct eblob_base_ctl *bctl;
@@ -120,6 +208,9 @@ int eblob_stat_base_json(struct eblob_backend *b, rapidjson::Value &stat, rapidj
 		for (i = EBLOB_LST_MIN + 1; i < EBLOB_LST_MAX; i++) {
 			base_stat.AddMember(eblob_stat_get_name(bctl->stat, i), eblob_stat_get(bctl->stat, i), allocator);
 		}
+		base_stat.AddMember("space_amplification",
+				eblob_stat_ratio(eblob_stat_get(bctl->stat, EBLOB_LST_BASE_SIZE),
+					eblob_stat_get(bctl->stat, EBLOB_LST_LIVE_SIZE)), allocator);
 		stat.AddMember(bctl->name, base_stat, allocator);
 	}
 	return 0;
@@ -138,6 +229,21 @@ int eblob_stat_config_json(struct eblob_backend *b, rapidjson::Value &stat, rapi
 	stat.AddMember("blob_size_limit", b->cfg.blob_size_limit, allocator);
 	stat.AddMember("defrag_time", b->cfg.defrag_time, allocator);
 	stat.AddMember("defrag_splay", b->cfg.defrag_splay, allocator);
+	stat.AddMember("admission_unsorted_limit", b->cfg.admission_unsorted_limit, allocator);
+	stat.AddMember("admission_index_limit", b->cfg.admission_index_limit, allocator);
+	stat.AddMember("admission_latency", b->cfg.admission_latency, allocator);
+	stat.AddMember("admission_max_delay", b->cfg.admission_max_delay, allocator);
+	stat.AddMember("blob_size_min", b->cfg.blob_size_min, allocator);
+	stat.AddMember("records_in_blob_min", b->cfg.records_in_blob_min, allocator);
+	stat.AddMember("defrag_idle_util", b->cfg.defrag_idle_util, allocator);
+	stat.AddMember("defrag_idle_ops", b->cfg.defrag_idle_ops, allocator);
+	stat.AddMember("defrag_idle_time", b->cfg.defrag_idle_time, allocator);
+	stat.AddMember("hot_key_updates", b->cfg.hot_key_updates, allocator);
+	stat.AddMember("max_open_bases", b->cfg.max_open_bases, allocator);
+	stat.AddMember("write_buffer_size", b->cfg.write_buffer_size, allocator);
+	stat.AddMember("write_buffer_timeout", b->cfg.write_buffer_timeout, allocator);
+	stat.AddMember("summary_memory_limit", b->cfg.summary_memory_limit, allocator);
+	stat.AddMember("read_threads", b->cfg.read_threads, allocator);
 	return 0;
 }
 
@@ -282,6 +388,61 @@ static int eblob_stat_vfs(struct eblob_backend *b, rapidjson::Value &stat, rapid
 	return err;
 }
 
+static int eblob_stat_amplification(struct eblob_backend *b, rapidjson::Value &stat, rapidjson::Document::AllocatorType &allocator) {
+	const int64_t logical = eblob_stat_get(b->stat, EBLOB_GST_WRITTEN_LOGICAL);
+	const int64_t physical = eblob_stat_get(b->stat, EBLOB_GST_WRITTEN_FOREGROUND)
+		+ eblob_stat_get(b->stat, EBLOB_GST_WRITTEN_RCU)
+		+ eblob_stat_get(b->stat, EBLOB_GST_WRITTEN_INDEX)
+		+ eblob_stat_get(b->stat, EBLOB_GST_WRITTEN_DATASORT_SPLIT)
+		+ eblob_stat_get(b->stat, EBLOB_GST_WRITTEN_DATASORT_SORT)
+		+ eblob_stat_get(b->stat, EBLOB_GST_WRITTEN_DATASORT_MERGE);
+	const int64_t allocated = eblob_stat_get(b->stat_summary, EBLOB_LST_BASE_SIZE);
+	const int64_t live = eblob_stat_get(b->stat_summary, EBLOB_LST_LIVE_SIZE);
+
+	stat.AddMember("logical", logical, allocator);
+	stat.AddMember("physical", physical, allocator);
+	stat.AddMember("write", eblob_stat_ratio(physical, logical), allocator);
+	stat.AddMember("allocated_size", allocated, allocator);
+	stat.AddMember("live_size", live, allocator);
+	stat.AddMember("space", eblob_stat_ratio(allocated, live), allocator);
+	return 0;
+}
+
+static int eblob_stat_defrag(struct eblob_backend *b, rapidjson::Value &stat, rapidjson::Document::AllocatorType &allocator) {
+	struct eblob_defrag_progress p;
+	int err;
+
+	err = eblob_defrag_progress(b, &p);
+	if (err)
+		return err;
+
+	stat.AddMember("phase", p.phase, allocator);
+	stat.AddMember("paused", p.paused, allocator);
+	stat.AddMember("bases_total", p.bases_total, allocator);
+	stat.AddMember("bases_done", p.bases_done, allocator);
+	stat.AddMember("records_total", p.records_total, allocator);
+	stat.AddMember("records_done", p.records_done, allocator);
+	stat.AddMember("bytes_total", p.bytes_total, allocator);
+	stat.AddMember("bytes_done", p.bytes_done, allocator);
+	stat.AddMember("elapsed", p.elapsed, allocator);
+	stat.AddMember("eta", p.eta, allocator);
+	return 0;
+}
+
+static int eblob_stat_space(struct eblob_backend *b, rapidjson::Value &stat, rapidjson::Document::AllocatorType &allocator) {
+	struct eblob_space_stat s;
+
+	eblob_space_get_stat(b, &s);
+
+	stat.AddMember("total", s.total, allocator);
+	stat.AddMember("avail", s.avail, allocator);
+	stat.AddMember("reserved", s.reserved, allocator);
+	stat.AddMember("datasort_reserved", s.datasort, allocator);
+	stat.AddMember("keep", s.keep, allocator);
+	stat.AddMember("used", s.used, allocator);
+	return 0;
+}
+
 int eblob_stat_json_get(struct eblob_backend *b, char **json_stat, size_t *size)
 {
 	int err = 0;
@@ -326,6 +487,27 @@ int eblob_stat_json_get(struct eblob_backend *b, char **json_stat, size_t *size)
 		}
 		doc.AddMember("vfs", vfs_stats, allocator);
 
+		rapidjson::Value space_stats(rapidjson::kObjectType);
+		err = eblob_stat_space(b, space_stats, allocator);
+		if (err) {
+			return err;
+		}
+		doc.AddMember("space", space_stats, allocator);
+
+		rapidjson::Value amplification(rapidjson::kObjectType);
+		err = eblob_stat_amplification(b, amplification, allocator);
+		if (err) {
+			return err;
+		}
+		doc.AddMember("amplification", amplification, allocator);
+
+		rapidjson::Value defrag_stats(rapidjson::kObjectType);
+		err = eblob_stat_defrag(b, defrag_stats, allocator);
+		if (err) {
+			return err;
+		}
+		doc.AddMember("defrag", defrag_stats, allocator);
+
 		rapidjson::Value dstat_stats(rapidjson::kObjectType);
 		err = eblob_stat_dstat(b, dstat_stats, allocator);
 		if (err) {
@@ -213,6 +213,12 @@ static int __eblob_l2hash_index_hdr(const struct eblob_ram_control *rctl, struct
 	assert(rctl->bctl != NULL);
 	assert(dc != NULL);
 
+	/* Entry of recently written record may be still in write buffer */
+	if (eblob_wbuf_read_index(rctl->bctl->back, rctl, dc) == 0)
+		return 0;
+
+	eblob_stat_inc(rctl->bctl->back->stat, EBLOB_GST_INDEX_HEADER_READS);
+
 	err = pread(eblob_get_index_fd(rctl->bctl), dc,
 			sizeof(struct eblob_disk_control), rctl->index_offset);
 	if (err != sizeof(struct eblob_disk_control))
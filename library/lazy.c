@@ -0,0 +1,657 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lazy opening of sorted bases (EBLOB_LAZY_BASES).
+ *
+ * Sorted base is fully described by its bloom filter, index blocks and
+ * stats, so when it is closed they are persisted in <base>.summary and on
+ * the next start base is registered from the summary without opening its
+ * files or reading sorted index. Files are opened by eblob_lazy_open() when
+ * lookup finds index block that may contain the key or when base is iterated
+ * or data-sorted. Summary is removed once base is opened, so crash while base
+ * is open makes next start read it as usual.
+ *
+ * Unsorted bases and the last one are always open. When more than
+ * max_open_bases sorted bases are open, ones not accessed for at least
+ * EBLOB_LAZY_MIN_IDLE_MS are closed least recently used first. Base is
+ * never closed while held: reads hold it while they use its fds, and
+ * iteration holds it with eblob_lazy_hold() till it is done. Bases
+ * whose fds were returned to callers of eblob_read_return() and friends are
+ * pinned open, see eblob_lazy_pin(), as well as removed ones are never
+ * closed, so that no summary is written for them.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Base used within this period is never closed */
+#define EBLOB_LAZY_MIN_IDLE_MS		(10 * 1000)
+
+#define EBLOB_LAZY_SUMMARY_MAGIC	"EBSUMM02"
+
+/*
+ * On-disk summary header in host byte order, followed by @bloom_size bytes
+ * of bloom filter with @bloom_bits bits in use and @block_count index blocks.
+ */
+struct eblob_lazy_summary {
+	char			magic[8];
+	/* Files summary was taken from */
+	uint64_t		data_size;
+	uint64_t		index_size;
+	uint64_t		sort_size;
+	uint64_t		sort_mtime_sec;
+	uint64_t		sort_mtime_nsec;
+	/* Config summary was built with */
+	uint32_t		index_block_size;
+	uint32_t		index_block_bloom_length;
+	uint64_t		bloom_size;
+	uint64_t		bloom_bits;
+	uint64_t		bloom_func_num;
+	uint64_t		block_count;
+	/* Local stats */
+	uint64_t		stat_count;
+	int64_t			stat[EBLOB_LST_MAX];
+};
+
+static uint64_t eblob_lazy_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int eblob_lazy_path(struct eblob_base_ctl *bctl, char *path, const char *suffix)
+{
+	if (snprintf(path, PATH_MAX, "%s-0.%d%s", bctl->back->cfg.file, bctl->index, suffix) >= PATH_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/*
+ * Open sorted base that is neither the last one nor invalidated by data-sort.
+ */
+static int eblob_lazy_closable(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	return !bctl->lazy_closed && !bctl->lazy_pinned && !bctl->removed
+		&& atomic_read(&bctl->lazy_users) == 0
+		&& bctl->sort.fd >= 0 && bctl->index_fd >= 0
+		&& bctl->base_entry.next != &b->bases;
+}
+
+static int eblob_lazy_idle(struct eblob_base_ctl *bctl, uint64_t now)
+{
+	return bctl->lazy_access + EBLOB_LAZY_MIN_IDLE_MS <= now;
+}
+
+/*
+ * Reads summary of @bctl into @sum and its bloom filter and index blocks into
+ * @bctl, checking that it was taken from current files of the base.
+ */
+static int eblob_lazy_read_summary(struct eblob_base_ctl *bctl, struct eblob_lazy_summary *sum)
+{
+	struct eblob_backend *b = bctl->back;
+	struct stat st;
+	char path[PATH_MAX];
+	uint64_t block_count;
+	int fd, err, shift;
+
+	err = eblob_lazy_path(bctl, path, EBLOB_BLOB_SUMMARY_SUFFIX);
+	if (err)
+		return err;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	err = __eblob_read_ll(fd, sum, sizeof(*sum), 0);
+	if (err)
+		goto err_out_close;
+
+	/* Index blocks may be coarser than configured, see summary.c */
+	for (shift = 0; shift < EBLOB_SUMMARY_MAX_SHIFT; ++shift)
+		if (sum->index_block_size == (uint64_t)b->cfg.index_block_size << shift)
+			break;
+
+	err = -EINVAL;
+	if (memcmp(sum->magic, EBLOB_LAZY_SUMMARY_MAGIC, sizeof(sum->magic))
+			|| sum->stat_count != EBLOB_LST_MAX
+			|| sum->index_block_size != (uint64_t)b->cfg.index_block_size << shift
+			|| sum->index_block_bloom_length != b->cfg.index_block_bloom_length
+			|| sum->bloom_bits == 0 || sum->bloom_size != howmany(sum->bloom_bits, 8)
+			|| sum->sort_size == 0 || sum->sort_size % sizeof(struct eblob_disk_control))
+		goto err_out_stale;
+
+	block_count = howmany(sum->sort_size / sizeof(struct eblob_disk_control), sum->index_block_size);
+	if (sum->block_count != block_count || fstat(fd, &st) == -1
+			|| (uint64_t)st.st_size != sizeof(*sum) + sum->bloom_size
+			+ block_count * sizeof(struct eblob_index_block))
+		goto err_out_stale;
+
+	/* Files must be exactly the ones summary was taken from */
+	if (eblob_lazy_path(bctl, path, "") || stat(path, &st) == -1
+			|| (uint64_t)st.st_size != sum->data_size)
+		goto err_out_stale;
+	if (eblob_lazy_path(bctl, path, EBLOB_BLOB_INDEX_SUFFIX) || stat(path, &st) == -1
+			|| (uint64_t)st.st_size != sum->index_size)
+		goto err_out_stale;
+	if (eblob_lazy_path(bctl, path, EBLOB_BLOB_INDEX_SUFFIX ".sorted") || stat(path, &st) == -1
+			|| (uint64_t)st.st_size != sum->sort_size
+			|| (uint64_t)st.st_mtim.tv_sec != sum->sort_mtime_sec
+			|| (uint64_t)st.st_mtim.tv_nsec != sum->sort_mtime_nsec)
+		goto err_out_stale;
+
+	err = -ENOMEM;
+	bctl->bloom = malloc(sum->bloom_size);
+	bctl->index_blocks = malloc(block_count * sizeof(struct eblob_index_block));
+	if (bctl->bloom == NULL || bctl->index_blocks == NULL)
+		goto err_out_free;
+
+	err = __eblob_read_ll(fd, bctl->bloom, sum->bloom_size, sizeof(*sum));
+	if (err)
+		goto err_out_free;
+	err = __eblob_read_ll(fd, bctl->index_blocks, block_count * sizeof(struct eblob_index_block),
+			sizeof(*sum) + sum->bloom_size);
+	if (err)
+		goto err_out_free;
+	close(fd);
+
+	bctl->bloom_size = sum->bloom_size;
+	bctl->bloom_bits = sum->bloom_bits;
+	bctl->bloom_func_num = sum->bloom_func_num;
+	bctl->index_block_shift = shift;
+	return 0;
+
+err_out_free:
+	free(bctl->bloom);
+	free(bctl->index_blocks);
+	bctl->bloom = NULL;
+	bctl->index_blocks = NULL;
+	goto err_out_close;
+err_out_stale:
+	eblob_log(b->cfg.log, EBLOB_LOG_NOTICE, "bctl: index: %d: summary does not match base\n",
+			bctl->index);
+err_out_close:
+	close(fd);
+	return err;
+}
+
+/**
+ * eblob_lazy_register() - registers sorted base from its summary without
+ * opening its files. Returns non-zero if there is no usable summary and base
+ * should be opened as usual.
+ */
+int eblob_lazy_register(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	struct eblob_lazy_summary sum;
+	uint64_t i;
+	int err;
+
+	if (!(b->cfg.blob_flags & EBLOB_LAZY_BASES) || (b->cfg.blob_flags & __EBLOB_NO_STARTUP_DATA_POPULATE))
+		return -ENOTSUP;
+
+	err = eblob_lazy_read_summary(bctl, &sum);
+	if (err)
+		return err;
+
+	bctl->data_size = sum.data_size;
+	bctl->index_size = sum.index_size;
+	bctl->sort.size = sum.sort_size;
+	bctl->data_fd = bctl->index_fd = bctl->sort.fd = -1;
+	bctl->lazy_closed = 1;
+
+	for (i = EBLOB_LST_MIN + 1; i < EBLOB_LST_MAX; ++i)
+		eblob_stat_set(bctl->stat, i, sum.stat[i]);
+	eblob_stat_inc(b->stat, EBLOB_GST_BASES_CLOSED);
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "bctl: index: %d: registered from summary: "
+			"records: %" PRIu64 ", index blocks: %" PRIu64 ", bloom: %" PRIu64 "\n",
+			bctl->index, sum.sort_size / sizeof(struct eblob_disk_control),
+			sum.block_count, sum.bloom_size);
+	return 0;
+}
+
+/**
+ * eblob_lazy_load_summary() - reads back bloom filter and index blocks of
+ * closed @bctl dropped by eblob_summary_balance().
+ * NB! Caller should hold write lock of bctl->index_blocks_lock.
+ */
+int eblob_lazy_load_summary(struct eblob_base_ctl *bctl)
+{
+	struct eblob_lazy_summary sum;
+	int err;
+
+	err = eblob_lazy_read_summary(bctl, &sum);
+	if (err)
+		return err;
+
+	eblob_stat_set(bctl->stat, EBLOB_LST_BLOOM_SIZE, sum.bloom_size);
+	eblob_stat_set(bctl->stat, EBLOB_LST_INDEX_BLOCKS_SIZE,
+			sum.block_count * sizeof(struct eblob_index_block));
+	return 0;
+}
+
+/*
+ * Writes summary of open sorted base, so that it can be registered without
+ * opening on the next start.
+ */
+static int eblob_lazy_write_summary(struct eblob_base_ctl *bctl)
+{
+	struct eblob_backend *b = bctl->back;
+	struct eblob_lazy_summary sum;
+	const uint64_t blocks_size = eblob_stat_get(bctl->stat, EBLOB_LST_INDEX_BLOCKS_SIZE);
+	char path[PATH_MAX], tmp[PATH_MAX];
+	struct stat st;
+	uint64_t i;
+	int fd, err;
+
+	if (bctl->bloom == NULL || bctl->index_blocks == NULL)
+		return -EINVAL;
+	if (fstat(bctl->sort.fd, &st) == -1)
+		return -errno;
+
+	memset(&sum, 0, sizeof(sum));
+	memcpy(sum.magic, EBLOB_LAZY_SUMMARY_MAGIC, sizeof(sum.magic));
+	sum.data_size = bctl->data_size;
+	sum.index_size = bctl->index_size;
+	sum.sort_size = bctl->sort.size;
+	sum.sort_mtime_sec = st.st_mtim.tv_sec;
+	sum.sort_mtime_nsec = st.st_mtim.tv_nsec;
+	sum.index_block_size = b->cfg.index_block_size << bctl->index_block_shift;
+	sum.index_block_bloom_length = b->cfg.index_block_bloom_length;
+	sum.bloom_size = bctl->bloom_size;
+	sum.bloom_bits = bctl->bloom_bits;
+	sum.bloom_func_num = bctl->bloom_func_num;
+	sum.block_count = blocks_size / sizeof(struct eblob_index_block);
+	sum.stat_count = EBLOB_LST_MAX;
+	for (i = EBLOB_LST_MIN + 1; i < EBLOB_LST_MAX; ++i)
+		sum.stat[i] = eblob_stat_get(bctl->stat, i);
+
+	if (eblob_lazy_path(bctl, path, EBLOB_BLOB_SUMMARY_SUFFIX)
+			|| snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -ENAMETOOLONG;
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	err = __eblob_write_ll(fd, &sum, sizeof(sum), 0);
+	if (err)
+		goto err_out_unlink;
+	err = __eblob_write_ll(fd, bctl->bloom, bctl->bloom_size, sizeof(sum));
+	if (err)
+		goto err_out_unlink;
+	err = __eblob_write_ll(fd, bctl->index_blocks, blocks_size, sizeof(sum) + bctl->bloom_size);
+	if (err)
+		goto err_out_unlink;
+	close(fd);
+
+	if (rename(tmp, path) == -1) {
+		err = -errno;
+		unlink(tmp);
+		return err;
+	}
+	return 0;
+
+err_out_unlink:
+	close(fd);
+	unlink(tmp);
+	return err;
+}
+
+static int eblob_lazy_open_ll(struct eblob_base_ctl *bctl)
+{
+	const int oflags = O_RDWR | O_CLOEXEC;
+	char path[PATH_MAX];
+	struct stat st;
+	int err;
+
+	err = eblob_lazy_path(bctl, path, EBLOB_BLOB_INDEX_SUFFIX);
+	if (err)
+		goto err_out_exit;
+	bctl->index_fd = open(path, oflags);
+	if (bctl->index_fd == -1) {
+		err = -errno;
+		goto err_out_exit;
+	}
+
+	err = eblob_lazy_path(bctl, path, "");
+	if (err)
+		goto err_out_close_index;
+	bctl->data_fd = open(path, oflags);
+	if (bctl->data_fd == -1) {
+		err = -errno;
+		goto err_out_close_index;
+	}
+
+	err = eblob_lazy_path(bctl, path, EBLOB_BLOB_INDEX_SUFFIX ".sorted");
+	if (err)
+		goto err_out_close_data;
+	bctl->sort.fd = open(path, oflags);
+	if (bctl->sort.fd == -1) {
+		err = -errno;
+		goto err_out_close_data;
+	}
+
+	if (fstat(bctl->sort.fd, &st) == -1) {
+		err = -errno;
+		goto err_out_close_sort;
+	}
+	if ((uint64_t)st.st_size != bctl->sort.size) {
+		err = -EINVAL;
+		goto err_out_close_sort;
+	}
+
+	err = eblob_data_map(&bctl->sort);
+	if (err)
+		goto err_out_close_sort;
+
+	bctl->data = NULL;
+	err = eblob_base_setup_data(bctl, 1);
+	if (err)
+		goto err_out_unmap_sort;
+
+	/* Dropped summary could not be read back, rebuild it from sorted index */
+	if (bctl->summary_evicted) {
+		pthread_rwlock_wrlock(&bctl->index_blocks_lock);
+		err = eblob_index_blocks_fill(bctl);
+		if (err == 0)
+			bctl->summary_evicted = 0;
+		pthread_rwlock_unlock(&bctl->index_blocks_lock);
+		if (err)
+			goto err_out_unmap_data;
+	}
+
+	return 0;
+
+err_out_unmap_data:
+	munmap(bctl->data, bctl->data_size);
+	bctl->data = NULL;
+err_out_unmap_sort:
+	eblob_data_unmap(&bctl->sort);
+err_out_close_sort:
+	close(bctl->sort.fd);
+	bctl->sort.fd = -1;
+err_out_close_data:
+	close(bctl->data_fd);
+	bctl->data_fd = -1;
+err_out_close_index:
+	close(bctl->index_fd);
+	bctl->index_fd = -1;
+err_out_exit:
+	return err;
+}
+
+/**
+ * eblob_lazy_open() - makes sure files of @bctl are open and marks it used.
+ * Caller should either hold @bctl or be the only one who may invalidate it
+ * (data-sort).
+ * NB! It takes b->lazy_lock, so caller must not hold bctl->lock.
+ */
+int eblob_lazy_open(struct eblob_base_ctl *bctl)
+{
+	struct eblob_backend *b = bctl->back;
+	int err = 0, opened = 0;
+
+	if (!(b->cfg.blob_flags & EBLOB_LAZY_BASES))
+		return 0;
+
+	bctl->lazy_access = eblob_lazy_now();
+	if (!bctl->lazy_closed) {
+		/* Pairs with barrier in opener: files are set up before flag is cleared */
+		atomic_mb();
+		return 0;
+	}
+
+	pthread_mutex_lock(&b->lazy_lock);
+	if (bctl->lazy_closed) {
+		/* Summary file is removed below, so dropped summary is read back first */
+		if (bctl->summary_evicted)
+			eblob_summary_reload(bctl);
+
+		err = eblob_lazy_open_ll(bctl);
+		if (err == 0) {
+			char path[PATH_MAX];
+
+			/* Base may change from now on */
+			if (eblob_lazy_path(bctl, path, EBLOB_BLOB_SUMMARY_SUFFIX) == 0)
+				unlink(path);
+
+			atomic_mb();
+			bctl->lazy_closed = 0;
+			opened = 1;
+		}
+	}
+	pthread_mutex_unlock(&b->lazy_lock);
+
+	if (err) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "lazy: index: %d: open: FAILED",
+				bctl->index);
+		return err;
+	}
+
+	if (opened) {
+		eblob_stat_sub(b->stat, EBLOB_GST_BASES_CLOSED, 1);
+		eblob_stat_inc(b->stat, EBLOB_GST_BASES_OPENED);
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "bctl: index: %d: opened on demand\n", bctl->index);
+		eblob_lazy_evict(b);
+	}
+	return 0;
+}
+
+/**
+ * eblob_lazy_touch() - marks @bctl used, so that it is closed after bases
+ * that were not used since.
+ */
+void eblob_lazy_touch(struct eblob_base_ctl *bctl)
+{
+	if (bctl->back->cfg.blob_flags & EBLOB_LAZY_BASES)
+		bctl->lazy_access = eblob_lazy_now();
+}
+
+/**
+ * eblob_lazy_hold() - keeps @bctl from being closed till matching
+ * eblob_lazy_release(). Closing is serialized by b->lazy_lock, so once it is
+ * taken here no base is being closed and files opened afterwards stay open.
+ */
+void eblob_lazy_hold(struct eblob_base_ctl *bctl)
+{
+	struct eblob_backend *b = bctl->back;
+
+	if (!(b->cfg.blob_flags & EBLOB_LAZY_BASES))
+		return;
+
+	pthread_mutex_lock(&b->lazy_lock);
+	atomic_inc(&bctl->lazy_users);
+	pthread_mutex_unlock(&b->lazy_lock);
+}
+
+void eblob_lazy_release(struct eblob_base_ctl *bctl)
+{
+	if (bctl->back->cfg.blob_flags & EBLOB_LAZY_BASES)
+		atomic_dec(&bctl->lazy_users);
+}
+
+/**
+ * eblob_lazy_pin() - keeps @bctl open until backend is closed, since its fd
+ * is handed out to caller who does not tell when it is done with it.
+ * Caller should hold @bctl.
+ */
+void eblob_lazy_pin(struct eblob_base_ctl *bctl)
+{
+	if ((bctl->back->cfg.blob_flags & EBLOB_LAZY_BASES) && !bctl->lazy_pinned)
+		bctl->lazy_pinned = 1;
+}
+
+/*
+ * Persists summary of idle @bctl and closes its files. Fails with -EBUSY
+ * instead of waiting if base is used.
+ * NB! Caller should hold b->lazy_lock.
+ */
+static int eblob_lazy_close(struct eblob_base_ctl *bctl, uint64_t now)
+{
+	struct eblob_backend *b = bctl->back;
+	int err;
+
+	if (pthread_mutex_trylock(&bctl->lock) != 0)
+		return -EBUSY;
+
+	/* Same as eblob_base_wait_locked() but without waiting */
+	bctl->exclusive = 1;
+	atomic_mb();
+	if (atomic_read(&bctl->critness) != 0 || !eblob_lazy_closable(b, bctl)
+			|| eblob_binlog_enabled(&bctl->binlog)
+			|| !eblob_lazy_idle(bctl, now)) {
+		err = -EBUSY;
+		goto err_out_unlock;
+	}
+
+	err = eblob_lazy_write_summary(bctl);
+	if (err) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "lazy: index: %d: summary: FAILED",
+				bctl->index);
+		goto err_out_unlock;
+	}
+
+	munmap(bctl->data, bctl->data_size);
+	bctl->data = NULL;
+	eblob_data_unmap(&bctl->sort);
+	bctl->sort.data = NULL;
+
+	close(bctl->sort.fd);
+	close(bctl->data_fd);
+	close(bctl->index_fd);
+	bctl->sort.fd = bctl->data_fd = bctl->index_fd = -1;
+
+	bctl->lazy_closed = 1;
+
+err_out_unlock:
+	eblob_base_unlock(bctl);
+	return err;
+}
+
+static int eblob_lazy_access_cmp(const void *p1, const void *p2)
+{
+	const struct eblob_base_ctl *b1 = *(struct eblob_base_ctl * const *)p1;
+	const struct eblob_base_ctl *b2 = *(struct eblob_base_ctl * const *)p2;
+
+	if (b1->lazy_access < b2->lazy_access)
+		return -1;
+	return b1->lazy_access > b2->lazy_access;
+}
+
+/**
+ * eblob_lazy_evict() - closes least recently used idle sorted bases of @b
+ * while more than max_open_bases are open. Does nothing while data-sort
+ * runs, since it relies on bases it has picked staying open.
+ */
+void eblob_lazy_evict(struct eblob_backend *b)
+{
+	struct eblob_base_ctl *bctl, **idle = NULL;
+	const uint64_t now = eblob_lazy_now();
+	uint64_t open = 0, evicted = 0;
+	int n = 0, num = 0, i;
+
+	if (!(b->cfg.blob_flags & EBLOB_LAZY_BASES))
+		return;
+
+	pthread_mutex_lock(&b->lazy_lock);
+	if (pthread_mutex_trylock(&b->defrag_lock) != 0)
+		goto out_unlock;
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(bctl, &b->bases, base_entry) {
+		if (!eblob_lazy_closable(b, bctl))
+			continue;
+		++open;
+		if (!eblob_lazy_idle(bctl, now))
+			continue;
+		if (n == num) {
+			struct eblob_base_ctl **tmp;
+
+			num = num ? num * 2 : 64;
+			tmp = realloc(idle, num * sizeof(*idle));
+			if (tmp == NULL)
+				break;
+			idle = tmp;
+		}
+		idle[n++] = bctl;
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	if (open <= b->cfg.max_open_bases)
+		goto out_unlock_defrag;
+
+	qsort(idle, n, sizeof(*idle), eblob_lazy_access_cmp);
+	for (i = 0; i < n && open > b->cfg.max_open_bases; ++i) {
+		if (eblob_lazy_close(idle[i], now) != 0)
+			continue;
+		--open;
+		++evicted;
+	}
+
+	if (evicted) {
+		eblob_stat_add(b->stat, EBLOB_GST_BASES_CLOSED, evicted);
+		eblob_stat_add(b->stat, EBLOB_GST_BASES_EVICTED, evicted);
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: lazy: closed %" PRIu64 " idle bases, "
+				"%" PRIu64 " sorted bases open\n", evicted, open);
+	}
+
+out_unlock_defrag:
+	pthread_mutex_unlock(&b->defrag_lock);
+out_unlock:
+	pthread_mutex_unlock(&b->lazy_lock);
+	free(idle);
+}
+
+/**
+ * eblob_lazy_cleanup() - persists summaries of open sorted bases on backend
+ * close, so that next start does not have to open them.
+ */
+void eblob_lazy_cleanup(struct eblob_backend *b)
+{
+	struct eblob_base_ctl *bctl;
+	int err;
+
+	if (!(b->cfg.blob_flags & EBLOB_LAZY_BASES))
+		return;
+
+	list_for_each_entry(bctl, &b->bases, base_entry) {
+		if (!eblob_lazy_closable(b, bctl))
+			continue;
+
+		err = eblob_lazy_write_summary(bctl);
+		if (err)
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "lazy: index: %d: summary: FAILED",
+					bctl->index);
+	}
+}
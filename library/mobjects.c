@@ -74,7 +74,9 @@ int eblob_base_setup_data(struct eblob_base_ctl *ctl, int force)
 		err = -errno;
 		goto err_out_exit;
 	}
-	ctl->index_size = st.st_size;
+	/* Index of open base may have buffered tail, see wbuf.c */
+	if ((uint64_t)st.st_size > ctl->index_size)
+		ctl->index_size = st.st_size;
 
 	err = fstat(ctl->data_fd, &st);
 	if (err) {
@@ -114,6 +116,11 @@ int _eblob_base_ctl_cleanup(struct eblob_base_ctl *ctl)
 
 	eblob_index_blocks_destroy(ctl);
 
+	if (ctl->lazy_closed) {
+		eblob_stat_sub(ctl->back->stat, EBLOB_GST_BASES_CLOSED, 1);
+		ctl->lazy_closed = 0;
+	}
+
 	munmap(ctl->data, ctl->data_size);
 	eblob_data_unmap(&ctl->sort);
 
@@ -205,12 +212,17 @@ err_out_exit:
 static int eblob_base_ctl_open(struct eblob_backend *b, struct eblob_base_ctl *ctl,
 		const char *dir_base, const char *name, int name_len)
 {
+	uint64_t blob_size, records_in_blob;
 	int err, full_len;
 	const int oflags = O_RDWR | O_CLOEXEC, mode = 0644;
 	char *full, *created = NULL;
 
 	eblob_log(b->cfg.log, EBLOB_LOG_NOTICE, "blob: %s: started: %s\n", __func__, name);
 
+	/* Sorted base closed with EBLOB_LAZY_BASES is opened on demand */
+	if (eblob_lazy_register(b, ctl) == 0)
+		return 0;
+
 	full_len = strlen(dir_base) + name_len + 3 + sizeof(".index") + sizeof(".sorted"); /* including / and null-byte */
 	full = malloc(full_len);
 	if (!full) {
@@ -274,10 +286,18 @@ again:
 
 		ctl->index_size = st.st_size;
 
+		err = eblob_txn_recover(b, ctl);
+		if (err) {
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
+					"bctl: index: %d, eblob_txn_recover: FAILED: %d\n", ctl->index, err);
+			goto err_out_close_index;
+		}
+
 		/* Sort index only if base is not empty and exceeds thresholds */
+		eblob_base_limits(b, &blob_size, &records_in_blob);
 		if (ctl->index_size &&
-				((ctl->data_size >= b->cfg.blob_size) ||
-				(ctl->index_size / sizeof(struct eblob_disk_control) >= b->cfg.records_in_blob))) {
+				((ctl->data_size >= blob_size) ||
+				(ctl->index_size / sizeof(struct eblob_disk_control) >= records_in_blob))) {
 			err = eblob_generate_sorted_index(b, ctl);
 			if (err) {
 				eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
@@ -295,7 +315,7 @@ again:
 					"data: size: %llu, max blob size: %llu\n",
 					ctl->index, b->max_index,
 					ctl->index_size, ctl->index_size / sizeof(struct eblob_disk_control),
-					ctl->data_size, (unsigned long long)b->cfg.blob_size);
+					ctl->data_size, (unsigned long long)blob_size);
 		}
 	} else {
 		struct stat st;
@@ -411,6 +431,15 @@ struct eblob_base_ctl *eblob_base_ctl_new(struct eblob_backend *b, int index,
 	if (pthread_cond_init(&ctl->critness_wait, NULL))
 		goto err_out_destroy_lock;
 
+	if (atomic_init(&ctl->critness, 0))
+		goto err_out_destroy_critness_wait;
+
+	if (atomic_init(&ctl->summary_heat, 0))
+		goto err_out_destroy_critness_wait;
+
+	if (atomic_init(&ctl->lazy_users, 0))
+		goto err_out_destroy_critness_wait;
+
 	if (pthread_rwlock_init(&ctl->index_blocks_lock, NULL))
 		goto err_out_destroy_critness_wait;
 
@@ -629,9 +658,10 @@ err_out_exit:
 }
 
 /**
- * eblob_cache_insert() - inserts or updates ram control in hash.
+ * eblob_cache_insert_nolock() - inserts or updates ram control in hash.
+ * NB! Caller should hold hash.root_lock for writing.
  */
-int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
+int eblob_cache_insert_nolock(struct eblob_backend *b, struct eblob_key *key,
 		struct eblob_ram_control *ctl)
 {
 	size_t entry_size;
@@ -641,19 +671,15 @@ int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
 	if (b == NULL || key == NULL || ctl == NULL || ctl->bctl == NULL)
 		return -EINVAL;
 
-	pthread_rwlock_wrlock(&b->hash.root_lock);
-
 	/* Do not accept bctls invalidated by data-sort */
-	if (ctl->bctl->index_fd < 0) {
-		err = -EAGAIN;
-		goto err_out_exit;
-	}
+	if (ctl->bctl->index_fd < 0)
+		return -EAGAIN;
 
 	if (b->cfg.blob_flags & EBLOB_L2HASH) {
 		err = eblob_l2hash_upsert(&b->l2hash, key, ctl, &replaced);
 		entry_size = EBLOB_L2HASH_ENTRY_SIZE;
 	} else {
-		err = eblob_hash_replace_nolock(&b->hash, key, ctl, &replaced);
+		err = eblob_hash_replace_nolock(&b->root->hash, b->ns_id, key, ctl, &replaced);
 		entry_size = EBLOB_HASH_ENTRY_SIZE;
 	}
 
@@ -661,8 +687,20 @@ int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
 	if (err == 0 && replaced == 0)
 		eblob_stat_add(b->stat, EBLOB_GST_CACHED, entry_size);
 
-err_out_exit:
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	return err;
+}
+
+/**
+ * eblob_cache_insert() - inserts or updates ram control in hash.
+ */
+int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_ram_control *ctl)
+{
+	int err;
+
+	pthread_rwlock_wrlock(&b->root->hash.root_lock);
+	err = eblob_cache_insert_nolock(b, key, ctl);
+	pthread_rwlock_unlock(&b->root->hash.root_lock);
 
 	return err;
 }
@@ -676,7 +714,7 @@ int eblob_cache_remove_nolock(struct eblob_backend *b, struct eblob_key *key)
 		err = eblob_l2hash_remove(&b->l2hash, key);
 		entry_size = EBLOB_L2HASH_ENTRY_SIZE;
 	} else {
-		err = eblob_hash_remove_nolock(&b->hash, key);
+		err = eblob_hash_remove_nolock(&b->root->hash, b->ns_id, key);
 		entry_size = EBLOB_HASH_ENTRY_SIZE;
 	}
 
@@ -690,29 +728,95 @@ int eblob_cache_remove(struct eblob_backend *b, struct eblob_key *key)
 {
 	int err;
 
-	pthread_rwlock_wrlock(&b->hash.root_lock);
+	pthread_rwlock_wrlock(&b->root->hash.root_lock);
 	err = eblob_cache_remove_nolock(b, key);
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	pthread_rwlock_unlock(&b->root->hash.root_lock);
 	return err;
 }
 
-int eblob_cache_lookup(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_ram_control *res, int *diskp)
+/**
+ * eblob_cache_remove_old() - removes @key from cache only if it still refers
+ * to record @old, so that record written after @old was looked up is kept.
+ * Lookup and removal are done under one lock, concurrent write can not
+ * sneak in between them.
+ */
+int eblob_cache_remove_old(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_ram_control *old)
 {
-	react_start_action(ACTION_EBLOB_CACHE_LOOKUP);
+	struct eblob_ram_control cur;
+	int err;
+
+	pthread_rwlock_wrlock(&b->root->hash.root_lock);
+	if (b->cfg.blob_flags & EBLOB_L2HASH)
+		err = eblob_l2hash_lookup(&b->l2hash, key, &cur);
+	else
+		err = eblob_hash_lookup_nolock(&b->root->hash, b->ns_id, key, &cur);
+
+	if (err == 0 && cur.bctl == old->bctl && cur.data_offset == old->data_offset)
+		err = eblob_cache_remove_nolock(b, key);
+	pthread_rwlock_unlock(&b->root->hash.root_lock);
+
+	return err;
+}
+
+/**
+ * eblob_cache_update_flags() - sets @flags of cached @key if it still points
+ * to record @old, returns -EAGAIN if it was replaced meanwhile.
+ */
+int eblob_cache_update_flags(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_ram_control *old, uint64_t flags)
+{
+	struct eblob_ram_control cur;
+	int err;
+
+	pthread_rwlock_wrlock(&b->root->hash.root_lock);
+	if (b->cfg.blob_flags & EBLOB_L2HASH)
+		err = eblob_l2hash_lookup(&b->l2hash, key, &cur);
+	else
+		err = eblob_hash_lookup_nolock(&b->root->hash, b->ns_id, key, &cur);
+
+	if (err == 0 && (cur.bctl != old->bctl || cur.data_offset != old->data_offset))
+		err = -EAGAIN;
+	if (err == 0) {
+		cur.flags = flags;
+		err = eblob_cache_insert_nolock(b, key, &cur);
+	}
+	pthread_rwlock_unlock(&b->root->hash.root_lock);
+
+	return err;
+}
 
-	int err = 1, disk = 0;
+/**
+ * eblob_cache_lookup_ram() - looks @key up in memory only, unlike
+ * eblob_cache_lookup() it never touches bases, so it can be called with
+ * bctl->lock held.
+ */
+int eblob_cache_lookup_ram(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_ram_control *res)
+{
+	int err;
 
-	pthread_rwlock_rdlock(&b->hash.root_lock);
+	pthread_rwlock_rdlock(&b->root->hash.root_lock);
 	if (b->cfg.blob_flags & EBLOB_L2HASH) {
 		/* If l2hash is enabled - look in it */
 		err = eblob_l2hash_lookup(&b->l2hash, key, res);
 	} else {
 		/* Look in memory cache */
-		err = eblob_hash_lookup_nolock(&b->hash, key, res);
+		err = eblob_hash_lookup_nolock(&b->root->hash, b->ns_id, key, res);
 	}
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	pthread_rwlock_unlock(&b->root->hash.root_lock);
 
+	return err;
+}
+
+int eblob_cache_lookup(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_ram_control *res, int *diskp)
+{
+	react_start_action(ACTION_EBLOB_CACHE_LOOKUP);
+
+	int err, disk = 0;
+
+	err = eblob_cache_lookup_ram(b, key, res);
 	if (err == -ENOENT) {
 		/* Look on disk */
 		err = eblob_disk_index_lookup(b, key, res);
@@ -773,7 +877,7 @@ static int eblob_iterate_existing(struct eblob_backend *b, struct eblob_iterate_
 			ctl->base = bctl;
 
 			err = 0;
-			if (bctl->sort.fd < 0 || (ctl->flags & EBLOB_ITERATE_FLAGS_ALL)) {
+			if ((bctl->sort.fd < 0 && !bctl->lazy_closed) || (ctl->flags & EBLOB_ITERATE_FLAGS_ALL)) {
 				err = eblob_blob_iterate(ctl);
 			}
 
@@ -900,6 +1004,11 @@ int eblob_add_new_base(struct eblob_backend *b)
 	if (b == NULL)
 		return -EINVAL;
 
+	/* Buffered records should land before open base becomes read-only */
+	err = eblob_wbuf_flush(b);
+	if (err)
+		goto err_out_exit;
+
 	if ((ctl = eblob_add_new_base_ll(b)) == NULL) {
 		err = -ENOMEM;
 		goto err_out_exit;
@@ -914,10 +1023,14 @@ void eblob_remove_blobs(struct eblob_backend *b)
 {
 	struct eblob_base_ctl *ctl, *tmp;
 
+	/* Lazy close in progress would write summary of removed base */
+	pthread_mutex_lock(&b->lazy_lock);
 	pthread_mutex_lock(&b->lock);
+	eblob_wbuf_flush(b);
 	list_for_each_entry_safe(ctl, tmp, &b->bases, base_entry)
 		eblob_base_remove(ctl);
 	pthread_mutex_unlock(&b->lock);
+	pthread_mutex_unlock(&b->lazy_lock);
 }
 
 /*
@@ -977,6 +1090,9 @@ void eblob_base_remove(struct eblob_base_ctl *bctl)
 	struct eblob_backend *b = bctl->back;
 	char path[PATH_MAX], base_path[PATH_MAX];
 
+	/* Base must not be closed lazily from now on, it would leave summary */
+	bctl->removed = 1;
+
 	snprintf(base_path, PATH_MAX, "%s-0.%d", b->cfg.file, bctl->index);
 	unlink(base_path);
 
@@ -988,4 +1104,7 @@ void eblob_base_remove(struct eblob_base_ctl *bctl)
 
 	snprintf(path, PATH_MAX, "%s.index.sorted", base_path);
 	unlink(path);
+
+	if (snprintf(path, PATH_MAX, "%s" EBLOB_BLOB_SUMMARY_SUFFIX, base_path) < PATH_MAX)
+		unlink(path);
 }
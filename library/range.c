@@ -221,7 +221,7 @@ err_out_exit:
 int eblob_read_range(struct eblob_range_request *req)
 {
 	struct eblob_backend *b = req->back;
-	struct eblob_hash *h = &b->hash;
+	struct eblob_hash *h = &b->root->hash;
 	struct rb_node *n = h->root.rb_node;
 	struct eblob_hash_entry *e = NULL, *t = NULL;
 	int err = -ENOENT, cmp;
@@ -237,13 +237,13 @@ int eblob_read_range(struct eblob_range_request *req)
 	while (n) {
 		t = rb_entry(n, struct eblob_hash_entry, node);
 
-		cmp = eblob_id_cmp(t->key.id, req->start);
+		cmp = eblob_hash_entry_cmp(t, b->ns_id, req->start);
 		if (cmp < 0)
 			n = n->rb_left;
 		else if (cmp > 0) {
 			n = n->rb_right;
 
-			if (eblob_id_in_range(t->key.id, req->start, req->end)) {
+			if (t->ns == b->ns_id && eblob_id_in_range(t->key.id, req->start, req->end)) {
 				e = t;
 			}
 		} else {
@@ -269,11 +269,12 @@ int eblob_read_range(struct eblob_range_request *req)
 					(unsigned long long)req->requested_limit_num);
 		}
 
-		if (eblob_id_in_range(e->key.id, req->start, req->end)) {
+		if (e->ns == b->ns_id && eblob_id_in_range(e->key.id, req->start, req->end)) {
 			for (unsigned int i = 0;
 					i < h->dsize / sizeof(struct eblob_ram_control); ++i) {
-				struct eblob_ram_control __attribute__((__may_alias__))
-					*const ctl = (void *)e->data + i;
+				struct eblob_ram_control ctl;
+
+				memcpy(&ctl, e->data + i * sizeof(ctl), sizeof(ctl));
 
 				/*
 				 * ctl->index is an index of the blob, which hosts given key. This key is currently in RAM (tree)
@@ -283,12 +284,12 @@ int eblob_read_range(struct eblob_range_request *req)
 				 * We should use key found in RAM only if blob, which hosts this key, does not have sorted indexes.
 				 * FIXME: Simplify me! Now we have bctl in ram control
 				 */
-				if (ctl->bctl->index != b->max_index) {
+				if (ctl.bctl->index != b->max_index) {
 					struct eblob_base_ctl *bctl;
 					int have_sorted_fd = 0;
 
 					list_for_each_entry(bctl, &b->bases, base_entry) {
-						if (bctl->index == ctl->bctl->index) {
+						if (bctl->index == ctl.bctl->index) {
 							if (bctl->sort.fd >= 0) {
 								have_sorted_fd = 1;
 								break;
@@ -300,8 +301,8 @@ int eblob_read_range(struct eblob_range_request *req)
 						continue;
 				}
 
-				err = eblob_range_callback(req, &e->key, ctl->bctl->data_fd,
-						ctl->data_offset + sizeof(struct eblob_disk_control), ctl->size);
+				err = eblob_range_callback(req, &e->key, ctl.bctl->data_fd,
+						ctl.data_offset + sizeof(struct eblob_disk_control), ctl.size);
 				if (err > 0)
 					goto err_out_unlock;
 				break;
@@ -0,0 +1,332 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Process-wide background scheduler.
+ *
+ * Instead of dedicated sync/defrag/periodic threads per backend all
+ * background work of all backends is done by a small pool of workers.
+ * Backends register periodic tasks, workers pick due tasks by class
+ * priority and then by how long they are overdue. Heavy tasks (data-sort)
+ * are limited per block device, so several backends on one disk do not sort
+ * at the same time, and never take the last worker.
+ *
+ * Pool is started with the first task and stopped with the last one.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+#include "scheduler.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Upper bound of worker sleep, so clock adjustments are picked up */
+#define EBLOB_SCHEDULER_MAX_WAIT_MS	(1000)
+
+static struct eblob_scheduler {
+	pthread_mutex_t		lock;
+	/* Signalled when task is added or finished and on shutdown */
+	pthread_cond_t		cond;
+	struct list_head	tasks;
+	pthread_t		*tids;
+	int			threads;
+	int			started;
+	int			device_limit;
+	int			heavy_running;
+	/* Workers of previous generations exit */
+	uint64_t		generation;
+} eblob_sched = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.tasks = LIST_HEAD_INIT(eblob_sched.tasks),
+	.threads = EBLOB_SCHEDULER_DEFAULT_THREADS,
+	.device_limit = EBLOB_SCHEDULER_DEFAULT_DEVICE_LIMIT,
+};
+
+static pthread_once_t eblob_sched_once = PTHREAD_ONCE_INIT;
+
+static void eblob_scheduler_init_once(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&eblob_sched.cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static uint64_t eblob_scheduler_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Heavy tasks may use all workers but one, pool has at least two of them.
+ */
+static int eblob_scheduler_heavy_allowed(const struct eblob_task *task)
+{
+	const struct eblob_task *t;
+	int on_device = 0;
+
+	if (eblob_sched.heavy_running >= eblob_sched.threads - 1)
+		return 0;
+
+	list_for_each_entry(t, &eblob_sched.tasks, task_entry)
+		if (t->running && t->heavy && t->dev == task->dev)
+			on_device++;
+
+	return on_device < eblob_sched.device_limit;
+}
+
+/*
+ * eblob_scheduler_pick() - finds the most important due task, if there is
+ * none stores in @wait number of milliseconds till the next one.
+ * NB! Caller should hold eblob_sched.lock.
+ */
+static struct eblob_task *eblob_scheduler_pick(uint64_t now, uint64_t *wait)
+{
+	struct eblob_task *t, *best = NULL;
+
+	*wait = EBLOB_SCHEDULER_MAX_WAIT_MS;
+
+	list_for_each_entry(t, &eblob_sched.tasks, task_entry) {
+		if (t->running)
+			continue;
+
+		if (t->next_run > now) {
+			if (t->next_run - now < *wait)
+				*wait = t->next_run - now;
+			continue;
+		}
+
+		if (t->heavy && !eblob_scheduler_heavy_allowed(t))
+			continue;
+
+		if (best == NULL || t->cls < best->cls
+				|| (t->cls == best->cls && t->next_run < best->next_run))
+			best = t;
+	}
+
+	return best;
+}
+
+static void *eblob_scheduler_worker(void *data)
+{
+	const uint64_t generation = (uintptr_t)data;
+	struct eblob_task *task;
+	struct timespec ts;
+	uint64_t wait;
+
+	pthread_mutex_lock(&eblob_sched.lock);
+	while (eblob_sched.generation == generation) {
+		task = eblob_scheduler_pick(eblob_scheduler_now(), &wait);
+		if (task == NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += wait / 1000;
+			ts.tv_nsec += (wait % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&eblob_sched.cond, &eblob_sched.lock, &ts);
+			continue;
+		}
+
+		task->running = 1;
+		if (task->heavy)
+			eblob_sched.heavy_running++;
+		pthread_mutex_unlock(&eblob_sched.lock);
+
+		task->func(task->b);
+
+		pthread_mutex_lock(&eblob_sched.lock);
+		task->running = 0;
+		if (task->heavy)
+			eblob_sched.heavy_running--;
+		task->next_run = eblob_scheduler_now() + task->interval;
+		pthread_cond_broadcast(&eblob_sched.cond);
+	}
+	pthread_mutex_unlock(&eblob_sched.lock);
+
+	return NULL;
+}
+
+/*
+ * NB! Caller should hold eblob_sched.lock.
+ */
+static int eblob_scheduler_start(void)
+{
+	int err, i;
+
+	eblob_sched.tids = calloc(eblob_sched.threads, sizeof(pthread_t));
+	if (eblob_sched.tids == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < eblob_sched.threads; ++i) {
+		err = pthread_create(&eblob_sched.tids[i], NULL, eblob_scheduler_worker,
+				(void *)(uintptr_t)eblob_sched.generation);
+		if (err != 0)
+			goto err_out_stop;
+	}
+
+	eblob_sched.started = eblob_sched.threads;
+	return 0;
+
+err_out_stop:
+	eblob_sched.generation++;
+	pthread_cond_broadcast(&eblob_sched.cond);
+	pthread_mutex_unlock(&eblob_sched.lock);
+	while (--i >= 0)
+		pthread_join(eblob_sched.tids[i], NULL);
+	pthread_mutex_lock(&eblob_sched.lock);
+	free(eblob_sched.tids);
+	eblob_sched.tids = NULL;
+	return -err;
+}
+
+/**
+ * eblob_scheduler_add() - registers periodic task @func of backend @b that
+ * is run every @interval_ms milliseconds.
+ */
+int eblob_scheduler_add(struct eblob_backend *b, enum eblob_task_class cls,
+		int (*func)(struct eblob_backend *b), uint64_t interval_ms, int heavy)
+{
+	char dir[PATH_MAX], *tmp;
+	struct eblob_task *task;
+	struct stat st;
+	int err = 0;
+
+	if (b == NULL || func == NULL || cls >= EBLOB_TASK_CLASS_MAX)
+		return -EINVAL;
+
+	pthread_once(&eblob_sched_once, eblob_scheduler_init_once);
+
+	task = calloc(1, sizeof(struct eblob_task));
+	if (task == NULL)
+		return -ENOMEM;
+
+	snprintf(dir, sizeof(dir), "%s", b->cfg.file);
+	tmp = strrchr(dir, '/');
+	if (tmp != NULL)
+		*tmp = '\0';
+	else
+		snprintf(dir, sizeof(dir), ".");
+	if (stat(dir, &st) == 0)
+		task->dev = st.st_dev;
+
+	task->b = b;
+	task->cls = cls;
+	task->func = func;
+	task->interval = interval_ms;
+	task->heavy = heavy;
+	task->next_run = eblob_scheduler_now() + interval_ms;
+
+	pthread_mutex_lock(&eblob_sched.lock);
+	if (eblob_sched.started == 0) {
+		err = eblob_scheduler_start();
+		if (err != 0) {
+			pthread_mutex_unlock(&eblob_sched.lock);
+			free(task);
+			return err;
+		}
+	}
+	list_add_tail(&task->task_entry, &eblob_sched.tasks);
+	pthread_cond_broadcast(&eblob_sched.cond);
+	pthread_mutex_unlock(&eblob_sched.lock);
+
+	return 0;
+}
+
+/**
+ * eblob_scheduler_cancel() - removes all tasks of backend @b waiting for
+ * running ones to complete. Caller should make long running tasks of @b
+ * return quickly, i.e. by setting its exit_event.
+ * Stops the pool when the last task is removed.
+ */
+void eblob_scheduler_cancel(struct eblob_backend *b)
+{
+	struct eblob_task *t, *tmp;
+	pthread_t *tids = NULL;
+	int started = 0, i;
+
+	pthread_once(&eblob_sched_once, eblob_scheduler_init_once);
+
+	pthread_mutex_lock(&eblob_sched.lock);
+again:
+	list_for_each_entry_safe(t, tmp, &eblob_sched.tasks, task_entry) {
+		if (t->b != b)
+			continue;
+
+		if (t->running) {
+			pthread_cond_wait(&eblob_sched.cond, &eblob_sched.lock);
+			goto again;
+		}
+
+		list_del(&t->task_entry);
+		free(t);
+	}
+
+	if (list_empty(&eblob_sched.tasks) && eblob_sched.started) {
+		eblob_sched.generation++;
+		pthread_cond_broadcast(&eblob_sched.cond);
+
+		tids = eblob_sched.tids;
+		started = eblob_sched.started;
+		eblob_sched.tids = NULL;
+		eblob_sched.started = 0;
+	}
+	pthread_mutex_unlock(&eblob_sched.lock);
+
+	for (i = 0; i < started; ++i)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+int eblob_scheduler_config(int threads, int device_limit)
+{
+	int err = 0;
+
+	if (threads < 0 || device_limit < 0)
+		return -EINVAL;
+
+	pthread_mutex_lock(&eblob_sched.lock);
+	if (device_limit)
+		eblob_sched.device_limit = device_limit;
+	if (threads) {
+		if (eblob_sched.started)
+			err = -EBUSY;
+		else if (threads < EBLOB_SCHEDULER_MIN_THREADS)
+			eblob_sched.threads = EBLOB_SCHEDULER_MIN_THREADS;
+		else
+			eblob_sched.threads = threads;
+	}
+	pthread_mutex_unlock(&eblob_sched.lock);
+
+	return err;
+}
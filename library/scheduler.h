@@ -0,0 +1,65 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_SCHEDULER_H
+#define __EBLOB_SCHEDULER_H
+
+#include "list.h"
+
+#include <sys/types.h>
+
+#include <stdint.h>
+
+struct eblob_backend;
+
+/* Default size of process-wide worker pool */
+#define EBLOB_SCHEDULER_DEFAULT_THREADS		(4)
+/* Smaller pool is rounded up, so that one worker is always left for light tasks */
+#define EBLOB_SCHEDULER_MIN_THREADS		(2)
+/* Default number of heavy tasks allowed to run on one device at once */
+#define EBLOB_SCHEDULER_DEFAULT_DEVICE_LIMIT	(1)
+
+/*
+ * Task classes in order of priority. Heavy tasks are limited per device and
+ * never occupy the last worker, so light ones can not be starved.
+ */
+enum eblob_task_class {
+	EBLOB_TASK_SYNC,
+	EBLOB_TASK_PERIODIC,
+	EBLOB_TASK_DEFRAG,
+	EBLOB_TASK_CLASS_MAX,
+};
+
+struct eblob_task {
+	struct list_head	task_entry;
+	struct eblob_backend	*b;
+	enum eblob_task_class	cls;
+	int			(*func)(struct eblob_backend *b);
+	/* Period and next run, milliseconds of monotonic clock */
+	uint64_t		interval;
+	uint64_t		next_run;
+	/* Device backend lives on, heavy tasks are limited per device */
+	dev_t			dev;
+	int			heavy;
+	int			running;
+};
+
+int eblob_scheduler_add(struct eblob_backend *b, enum eblob_task_class cls,
+		int (*func)(struct eblob_backend *b), uint64_t interval_ms, int heavy);
+void eblob_scheduler_cancel(struct eblob_backend *b);
+
+#endif /* __EBLOB_SCHEDULER_H */
@@ -0,0 +1,413 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Free space accounting.
+ *
+ * All backends living on one device share an accountant. Space for new
+ * records and data-sort temporaries is reserved under its lock against free
+ * space of the last statvfs() sample, so concurrent writers can not
+ * overcommit the disk between samples. Writers' reservations are dropped on
+ * each sample, since by then written data is accounted by the filesystem
+ * itself. Data-sort holds its reservation till it finishes, but its
+ * temporary files show up in samples as they are written: only part of the
+ * reservation that was not on disk by the last sample is subtracted from it.
+ *
+ * Filesystem is sampled every EBLOB_SPACE_SAMPLE_MAX_MS, or every
+ * EBLOB_SPACE_SAMPLE_MIN_MS when headroom of the backend is low.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EBLOB_SPACE_SAMPLE_MAX_MS	(30 * 1000)
+#define EBLOB_SPACE_SAMPLE_MIN_MS	(1000)
+
+struct eblob_space {
+	struct list_head	space_entry;
+	dev_t			dev;
+	int			refcnt;
+	pthread_mutex_t		lock;
+	/* Directory statvfs() is called on */
+	char			path[PATH_MAX];
+	/* Last sample of filesystem, bytes */
+	uint64_t		total;
+	uint64_t		avail;
+	/* Time of the last sample, ms of monotonic clock */
+	uint64_t		sampled;
+	/* Reserved by writers since the last sample */
+	uint64_t		reserved;
+	/* Reserved by running data-sorts */
+	uint64_t		datasort;
+	/* Written by running data-sorts and still on disk, now and by the last sample */
+	uint64_t		datasort_written;
+	uint64_t		datasort_sampled;
+};
+
+static pthread_mutex_t eblob_spaces_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(eblob_spaces);
+
+static uint64_t eblob_space_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * NB! Caller should hold s->lock.
+ */
+static int eblob_space_sample(struct eblob_space *s)
+{
+	struct statvfs st;
+
+	if (statvfs(s->path, &st) == -1)
+		return -errno;
+
+	s->total = (uint64_t)st.f_frsize * st.f_blocks;
+	s->avail = (uint64_t)st.f_bsize * st.f_bavail;
+	s->reserved = 0;
+	s->datasort_sampled = s->datasort_written;
+	s->sampled = eblob_space_now();
+	return 0;
+}
+
+/*
+ * Part of data-sort reservations not accounted by the last sample yet.
+ * Files removed by data-sort since the sample do not change it: sample
+ * still shows them as used.
+ */
+static uint64_t eblob_space_datasort(const struct eblob_space *s)
+{
+	if (s->datasort < s->datasort_sampled)
+		return 0;
+	return s->datasort - s->datasort_sampled;
+}
+
+static uint64_t eblob_space_free(const struct eblob_space *s)
+{
+	const uint64_t datasort = eblob_space_datasort(s);
+
+	if (s->avail < s->reserved + datasort)
+		return 0;
+	return s->avail - s->reserved - datasort;
+}
+
+/*
+ * Amount of free space writers of @b must leave untouched.
+ */
+static uint64_t eblob_space_keep(const struct eblob_backend *b, const struct eblob_space *s)
+{
+	if (b->cfg.blob_size_limit)
+		return 0;
+	if (b->cfg.blob_flags & EBLOB_RESERVE_10_PERCENTS)
+		return s->total / 10;
+	return 2 * b->cfg.blob_size;
+}
+
+/*
+ * Headroom is low when backend is closer than its reserve to the point
+ * where writes start to fail.
+ */
+static int eblob_space_low(const struct eblob_backend *b, const struct eblob_space *s)
+{
+	if (b->cfg.blob_size_limit)
+		return b->space_used + 2 * b->cfg.blob_size > b->cfg.blob_size_limit;
+	return eblob_space_free(s) < 2 * eblob_space_keep(b, s);
+}
+
+/*
+ * eblob_space_refresh() - resamples filesystem and size of @b's bases if
+ * their samples are too old for current headroom.
+ * NB! Caller should hold b->space->lock.
+ */
+static int eblob_space_refresh(struct eblob_backend *b)
+{
+	struct eblob_space *s = b->space;
+	struct eblob_base_ctl *bctl;
+	const uint64_t now = eblob_space_now();
+	uint64_t interval, used = 0;
+	int err = 0;
+
+	interval = eblob_space_low(b, s) ? EBLOB_SPACE_SAMPLE_MIN_MS : EBLOB_SPACE_SAMPLE_MAX_MS;
+
+	if (now - s->sampled >= interval)
+		err = eblob_space_sample(s);
+
+	if (now - b->space_sampled >= interval) {
+		pthread_mutex_lock(&b->lock);
+		list_for_each_entry(bctl, &b->bases, base_entry)
+			used += bctl->data_offset + bctl->index_size;
+		pthread_mutex_unlock(&b->lock);
+
+		b->space_used = used;
+		b->space_sampled = now;
+	}
+
+	return err;
+}
+
+/**
+ * eblob_space_attach() - finds or creates accountant of the device @b lives
+ * on.
+ */
+int eblob_space_attach(struct eblob_backend *b)
+{
+	char dir[PATH_MAX], *tmp;
+	struct eblob_space *s;
+	struct stat st;
+	int err = 0;
+
+	if (snprintf(dir, sizeof(dir), "%s", b->cfg.file) >= (int)sizeof(dir))
+		return -ENAMETOOLONG;
+	tmp = strrchr(dir, '/');
+	if (tmp != NULL)
+		*tmp = '\0';
+	else
+		snprintf(dir, sizeof(dir), ".");
+
+	if (stat(dir, &st) == -1)
+		return -errno;
+
+	pthread_mutex_lock(&eblob_spaces_lock);
+	list_for_each_entry(s, &eblob_spaces, space_entry)
+		if (s->dev == st.st_dev)
+			goto found;
+
+	s = calloc(1, sizeof(struct eblob_space));
+	if (s == NULL) {
+		err = -ENOMEM;
+		goto err_out_unlock;
+	}
+
+	err = eblob_mutex_init(&s->lock);
+	if (err != 0)
+		goto err_out_free;
+
+	s->dev = st.st_dev;
+	snprintf(s->path, sizeof(s->path), "%s", dir);
+	err = eblob_space_sample(s);
+	if (err != 0)
+		goto err_out_destroy;
+
+	list_add_tail(&s->space_entry, &eblob_spaces);
+found:
+	s->refcnt++;
+	b->space = s;
+	pthread_mutex_unlock(&eblob_spaces_lock);
+	return 0;
+
+err_out_destroy:
+	pthread_mutex_destroy(&s->lock);
+err_out_free:
+	free(s);
+err_out_unlock:
+	pthread_mutex_unlock(&eblob_spaces_lock);
+	return err;
+}
+
+void eblob_space_detach(struct eblob_backend *b)
+{
+	struct eblob_space *s = b->space;
+
+	if (s == NULL)
+		return;
+
+	pthread_mutex_lock(&eblob_spaces_lock);
+	if (--s->refcnt == 0) {
+		list_del(&s->space_entry);
+		pthread_mutex_destroy(&s->lock);
+		free(s);
+	}
+	pthread_mutex_unlock(&eblob_spaces_lock);
+	b->space = NULL;
+}
+
+/**
+ * eblob_space_reserve() - reserves @size bytes for new record of @b or
+ * returns -ENOSPC if there is not enough space for it, i.e. writing it would
+ * exceed blob_size_limit or eat into the reserve: 10% of filesystem with
+ * EBLOB_RESERVE_10_PERCENTS or two blobs otherwise.
+ */
+int eblob_space_reserve(struct eblob_backend *b, uint64_t size)
+{
+	struct eblob_space *s = b->space;
+	static int print_once;
+	uint64_t avail;
+	int err = 0;
+
+	if (b->cfg.blob_flags & EBLOB_NO_FREE_SPACE_CHECK)
+		return 0;
+
+	pthread_mutex_lock(&s->lock);
+	eblob_space_refresh(b);
+
+	avail = eblob_space_free(s);
+	if (avail < size) {
+		err = -ENOSPC;
+		goto err_out_unlock;
+	}
+
+	if (b->cfg.blob_size_limit) {
+		if (b->space_used + size > b->cfg.blob_size_limit) {
+			if (!print_once) {
+				print_once = 1;
+
+				eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "OUT OF FREE SPACE: available: %" PRIu64 " Mb, "
+						"total: %" PRIu64 " Mb, current size: %" PRIu64 " Mb, limit: %" PRIu64 "Mb\n",
+						avail / EBLOB_1_M, s->total / EBLOB_1_M,
+						(b->space_used + size) / EBLOB_1_M,
+						b->cfg.blob_size_limit / EBLOB_1_M);
+			}
+			err = -ENOSPC;
+			goto err_out_unlock;
+		}
+	} else if (avail - size < eblob_space_keep(b, s)) {
+		if (!print_once) {
+			print_once = 1;
+
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "OUT OF FREE SPACE: available: %" PRIu64 " Mb, "
+					"total: %" PRIu64 " Mb, blob size: %" PRIu64 " Mb\n",
+					avail / EBLOB_1_M, s->total / EBLOB_1_M, b->cfg.blob_size / EBLOB_1_M);
+		}
+		err = -ENOSPC;
+		goto err_out_unlock;
+	}
+
+	s->reserved += size;
+	b->space_used += size;
+
+err_out_unlock:
+	pthread_mutex_unlock(&s->lock);
+	return err;
+}
+
+/**
+ * eblob_space_release() - returns @size bytes reserved by
+ * eblob_space_reserve() for record of @b that was not written after all.
+ * Reservation may have been dropped by new sample already, hence clamping.
+ */
+void eblob_space_release(struct eblob_backend *b, uint64_t size)
+{
+	struct eblob_space *s = b->space;
+
+	if ((b->cfg.blob_flags & EBLOB_NO_FREE_SPACE_CHECK) || size == 0)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	s->reserved -= size < s->reserved ? size : s->reserved;
+	b->space_used -= size < b->space_used ? size : b->space_used;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * eblob_space_reserve_datasort() - reserves @size bytes for temporary files
+ * of data-sort. Data-sort is what frees space, so it may use the reserve
+ * that is kept from writers.
+ */
+int eblob_space_reserve_datasort(struct eblob_backend *b, uint64_t size)
+{
+	struct eblob_space *s = b->space;
+	int err = 0;
+
+	pthread_mutex_lock(&s->lock);
+	eblob_space_refresh(b);
+
+	if (!(b->cfg.blob_flags & EBLOB_NO_FREE_SPACE_CHECK) && eblob_space_free(s) < size)
+		err = -ENOSPC;
+	else
+		s->datasort += size;
+	pthread_mutex_unlock(&s->lock);
+
+	return err;
+}
+
+/**
+ * eblob_space_account_datasort() - accounts @size bytes data-sort has written
+ * to (or, if negative, removed from) its temporary files, @written is its
+ * own total.
+ */
+void eblob_space_account_datasort(struct eblob_backend *b, uint64_t *written, int64_t size)
+{
+	struct eblob_space *s = b->space;
+
+	pthread_mutex_lock(&s->lock);
+	if (size < 0 && (uint64_t)-size > *written)
+		size = -(int64_t)*written;
+	*written += size;
+	s->datasort_written += size;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * eblob_space_release_datasort() - drops reservation of @size bytes of
+ * finished data-sort that had @written bytes on disk. Its share of the
+ * sample is not known exactly, so all of them are assumed to be sampled.
+ */
+void eblob_space_release_datasort(struct eblob_backend *b, uint64_t size, uint64_t written)
+{
+	struct eblob_space *s = b->space;
+
+	pthread_mutex_lock(&s->lock);
+	s->datasort -= size;
+	s->datasort_written -= written;
+	s->datasort_sampled -= written < s->datasort_sampled ? written : s->datasort_sampled;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * eblob_space_update() - refreshes samples of @b if they are stale.
+ */
+int eblob_space_update(struct eblob_backend *b)
+{
+	int err;
+
+	pthread_mutex_lock(&b->space->lock);
+	err = eblob_space_refresh(b);
+	pthread_mutex_unlock(&b->space->lock);
+
+	return err;
+}
+
+void eblob_space_get_stat(struct eblob_backend *b, struct eblob_space_stat *st)
+{
+	struct eblob_space *s = b->space;
+
+	pthread_mutex_lock(&s->lock);
+	st->total = s->total;
+	st->avail = s->avail;
+	st->reserved = s->reserved;
+	st->datasort = eblob_space_datasort(s);
+	st->keep = eblob_space_keep(b, s);
+	st->used = b->space_used;
+	pthread_mutex_unlock(&s->lock);
+}
@@ -162,6 +162,20 @@ eblob_stat_summary_print(FILE *fp, struct eblob_backend *b)
 	fprintf(fp, "\n");
 }
 
+/*
+ * Approximate size of live records of base: its data and index less removed
+ * records and their index entries.
+ */
+static int64_t
+eblob_stat_live_size(struct eblob_stat *s)
+{
+	int64_t live = eblob_stat_get(s, EBLOB_LST_BASE_SIZE)
+		- eblob_stat_get(s, EBLOB_LST_REMOVED_SIZE)
+		- eblob_stat_get(s, EBLOB_LST_RECORDS_REMOVED) * (int64_t)sizeof(struct eblob_disk_control);
+
+	return live > 0 ? live : 0;
+}
+
 static void
 eblob_stat_base_update(struct eblob_backend *b)
 {
@@ -171,6 +185,7 @@ eblob_stat_base_update(struct eblob_backend *b)
 	list_for_each_entry(bctl, &b->bases, base_entry) {
 		eblob_stat_set(bctl->stat, EBLOB_LST_WANT_DEFRAG, eblob_want_defrag(bctl));
 		eblob_stat_set(bctl->stat, EBLOB_LST_IS_SORTED, datasort_base_is_sorted(bctl));
+		eblob_stat_set(bctl->stat, EBLOB_LST_LIVE_SIZE, eblob_stat_live_size(bctl->stat));
 	}
 }
 
@@ -213,10 +228,12 @@ int eblob_stat_commit(struct eblob_backend *b)
 
 	eblob_stat_global_print(fp, b);
 
+	/* Bases first, so summary includes values derived for them */
+	eblob_stat_base_update(b);
+
 	eblob_stat_summary_update(b);
 	eblob_stat_summary_print(fp, b);
 
-	eblob_stat_base_update(b);
 	eblob_stat_base_print(fp, b);
 
 	if (fclose(fp) == EOF)
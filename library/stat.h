@@ -109,6 +109,186 @@ static const struct eblob_stat_entry eblob_stat_default_global[] = {
 		EBLOB_GST_DATASORT_COMPLETION_STATUS,
 		{0}
 	},
+	{
+		"index_header_reads_number",
+		EBLOB_GST_INDEX_HEADER_READS,
+		{0}
+	},
+	{
+		"write_latency",
+		EBLOB_GST_WRITE_LATENCY,
+		{0}
+	},
+	{
+		"admission_pressure",
+		EBLOB_GST_ADMISSION_PRESSURE,
+		{0}
+	},
+	{
+		"admission_delayed",
+		EBLOB_GST_ADMISSION_DELAYED,
+		{0}
+	},
+	{
+		"admission_rejected",
+		EBLOB_GST_ADMISSION_REJECTED,
+		{0}
+	},
+	{
+		"auto_blob_size",
+		EBLOB_GST_AUTO_BLOB_SIZE,
+		{0}
+	},
+	{
+		"auto_records_in_blob",
+		EBLOB_GST_AUTO_RECORDS_IN_BLOB,
+		{0}
+	},
+	{
+		"auto_base_size_reason",
+		EBLOB_GST_AUTO_BASE_SIZE_REASON,
+		{0}
+	},
+	{
+		"device_util",
+		EBLOB_GST_DEVICE_UTIL,
+		{0}
+	},
+	{
+		"device_in_flight",
+		EBLOB_GST_DEVICE_IN_FLIGHT,
+		{0}
+	},
+	{
+		"foreground_ops",
+		EBLOB_GST_FOREGROUND_OPS,
+		{0}
+	},
+	{
+		"idle_time",
+		EBLOB_GST_IDLE_TIME,
+		{0}
+	},
+	{
+		"defrag_paused",
+		EBLOB_GST_DEFRAG_PAUSED,
+		{0}
+	},
+	{
+		"written_logical",
+		EBLOB_GST_WRITTEN_LOGICAL,
+		{0}
+	},
+	{
+		"written_foreground",
+		EBLOB_GST_WRITTEN_FOREGROUND,
+		{0}
+	},
+	{
+		"written_rcu",
+		EBLOB_GST_WRITTEN_RCU,
+		{0}
+	},
+	{
+		"written_index",
+		EBLOB_GST_WRITTEN_INDEX,
+		{0}
+	},
+	{
+		"written_datasort_split",
+		EBLOB_GST_WRITTEN_DATASORT_SPLIT,
+		{0}
+	},
+	{
+		"written_datasort_sort",
+		EBLOB_GST_WRITTEN_DATASORT_SORT,
+		{0}
+	},
+	{
+		"written_datasort_merge",
+		EBLOB_GST_WRITTEN_DATASORT_MERGE,
+		{0}
+	},
+	{
+		"datasort_hot_records",
+		EBLOB_GST_DATASORT_HOT_RECORDS,
+		{0}
+	},
+	{
+		"datasort_cold_records",
+		EBLOB_GST_DATASORT_COLD_RECORDS,
+		{0}
+	},
+	{
+		"bases_closed",
+		EBLOB_GST_BASES_CLOSED,
+		{0}
+	},
+	{
+		"bases_opened",
+		EBLOB_GST_BASES_OPENED,
+		{0}
+	},
+	{
+		"bases_evicted",
+		EBLOB_GST_BASES_EVICTED,
+		{0}
+	},
+	{
+		"write_buffer_records",
+		EBLOB_GST_WRITE_BUFFER_RECORDS,
+		{0}
+	},
+	{
+		"write_buffer_flushes",
+		EBLOB_GST_WRITE_BUFFER_FLUSHES,
+		{0}
+	},
+	{
+		"write_buffer_reads",
+		EBLOB_GST_WRITE_BUFFER_READS,
+		{0}
+	},
+	{
+		"exists_probes",
+		EBLOB_GST_EXISTS_PROBES,
+		{0}
+	},
+	{
+		"exists_maybe",
+		EBLOB_GST_EXISTS_MAYBE,
+		{0}
+	},
+	{
+		"summary_resident",
+		EBLOB_GST_SUMMARY_RESIDENT,
+		{0}
+	},
+	{
+		"summary_evicted",
+		EBLOB_GST_SUMMARY_EVICTED,
+		{0}
+	},
+	{
+		"summary_reloads",
+		EBLOB_GST_SUMMARY_RELOADS,
+		{0}
+	},
+	{
+		"read_nowait_hits",
+		EBLOB_GST_READ_NOWAIT_HITS,
+		{0}
+	},
+	{
+		"read_nowait_misses",
+		EBLOB_GST_READ_NOWAIT_MISSES,
+		{0}
+	},
+	{
+		"read_queued",
+		EBLOB_GST_READ_QUEUED,
+		{0}
+	},
 	{
 		"MAX",
 		EBLOB_GST_MAX,
@@ -167,6 +347,11 @@ static const struct eblob_stat_entry eblob_stat_default_local[] = {
 		EBLOB_LST_IS_SORTED,
 		{0}
 	},
+	{
+		"live_size",
+		EBLOB_LST_LIVE_SIZE,
+		{0}
+	},
 	{
 		"MAX",
 		EBLOB_LST_MAX,
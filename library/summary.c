@@ -0,0 +1,387 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Memory budget of sorted bases summaries (summary_memory_limit).
+ *
+ * Bloom filter and index blocks of each sorted base stay in memory so that
+ * lookups do not touch sorted index of bases without the key. When they take
+ * more than the budget, eblob_summary_balance() called from eblob_periodic()
+ * makes summaries of least searched bases coarser - each step merges pairs
+ * of adjacent index blocks, at the cost of a longer binary search in sorted
+ * index, and folds bloom filter in half, at the cost of more false positives -
+ * and then drops summaries of EBLOB_LAZY_BASES
+ * closed bases altogether, they are read back from <base>.summary by the next
+ * lookup. Open bases that are searched again get full granularity back,
+ * rebuilt from sorted index, while it fits well within the budget.
+ *
+ * Summaries of existing bases are only replaced under b->lazy_lock and write
+ * lock of bctl->index_blocks_lock, lookups use eblob_summary_rdlock().
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Full granularity is restored only if resident size stays below this share of the budget */
+#define EBLOB_SUMMARY_REFINE_PERCENT	90
+
+struct eblob_summary_base {
+	struct eblob_base_ctl	*bctl;
+	long			heat;
+};
+
+/*
+ * Sorted base which summary is accounted: closed or open, but neither the last
+ * one nor invalidated by data-sort.
+ */
+static int eblob_summary_managed(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	return (bctl->lazy_closed || (bctl->sort.fd >= 0 && bctl->index_fd >= 0 && bctl->index_blocks != NULL))
+		&& bctl->base_entry.next != &b->bases;
+}
+
+static uint64_t eblob_summary_resident(struct eblob_base_ctl *bctl)
+{
+	return eblob_stat_get(bctl->stat, EBLOB_LST_BLOOM_SIZE)
+		+ eblob_stat_get(bctl->stat, EBLOB_LST_INDEX_BLOCKS_SIZE);
+}
+
+/* Size of summary of @bctl with index blocks of configured granularity */
+static uint64_t eblob_summary_full(struct eblob_base_ctl *bctl)
+{
+	return howmany(eblob_bloom_bits(bctl), 8) + sizeof(struct eblob_index_block)
+		* howmany(bctl->sort.size / sizeof(struct eblob_disk_control), bctl->back->cfg.index_block_size);
+}
+
+/*
+ * Swaps summary of @bctl with @bloom of @bits bits and @num @blocks.
+ */
+static void eblob_summary_replace(struct eblob_base_ctl *bctl, unsigned char *bloom, uint64_t bits,
+		struct eblob_index_block *blocks, uint64_t num, int shift)
+{
+	unsigned char *old_bloom;
+	struct eblob_index_block *old_blocks;
+
+	pthread_rwlock_wrlock(&bctl->index_blocks_lock);
+	old_bloom = bctl->bloom;
+	old_blocks = bctl->index_blocks;
+	bctl->bloom = bloom;
+	bctl->bloom_bits = bits;
+	bctl->bloom_size = howmany(bits, 8);
+	bctl->index_blocks = blocks;
+	bctl->index_block_shift = shift;
+	eblob_stat_set(bctl->stat, EBLOB_LST_BLOOM_SIZE, bctl->bloom_size);
+	eblob_stat_set(bctl->stat, EBLOB_LST_INDEX_BLOCKS_SIZE, num * sizeof(struct eblob_index_block));
+	pthread_rwlock_unlock(&bctl->index_blocks_lock);
+
+	free(old_bloom);
+	free(old_blocks);
+}
+
+static inline int eblob_summary_bit(const unsigned char *bloom, uint64_t bit)
+{
+	return bloom[bit / 8] & (1 << (bit % 8));
+}
+
+/*
+ * Merges pairs of adjacent index blocks of @bctl and folds its bloom filter:
+ * bit positions are taken modulo number of bits, so with even number of bits
+ * bit i of folded filter is set iff bit i or i + bits/2 was set.
+ */
+static int eblob_summary_coarsen(struct eblob_base_ctl *bctl)
+{
+	const struct eblob_index_block *old = bctl->index_blocks;
+	const uint64_t old_num = eblob_stat_get(bctl->stat, EBLOB_LST_INDEX_BLOCKS_SIZE)
+		/ sizeof(struct eblob_index_block);
+	struct eblob_index_block *blocks;
+	unsigned char *bloom;
+	uint64_t i, num = howmany(old_num, 2), bits = bctl->bloom_bits;
+
+	if (old_num < 2)
+		return -ERANGE;
+
+	if (bits % 2 == 0)
+		bits /= 2;
+
+	bloom = calloc(1, howmany(bits, 8));
+	blocks = malloc(num * sizeof(struct eblob_index_block));
+	if (bloom == NULL || blocks == NULL) {
+		free(bloom);
+		free(blocks);
+		return -ENOMEM;
+	}
+
+	if (bits == bctl->bloom_bits) {
+		memcpy(bloom, bctl->bloom, bctl->bloom_size);
+	} else {
+		for (i = 0; i < bits; ++i)
+			if (eblob_summary_bit(bctl->bloom, i) || eblob_summary_bit(bctl->bloom, i + bits))
+				bloom[i / 8] |= 1 << (i % 8);
+	}
+
+	for (i = 0; i < num; ++i) {
+		const struct eblob_index_block *first = &old[2 * i];
+		const struct eblob_index_block *last = &old[EBLOB_MIN(2 * i + 1, old_num - 1)];
+
+		blocks[i].start_key = first->start_key;
+		blocks[i].start_offset = first->start_offset;
+		blocks[i].end_key = last->end_key;
+		blocks[i].end_offset = last->end_offset;
+	}
+
+	eblob_summary_replace(bctl, bloom, bits, blocks, num, bctl->index_block_shift + 1);
+	return 0;
+}
+
+/*
+ * Rebuilds summary of open @bctl with configured granularity from its mapped
+ * sorted index, same as eblob_index_blocks_fill() does.
+ */
+static int eblob_summary_refine(struct eblob_base_ctl *bctl)
+{
+	const struct eblob_disk_control *sorted = bctl->sort.data;
+	const uint64_t records = bctl->sort.size / sizeof(struct eblob_disk_control);
+	const uint64_t step = bctl->back->cfg.index_block_size;
+	const uint64_t bits = eblob_bloom_bits(bctl);
+	struct eblob_index_block *blocks;
+	unsigned char *bloom;
+	uint64_t i, num = howmany(records, step);
+
+	if (sorted == NULL || num == 0)
+		return -EINVAL;
+
+	bloom = calloc(1, howmany(bits, 8));
+	blocks = malloc(num * sizeof(struct eblob_index_block));
+	if (bloom == NULL || blocks == NULL) {
+		free(bloom);
+		free(blocks);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < records; ++i)
+		if (!(sorted[i].flags & eblob_bswap64(BLOB_DISK_CTL_REMOVE)))
+			__eblob_bloom_ll(bloom, bits, bctl->bloom_func_num, &sorted[i].key, EBLOB_BLOOM_CMD_SET);
+
+	for (i = 0; i < num; ++i) {
+		const uint64_t start = i * step;
+		const uint64_t end = EBLOB_MIN(start + step, records);
+
+		blocks[i].start_key = sorted[start].key;
+		blocks[i].start_offset = start * sizeof(struct eblob_disk_control);
+		blocks[i].end_key = sorted[end - 1].key;
+		blocks[i].end_offset = end * sizeof(struct eblob_disk_control);
+	}
+
+	eblob_summary_replace(bctl, bloom, bits, blocks, num, 0);
+	return 0;
+}
+
+/*
+ * Drops bloom filter and index blocks of closed @bctl, they are persisted in
+ * its summary file.
+ */
+static void eblob_summary_evict(struct eblob_base_ctl *bctl)
+{
+	pthread_rwlock_wrlock(&bctl->index_blocks_lock);
+	free(bctl->bloom);
+	free(bctl->index_blocks);
+	bctl->bloom = NULL;
+	bctl->index_blocks = NULL;
+	eblob_stat_set(bctl->stat, EBLOB_LST_BLOOM_SIZE, 0);
+	eblob_stat_set(bctl->stat, EBLOB_LST_INDEX_BLOCKS_SIZE, 0);
+	bctl->summary_evicted = 1;
+	pthread_rwlock_unlock(&bctl->index_blocks_lock);
+}
+
+/**
+ * eblob_summary_reload() - reads back summary of @bctl dropped by
+ * eblob_summary_balance() from its summary file.
+ * NB! Caller should hold b->lazy_lock.
+ */
+int eblob_summary_reload(struct eblob_base_ctl *bctl)
+{
+	struct eblob_backend *b = bctl->back;
+	int err = 0;
+
+	pthread_rwlock_wrlock(&bctl->index_blocks_lock);
+	if (bctl->summary_evicted) {
+		err = eblob_lazy_load_summary(bctl);
+		if (err == 0) {
+			bctl->summary_evicted = 0;
+			eblob_stat_inc(b->stat, EBLOB_GST_SUMMARY_RELOADS);
+		}
+	}
+	pthread_rwlock_unlock(&bctl->index_blocks_lock);
+
+	if (err)
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "summary: index: %d: reload: FAILED",
+				bctl->index);
+	return err;
+}
+
+/**
+ * eblob_summary_rdlock() - takes read lock of bctl->index_blocks_lock making
+ * sure that summary of @bctl is in memory. If summary file can not be read,
+ * base is opened, which rebuilds summary from sorted index.
+ * Caller should hold @bctl and must not hold b->lazy_lock.
+ */
+int eblob_summary_rdlock(struct eblob_base_ctl *bctl)
+{
+	struct eblob_backend *b = bctl->back;
+	static const int max_tries = 10;
+	int err, tries;
+
+	for (tries = 0; tries < max_tries; ++tries) {
+		pthread_rwlock_rdlock(&bctl->index_blocks_lock);
+		if (!bctl->summary_evicted)
+			return 0;
+		pthread_rwlock_unlock(&bctl->index_blocks_lock);
+
+		pthread_mutex_lock(&b->lazy_lock);
+		err = eblob_summary_reload(bctl);
+		pthread_mutex_unlock(&b->lazy_lock);
+
+		if (err) {
+			err = eblob_lazy_open(bctl);
+			if (err)
+				return err;
+		}
+	}
+
+	return -EDEADLK;
+}
+
+static int eblob_summary_heat_cmp(const void *p1, const void *p2)
+{
+	const struct eblob_summary_base *s1 = p1;
+	const struct eblob_summary_base *s2 = p2;
+
+	if (s1->heat != s2->heat)
+		return s1->heat < s2->heat ? -1 : 1;
+	return s1->bctl->index - s2->bctl->index;
+}
+
+/**
+ * eblob_summary_balance() - keeps summaries of sorted bases of @b within
+ * summary_memory_limit and updates summary stats. Does nothing while
+ * data-sort runs, since it replaces bases.
+ */
+void eblob_summary_balance(struct eblob_backend *b)
+{
+	struct eblob_summary_base *bases = NULL;
+	struct eblob_base_ctl *bctl;
+	const uint64_t limit = b->cfg.summary_memory_limit;
+	uint64_t resident = 0, full = 0, size;
+	int n = 0, num = 0, i, coarsened = 0, evicted = 0, refined = 0;
+
+	pthread_mutex_lock(&b->lazy_lock);
+	if (pthread_mutex_trylock(&b->defrag_lock) != 0)
+		goto out_unlock;
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(bctl, &b->bases, base_entry) {
+		long heat;
+
+		if (!eblob_summary_managed(b, bctl))
+			continue;
+
+		resident += eblob_summary_resident(bctl);
+		full += eblob_summary_full(bctl);
+		if (limit == 0)
+			continue;
+
+		if (n == num) {
+			struct eblob_summary_base *tmp;
+
+			num = num ? num * 2 : 64;
+			tmp = realloc(bases, num * sizeof(*bases));
+			if (tmp == NULL)
+				break;
+			bases = tmp;
+		}
+
+		/* Searches of previous periods count less and less */
+		heat = atomic_read(&bctl->summary_heat);
+		atomic_sub(&bctl->summary_heat, heat / 2);
+
+		bases[n].bctl = bctl;
+		bases[n].heat = heat;
+		++n;
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	qsort(bases, n, sizeof(*bases), eblob_summary_heat_cmp);
+
+	/* Over budget: least searched bases get coarser index blocks first */
+	for (i = 0; i < n && resident > limit; ++i) {
+		bctl = bases[i].bctl;
+		while (resident > limit && !bctl->summary_evicted
+				&& bctl->index_block_shift < EBLOB_SUMMARY_MAX_SHIFT) {
+			size = eblob_summary_resident(bctl);
+			if (eblob_summary_coarsen(bctl) != 0)
+				break;
+			resident -= size - eblob_summary_resident(bctl);
+			++coarsened;
+		}
+	}
+
+	/* ... then summaries of closed ones are dropped */
+	for (i = 0; i < n && resident > limit; ++i) {
+		bctl = bases[i].bctl;
+		if (!bctl->lazy_closed || bctl->summary_evicted)
+			continue;
+		resident -= eblob_summary_resident(bctl);
+		eblob_summary_evict(bctl);
+		++evicted;
+	}
+
+	/* Under budget: most searched open bases get full granularity back */
+	for (i = n - 1; i >= 0 && resident <= limit; --i) {
+		bctl = bases[i].bctl;
+		if (bases[i].heat == 0)
+			break;
+		if (bctl->lazy_closed || bctl->index_block_shift == 0)
+			continue;
+
+		size = eblob_summary_full(bctl) - eblob_summary_resident(bctl);
+		if (resident + size > limit / 100 * EBLOB_SUMMARY_REFINE_PERCENT)
+			continue;
+		if (eblob_summary_refine(bctl) != 0)
+			continue;
+		resident += size;
+		++refined;
+	}
+
+	eblob_stat_set(b->stat, EBLOB_GST_SUMMARY_RESIDENT, resident);
+	eblob_stat_set(b->stat, EBLOB_GST_SUMMARY_EVICTED, full - resident);
+
+	if (coarsened || evicted || refined)
+		eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: summary: coarsened: %d, evicted: %d, "
+				"refined: %d, resident: %" PRIu64 ", full: %" PRIu64 ", limit: %" PRIu64 "\n",
+				coarsened, evicted, refined, resident, full, limit);
+
+	pthread_mutex_unlock(&b->defrag_lock);
+out_unlock:
+	pthread_mutex_unlock(&b->lazy_lock);
+	free(bases);
+}
@@ -0,0 +1,359 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Write-combining buffer of the open base (EBLOB_WRITE_BUFFER).
+ *
+ * New small records are laid out in memory exactly as they would be in data
+ * and index files of the open base: header, data and footer go to the data
+ * buffer, copy of the header to the index one. Both buffers hold contiguous
+ * tail of the files, which is written with two pwrite(2)s - data first, so
+ * that on-disk index never points past data. Until then records are in RAM
+ * index only and are lost on crash.
+ *
+ * Everything that accesses records on disk by their location (reads that
+ * return file descriptor, overwrites, removals, iterators) flushes the buffer
+ * first if record lives in it. Writes that bypass the buffer and creation of
+ * the next base flush it too, so that buffered tail always ends at the end of
+ * the open base and the files never have holes.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Bigger records gain nothing from buffering */
+#define EBLOB_WBUF_MAX_RECORD		(64 * 1024)
+
+static uint64_t eblob_wbuf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * eblob_wbuf_init() - allocates buffers of @b if EBLOB_WRITE_BUFFER is set.
+ * With sync == 0 every write is synced anyway, so buffer is not used.
+ */
+int eblob_wbuf_init(struct eblob_backend *b)
+{
+	int err;
+
+	err = eblob_mutex_init(&b->wbuf_lock);
+	if (err != 0)
+		return err;
+
+	if (!(b->cfg.blob_flags & EBLOB_WRITE_BUFFER) || b->cfg.sync == 0)
+		return 0;
+
+	/* Every record takes at least one header in data buffer */
+	b->wbuf_data = malloc(b->cfg.write_buffer_size);
+	b->wbuf_index = malloc(b->cfg.write_buffer_size);
+	if (b->wbuf_data == NULL || b->wbuf_index == NULL) {
+		eblob_wbuf_cleanup(b);
+		return -ENOMEM;
+	}
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob: %s: write buffer: size: %" PRIu32
+			", timeout: %" PRIu32 " ms\n", b->cfg.file, b->cfg.write_buffer_size,
+			b->cfg.write_buffer_timeout);
+	return 0;
+}
+
+/**
+ * eblob_wbuf_cleanup() - frees buffers of @b, they should be flushed by now.
+ */
+void eblob_wbuf_cleanup(struct eblob_backend *b)
+{
+	free(b->wbuf_data);
+	free(b->wbuf_index);
+	b->wbuf_data = b->wbuf_index = NULL;
+	b->wbuf_data_len = b->wbuf_index_len = 0;
+	b->wbuf_bctl = NULL;
+	pthread_mutex_destroy(&b->wbuf_lock);
+}
+
+/**
+ * eblob_wbuf_fits() - returns 1 if record of @size bytes on disk should be
+ * written through buffer of @b.
+ */
+int eblob_wbuf_fits(struct eblob_backend *b, uint64_t size)
+{
+	return b->wbuf_data != NULL && size <= EBLOB_WBUF_MAX_RECORD
+		&& size <= b->cfg.write_buffer_size / 4;
+}
+
+/*
+ * Writes buffered tail of the open base.
+ * NB! Caller should hold b->wbuf_lock.
+ */
+static int eblob_wbuf_flush_nolock(struct eblob_backend *b)
+{
+	struct eblob_base_ctl *bctl = b->wbuf_bctl;
+	int err;
+
+	if (b->wbuf_data_len == 0)
+		return 0;
+
+	err = __eblob_write_ll(bctl->data_fd, b->wbuf_data, b->wbuf_data_len, b->wbuf_data_offset);
+	if (err)
+		goto err_out_exit;
+
+	err = __eblob_write_ll(bctl->index_fd, b->wbuf_index, b->wbuf_index_len, b->wbuf_index_offset);
+	if (err)
+		goto err_out_exit;
+
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_FOREGROUND, b->wbuf_data_len);
+	eblob_stat_add(b->stat, EBLOB_GST_WRITTEN_INDEX, b->wbuf_index_len);
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITE_BUFFER_FLUSHES);
+
+	b->wbuf_data_offset += b->wbuf_data_len;
+	b->wbuf_index_offset += b->wbuf_index_len;
+	b->wbuf_data_len = b->wbuf_index_len = 0;
+	return 0;
+
+err_out_exit:
+	/* Buffer is kept, so next flush retries the whole tail */
+	EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "write buffer: flush: base: %d, "
+			"data offset: %" PRIu64 ", size: %" PRIu64 ", index offset: %" PRIu64
+			", size: %" PRIu64, bctl->index, b->wbuf_data_offset, b->wbuf_data_len,
+			b->wbuf_index_offset, b->wbuf_index_len);
+	return err;
+}
+
+/**
+ * eblob_wbuf_append() - stages record described by @wc in buffer of @b.
+ * @record is its whole disk image, @dc - its index entry. Buffer is flushed
+ * first if record does not follow buffered ones or does not fit.
+ * NB! Caller should hold b->lock.
+ */
+int eblob_wbuf_append(struct eblob_backend *b, const struct eblob_write_control *wc,
+		const void *record, const struct eblob_disk_control *dc)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+
+	if (b->wbuf_data_len != 0 && (b->wbuf_bctl != wc->bctl
+			|| b->wbuf_data_offset + b->wbuf_data_len != wc->ctl_data_offset
+			|| b->wbuf_index_offset + b->wbuf_index_len != wc->ctl_index_offset
+			|| b->wbuf_data_len + wc->total_size > b->cfg.write_buffer_size)) {
+		err = eblob_wbuf_flush_nolock(b);
+		if (err)
+			goto err_out_unlock;
+	}
+
+	if (b->wbuf_data_len == 0) {
+		b->wbuf_bctl = wc->bctl;
+		b->wbuf_data_offset = wc->ctl_data_offset;
+		b->wbuf_index_offset = wc->ctl_index_offset;
+		b->wbuf_since = eblob_wbuf_now();
+	}
+
+	memcpy(b->wbuf_data + b->wbuf_data_len, record, wc->total_size);
+	memcpy(b->wbuf_index + b->wbuf_index_len, dc, sizeof(struct eblob_disk_control));
+	b->wbuf_data_len += wc->total_size;
+	b->wbuf_index_len += sizeof(struct eblob_disk_control);
+
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITE_BUFFER_RECORDS);
+
+	/*
+	 * Do not wait for periodic task if records are old enough already.
+	 * Record is staged anyway, failed flush is retried later.
+	 */
+	if (eblob_wbuf_now() - b->wbuf_since >= b->cfg.write_buffer_timeout)
+		eblob_wbuf_flush_nolock(b);
+
+err_out_unlock:
+	pthread_mutex_unlock(&b->wbuf_lock);
+	return err;
+}
+
+/**
+ * eblob_wbuf_read() - copies @size bytes at @offset of record @rctl to @dst
+ * if record is still in buffer of @b, otherwise returns -ENOENT.
+ */
+int eblob_wbuf_read(struct eblob_backend *b, const struct eblob_ram_control *rctl,
+		uint64_t offset, void *dst, uint64_t size)
+{
+	int err = -ENOENT;
+
+	if (b->wbuf_data == NULL)
+		return -ENOENT;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	if (b->wbuf_data_len != 0 && rctl->bctl == b->wbuf_bctl
+			&& rctl->data_offset >= b->wbuf_data_offset
+			&& rctl->data_offset + offset + size <= b->wbuf_data_offset + b->wbuf_data_len) {
+		memcpy(dst, b->wbuf_data + rctl->data_offset - b->wbuf_data_offset + offset, size);
+		eblob_stat_inc(b->stat, EBLOB_GST_WRITE_BUFFER_READS);
+		err = 0;
+	}
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_read_index() - copies index entry of record @rctl to @dc if it
+ * is still in buffer of @b, otherwise returns -ENOENT.
+ */
+int eblob_wbuf_read_index(struct eblob_backend *b, const struct eblob_ram_control *rctl,
+		struct eblob_disk_control *dc)
+{
+	int err = -ENOENT;
+
+	if (b->wbuf_data == NULL)
+		return -ENOENT;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	if (b->wbuf_index_len != 0 && rctl->bctl == b->wbuf_bctl
+			&& rctl->index_offset >= b->wbuf_index_offset
+			&& rctl->index_offset + sizeof(*dc) <= b->wbuf_index_offset + b->wbuf_index_len) {
+		memcpy(dc, b->wbuf_index + rctl->index_offset - b->wbuf_index_offset, sizeof(*dc));
+		err = 0;
+	}
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_flush() - writes everything buffered in @b.
+ */
+int eblob_wbuf_flush(struct eblob_backend *b)
+{
+	int err;
+
+	if (b->wbuf_data == NULL)
+		return 0;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	err = eblob_wbuf_flush_nolock(b);
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_flush_sync() - writes everything buffered in @b and syncs it to
+ * disk, used when backend is closed and nothing syncs its files later.
+ */
+int eblob_wbuf_flush_sync(struct eblob_backend *b)
+{
+	struct eblob_base_ctl *bctl;
+	int err;
+
+	if (b->wbuf_data == NULL)
+		return 0;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	bctl = b->wbuf_data_len ? b->wbuf_bctl : NULL;
+	err = eblob_wbuf_flush_nolock(b);
+	if (err == 0 && bctl != NULL) {
+		err = eblob_fdatasync(bctl->data_fd);
+		if (err == 0)
+			err = eblob_fdatasync(bctl->index_fd);
+	}
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_flush_base() - flushes buffer of @b if it holds records of @bctl.
+ */
+int eblob_wbuf_flush_base(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	int err = 0;
+
+	if (b->wbuf_data == NULL)
+		return 0;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	if (b->wbuf_bctl == bctl)
+		err = eblob_wbuf_flush_nolock(b);
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_flush_record() - flushes buffer of @b if record @rctl is in it,
+ * so that it can be accessed on disk.
+ */
+int eblob_wbuf_flush_record(struct eblob_backend *b, const struct eblob_ram_control *rctl)
+{
+	int err = 0;
+
+	if (b->wbuf_data == NULL)
+		return 0;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	if (rctl->bctl == b->wbuf_bctl && rctl->data_offset >= b->wbuf_data_offset)
+		err = eblob_wbuf_flush_nolock(b);
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_index_flushed() - returns size of index of @bctl that is on
+ * disk, it is smaller than bctl->index_size while records are buffered.
+ */
+uint64_t eblob_wbuf_index_flushed(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	uint64_t size = bctl->index_size;
+
+	if (b->wbuf_data == NULL)
+		return size;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	if (b->wbuf_bctl == bctl && b->wbuf_index_len != 0 && b->wbuf_index_offset < size)
+		size = b->wbuf_index_offset;
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return size;
+}
+
+/**
+ * eblob_wbuf_tick() - periodic task that flushes buffer of @b if its oldest
+ * record was buffered write_buffer_timeout milliseconds ago.
+ */
+int eblob_wbuf_tick(struct eblob_backend *b)
+{
+	int err = 0;
+
+	if (b->wbuf_data == NULL)
+		return 0;
+
+	pthread_mutex_lock(&b->wbuf_lock);
+	if (b->wbuf_data_len != 0
+			&& eblob_wbuf_now() - b->wbuf_since >= b->cfg.write_buffer_timeout)
+		err = eblob_wbuf_flush_nolock(b);
+	pthread_mutex_unlock(&b->wbuf_lock);
+
+	return err;
+}
@@ -15,9 +15,20 @@ $(find . -name test.py)
 # Run cpp bindings test
 $(find . -name eblob_cpp_test)
 
+# Functional tests, fsck checks bases written by them
+FEATURES_DIR=$(mktemp -d)
+$(find . -name eblob_features) -p $FEATURES_DIR -k $(find . -name eblob_fsck)
+rm -rf $FEATURES_DIR
+
 # Big and small stress tests
 $(find . -name eblob_stress) -m0 -f1000 -D0 -I300000 -o20000 -i1000 -l0 -r 1000 -S10 -F87
 $(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l0 -r 100 -S100 -F14
 
 # Overwrite-heavy test with many bases and threads
 $(find . -name eblob_stress) -f1000 -D0 -I100000 -i64 -r 40 -S10 -F64 -T32 -l0 -o 0
+
+# Write buffer (EBLOB_WRITE_BUFFER | EBLOB_NO_FREE_SPACE_CHECK) with data-sort and reopens
+$(find . -name eblob_stress) -f10000 -D0 -I300000 -o20000 -i1000 -l0 -r 1000 -S100 -F65552 -T8
+
+# Same load inside a namespace of the backend
+$(find . -name eblob_stress) -f10000 -D0 -I300000 -o20000 -i1000 -l0 -r 1000 -S100 -F16 -T8 -n stress
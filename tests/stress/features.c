@@ -0,0 +1,1520 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Functional tests of eblob features that random stress test does not
+ * check deterministically. Each test starts with an empty directory under
+ * test path and fails the whole run with errx() on first mismatch.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eblob/blob.h"
+#include "../../library/blob.h"
+
+/* Test configuration */
+static struct {
+	char			*path;		/* Test directory */
+	char			*fsck;		/* Path to eblob_fsck binary */
+	long			log_level;	/* Log level for eblob_log */
+} fcfg;
+
+static struct eblob_log flog;
+static char fdir[PATH_MAX], ffile[PATH_MAX];
+
+/* Fails test with line number of failed check */
+#define CHECK(expr) do {								\
+	if (!(expr))									\
+		errx(EX_SOFTWARE, "%s:%d: check failed: %s", __func__, __LINE__, #expr);	\
+} while (0)
+
+#define CHECK_ERR(expr, expected) do {							\
+	int __err = (expr);								\
+	if (__err != (expected))							\
+		errx(EX_SOFTWARE, "%s:%d: %s: returned %d, expected %d",		\
+				__func__, __LINE__, #expr, __err, (expected));		\
+} while (0)
+
+static void
+feature_key(struct eblob_key *key, int i)
+{
+	memset(key, 0, sizeof(struct eblob_key));
+	snprintf((char *)key->id, sizeof(key->id), "feature-key-%d", i);
+}
+
+static void
+feature_data(char *buf, size_t size, int i, int version)
+{
+	memset(buf, 'a' + i % 26, size);
+	snprintf(buf, size, "%d-%d", i, version);
+}
+
+/* Runs @cmd with path of test directory appended, returns its exit status */
+static int
+feature_system(const char *cmd)
+{
+	char line[PATH_MAX * 2];
+	int status;
+
+	snprintf(line, sizeof(line), "%s %s >> %s/features.log 2>&1", cmd, fdir, fcfg.path);
+	status = system(line);
+	if (status == -1 || !WIFEXITED(status))
+		errx(EX_OSERR, "%s: failed to run", line);
+	return WEXITSTATUS(status);
+}
+
+/* Starts test @name in empty directory, returns config to open backend with */
+static void
+feature_start(const char *name, struct eblob_config *bcfg)
+{
+	char cmd[PATH_MAX + 16];
+
+	if (snprintf(fdir, sizeof(fdir), "%s/%s", fcfg.path, name) >= (int)sizeof(fdir)
+			|| snprintf(ffile, sizeof(ffile), "%s/data", fdir) >= (int)sizeof(ffile))
+		errx(EX_USAGE, "test path is too long: %s", fcfg.path);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", fdir);
+	if (system(cmd) != 0 || mkdir(fdir, 0755) == -1)
+		err(EX_CANTCREAT, "%s", fdir);
+
+	memset(bcfg, 0, sizeof(struct eblob_config));
+	bcfg->blob_flags = EBLOB_NO_FREE_SPACE_CHECK | EBLOB_DISABLE_THREADS;
+	bcfg->file = ffile;
+	bcfg->log = &flog;
+	bcfg->sync = -1;
+	bcfg->records_in_blob = 1000;
+
+	warnx("%s: started", name);
+}
+
+static struct eblob_backend *
+feature_open(struct eblob_config *bcfg)
+{
+	struct eblob_backend *b;
+
+	b = eblob_init(bcfg);
+	if (b == NULL)
+		errx(EX_SOFTWARE, "eblob_init: %s failed", bcfg->file);
+	return b;
+}
+
+static void
+feature_write(struct eblob_backend *b, int i, int version, uint64_t size, uint64_t flags)
+{
+	struct eblob_key key;
+	char buf[size];
+
+	feature_key(&key, i);
+	feature_data(buf, size, i, version);
+	CHECK_ERR(eblob_write(b, &key, buf, 0, size, flags), 0);
+}
+
+/* Reads record @i and checks that it was written by feature_write() */
+static int
+feature_read(struct eblob_backend *b, int i, int version, uint64_t size)
+{
+	struct eblob_key key;
+	uint64_t rsize = 0;
+	char *data, buf[size];
+	int err;
+
+	feature_key(&key, i);
+	err = eblob_read_data(b, &key, 0, &data, &rsize);
+	if (err != 0)
+		return err;
+
+	feature_data(buf, size, i, version);
+	CHECK(rsize == size && memcmp(data, buf, size) == 0);
+	free(data);
+	return 0;
+}
+
+/*
+ * fsck of bases written by current library: it must find nothing to fix,
+ * and fix mode must leave them intact.
+ */
+static void
+test_fsck(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	char cmd[PATH_MAX];
+	int i;
+
+	if (fcfg.fsck == NULL) {
+		warnx("fsck: skipped, no -k given");
+		return;
+	}
+
+	feature_start("fsck", &bcfg);
+	bcfg.records_in_blob = 100;
+
+	b = feature_open(&bcfg);
+	for (i = 0; i < 250; ++i)
+		feature_write(b, i, 0, 100 + i, BLOB_DISK_CTL_USER(i + 1));
+	for (i = 0; i < 250; i += 7) {
+		struct eblob_key key;
+
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	/* First bases become sorted, the last one stays unsorted */
+	CHECK_ERR(eblob_defrag(b), 0);
+	eblob_cleanup(b);
+
+	CHECK_ERR(feature_system(fcfg.fsck), 0);
+	snprintf(cmd, sizeof(cmd), "%s -f", fcfg.fsck);
+	CHECK_ERR(feature_system(cmd), 0);
+
+	b = feature_open(&bcfg);
+	for (i = 0; i < 250; ++i)
+		CHECK_ERR(feature_read(b, i, 0, 100 + i), i % 7 ? 0 : -ENOENT);
+	eblob_cleanup(b);
+}
+
+/*
+ * Write session must not commit over key that was removed or written by
+ * someone else after session was opened.
+ */
+static void
+test_session(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_write_session *s;
+	struct eblob_key key;
+	char buf[128];
+	int i;
+
+	feature_start("session", &bcfg);
+	b = feature_open(&bcfg);
+
+	for (i = 0; i < 3; ++i) {
+		feature_key(&key, i);
+		feature_data(buf, sizeof(buf), i, 0);
+		CHECK_ERR(eblob_write_session_open(b, &key, sizeof(buf), 0, &s), 0);
+		CHECK_ERR(eblob_write_session_write(s, buf, 0, sizeof(buf)), 0);
+
+		if (i == 1)
+			CHECK_ERR(eblob_remove(b, &key), 0);
+		else if (i == 2)
+			feature_write(b, i, 1, 4 * sizeof(buf), 0);
+
+		CHECK_ERR(eblob_write_session_commit(s, ~0ULL, ~0ULL), i ? -ESTALE : 0);
+		eblob_write_session_close(s);
+	}
+
+	for (i = 0; i < 2; ++i) {
+		CHECK_ERR(feature_read(b, 0, 0, sizeof(buf)), 0);
+		CHECK_ERR(feature_read(b, 1, 0, sizeof(buf)), -ENOENT);
+		CHECK_ERR(feature_read(b, 2, 1, 4 * sizeof(buf)), 0);
+
+		eblob_cleanup(b);
+		b = feature_open(&bcfg);
+	}
+	eblob_cleanup(b);
+}
+
+#define FEATURE_BATCH	10
+
+/*
+ * Turns live index entries of keys [@first, @first + FEATURE_BATCH) of the
+ * first base back into batch that crashed before its flags were cleared,
+ * @last_flags are added to its last entry.
+ */
+static void
+feature_txn_unclear(int first, uint64_t last_flags)
+{
+	struct eblob_disk_control dc;
+	struct eblob_key key;
+	char path[PATH_MAX];
+	off_t offset;
+	int fd, i, patched = 0;
+
+	if (snprintf(path, sizeof(path), "%s-0.0.index", ffile) >= (int)sizeof(path))
+		errx(EX_USAGE, "test path is too long: %s", fcfg.path);
+	if ((fd = open(path, O_RDWR)) == -1)
+		err(EX_OSFILE, "open: %s", path);
+
+	for (offset = 0; pread(fd, &dc, sizeof(dc), offset) == sizeof(dc); offset += sizeof(dc)) {
+		eblob_convert_disk_control(&dc);
+		for (i = first; i < first + FEATURE_BATCH; ++i) {
+			feature_key(&key, i);
+			if (memcmp(key.id, dc.key.id, EBLOB_ID_SIZE) || (dc.flags & BLOB_DISK_CTL_REMOVE))
+				continue;
+
+			dc.flags |= BLOB_DISK_CTL_TXN;
+			if (i == first + FEATURE_BATCH - 1)
+				dc.flags |= last_flags;
+			eblob_convert_disk_control(&dc);
+			CHECK(pwrite(fd, &dc, sizeof(dc), offset) == sizeof(dc));
+			patched++;
+			break;
+		}
+	}
+	close(fd);
+	CHECK(patched == FEATURE_BATCH);
+}
+
+/*
+ * Atomic batches: invalid ones are rejected, committed ones are readable at
+ * once. On open batch that lost its flags cleanup in a crash is kept if its
+ * commit mark made it to disk and dropped as a whole otherwise.
+ */
+static void
+test_atomic(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_write_record records[FEATURE_BATCH];
+	char buf[FEATURE_BATCH][64];
+	int i, batch, round;
+
+	feature_start("atomic", &bcfg);
+	b = feature_open(&bcfg);
+
+	for (batch = 0; batch < 2; ++batch) {
+		for (i = 0; i < FEATURE_BATCH; ++i) {
+			feature_key(&records[i].key, batch * FEATURE_BATCH + i);
+			feature_data(buf[i], sizeof(buf[i]), batch * FEATURE_BATCH + i, 0);
+			records[i].data = buf[i];
+			records[i].size = sizeof(buf[i]);
+			records[i].flags = 0;
+		}
+
+		CHECK_ERR(eblob_write_atomic(b, records, 0), -EINVAL);
+		records[1].key = records[0].key;
+		CHECK_ERR(eblob_write_atomic(b, records, FEATURE_BATCH), -EINVAL);
+		feature_key(&records[1].key, batch * FEATURE_BATCH + 1);
+		records[2].flags = BLOB_DISK_CTL_TXN;
+		CHECK_ERR(eblob_write_atomic(b, records, FEATURE_BATCH), -EINVAL);
+		records[2].flags = BLOB_DISK_CTL_APPEND;
+		CHECK_ERR(eblob_write_atomic(b, records, FEATURE_BATCH), -ENOTSUP);
+		records[2].flags = 0;
+
+		CHECK_ERR(eblob_write_atomic(b, records, FEATURE_BATCH), 0);
+		for (i = 0; i < FEATURE_BATCH; ++i)
+			CHECK_ERR(feature_read(b, batch * FEATURE_BATCH + i, 0, sizeof(buf[i])), 0);
+	}
+	eblob_cleanup(b);
+
+	feature_txn_unclear(0, BLOB_DISK_CTL_TXN_LAST | BLOB_DISK_CTL_TXN_COMMIT);
+	feature_txn_unclear(FEATURE_BATCH, BLOB_DISK_CTL_TXN_LAST);
+
+	/* Recovery result must persist */
+	for (round = 0; round < 2; ++round) {
+		b = feature_open(&bcfg);
+		for (i = 0; i < 2 * FEATURE_BATCH; ++i)
+			CHECK_ERR(feature_read(b, i, 0, sizeof(buf[0])), i < FEATURE_BATCH ? 0 : -ENOENT);
+		eblob_cleanup(b);
+	}
+}
+
+static int
+feature_count_cb(struct eblob_disk_control *dc, struct eblob_ram_control *ctl,
+		void *data, void *priv, void *thread_priv)
+{
+	(void)ctl;
+	(void)data;
+	(void)thread_priv;
+
+	if (!(dc->flags & BLOB_DISK_CTL_REMOVE))
+		__sync_add_and_fetch((int *)priv, 1);
+	return 0;
+}
+
+/* Returns number of live records whose user flags are @user_flags */
+static int
+feature_count_user(struct eblob_backend *b, uint16_t user_flags)
+{
+	struct eblob_iterate_control ictl;
+	int count = 0;
+
+	memset(&ictl, 0, sizeof(ictl));
+	ictl.flags = EBLOB_ITERATE_FLAGS_ALL | EBLOB_ITERATE_FLAGS_READONLY;
+	ictl.iterator_cb.iterator = feature_count_cb;
+	ictl.priv = &count;
+	ictl.user_flags_mask = 0xffff;
+	ictl.user_flags = user_flags;
+	CHECK_ERR(eblob_iterate(b, &ictl), 0);
+	return count;
+}
+
+/*
+ * User flags of every kind of overwrite replace old ones: in place, with
+ * copy to a bigger record and through prepare/commit of reused record.
+ * Iteration filter must see only new flags, before and after reopen.
+ */
+static void
+test_user_flags(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_write_control wc;
+	struct eblob_key key;
+	char buf[100];
+	int i, round;
+
+	feature_start("user_flags", &bcfg);
+	b = feature_open(&bcfg);
+
+	for (i = 0; i < 400; ++i)
+		feature_write(b, i, 0, sizeof(buf), BLOB_DISK_CTL_USER(1));
+	for (i = 0; i < 400; ++i) {
+		switch (i % 4) {
+		case 1:
+			feature_write(b, i, 1, sizeof(buf), BLOB_DISK_CTL_USER(2));
+			break;
+		case 2:
+			feature_write(b, i, 1, 3 * sizeof(buf), BLOB_DISK_CTL_USER(3));
+			break;
+		case 3:
+			feature_key(&key, i);
+			feature_data(buf, sizeof(buf), i, 1);
+			CHECK_ERR(eblob_write_prepare(b, &key, sizeof(buf), BLOB_DISK_CTL_USER(4)), 0);
+			CHECK_ERR(eblob_plain_write(b, &key, buf, 0, sizeof(buf), 0), 0);
+			CHECK_ERR(eblob_write_commit(b, &key, sizeof(buf), ~0ULL), 0);
+			break;
+		}
+	}
+
+	for (round = 0; round < 2; ++round) {
+		for (i = 1; i <= 4; ++i)
+			CHECK(feature_count_user(b, i) == 100);
+		for (i = 0; i < 400; ++i) {
+			feature_key(&key, i);
+			CHECK_ERR(eblob_read_return(b, &key, EBLOB_READ_CSUM, &wc), 0);
+			CHECK(eblob_flags_user(wc.flags) == i % 4 + 1);
+			CHECK_ERR(feature_read(b, i, i % 4 ? 1 : 0, i % 4 == 2 ? 3 * sizeof(buf) : sizeof(buf)), 0);
+		}
+
+		eblob_cleanup(b);
+		b = feature_open(&bcfg);
+	}
+	eblob_cleanup(b);
+}
+
+static int
+feature_key_cmp(const void *l, const void *r)
+{
+	struct eblob_key lkey, rkey;
+
+	feature_key(&lkey, *(const int *)l);
+	feature_key(&rkey, *(const int *)r);
+	return memcmp(lkey.id, rkey.id, EBLOB_ID_SIZE);
+}
+
+/* Rewrites keys [0, FEATURE_INGEST_KEYS) until told to stop */
+#define FEATURE_INGEST_KEYS	2000
+
+struct feature_writer {
+	struct eblob_backend	*b;
+	volatile int		stop;
+	int			passes;
+};
+
+static void *
+feature_writer(void *data)
+{
+	struct feature_writer *fw = data;
+	int i;
+
+	while (!fw->stop) {
+		fw->passes++;
+		for (i = 0; i < FEATURE_INGEST_KEYS; ++i)
+			feature_write(fw->b, i, fw->passes, 64, 0);
+	}
+	return NULL;
+}
+
+/*
+ * Ingest racing with writes of the same keys. Writer goes over keys in
+ * order, so ingest may override only records written before its base was
+ * linked: ingested keys form a prefix of the last writer pass, give or take
+ * one write in flight. RAM index must also agree with what is on disk.
+ */
+static void
+test_ingest(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_base_builder *bb;
+	struct feature_writer fw;
+	struct eblob_key key;
+	pthread_t tid;
+	char src[PATH_MAX], buf[64], *data;
+	char seen[FEATURE_INGEST_KEYS][64];
+	int order[FEATURE_INGEST_KEYS];
+	uint64_t size;
+	int i, round, version, first_written, late_ingested;
+
+	/* Builder takes keys in increasing order only */
+	for (i = 0; i < FEATURE_INGEST_KEYS; ++i)
+		order[i] = i;
+	qsort(order, FEATURE_INGEST_KEYS, sizeof(order[0]), feature_key_cmp);
+
+	feature_start("ingest", &bcfg);
+	bcfg.records_in_blob = 3000;
+	b = feature_open(&bcfg);
+
+	for (round = 0; round < 5; ++round) {
+		if (snprintf(src, sizeof(src), "%s/src-%d", fdir, round) >= (int)sizeof(src))
+			errx(EX_USAGE, "test path is too long: %s", fcfg.path);
+		CHECK_ERR(eblob_base_builder_open(src, 0, &bb), 0);
+		for (i = 0; i < FEATURE_INGEST_KEYS; ++i) {
+			feature_key(&key, order[i]);
+			feature_data(buf, sizeof(buf), order[i], -1 - round);
+			CHECK_ERR(eblob_base_builder_add(bb, &key, buf, sizeof(buf), 0), 0);
+		}
+		CHECK_ERR(eblob_base_builder_finish(bb), 0);
+		eblob_base_builder_close(bb);
+
+		memset(&fw, 0, sizeof(fw));
+		fw.b = b;
+		CHECK_ERR(pthread_create(&tid, NULL, feature_writer, &fw), 0);
+		while (fw.passes < 2)
+			sched_yield();
+		CHECK_ERR(eblob_ingest_base(b, src), 0);
+		fw.stop = 1;
+		CHECK_ERR(pthread_join(tid, NULL), 0);
+
+		first_written = FEATURE_INGEST_KEYS;
+		late_ingested = 0;
+		for (i = 0; i < FEATURE_INGEST_KEYS; ++i) {
+			feature_key(&key, i);
+			size = 0;
+			CHECK_ERR(eblob_read_data(b, &key, 0, &data, &size), 0);
+			CHECK(size == sizeof(seen[i]));
+			memcpy(seen[i], data, size);
+			free(data);
+
+			CHECK(sscanf(seen[i], "%*d-%d", &version) == 1);
+			if (version < 0) {
+				CHECK(version == -1 - round);
+				late_ingested += i > first_written;
+			} else {
+				CHECK(version == fw.passes);
+				if (first_written == FEATURE_INGEST_KEYS)
+					first_written = i;
+			}
+		}
+		CHECK(late_ingested <= 1);
+
+		eblob_cleanup(b);
+		b = feature_open(&bcfg);
+		for (i = 0; i < FEATURE_INGEST_KEYS; ++i) {
+			feature_key(&key, i);
+			size = 0;
+			CHECK_ERR(eblob_read_data(b, &key, 0, &data, &size), 0);
+			CHECK(size == sizeof(seen[i]) && memcmp(data, seen[i], size) == 0);
+			free(data);
+		}
+	}
+	eblob_cleanup(b);
+}
+
+/*
+ * Namespaces: same keys in backend and its namespaces are independent
+ * records, including removal and defrag of namespace, and all of them are
+ * found again after namespace or whole backend is reopened.
+ */
+static void
+test_namespaces(void)
+{
+	struct eblob_config bcfg, ncfg;
+	struct eblob_backend *b, *one, *two;
+	struct eblob_key key;
+	const uint64_t size = 64;
+	int i, round;
+
+	feature_start("namespaces", &bcfg);
+	b = feature_open(&bcfg);
+
+	memset(&ncfg, 0, sizeof(ncfg));
+	ncfg.records_in_blob = 100;
+	CHECK((one = eblob_namespace_open(b, "one", &ncfg)) != NULL);
+	CHECK((two = eblob_namespace_open(b, "two", NULL)) != NULL);
+	CHECK(eblob_namespace_open(b, "one", NULL) == NULL && errno == EEXIST);
+	CHECK(eblob_namespace_open(b, "bad.name", NULL) == NULL && errno == EINVAL);
+	CHECK(eblob_namespace_open(one, "nested", NULL) == NULL && errno == EINVAL);
+
+	for (i = 0; i < 500; ++i) {
+		feature_write(b, i, 0, size, 0);
+		feature_write(one, i, 1, size, 0);
+		if (i % 2)
+			feature_write(two, i, 2, size, 0);
+	}
+	for (i = 0; i < 500; i += 3) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(one, &key), 0);
+	}
+	CHECK_ERR(eblob_defrag(one), 0);
+
+	/* Namespace reopened alone, then whole backend reopened */
+	for (round = 0; round < 3; ++round) {
+		for (i = 0; i < 500; ++i) {
+			CHECK_ERR(feature_read(b, i, 0, size), 0);
+			CHECK_ERR(feature_read(one, i, 1, size), i % 3 ? 0 : -ENOENT);
+			CHECK_ERR(feature_read(two, i, 2, size), i % 2 ? 0 : -ENOENT);
+		}
+
+		if (round == 0) {
+			eblob_cleanup(two);
+		} else {
+			eblob_cleanup(b);
+			if (round == 2)
+				break;
+			b = feature_open(&bcfg);
+			CHECK((one = eblob_namespace_open(b, "one", &ncfg)) != NULL);
+		}
+		CHECK((two = eblob_namespace_open(b, "two", NULL)) != NULL);
+	}
+}
+
+/* Returns size of data file of the first base */
+static off_t
+feature_base_size(void)
+{
+	struct stat st;
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s-0.0", ffile) >= (int)sizeof(path))
+		errx(EX_USAGE, "test path is too long: %s", fcfg.path);
+	if (stat(path, &st) == -1)
+		err(EX_OSFILE, "stat: %s", path);
+	return st.st_size;
+}
+
+/*
+ * Write buffer: buffered records are readable before they reach disk and
+ * sync writes them out; overwrites, removals and cleanup of backend keep
+ * them consistent. Records written after the last sync are lost on crash,
+ * the rest survive it.
+ */
+static void
+test_write_buffer(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_key key;
+	const uint64_t size = 100;
+	int i, status;
+	pid_t pid;
+
+	feature_start("write_buffer", &bcfg);
+	bcfg.blob_flags |= EBLOB_WRITE_BUFFER;
+	bcfg.write_buffer_timeout = 60000;
+	/* Base rollover flushes buffer too */
+	bcfg.records_in_blob = 10000;
+	b = feature_open(&bcfg);
+
+	for (i = 0; i < 1000; ++i)
+		feature_write(b, i, 0, size, 0);
+	CHECK(feature_base_size() == 0);
+	for (i = 0; i < 1000; ++i)
+		CHECK_ERR(feature_read(b, i, 0, size), 0);
+
+	CHECK_ERR(eblob_sync(b), 0);
+	CHECK(feature_base_size() > 0);
+
+	for (i = 0; i < 1000; i += 3)
+		feature_write(b, i, 1, i % 2 ? size : 4 * size, 0);
+	for (i = 1; i < 1000; i += 3) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	for (i = 0; i < 1000; i += 3)
+		CHECK_ERR(feature_read(b, i, 1, i % 2 ? size : 4 * size), 0);
+	eblob_cleanup(b);
+
+	bcfg.blob_flags &= ~EBLOB_WRITE_BUFFER;
+	b = feature_open(&bcfg);
+	for (i = 0; i < 1000; ++i) {
+		switch (i % 3) {
+		case 0:
+			CHECK_ERR(feature_read(b, i, 1, i % 2 ? size : 4 * size), 0);
+			break;
+		case 1:
+			CHECK_ERR(feature_read(b, i, 0, size), -ENOENT);
+			break;
+		default:
+			CHECK_ERR(feature_read(b, i, 0, size), 0);
+		}
+	}
+	eblob_cleanup(b);
+
+	/* Crash after sync */
+	bcfg.blob_flags |= EBLOB_WRITE_BUFFER;
+	if ((pid = fork()) == -1)
+		err(EX_OSERR, "fork");
+	if (pid == 0) {
+		b = feature_open(&bcfg);
+		for (i = 1000; i < 2000; ++i) {
+			if (i == 1500)
+				CHECK_ERR(eblob_sync(b), 0);
+			feature_write(b, i, 0, size, 0);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(EX_SOFTWARE, "write_buffer: writer process failed");
+
+	b = feature_open(&bcfg);
+	for (i = 1000; i < 2000; ++i)
+		CHECK_ERR(feature_read(b, i, 0, size), i < 1500 ? 0 : -ENOENT);
+	for (i = 0; i < 1000; i += 3)
+		CHECK_ERR(feature_read(b, i, 1, i % 2 ? size : 4 * size), 0);
+	eblob_cleanup(b);
+}
+
+#define FEATURE_EXISTS_KEYS	2200
+
+/* Keys removed before and after bases were sorted, ones past 2100 never written */
+static int
+feature_exists_present(int i)
+{
+	return i < 2100 && (i % 10 != 3 || i >= 2000);
+}
+
+/*
+ * Checks eblob_exists_multi() answers for keys in reverse order against
+ * feature_exists_present(), with EBLOB_EXISTS_MAYBE existing keys still must
+ * be reported.
+ */
+static void
+feature_exists_check(struct eblob_backend *b, uint64_t flags)
+{
+	static struct eblob_key keys[FEATURE_EXISTS_KEYS];
+	static uint8_t bitmap[(FEATURE_EXISTS_KEYS + 7) / 8];
+	int i, j, bit, present;
+
+	for (i = 0; i < FEATURE_EXISTS_KEYS; ++i)
+		feature_key(&keys[FEATURE_EXISTS_KEYS - 1 - i], i);
+	memset(bitmap, 0, sizeof(bitmap));
+	CHECK_ERR(eblob_exists_multi(b, keys, FEATURE_EXISTS_KEYS, flags, bitmap), 0);
+
+	for (i = 0; i < FEATURE_EXISTS_KEYS; ++i) {
+		j = FEATURE_EXISTS_KEYS - 1 - i;
+		bit = !!(bitmap[j / 8] & (1 << (j % 8)));
+		present = feature_exists_present(i);
+		if (flags & EBLOB_EXISTS_MAYBE)
+			CHECK(bit || !present);
+		else
+			CHECK(bit == present);
+		CHECK_ERR(eblob_exists(b, &keys[j]), present ? 0 : -ENOENT);
+	}
+}
+
+/*
+ * Batched existence checks over unsorted and sorted bases with removed keys,
+ * before and after reopen.
+ */
+static void
+test_exists(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_key key;
+	uint8_t bitmap = 0xff;
+	int i;
+
+	feature_start("exists", &bcfg);
+	bcfg.records_in_blob = 100;
+	b = feature_open(&bcfg);
+
+	for (i = 0; i < 2000; ++i)
+		feature_write(b, i, 0, 64, 0);
+	for (i = 3; i < 1000; i += 10) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	CHECK_ERR(eblob_defrag(b), 0);
+	for (i = 1003; i < 2000; i += 10) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	for (i = 2000; i < 2100; ++i)
+		feature_write(b, i, 0, 64, 0);
+
+	CHECK_ERR(eblob_exists_multi(b, NULL, 0, 0, NULL), 0);
+	CHECK_ERR(eblob_exists_multi(b, &key, 1, ~EBLOB_EXISTS_MAYBE, &bitmap), -EINVAL);
+	feature_exists_check(b, 0);
+	feature_exists_check(b, EBLOB_EXISTS_MAYBE);
+	eblob_cleanup(b);
+
+	b = feature_open(&bcfg);
+	feature_exists_check(b, EBLOB_EXISTS_MAYBE);
+	feature_exists_check(b, 0);
+	eblob_cleanup(b);
+}
+
+#define FEATURE_ASYNC_KEYS	200
+#define FEATURE_ASYNC_SIZE	20000
+
+static int feature_async_done;
+
+/* Odd records are read from the start, even ones from offset depending on key */
+static uint64_t
+feature_async_offset(int i)
+{
+	return i % 2 ? 0 : (uint64_t)i * 10;
+}
+
+/* Checks async read of record @priv, negative ones were never written */
+static void
+feature_async_cb(void *priv, int err, char *data, uint64_t size)
+{
+	char buf[FEATURE_ASYNC_SIZE];
+	int i = (int)(intptr_t)priv;
+	uint64_t offset;
+
+	if (i < 0) {
+		CHECK_ERR(err, -ENOENT);
+		CHECK(data == NULL && size == 0);
+	} else {
+		CHECK_ERR(err, 0);
+		offset = feature_async_offset(i);
+		feature_data(buf, sizeof(buf), i, 0);
+		CHECK(size == sizeof(buf) - offset && memcmp(data, buf + offset, size) == 0);
+	}
+	free(data);
+	__sync_add_and_fetch(&feature_async_done, 1);
+}
+
+/*
+ * Async reads: cached records are served by the caller, evicted ones by read
+ * workers, and cleanup of backend completes all queued reads.
+ */
+static void
+test_read_async(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_key key;
+	char path[PATH_MAX];
+	int i, round, fd;
+
+	feature_start("read_async", &bcfg);
+	bcfg.read_threads = 3;
+	b = feature_open(&bcfg);
+
+	for (i = 0; i < FEATURE_ASYNC_KEYS; ++i)
+		feature_write(b, i, 0, FEATURE_ASYNC_SIZE, 0);
+	feature_key(&key, 0);
+	CHECK_ERR(eblob_read_data_async(b, &key, EBLOB_READ_CSUM, 0, 0, NULL, NULL), -EINVAL);
+
+	if (snprintf(path, sizeof(path), "%s-0.0", ffile) >= (int)sizeof(path))
+		errx(EX_USAGE, "test path is too long: %s", fcfg.path);
+
+	feature_async_done = 0;
+	for (round = 0; round < 3; ++round) {
+		/* Evicts data from page cache, workers have to read it */
+		if (round > 0) {
+			if ((fd = open(path, O_RDONLY)) == -1)
+				err(EX_OSFILE, "open: %s", path);
+			CHECK(fdatasync(fd) == 0);
+			CHECK(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+			close(fd);
+		}
+
+		for (i = 0; i < FEATURE_ASYNC_KEYS; ++i) {
+			feature_key(&key, i);
+			CHECK_ERR(eblob_read_data_async(b, &key, i % 3 ? EBLOB_READ_CSUM : EBLOB_READ_NOCSUM,
+						feature_async_offset(i), 0, feature_async_cb, (void *)(intptr_t)i), 0);
+		}
+		feature_key(&key, FEATURE_ASYNC_KEYS);
+		CHECK_ERR(eblob_read_data_async(b, &key, EBLOB_READ_CSUM, 0, 0,
+					feature_async_cb, (void *)(intptr_t)-1), 0);
+	}
+	eblob_cleanup(b);
+	CHECK(feature_async_done == 3 * (FEATURE_ASYNC_KEYS + 1));
+}
+
+static void
+feature_sleep_ms(long ms)
+{
+	struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (ms % 1000) * 1000000,
+	};
+
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/* Runs blocking defrag in a thread of its own */
+struct feature_defrag {
+	struct eblob_backend	*b;
+	pthread_t		tid;
+	int			err;
+};
+
+static void *
+feature_defrag_thread(void *data)
+{
+	struct feature_defrag *fd = data;
+
+	fd->err = eblob_defrag(fd->b);
+	return NULL;
+}
+
+static void
+feature_defrag_start(struct feature_defrag *fd, struct eblob_backend *b)
+{
+	fd->b = b;
+	fd->err = 0;
+	CHECK_ERR(pthread_create(&fd->tid, NULL, feature_defrag_thread, fd), 0);
+}
+
+static int
+feature_defrag_join(struct feature_defrag *fd)
+{
+	CHECK_ERR(pthread_join(fd->tid, NULL), 0);
+	return fd->err;
+}
+
+/* Pauses defrag of @b once it reaches @phase and waits till it stops working */
+static void
+feature_defrag_pause(struct eblob_backend *b, int phase)
+{
+	struct eblob_defrag_progress p;
+
+	do {
+		CHECK_ERR(eblob_defrag_progress(b, &p), 0);
+		sched_yield();
+	} while (p.phase < phase);
+	CHECK_ERR(eblob_pause_defrag(b), 0);
+
+	do {
+		feature_sleep_ms(1);
+		CHECK_ERR(eblob_defrag_progress(b, &p), 0);
+	} while (!p.paused);
+}
+
+/* Returns size of file @suffix of @ffile */
+static off_t
+feature_file_size(const char *suffix)
+{
+	struct stat st;
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s%s", ffile, suffix) >= (int)sizeof(path))
+		errx(EX_USAGE, "test path is too long: %s", fcfg.path);
+	if (stat(path, &st) == -1)
+		err(EX_OSFILE, "stat: %s", path);
+	return st.st_size;
+}
+
+/*
+ * Writes during data-sort on nearly full filesystem: free space writers must
+ * keep is set just below what is left after data-sort's reservation. Files
+ * data-sort has written show up in samples of filesystem and must not be
+ * subtracted from free space the second time as part of its reservation.
+ */
+static void
+test_space(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct feature_defrag fd;
+	struct eblob_key key;
+	struct statvfs st;
+	uint64_t avail, reserve, margin;
+	const uint64_t size = 16384;
+	int i;
+
+	feature_start("space", &bcfg);
+	bcfg.records_in_blob = 2000;
+	bcfg.defrag_percentage = 5;
+	b = feature_open(&bcfg);
+	for (i = 0; i <= 2000; ++i)
+		feature_write(b, i, 0, size, 0);
+	for (i = 0; i < 2000; i += 10) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	eblob_cleanup(b);
+
+	/* Data-sort of the first base reserves twice its data plus index */
+	reserve = 2 * feature_file_size("-0.0") + feature_file_size("-0.0.index");
+	margin = 1800 * size / 2;
+	if (statvfs(fdir, &st) == -1)
+		err(EX_OSFILE, "statvfs: %s", fdir);
+	avail = (uint64_t)st.f_bsize * st.f_bavail;
+	if (avail < reserve + margin + 2 * size) {
+		warnx("space: skipped: not enough free space");
+		return;
+	}
+
+	bcfg.blob_flags &= ~EBLOB_NO_FREE_SPACE_CHECK;
+	bcfg.blob_size = (avail - reserve - margin) / 2;
+	b = feature_open(&bcfg);
+
+	/* Data-sort has at least live data of the base on disk past split */
+	feature_defrag_start(&fd, b);
+	feature_defrag_pause(b, EBLOB_DEFRAG_PHASE_SORT);
+	/* Let free space be resampled */
+	feature_sleep_ms(1100);
+	for (i = 3000; i < 3016; ++i)
+		feature_write(b, i, 0, size, 0);
+
+	CHECK_ERR(eblob_resume_defrag(b), 0);
+	CHECK_ERR(feature_defrag_join(&fd), 0);
+	for (i = 0; i <= 2000; ++i)
+		CHECK_ERR(feature_read(b, i, 0, size), i % 10 || i == 2000 ? 0 : -ENOENT);
+	for (i = 3000; i < 3016; ++i)
+		CHECK_ERR(feature_read(b, i, 0, size), 0);
+	eblob_cleanup(b);
+}
+
+/* Returns number of live records in all bases of @b */
+static int
+feature_count(struct eblob_backend *b)
+{
+	struct eblob_iterate_control ictl;
+	int count = 0;
+
+	memset(&ictl, 0, sizeof(ictl));
+	ictl.flags = EBLOB_ITERATE_FLAGS_ALL | EBLOB_ITERATE_FLAGS_READONLY;
+	ictl.iterator_cb.iterator = feature_count_cb;
+	ictl.priv = &count;
+	CHECK_ERR(eblob_iterate(b, &ictl), 0);
+	return count;
+}
+
+/* Returns number of files in test directory whose names contain @part */
+static int
+feature_files(const char *part)
+{
+	struct dirent *ent;
+	DIR *dir;
+	int count = 0;
+
+	if ((dir = opendir(fdir)) == NULL)
+		err(EX_OSFILE, "opendir: %s", fdir);
+	while ((ent = readdir(dir)) != NULL)
+		if (strstr(ent->d_name, part) != NULL)
+			++count;
+	closedir(dir);
+	return count;
+}
+
+/* Returns number of summaries of closed lazy bases in test directory */
+static int
+feature_summaries(void)
+{
+	return feature_files(".summary");
+}
+
+#define FEATURE_LAZY_KEYS	1050
+
+/* Reads back keys written by test_lazy(), @removed of each ten are gone */
+static void
+feature_lazy_check(struct eblob_backend *b, int removed)
+{
+	int i;
+
+	for (i = 0; i < FEATURE_LAZY_KEYS; ++i)
+		CHECK_ERR(feature_read(b, i, 0, 100), i % 10 >= 3 && i % 10 < 3 + removed ? -ENOENT : 0);
+}
+
+/*
+ * Lazy bases: sorted bases above max_open_bases are closed on startup and
+ * registered from their summaries on the next one, files are opened on
+ * lookup, iteration and data-sort. Summary taken from other files than the
+ * ones on disk is ignored.
+ */
+static void
+test_lazy(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_key key;
+	char summary[PATH_MAX], saved[PATH_MAX];
+	off_t size;
+	int i;
+
+	feature_start("lazy", &bcfg);
+	bcfg.records_in_blob = 100;
+	bcfg.defrag_percentage = 5;
+	bcfg.blob_flags |= EBLOB_LAZY_BASES;
+	bcfg.max_open_bases = 2;
+
+	/* Ten full bases, sorted on the next start */
+	b = feature_open(&bcfg);
+	for (i = 0; i < FEATURE_LAZY_KEYS; ++i)
+		feature_write(b, i, 0, 100, 0);
+	for (i = 3; i < FEATURE_LAZY_KEYS; i += 10) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	eblob_cleanup(b);
+	CHECK(feature_summaries() == 0);
+
+	/* All but max_open_bases sorted bases are closed */
+	b = feature_open(&bcfg);
+	CHECK(feature_summaries() == 8);
+	feature_lazy_check(b, 1);
+	eblob_cleanup(b);
+	CHECK(feature_summaries() == 10);
+
+	/* Registered from summaries, lookup opens only the base it needs */
+	b = feature_open(&bcfg);
+	CHECK(feature_summaries() == 10);
+	CHECK_ERR(feature_read(b, 0, 0, 100), 0);
+	CHECK(feature_summaries() == 9);
+	CHECK(feature_count(b) == FEATURE_LAZY_KEYS - FEATURE_LAZY_KEYS / 10);
+	CHECK(feature_summaries() == 0);
+	eblob_cleanup(b);
+
+	/* Data-sort opens bases it picks */
+	b = feature_open(&bcfg);
+	size = feature_file_size("-0.0");
+	CHECK_ERR(eblob_defrag(b), 0);
+	CHECK(feature_file_size("-0.0") < size);
+	feature_lazy_check(b, 1);
+	eblob_cleanup(b);
+
+	/*
+	 * Bases are data-sorted again without the flag, summary of the first
+	 * one is put back afterwards as if it survived the change
+	 */
+	if (snprintf(summary, sizeof(summary), "%s-0.0.summary", ffile) >= (int)sizeof(summary)
+			|| snprintf(saved, sizeof(saved), "%s/lazy.summary", fcfg.path) >= (int)sizeof(saved))
+		errx(EX_USAGE, "test path is too long: %s", fcfg.path);
+	CHECK_ERR(rename(summary, saved), 0);
+	bcfg.blob_flags &= ~EBLOB_LAZY_BASES;
+	b = feature_open(&bcfg);
+	for (i = 4; i < FEATURE_LAZY_KEYS; i += 10) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	CHECK_ERR(eblob_defrag(b), 0);
+	eblob_cleanup(b);
+	CHECK(feature_summaries() == 0);
+	CHECK_ERR(rename(saved, summary), 0);
+
+	bcfg.blob_flags |= EBLOB_LAZY_BASES;
+	b = feature_open(&bcfg);
+	feature_lazy_check(b, 2);
+	CHECK(feature_count(b) == FEATURE_LAZY_KEYS - 2 * FEATURE_LAZY_KEYS / 10);
+	eblob_cleanup(b);
+}
+
+#define FEATURE_STOP_KEYS	20000
+
+/* Checks that stopped data-sort left base intact and nothing behind */
+static void
+feature_stop_check(struct eblob_backend *b)
+{
+	struct eblob_defrag_progress p;
+	int i;
+
+	CHECK_ERR(eblob_defrag_progress(b, &p), 0);
+	CHECK(p.phase == EBLOB_DEFRAG_PHASE_NONE && !p.paused);
+	CHECK(p.bases_total == 0 && p.records_total == 0 && p.bytes_total == 0);
+	CHECK(feature_files(".datasort.") == 0);
+	for (i = 0; i <= FEATURE_STOP_KEYS; ++i)
+		CHECK_ERR(feature_read(b, i, 0, 1024), i % 10 == 3 && i < FEATURE_STOP_KEYS ? -ENOENT : 0);
+}
+
+/* Waits till data-sort of @b reaches @phase, it is paused unless it is split */
+static void
+feature_stop_wait(struct eblob_backend *b, int phase)
+{
+	struct eblob_defrag_progress p;
+
+	if (phase == EBLOB_DEFRAG_PHASE_SPLIT) {
+		do {
+			CHECK_ERR(eblob_defrag_progress(b, &p), 0);
+			sched_yield();
+		} while (p.phase < phase);
+		return;
+	}
+
+	feature_defrag_pause(b, phase);
+	CHECK_ERR(eblob_defrag_progress(b, &p), 0);
+	CHECK(p.phase == phase);
+}
+
+/*
+ * Data-sort stopped in split, sort and merge, both by eblob_stop_defrag()
+ * and by closing backend, leaves base as it was: every record reads back,
+ * temporary directory is removed and progress is reset.
+ */
+static void
+test_defrag_stop(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct feature_defrag fd;
+	struct eblob_key key;
+	off_t size;
+	int i, phase;
+
+	feature_start("defrag_stop", &bcfg);
+	bcfg.records_in_blob = FEATURE_STOP_KEYS;
+	bcfg.defrag_percentage = 5;
+
+	/* The first base is closed and due for data-sort */
+	b = feature_open(&bcfg);
+	for (i = 0; i <= FEATURE_STOP_KEYS; ++i)
+		feature_write(b, i, 0, 1024, 0);
+	for (i = 3; i < FEATURE_STOP_KEYS; i += 10) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	eblob_cleanup(b);
+	size = feature_file_size("-0.0");
+
+	for (phase = EBLOB_DEFRAG_PHASE_SPLIT; phase <= EBLOB_DEFRAG_PHASE_MERGE; ++phase) {
+		b = feature_open(&bcfg);
+		feature_defrag_start(&fd, b);
+		feature_stop_wait(b, phase);
+		CHECK_ERR(eblob_stop_defrag(b), 0);
+		CHECK_ERR(feature_defrag_join(&fd), -EINTR);
+		feature_stop_check(b);
+		eblob_cleanup(b);
+
+		/* Backend is closed under data-sort run by its own thread */
+		bcfg.blob_flags &= ~EBLOB_DISABLE_THREADS;
+		b = feature_open(&bcfg);
+		CHECK_ERR(eblob_start_defrag(b), 0);
+		feature_stop_wait(b, phase);
+		eblob_cleanup(b);
+		bcfg.blob_flags |= EBLOB_DISABLE_THREADS;
+
+		b = feature_open(&bcfg);
+		feature_stop_check(b);
+		eblob_cleanup(b);
+		CHECK(feature_file_size("-0.0") == size);
+	}
+
+	/* Base is still data-sorted fine */
+	b = feature_open(&bcfg);
+	CHECK_ERR(eblob_defrag(b), 0);
+	CHECK(feature_file_size("-0.0") < size);
+	feature_stop_check(b);
+	eblob_cleanup(b);
+}
+
+/* Returns inode of data file of base record @i is in */
+static ino_t
+feature_base_of(struct eblob_backend *b, int i)
+{
+	struct eblob_key key;
+	struct stat st;
+	uint64_t offset, size;
+	int fd;
+
+	feature_key(&key, i);
+	CHECK(eblob_read(b, &key, &fd, &offset, &size) >= 0);
+	if (fstat(fd, &st) == -1)
+		err(EX_OSERR, "fstat");
+	return st.st_ino;
+}
+
+#define FEATURE_HOT_KEYS	100
+#define FEATURE_COLD_KEYS	900
+
+/*
+ * Fills two bases: hot keys are moved to the open base by two updates each,
+ * second half of cold ones is removed. With @aged data-sort runs in between
+ * and has nothing to sort, but hot keys cool down.
+ */
+static void
+feature_hot_cold_fill(struct eblob_backend *b, int aged)
+{
+	struct eblob_key key;
+	int i, version;
+
+	/* Growing records can not be overwritten in place */
+	for (version = 0; version < 3; ++version)
+		for (i = 0; i < FEATURE_HOT_KEYS; ++i)
+			feature_write(b, i, version, 256 * (version + 1), 0);
+	if (aged)
+		CHECK_ERR(eblob_defrag(b), 0);
+
+	for (i = FEATURE_HOT_KEYS; i < 2 * FEATURE_COLD_KEYS; ++i)
+		feature_write(b, i, 0, 256, 0);
+	for (i = FEATURE_COLD_KEYS; i < 2 * FEATURE_COLD_KEYS; ++i) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	/* Both full bases are data-sorted */
+	feature_write(b, 2 * FEATURE_COLD_KEYS, 0, 256, 0);
+}
+
+static void
+feature_hot_cold_check(struct eblob_backend *b)
+{
+	int i;
+
+	for (i = 0; i < FEATURE_HOT_KEYS; ++i)
+		CHECK_ERR(feature_read(b, i, 2, 768), 0);
+	for (i = FEATURE_HOT_KEYS; i < 2 * FEATURE_COLD_KEYS; ++i)
+		CHECK_ERR(feature_read(b, i, 0, 256), i < FEATURE_COLD_KEYS ? 0 : -ENOENT);
+}
+
+/*
+ * Hot/cold data-sort puts frequently updated keys and stable ones into two
+ * sorted bases, before and after reopen. Update counts are halved after
+ * each data-sort run, so keys that are not updated any more become cold.
+ */
+static void
+test_hot_cold(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	ino_t hot, cold;
+	int i, reopen;
+
+	feature_start("hot_cold", &bcfg);
+	bcfg.blob_flags |= EBLOB_HOT_COLD_DATASORT;
+
+	b = feature_open(&bcfg);
+	feature_hot_cold_fill(b, 0);
+	CHECK_ERR(eblob_defrag(b), 0);
+	CHECK(feature_files(EBLOB_DATASORT_SORTED_MARK_SUFFIX) == 2);
+
+	for (reopen = 0; reopen < 2; ++reopen) {
+		if (reopen) {
+			eblob_cleanup(b);
+			b = feature_open(&bcfg);
+		}
+		feature_hot_cold_check(b);
+
+		hot = feature_base_of(b, 0);
+		cold = feature_base_of(b, FEATURE_HOT_KEYS);
+		CHECK(hot != cold);
+		for (i = 0; i < FEATURE_HOT_KEYS; ++i)
+			CHECK(feature_base_of(b, i) == hot);
+		for (i = FEATURE_HOT_KEYS; i < FEATURE_COLD_KEYS; ++i)
+			CHECK(feature_base_of(b, i) == cold);
+	}
+	eblob_cleanup(b);
+
+	/* Hot keys cooled down by the run in between go to the only sorted base */
+	feature_start("hot_cold_aged", &bcfg);
+	bcfg.blob_flags |= EBLOB_HOT_COLD_DATASORT;
+
+	b = feature_open(&bcfg);
+	feature_hot_cold_fill(b, 1);
+	CHECK_ERR(eblob_defrag(b), 0);
+	CHECK(feature_files(EBLOB_DATASORT_SORTED_MARK_SUFFIX) == 1);
+	feature_hot_cold_check(b);
+	cold = feature_base_of(b, FEATURE_HOT_KEYS);
+	for (i = 0; i < FEATURE_COLD_KEYS; ++i)
+		CHECK(feature_base_of(b, i) == cold);
+	eblob_cleanup(b);
+}
+
+#define FEATURE_SUMMARY_KEYS	20000
+
+/* Looks every key written by test_summary() up, with read and existence checks */
+static void
+feature_summary_check(struct eblob_backend *b)
+{
+	static struct eblob_key keys[FEATURE_SUMMARY_KEYS + 100];
+	static uint8_t bitmap[(FEATURE_SUMMARY_KEYS + 100 + 7) / 8];
+	const uint32_t num = FEATURE_SUMMARY_KEYS + 100;
+	uint32_t i;
+
+	for (i = 0; i < FEATURE_SUMMARY_KEYS; i += 7)
+		CHECK_ERR(feature_read(b, i, 0, 64), i % 10 == 3 ? -ENOENT : 0);
+
+	for (i = 0; i < num; ++i)
+		feature_key(&keys[i], i);
+	CHECK_ERR(eblob_exists_multi(b, keys, num, 0, bitmap), 0);
+	for (i = 0; i < num; ++i)
+		CHECK(!!(bitmap[i / 8] & (1 << (i % 8))) == (i < FEATURE_SUMMARY_KEYS && i % 10 != 3));
+}
+
+/*
+ * Summary memory budget: over summary_memory_limit index blocks of sorted
+ * bases get coarser, then summaries of closed lazy bases are dropped and
+ * read back by lookups. Lookups are correct all the way.
+ */
+static void
+test_summary(void)
+{
+	struct eblob_config bcfg;
+	struct eblob_backend *b;
+	struct eblob_key key;
+	int64_t full, resident;
+	int i, summaries;
+
+	feature_start("summary", &bcfg);
+	bcfg.blob_flags |= EBLOB_LAZY_BASES;
+	bcfg.max_open_bases = 2;
+
+	/* Bases are sorted on the next start and get summaries on close */
+	b = feature_open(&bcfg);
+	for (i = 0; i < FEATURE_SUMMARY_KEYS; ++i)
+		feature_write(b, i, 0, 64, 0);
+	for (i = 3; i < FEATURE_SUMMARY_KEYS; i += 10) {
+		feature_key(&key, i);
+		CHECK_ERR(eblob_remove(b, &key), 0);
+	}
+	eblob_cleanup(b);
+	b = feature_open(&bcfg);
+	eblob_cleanup(b);
+	summaries = feature_summaries();
+	CHECK(summaries == FEATURE_SUMMARY_KEYS / 1000 - 1);
+
+	/* Unlimited budget is only accounted */
+	b = feature_open(&bcfg);
+	CHECK_ERR(eblob_periodic(b), 0);
+	full = eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_RESIDENT);
+	CHECK(full > 0 && eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_EVICTED) == 0);
+	eblob_cleanup(b);
+
+	/* Half of it is reached by coarser index blocks alone */
+	bcfg.summary_memory_limit = full / 2;
+	b = feature_open(&bcfg);
+	CHECK_ERR(eblob_periodic(b), 0);
+	resident = eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_RESIDENT);
+	CHECK(resident > 0 && resident <= full / 2);
+	CHECK(eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_EVICTED) == full - resident);
+	feature_summary_check(b);
+	CHECK(eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_RELOADS) == 0);
+	eblob_cleanup(b);
+
+	/* Nothing fits: summaries of closed bases are dropped and read back */
+	bcfg.summary_memory_limit = 1;
+	b = feature_open(&bcfg);
+	CHECK_ERR(eblob_periodic(b), 0);
+	CHECK(eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_RESIDENT) == 0);
+	CHECK(eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_EVICTED) == full);
+	/* Missing key is looked up in reloaded summaries without opening bases */
+	feature_key(&key, 2 * FEATURE_SUMMARY_KEYS);
+	CHECK_ERR(eblob_exists(b, &key), -ENOENT);
+	CHECK(eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_RELOADS) == summaries);
+	CHECK(feature_summaries() == summaries);
+	feature_summary_check(b);
+
+	/* ... and dropped again, open bases keep coarse ones */
+	CHECK_ERR(eblob_periodic(b), 0);
+	CHECK(eblob_stat_get(b->stat, EBLOB_GST_SUMMARY_RESIDENT) < full / 2);
+	feature_summary_check(b);
+	eblob_cleanup(b);
+}
+
+static const struct {
+	const char	*name;
+	void		(*func)(void);
+} feature_tests[] = {
+	{ "fsck",	test_fsck },
+	{ "session",	test_session },
+	{ "atomic",	test_atomic },
+	{ "ingest",	test_ingest },
+	{ "user_flags",	test_user_flags },
+	{ "namespaces",	test_namespaces },
+	{ "write_buffer", test_write_buffer },
+	{ "exists",	test_exists },
+	{ "read_async",	test_read_async },
+	{ "space",	test_space },
+	{ "lazy",	test_lazy },
+	{ "defrag_stop", test_defrag_stop },
+	{ "hot_cold",	test_hot_cold },
+	{ "summary",	test_summary },
+};
+
+static void __attribute__((noreturn))
+features_usage(char *progname, int eval, FILE *stream)
+{
+	size_t i;
+
+	fprintf(stream, "usage: %s [-k fsck_binary] [-l log_level] [-p path] [test ...]\n", progname);
+	fprintf(stream, "tests:");
+	for (i = 0; i < sizeof(feature_tests) / sizeof(feature_tests[0]); ++i)
+		fprintf(stream, " %s", feature_tests[i].name);
+	fprintf(stream, "\n");
+
+	exit(eval);
+}
+
+int
+main(int argc, char **argv)
+{
+	char log_path[PATH_MAX];
+	size_t i;
+	int ch, j, found;
+
+	fcfg.path = ".";
+	fcfg.log_level = EBLOB_LOG_ERROR;
+
+	while ((ch = getopt(argc, argv, "hk:l:p:")) != -1) {
+		switch (ch) {
+		case 'k':
+			fcfg.fsck = optarg;
+			break;
+		case 'l':
+			fcfg.log_level = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			fcfg.path = optarg;
+			break;
+		case 'h':
+			features_usage(argv[0], EX_OK, stdout);
+		default:
+			features_usage(argv[0], EX_USAGE, stderr);
+		}
+	}
+
+	snprintf(log_path, sizeof(log_path), "%s/features.log", fcfg.path);
+	flog.log_level = fcfg.log_level;
+	flog.log = eblob_log_raw_formatted;
+	if ((flog.log_private = fopen(log_path, "a")) == NULL)
+		err(EX_OSFILE, "fopen: %s", log_path);
+	setvbuf(flog.log_private, NULL, _IOLBF, 0);
+
+	for (i = 0; i < sizeof(feature_tests) / sizeof(feature_tests[0]); ++i) {
+		found = optind == argc;
+		for (j = optind; j < argc; ++j)
+			found |= !strcmp(argv[j], feature_tests[i].name);
+		if (!found)
+			continue;
+
+		feature_tests[i].func();
+		warnx("%s: ok", feature_tests[i].name);
+	}
+
+	fclose(flog.log_private);
+	errx(EX_OK, "finished");
+}
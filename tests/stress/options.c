@@ -47,7 +47,7 @@ options_usage(char *progname, int eval, FILE *stream)
 	fprintf(stream, "usage: %s ", progname);
 	fprintf(stream, "[-d defrag_time] [-D delay ] [-f force_defrag] [-F eblob_flags] ");
 	fprintf(stream, "[-i test_items] [-I iterations] [-b block size] ");
-	fprintf(stream, "[-l log_level] [-m milestone] [-o reopen] [-p path] [-r blob_records] ");
+	fprintf(stream, "[-l log_level] [-m milestone] [-n namespace] [-o reopen] [-p path] [-r blob_records] ");
 	fprintf(stream, "[-R random_seed] [-s blob_size] [-S item_size] [-t iterator_threads] ");
 	fprintf(stream, "[-T test_threads] [-y sync_time] ");
 	fprintf(stream, "\n");
@@ -126,6 +126,7 @@ options_get(int argc, char **argv)
 		{ "test-items",		required_argument,	NULL,		'i' },
 		{ "test-iterations",	required_argument,	NULL,		'I' },
 		{ "test-milestone",	required_argument,	NULL,		'm' },
+		{ "test-namespace",	required_argument,	NULL,		'n' },
 		{ "test-path",		required_argument,	NULL,		'p' },
 		{ "test-reopen",	required_argument,	NULL,		'o' },
 		{ "test-rnd-seed",	required_argument,	NULL,		'R' },
@@ -134,7 +135,7 @@ options_get(int argc, char **argv)
 	};
 
 	opterr = 0;
-	while ((ch = getopt_long(argc, argv, "d:D:f:F:hi:I:l:m:o:p:r:R:s:S:t:T:vy:", longopts, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "d:D:f:F:hi:I:l:m:n:o:p:r:R:s:S:t:T:vy:", longopts, NULL)) != -1) {
 		switch(ch) {
 		case 'd':
 			options_get_l(&cfg.blob_defrag, optarg);
@@ -162,6 +163,11 @@ options_get(int argc, char **argv)
 		case 'm':
 			options_get_l(&cfg.test_milestone, optarg);
 			break;
+		case 'n':
+			free(cfg.test_namespace);
+			if ((cfg.test_namespace = strdup(optarg)) == NULL)
+				err(EX_OSERR, "strdup");
+			break;
 		case 'o':
 			options_get_ll(&cfg.test_reopen, optarg);
 			break;
@@ -222,5 +228,6 @@ options_dump(void)
 	printf("Random seed: %lld\n", cfg.test_rnd_seed);
 	printf("Test threads num: %ld\n", cfg.test_threads);
 	printf("Test path: %s\n", cfg.test_path);
+	printf("Test namespace: %s\n", cfg.test_namespace ? cfg.test_namespace : "none");
 	printf("\n");
 }
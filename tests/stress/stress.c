@@ -199,6 +199,78 @@ blob_read_return(struct eblob_backend *b, struct eblob_key *key,
 			wc.data_fd, wc.total_data_size, wc.data_offset);
 }
 
+/* Completion state of one async read */
+struct blob_read_async_req {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	int			done;
+	int			error;
+	char			*data;
+	uint64_t		size;
+};
+
+static void
+blob_read_async_cb(void *priv, int error, char *data, uint64_t size)
+{
+	struct blob_read_async_req *req = priv;
+
+	pthread_mutex_lock(&req->lock);
+	req->error = error;
+	req->data = data;
+	req->size = size;
+	req->done = 1;
+	pthread_cond_signal(&req->cond);
+	pthread_mutex_unlock(&req->lock);
+}
+
+/* Read using async interface and wait for its completion */
+static int
+blob_read_async(struct eblob_backend *b, struct eblob_key *key,
+		void **datap, uint64_t *sizep)
+{
+	struct blob_read_async_req req = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	int error;
+
+	error = eblob_read_data_async(b, key, EBLOB_READ_CSUM, 0, 0, blob_read_async_cb, &req);
+	if (error != 0)
+		return error;
+
+	pthread_mutex_lock(&req.lock);
+	while (req.done == 0)
+		pthread_cond_wait(&req.cond, &req.lock);
+	pthread_mutex_unlock(&req.lock);
+	pthread_cond_destroy(&req.cond);
+	pthread_mutex_destroy(&req.lock);
+
+	if (req.error != 0)
+		return req.error;
+
+	*sizep = req.size;
+	*datap = req.data;
+
+	return 0;
+}
+
+/* Check existence using either single or batched interface */
+static int
+blob_exists(struct eblob_backend *b, struct eblob_key *key)
+{
+	uint8_t bitmap = 0;
+	int error;
+
+	if (random() % 2)
+		return eblob_exists(b, key);
+
+	error = eblob_exists_multi(b, key, 1, 0, &bitmap);
+	if (error != 0)
+		return error;
+
+	return bitmap & 1 ? 0 : -ENOENT;
+}
+
 /*
  * Reads data from blob and compares it to shadow copy
  */
@@ -219,7 +291,7 @@ item_check(struct shadow *item, struct eblob_backend *b)
 			item->key, eblob_dump_id(item->ekey.id));
 
 	/* Read hashed key */
-	switch (rnd = random() % 3) {
+	switch (rnd = random() % 4) {
 	case 0:
 		error = eblob_read_data(b, &item->ekey, 0, (char **)&data, &size);
 		break;
@@ -229,6 +301,9 @@ item_check(struct shadow *item, struct eblob_backend *b)
 	case 2:
 		error = blob_read_return(b, &item->ekey, &data, &size);
 		break;
+	case 3:
+		error = blob_read_async(b, &item->ekey, &data, &size);
+		break;
 	default:
 		/* Unknown read type */
 		abort();
@@ -243,6 +318,9 @@ item_check(struct shadow *item, struct eblob_backend *b)
 			    item->key, eblob_dump_id(item->ekey.id), -error);
 			return error;
 		}
+		if (blob_exists(b, &item->ekey) != -ENOENT)
+			errx(EX_SOFTWARE, "key NOT supposed to be reported as existing: %s (%s)",
+					item->key, eblob_dump_id(item->ekey.id));
 	} else {
 		/* Check data consistency */
 		if (error != 0) {
@@ -259,6 +337,9 @@ item_check(struct shadow *item, struct eblob_backend *b)
 		if (error != 0)
 			errx(EX_SOFTWARE, "data verification failed for: %s (%s), flags: %s",
 			    item->key, eblob_dump_id(item->ekey.id), item->hflags);
+		if (blob_exists(b, &item->ekey) != 0)
+			errx(EX_SOFTWARE, "key supposed to be reported as existing: %s (%s)",
+					item->key, eblob_dump_id(item->ekey.id));
 	}
 	free(data);
 
@@ -401,6 +482,21 @@ blob_three_stage_write(struct eblob_backend *b, struct eblob_key *key,
 	return error;
 }
 
+/* Single record atomic batch */
+static int
+blob_write_atomic(struct eblob_backend *b, struct eblob_key *key,
+		void *data, uint64_t size, uint64_t flags)
+{
+	struct eblob_write_record record = {
+		.key = *key,
+		.data = data,
+		.size = size,
+		.flags = flags,
+	};
+
+	return eblob_write_atomic(b, &record, 1);
+}
+
 /*
  * "Syncs" item from shadow list to blob by removing or updating it
  */
@@ -415,7 +511,7 @@ item_sync(struct shadow *item, struct eblob_backend *b)
 	if (item->flags & BLOB_DISK_CTL_REMOVE) {
 		error = eblob_remove(b, &item->ekey);
 	} else {
-		int rnd = random() % 3;
+		int rnd = random() % 4;
 
 		if (item->inited == 0)
 			item->inited = 1;
@@ -426,6 +522,10 @@ item_sync(struct shadow *item, struct eblob_backend *b)
 		} else if (rnd == 1 && item->offset == 0) {
 			error = blob_three_stage_write(b, &item->ekey,
 					item->value, item->size, item->flags);
+		} else if (rnd == 2 && item->offset == 0
+				&& !(item->flags & BLOB_DISK_CTL_APPEND)) {
+			error = blob_write_atomic(b, &item->ekey,
+					item->value, item->size, item->flags);
 		} else {
 			error = eblob_write(b, &item->ekey, item->value + item->offset,
 					item->flags & BLOB_DISK_CTL_APPEND ? 0 : item->offset,
@@ -466,16 +566,32 @@ cleanups(void)
 	eblob_remove_blobs(cfg.b);
 
 	warnx("eblob cleanup...");
-	eblob_cleanup(cfg.b);
+	eblob_cleanup(cfg.root);
 	fclose(log);
 
 	warnx("memory cleanup...");
 	free(cfg.test_path);
+	free(cfg.test_namespace);
 	for (i = 0; i < cfg.test_items; i++)
 		free(cfg.shadow[i].value);
 	free(cfg.shadow);
 }
 
+/* Opens backend and test namespace in it if one is configured */
+static void
+blob_open(struct eblob_config *bcfg)
+{
+	cfg.root = cfg.b = eblob_init(bcfg);
+	if (cfg.root == NULL)
+		errx(EX_OSERR, "eblob_init");
+
+	if (cfg.test_namespace != NULL) {
+		cfg.b = eblob_namespace_open(cfg.root, cfg.test_namespace, NULL);
+		if (cfg.b == NULL)
+			err(EX_OSERR, "eblob_namespace_open: %s", cfg.test_namespace);
+	}
+}
+
 static void *
 test_thread(void *priv)
 {
@@ -589,19 +705,15 @@ main(int argc, char **argv)
 	bcfg.log = &logger;
 	bcfg.records_in_blob = cfg.blob_records;
 	bcfg.sync = cfg.blob_sync;
-	cfg.b = eblob_init(&bcfg);
-	if (cfg.b == NULL)
-		errx(EX_OSERR, "eblob_init");
+	blob_open(&bcfg);
 
 	/* Remove all data that may belong to previous reincarnation of test */
 	warnx("previous test cleanup...");
 	eblob_remove_blobs(cfg.b);
-	eblob_cleanup(cfg.b);
+	eblob_cleanup(cfg.root);
 
 	/* Re-init blob */
-	cfg.b = eblob_init(&bcfg);
-	if (cfg.b == NULL)
-		errx(EX_OSERR, "eblob_init");
+	blob_open(&bcfg);
 
 	/* Init test */
 	cfg.shadow = calloc(cfg.test_items, sizeof(struct shadow));
@@ -676,9 +788,8 @@ main(int argc, char **argv)
 		if (cfg.test_reopen > 0 && cfg.iterations >= next_reopen) {
 			warnx("reopening blob: %lld", cfg.iterations);
 			next_reopen = cfg.iterations + cfg.test_reopen;
-			eblob_cleanup(cfg.b);
-			if ((cfg.b = eblob_init(&bcfg)) == NULL)
-				errx(EX_OSERR, "loop: eblob_init");
+			eblob_cleanup(cfg.root);
+			blob_open(&bcfg);
 		}
 		pthread_rwlock_unlock(&tcfg->gcfg->lock);
 
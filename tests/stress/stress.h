@@ -82,6 +82,8 @@ struct test_cfg {
 	long		test_milestone;		/* Print message each
 						   "milestone" iterations */
 	char		*test_path;		/* Path to test directory */
+	char		*test_namespace;	/* Run test in namespace of
+						   backend. Disabled if NULL */
 	long long	test_reopen;		/* Reopen blob each `reopen`
 						   iterations */
 	long long	test_rnd_seed;		/* Random seed for reproducible
@@ -91,7 +93,9 @@ struct test_cfg {
 	/* Internal structures follow */
 	sig_atomic_t		need_exit;	/* SIGINT caught */
 	long			log_fd;		/* Opened log file descriptor */
-	struct eblob_backend	*b;		/* Eblob backend */
+	struct eblob_backend	*root;		/* Eblob backend */
+	struct eblob_backend	*b;		/* Tested backend: either root
+						   or its namespace */
 	struct shadow		*shadow;	/* Shadow storage pointer */
 	pthread_rwlock_t	lock;		/* Lock to protect shared test
 						   structures */